@@ -0,0 +1,282 @@
+/*
+Replay benchmark for the NEA's event handling.
+Loads a recorded event journal (or builds a synthetic trace of patients arriving at the desk)
+into memory, then pushes every event through callback() and the handlers behind it as fast as
+possible, against an NCL stub. Reports events/sec, heap allocations per event and handler latency
+percentiles per NclEventType, and appends them to nymibench.csv so runs can be compared across commits.
+With --check, runs the regression checks instead and exits non-zero if one fails.
+
+Usage: nymibench [journal] [--patients N] [--label name]
+       nymibench --check
+*/
+#include "checks.h"
+#include "ncl.h"
+#include "nea.h"
+#include "clock.h"
+#include "continuous_finder.h"
+#include "event_journal.h"
+#include "logger.h"
+#include "nclevents.h"
+#include "records.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <sstream>
+#include <string>
+#include <vector>
+
+static std::atomic<unsigned long long> gAllocations(0);
+
+//The deletes are kept out of their callers: inlined, GCC would see free() on memory from operator new
+#if defined(_MSC_VER)
+#define BENCH_NOINLINE __declspec(noinline)
+#else
+#define BENCH_NOINLINE __attribute__((noinline))
+#endif
+
+void* operator new(size_t size){
+	gAllocations.fetch_add(1, std::memory_order_relaxed);
+	void* p = malloc(size ? size : 1);
+	if (!p) throw std::bad_alloc();
+	return p;
+}
+
+void* operator new[](size_t size){
+	return operator new(size);
+}
+
+BENCH_NOINLINE void operator delete(void* p){
+	free(p);
+}
+
+BENCH_NOINLINE void operator delete[](void* p){
+	operator delete(p);
+}
+
+BENCH_NOINLINE void operator delete(void* p, size_t){
+	operator delete(p);
+}
+
+BENCH_NOINLINE void operator delete[](void* p, size_t){
+	operator delete(p);
+}
+
+/*
+Swallows console output the handlers still write directly
+*/
+class NullBuffer : public std::streambuf{
+protected:
+	int overflow(int c){ return c; }
+	std::streamsize xsputn(const char*, std::streamsize n){ return n; }
+};
+
+static const unsigned kSeed = 20151010;
+static const unsigned kPassersBy = 24; //Nymis seen by the scanner that never come to the desk
+static const int kPasserByHandleBase = 100000;
+
+/*
+Small deterministic generator, so the synthetic trace is identical on every run and compiler
+*/
+class TraceRandom{
+public:
+	explicit TraceRandom(unsigned seed) : mState(seed){}
+	unsigned next(){
+		mState = mState * 1664525u + 1013904223u;
+		return mState >> 8;
+	}
+	int range(int low, int high){ //inclusive
+		return low + (int)(next() % (unsigned)(high - low + 1));
+	}
+private:
+	unsigned mState;
+};
+
+static NclEvent makeEvent(NclEventType type){
+	NclEvent event;
+	memset(&event, 0, sizeof(event));
+	event.type = type;
+	return event;
+}
+
+static void pushScan(std::vector<NclEvent>& trace, NclEventType type, int nymiHandle, int rssi){
+	NclEvent event = makeEvent(type);
+	if (type == NCL_EVENT_FIND){
+		event.find.nymiHandle = nymiHandle;
+		event.find.rssi = rssi;
+	}
+	else{
+		event.detection.nymiHandle = nymiHandle;
+		event.detection.rssi = rssi;
+	}
+	trace.push_back(event);
+}
+
+/*
+A morning at the registration desk in continuous mode: each patient is found far away, walks up
+to the desk while detections come in, gets validated and is disconnected. Passers-by keep showing
+up in the scan at a distance, and the odd ECG burst and busy error are mixed in.
+*/
+static void buildSyntheticTrace(std::vector<NclEvent>& trace, unsigned patients){
+	TraceRandom random(kSeed);
+	for (unsigned p = 0; p < patients; ++p){
+		int nymiHandle = (int)p + 1;
+		NclEvent find = makeEvent(NCL_EVENT_FIND);
+		find.find.nymiHandle = nymiHandle;
+		find.find.rssi = random.range(-90, -80);
+		memcpy(find.find.provisionId, &p, sizeof(p)); //unique per patient
+		find.find.provisionId[NCL_PROVISION_ID_SIZE - 1] = 0x5a;
+		find.find.strong = random.range(0, 9) == 0 ? NCL_TRUE : NCL_FALSE;
+		trace.push_back(find);
+
+		int rssi = find.find.rssi;
+		while (rssi < -60){
+			rssi += random.range(1, 4);
+			pushScan(trace, NCL_EVENT_DETECTION, nymiHandle, rssi + random.range(-3, 3));
+			int passerBy = kPasserByHandleBase + (int)(random.next() % kPassersBy);
+			pushScan(trace, random.range(0, 7) == 0 ? NCL_EVENT_FIND : NCL_EVENT_DETECTION, passerBy, random.range(-95, -78));
+		}
+		if (find.find.strong) continue; //identified without connecting
+
+		NclEvent validation = makeEvent(NCL_EVENT_VALIDATION);
+		validation.validation.nymiHandle = nymiHandle;
+		trace.push_back(validation);
+
+		if (random.range(0, 19) == 0){
+			NclEvent ecg = makeEvent(NCL_EVENT_ECG);
+			ecg.ecg.nymiHandle = nymiHandle;
+			for (int i = 0; i < 250; ++i) trace.push_back(ecg);
+		}
+		if (random.range(0, 49) == 0){
+			NclEvent error = makeEvent(NCL_EVENT_ERROR);
+			error.error.code = NCL_ERROR_BUSY;
+			trace.push_back(error);
+		}
+
+		NclEvent disconnection = makeEvent(NCL_EVENT_DISCONNECTION);
+		disconnection.disconnection.nymiHandle = nymiHandle;
+		disconnection.disconnection.reason = NCL_DISCONNECTION_LOCAL;
+		trace.push_back(disconnection);
+	}
+}
+
+static void collectEvent(NclEvent event, void* userData){
+	((std::vector<NclEvent>*)userData)->push_back(event);
+}
+
+static long long percentile(const std::vector<long long>& sorted, double fraction){
+	if (sorted.empty()) return 0;
+	size_t index = (size_t)(fraction * (sorted.size() - 1) + 0.5);
+	return sorted[index];
+}
+
+static unsigned long long gIdentified = 0;
+
+/*
+Identification sink during the replay: onIdentified would publish the replayed patients to the
+terminals and write example.txt for every one of them
+*/
+static void benchIdentified(int nymiHandle, bool strong){
+	++gIdentified;
+}
+
+/*
+Main program function
+*/
+int main(int argc, char** argv){
+	std::string journal, label = "unlabeled";
+	unsigned patients = 2000;
+	for (int i = 1; i < argc; ++i){
+		std::string arg = argv[i];
+		if (arg == "--check") return runChecks();
+		else if (arg == "--patients" && i + 1 < argc) patients = (unsigned)atoi(argv[++i]);
+		else if (arg == "--label" && i + 1 < argc) label = argv[++i];
+		else journal = arg;
+	}
+
+	std::vector<NclEvent> trace;
+	std::string traceName;
+	if (!journal.empty()){
+		replayJournal(journal, collectEvent, &trace, false);
+		traceName = journal;
+	}
+	else{
+		buildSyntheticTrace(trace, patients);
+		std::ostringstream name;
+		name << "synthetic-" << patients;
+		traceName = name.str();
+	}
+	if (trace.empty()){
+		std::cout << "No events to replay\n";
+		return 1;
+	}
+
+	//The NEA as it runs unattended at the desk
+	gNclInitialized = true;
+	gScanMode = SCAN_FINDING;
+	gContinuousFinder.setIdentifier(beginIdentification);
+	gContinuousFinder.setEnabled(true);
+	gIdentifiedHandler.store(benchIdentified);
+
+	//Latency buffers are sized up front so the measurement allocates nothing of its own
+	std::vector<std::vector<long long> > latencies(NCL_EVENT_NOTIFIED + 1);
+	std::vector<unsigned long long> allocations(NCL_EVENT_NOTIFIED + 1, 0);
+	{
+		std::vector<size_t> counts(NCL_EVENT_NOTIFIED + 1, 0);
+		for (size_t i = 0; i < trace.size(); ++i){
+			if ((unsigned)trace[i].type <= NCL_EVENT_NOTIFIED) ++counts[trace[i].type];
+		}
+		for (size_t t = 0; t < counts.size(); ++t) latencies[t].reserve(counts[t]);
+	}
+
+	//Log lines are queued and formatted as usual, but not written anywhere
+	gLog.start(NULL);
+	NullBuffer null;
+	std::streambuf* console = std::cout.rdbuf(&null);
+	unsigned long long allocationsBefore = gAllocations.load();
+	long long startedAt = monotonicNanos();
+	for (size_t i = 0; i < trace.size(); ++i){
+		unsigned type = (unsigned)trace[i].type;
+		if (type > NCL_EVENT_NOTIFIED) continue;
+		unsigned long long allocated = gAllocations.load(std::memory_order_relaxed);
+		long long before = monotonicNanos();
+		callback(trace[i], NULL);
+		long long after = monotonicNanos();
+		allocations[type] += gAllocations.load(std::memory_order_relaxed) - allocated;
+		latencies[type].push_back(after - before);
+	}
+	long long elapsed = monotonicNanos() - startedAt;
+	unsigned long long allocated = gAllocations.load() - allocationsBefore;
+	std::cout.rdbuf(console);
+	gLog.stop();
+
+	double seconds = elapsed / 1e9;
+	double eventsPerSecond = trace.size() / seconds;
+	double allocationsPerEvent = (double)allocated / trace.size();
+	std::cout << "Trace " << traceName << ": " << trace.size() << " events, " << gIdentified << " patients identified\n";
+	std::cout << std::fixed << std::setprecision(0) << eventsPerSecond << " events/sec, "
+		<< std::setprecision(2) << allocationsPerEvent << " allocations/event\n\n";
+	std::cout << std::left << std::setw(28) << "event" << std::right << std::setw(10) << "count"
+		<< std::setw(12) << "alloc/ev" << std::setw(12) << "p50 us" << std::setw(12) << "p99 us" << std::setw(12) << "max us" << "\n";
+
+	std::ofstream csv("nymibench.csv", std::ios::app);
+	csv << std::fixed << std::setprecision(3);
+	csv << label << "," << traceName << ",ALL," << trace.size() << "," << eventsPerSecond << "," << allocationsPerEvent << ",,,\n";
+	for (size_t t = 0; t < latencies.size(); ++t){
+		std::vector<long long>& samples = latencies[t];
+		if (samples.empty()) continue;
+		std::sort(samples.begin(), samples.end());
+		double perEvent = (double)allocations[t] / samples.size();
+		double p50 = percentile(samples, 0.50) / 1e3, p99 = percentile(samples, 0.99) / 1e3, max = samples.back() / 1e3;
+		const char* name = nclEventName((NclEventType)t);
+		std::cout << std::left << std::setw(28) << name << std::right << std::setw(10) << samples.size()
+			<< std::setprecision(2) << std::setw(12) << perEvent << std::setw(12) << p50 << std::setw(12) << p99 << std::setw(12) << max << "\n";
+		csv << label << "," << traceName << "," << name << "," << samples.size() << ",," << perEvent << "," << p50 << "," << p99 << "," << max << "\n";
+	}
+	return 0;
+}
@@ -0,0 +1,1238 @@
+#include "checks.h"
+#include "edit_distance.h"
+#include "gzip.h"
+#include "image.h"
+#include "jpeg.h"
+#include "record_log.h"
+#include "records.h"
+#include "resample.h"
+#include "roaring.h"
+#include "tiff.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+static const char* kCheckLogPath = "nymibench_check.wal";
+
+/*
+Small deterministic generator, so every run checks the same inputs
+*/
+class CheckRandom{
+public:
+	explicit CheckRandom(unsigned seed) : mState(seed){}
+	unsigned next(){
+		mState = mState * 1664525u + 1013904223u;
+		return mState >> 8;
+	}
+	unsigned below(unsigned bound){ return next() % bound; }
+private:
+	unsigned mState;
+};
+
+/*
+Reads deflate's bit stream: least significant bit first, a byte at a time as bits are asked for
+*/
+class InflateInput{
+public:
+	InflateInput(const std::string& data, size_t at) : mData(data), mAt(at), mBuffer(0), mCount(0), mOver(false){}
+
+	unsigned bits(unsigned count){
+		while (mCount < count){
+			if (mAt >= mData.size()){
+				mOver = true;
+				return 0;
+			}
+			mBuffer |= (unsigned)(unsigned char)mData[mAt++] << mCount;
+			mCount += 8;
+		}
+		unsigned value = mBuffer & ((1u << count) - 1);
+		mBuffer >>= count;
+		mCount -= count;
+		return value;
+	}
+
+	//Drops the rest of the current byte; fewer than 8 bits are ever buffered
+	void alignToByte(){
+		mBuffer = 0;
+		mCount = 0;
+	}
+
+	void skip(size_t bytes){ mAt += bytes; }
+	size_t position() const{ return mAt; }
+	bool over() const{ return mOver; }
+
+private:
+	const std::string& mData;
+	size_t mAt;
+	unsigned mBuffer;
+	unsigned mCount;
+	bool mOver;
+};
+
+/*
+Canonical Huffman code as deflate and JPEG define it, decoded a bit at a time
+*/
+struct CanonicalCode{
+	unsigned short count[17]; //codes of each length
+	unsigned short symbol[320]; //by code
+};
+
+/*
+@return false if the lengths over-subscribe the code
+*/
+static bool buildCanonicalCode(const unsigned char* lengths, unsigned symbols, CanonicalCode& code){
+	std::fill(code.count, code.count + 17, 0);
+	for (unsigned i = 0; i < symbols; ++i) ++code.count[lengths[i]];
+	int left = 1;
+	for (unsigned length = 1; length <= 16; ++length){
+		left = left * 2 - code.count[length];
+		if (left < 0) return false;
+	}
+	unsigned short offsets[17];
+	offsets[1] = 0;
+	for (unsigned length = 1; length < 16; ++length) offsets[length + 1] = (unsigned short)(offsets[length] + code.count[length]);
+	for (unsigned i = 0; i < symbols; ++i){
+		if (lengths[i] != 0) code.symbol[offsets[lengths[i]]++] = (unsigned short)i;
+	}
+	return true;
+}
+
+template <typename BitSource>
+static int decodeCanonical(BitSource& in, const CanonicalCode& code){
+	int value = 0, first = 0, index = 0;
+	for (unsigned length = 1; length <= 16; ++length){
+		value |= (int)in.bits(1);
+		int count = code.count[length];
+		if (value - count < first) return code.symbol[index + value - first];
+		index += count;
+		first = (first + count) << 1;
+		value <<= 1;
+	}
+	return -1;
+}
+
+static const unsigned short kInflateLengthBase[29] = {
+	3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static const unsigned char kInflateLengthExtra[29] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+static const unsigned short kInflateDistanceBase[30] = {
+	1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+};
+static const unsigned char kInflateDistanceExtra[30] = {
+	0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+static const unsigned char kInflateCodeLengthOrder[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+/*
+Decodes a raw deflate stream (RFC 1951) starting at byte at
+@param[out] end byte after the last one of the stream
+@return false if the stream is malformed
+*/
+static bool inflateRaw(const std::string& data, size_t at, std::string& out, size_t& end){
+	InflateInput in(data, at);
+	bool last;
+	do{
+		last = in.bits(1) != 0;
+		unsigned type = in.bits(2);
+		if (type == 0){
+			in.alignToByte();
+			size_t p = in.position();
+			if (data.size() - p < 4) return false;
+			unsigned length = (unsigned char)data[p] | (unsigned)(unsigned char)data[p + 1] << 8;
+			unsigned complement = (unsigned char)data[p + 2] | (unsigned)(unsigned char)data[p + 3] << 8;
+			if (length != (~complement & 0xffff) || data.size() - p - 4 < length) return false;
+			out.append(data, p + 4, length);
+			in.skip(4 + length);
+			continue;
+		}
+		if (type == 3) return false;
+		CanonicalCode lengthCode, distanceCode;
+		unsigned char lengths[320];
+		if (type == 1){
+			for (unsigned i = 0; i < 288; ++i) lengths[i] = i < 144 ? 8 : i < 256 ? 9 : i < 280 ? 7 : 8;
+			buildCanonicalCode(lengths, 288, lengthCode);
+			std::fill(lengths, lengths + 30, 5);
+			buildCanonicalCode(lengths, 30, distanceCode);
+		}
+		else{
+			unsigned literals = in.bits(5) + 257, distances = in.bits(5) + 1, codeLengths = in.bits(4) + 4;
+			if (literals > 286 || distances > 30) return false;
+			unsigned char codeLengthLengths[19] = { 0 };
+			for (unsigned i = 0; i < codeLengths; ++i) codeLengthLengths[kInflateCodeLengthOrder[i]] = (unsigned char)in.bits(3);
+			CanonicalCode codeLengthCode;
+			if (!buildCanonicalCode(codeLengthLengths, 19, codeLengthCode)) return false;
+			unsigned index = 0;
+			while (index < literals + distances){
+				int symbol = decodeCanonical(in, codeLengthCode);
+				if (symbol < 0 || in.over()) return false;
+				if (symbol < 16){
+					lengths[index++] = (unsigned char)symbol;
+					continue;
+				}
+				unsigned char value = 0;
+				unsigned repeat;
+				if (symbol == 16){
+					if (index == 0) return false;
+					value = lengths[index - 1];
+					repeat = 3 + in.bits(2);
+				}
+				else{
+					repeat = symbol == 17 ? 3 + in.bits(3) : 11 + in.bits(7);
+				}
+				if (index + repeat > literals + distances) return false;
+				while (repeat-- > 0) lengths[index++] = value;
+			}
+			if (lengths[256] == 0) return false;
+			if (!buildCanonicalCode(lengths, literals, lengthCode) || !buildCanonicalCode(lengths + literals, distances, distanceCode)) return false;
+		}
+		while (true){
+			int symbol = decodeCanonical(in, lengthCode);
+			if (symbol < 0 || in.over()) return false;
+			if (symbol < 256){
+				out += (char)symbol;
+				continue;
+			}
+			if (symbol == 256) break;
+			symbol -= 257;
+			if (symbol >= 29) return false;
+			unsigned length = kInflateLengthBase[symbol] + in.bits(kInflateLengthExtra[symbol]);
+			int distanceSymbol = decodeCanonical(in, distanceCode);
+			if (distanceSymbol < 0 || distanceSymbol >= 30) return false;
+			unsigned distance = kInflateDistanceBase[distanceSymbol] + in.bits(kInflateDistanceExtra[distanceSymbol]);
+			if (distance > out.size()) return false;
+			size_t from = out.size() - distance;
+			for (unsigned i = 0; i < length; ++i) out += out[from + i];
+		}
+		if (in.over()) return false;
+	} while (!last);
+	end = in.position();
+	return true;
+}
+
+static unsigned littleEndian32(const std::string& data, size_t at){
+	unsigned value = 0;
+	for (unsigned i = 0; i < 4; ++i) value |= (unsigned)(unsigned char)data[at + i] << (8 * i);
+	return value;
+}
+
+/*
+@return false unless gz is exactly one gzip member whose CRC and size match what it inflates to
+*/
+static bool gunzip(const std::string& gz, std::string& out){
+	if (gz.size() < 18 || (unsigned char)gz[0] != 0x1f || (unsigned char)gz[1] != 0x8b || gz[2] != 8) return false;
+	unsigned flags = (unsigned char)gz[3];
+	size_t at = 10;
+	if (flags & 4) at += 2 + ((unsigned char)gz[10] | (unsigned)(unsigned char)gz[11] << 8);
+	for (unsigned flag = 8; flag <= 16; flag <<= 1){
+		if (!(flags & flag)) continue;
+		while (at < gz.size() && gz[at] != 0) ++at;
+		++at;
+	}
+	if (flags & 2) at += 2;
+	size_t end;
+	if (at > gz.size() || !inflateRaw(gz, at, out, end) || gz.size() - end != 8) return false;
+	return littleEndian32(gz, end) == crc32(out.data(), out.size()) && littleEndian32(gz, end + 4) == (unsigned)out.size();
+}
+
+/*
+gzipCompress round trips through the reference inflater on inputs that hit stored-like random data,
+runs of the longest match, matches at the far end of the window and many blocks
+*/
+static bool checkGzip(){
+	if (crc32("123456789", 9) != 0xcbf43926u){
+		std::cout << "gzip: CRC-32 of the check string is wrong\n";
+		return false;
+	}
+	CheckRandom random(1);
+	std::vector<std::string> inputs;
+	inputs.push_back(std::string());
+	inputs.push_back("a");
+	inputs.push_back("ab");
+	inputs.push_back(std::string(200000, 'x'));
+	std::string noise;
+	for (unsigned i = 0; i < 100000; ++i) noise += (char)random.below(256);
+	inputs.push_back(noise);
+	static const char* const kWords[] = { "patient", "record", "allergy", "penicillin", "Nymi", "validation", " ", ", ", "\n" };
+	std::string text;
+	while (text.size() < 400000) text += kWords[random.below(sizeof(kWords) / sizeof(kWords[0]))];
+	inputs.push_back(text);
+	//Repeats exactly one window back, and one byte further than deflate can reach
+	for (unsigned period = 32767; period <= 32769; ++period){
+		std::string block = noise.substr(0, period);
+		inputs.push_back(block + block + block.substr(0, 1000));
+	}
+	//Short repeats over a small alphabet, where lazy matching decides most tokens
+	std::string small;
+	for (unsigned i = 0; i < 150000; ++i) small += (char)('a' + random.below(3));
+	inputs.push_back(small);
+
+	for (size_t i = 0; i < inputs.size(); ++i){
+		std::string gz, back;
+		gzipCompress(inputs[i].data(), inputs[i].size(), gz);
+		if (!gunzip(gz, back) || back != inputs[i]){
+			std::cout << "gzip: input " << i << " (" << inputs[i].size() << " bytes) doesn't round trip\n";
+			return false;
+		}
+	}
+	std::string gz;
+	gzipCompress(inputs[3].data(), inputs[3].size(), gz);
+	if (gz.size() > inputs[3].size() / 100){
+		std::cout << "gzip: a run of one byte compressed to " << gz.size() << " bytes\n";
+		return false;
+	}
+	return true;
+}
+
+/*
+Reads a JPEG entropy coded segment most significant bit first, dropping the zero stuffed after
+0xff. At a marker it stops and feeds ones, like the encoder's padding.
+*/
+class JpegInput{
+public:
+	JpegInput(const std::string& data, size_t at) : mData(data), mAt(at), mBuffer(0), mCount(0), mMarker(false){}
+
+	unsigned bits(unsigned count){
+		unsigned value = 0;
+		while (count-- > 0) value = (value << 1) | bit();
+		return value;
+	}
+
+	size_t position() const{ return mAt; }
+	bool hitMarker() const{ return mMarker; }
+
+private:
+	unsigned bit(){
+		if (mCount == 0){
+			if (mAt >= mData.size() || mMarker){
+				mMarker = true;
+				return 1;
+			}
+			unsigned char byte = (unsigned char)mData[mAt];
+			if (byte == 0xff){
+				if (mAt + 1 < mData.size() && mData[mAt + 1] == 0){
+					mAt += 2;
+				}
+				else{
+					mMarker = true;
+					return 1;
+				}
+			}
+			else{
+				++mAt;
+			}
+			mBuffer = byte;
+			mCount = 8;
+		}
+		--mCount;
+		return (mBuffer >> mCount) & 1;
+	}
+
+	const std::string& mData;
+	size_t mAt;
+	unsigned mBuffer;
+	unsigned mCount;
+	bool mMarker;
+};
+
+static const unsigned char kCheckZigzag[64] = {
+	0, 1, 8, 16, 9, 2, 3, 10, 17, 24, 32, 25, 18, 11, 4, 5, 12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13, 6, 7, 14, 21, 28,
+	35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51, 58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63
+};
+
+static int extendJpeg(unsigned value, unsigned length){
+	if (length == 0) return 0;
+	return value < (1u << (length - 1)) ? (int)value - (1 << length) + 1 : (int)value;
+}
+
+static unsigned bigEndian16(const std::string& data, size_t at){
+	return (unsigned)(unsigned char)data[at] << 8 | (unsigned char)data[at + 1];
+}
+
+/*
+Decodes what encodeJpeg writes: a baseline JPEG with three components sampled 1x1 in one
+interleaved scan, with a plain float IDCT
+@return false if it is malformed, uses anything else, or has bytes between the scan and EOI
+*/
+static bool decodeBaselineJpeg(const std::string& data, Image& image){
+	if (data.size() < 4 || (unsigned char)data[0] != 0xff || (unsigned char)data[1] != 0xd8) return false;
+	unsigned char quantization[4][64]; //zigzag order
+	CanonicalCode huffman[2][4]; //DC, AC
+	bool haveQuantization[4] = { false, false, false, false }, haveHuffman[2][4] = { { false } };
+	unsigned width = 0, height = 0;
+	unsigned componentIds[3], quantizationIds[3], dcIds[3] = { 0 }, acIds[3] = { 0 };
+	size_t at = 2;
+	while (true){
+		if (data.size() - at < 4 || (unsigned char)data[at] != 0xff) return false;
+		unsigned marker = (unsigned char)data[at + 1];
+		size_t segment = at + 4, end = at + 2 + bigEndian16(data, at + 2);
+		if (end > data.size() || end < segment) return false;
+		if (marker == 0xdb){
+			for (size_t p = segment; p < end; p += 65){
+				unsigned table = (unsigned char)data[p];
+				if (table > 3 || end - p < 65) return false;
+				memcpy(quantization[table], data.data() + p + 1, 64);
+				haveQuantization[table] = true;
+			}
+		}
+		else if (marker == 0xc0){
+			if (end - segment != 15 || data[segment] != 8 || data[segment + 5] != 3) return false;
+			height = bigEndian16(data, segment + 1);
+			width = bigEndian16(data, segment + 3);
+			for (unsigned c = 0; c < 3; ++c){
+				componentIds[c] = (unsigned char)data[segment + 6 + c * 3];
+				if ((unsigned char)data[segment + 7 + c * 3] != 0x11) return false;
+				quantizationIds[c] = (unsigned char)data[segment + 8 + c * 3] & 3;
+			}
+		}
+		else if (marker == 0xc4){
+			for (size_t p = segment; p < end;){
+				unsigned kind = (unsigned char)data[p] >> 4, table = (unsigned char)data[p] & 15;
+				if (kind > 1 || table > 3 || end - p < 17) return false;
+				unsigned symbols = 0;
+				CanonicalCode& code = huffman[kind][table];
+				std::fill(code.count, code.count + 17, 0);
+				for (unsigned length = 1; length <= 16; ++length){
+					unsigned count = (unsigned char)data[p + length];
+					code.count[length] = (unsigned short)count;
+					symbols += count;
+				}
+				if (symbols > 256 || end - p - 17 < symbols) return false;
+				//Symbols are listed in code order, so the code index is the position in the list
+				for (unsigned i = 0; i < symbols; ++i) code.symbol[i] = (unsigned char)data[p + 17 + i];
+				haveHuffman[kind][table] = true;
+				p += 17 + symbols;
+			}
+		}
+		else if (marker == 0xda){
+			if ((unsigned char)data[segment] != 3 || end - segment != 10) return false;
+			for (unsigned c = 0; c < 3; ++c){
+				if ((unsigned char)data[segment + 1 + c * 2] != componentIds[c]) return false;
+				unsigned tables = (unsigned char)data[segment + 2 + c * 2];
+				dcIds[c] = (tables >> 4) & 3;
+				acIds[c] = tables & 3;
+			}
+			at = end;
+			break;
+		}
+		else if (marker == 0xd9){
+			return false;
+		}
+		at = end;
+	}
+	if (width == 0 || height == 0) return false;
+	for (unsigned c = 0; c < 3; ++c){
+		if (!haveQuantization[quantizationIds[c]] || !haveHuffman[0][dcIds[c]] || !haveHuffman[1][acIds[c]]) return false;
+	}
+
+	const double pi = 3.14159265358979323846;
+	double cosines[8][8]; //[x][u], scaled by C(u) / 2
+	for (int x = 0; x < 8; ++x){
+		for (int u = 0; u < 8; ++u) cosines[x][u] = std::cos((2 * x + 1) * u * pi / 16) * (u == 0 ? std::sqrt(0.5) : 1.0) * 0.5;
+	}
+
+	image.width = width;
+	image.height = height;
+	image.pixels.assign((size_t)width * height * 4, 255);
+	JpegInput in(data, at);
+	int dc[3] = { 0, 0, 0 };
+	double samples[3][64];
+	for (unsigned top = 0; top < height; top += 8){
+		for (unsigned left = 0; left < width; left += 8){
+			for (unsigned c = 0; c < 3; ++c){
+				double coefficients[64] = { 0 };
+				int symbol = decodeCanonical(in, huffman[0][dcIds[c]]);
+				if (symbol < 0 || symbol > 11) return false;
+				dc[c] += extendJpeg(in.bits(symbol), symbol);
+				coefficients[0] = dc[c] * quantization[quantizationIds[c]][0];
+				for (unsigned k = 1; k < 64;){
+					symbol = decodeCanonical(in, huffman[1][acIds[c]]);
+					if (symbol < 0) return false;
+					unsigned run = (unsigned)symbol >> 4, length = (unsigned)symbol & 15;
+					if (length == 0){
+						if (run != 15) break; //end of block
+						k += 16;
+						continue;
+					}
+					k += run;
+					if (k > 63) return false;
+					coefficients[kCheckZigzag[k]] = extendJpeg(in.bits(length), length) * quantization[quantizationIds[c]][k];
+					++k;
+				}
+				for (int y = 0; y < 8; ++y){
+					for (int x = 0; x < 8; ++x){
+						double sum = 0;
+						for (int v = 0; v < 8; ++v){
+							for (int u = 0; u < 8; ++u) sum += coefficients[v * 8 + u] * cosines[x][u] * cosines[y][v];
+						}
+						samples[c][y * 8 + x] = sum;
+					}
+				}
+			}
+			for (unsigned row = 0; row < 8 && top + row < height; ++row){
+				for (unsigned column = 0; column < 8 && left + column < width; ++column){
+					unsigned i = row * 8 + column;
+					double y = samples[0][i] + 128, cb = samples[1][i], cr = samples[2][i];
+					double rgb[3] = { y + 1.402 * cr, y - 0.344136 * cb - 0.714136 * cr, y + 1.772 * cb };
+					unsigned char* pixel = &image.pixels[((size_t)(top + row) * width + left + column) * 4];
+					for (unsigned channel = 0; channel < 3; ++channel){
+						double value = std::floor(rgb[channel] + 0.5);
+						pixel[channel] = (unsigned char)(value < 0 ? 0 : value > 255 ? 255 : value);
+					}
+				}
+			}
+		}
+	}
+	if (in.hitMarker()) return false; //ran out of entropy coded data
+	return data.size() - in.position() == 2 && (unsigned char)data[in.position()] == 0xff && (unsigned char)data[in.position() + 1] == 0xd9;
+}
+
+/*
+A card-like test image: smooth gradients with sharp edged text-like bars and some noise
+*/
+static void makeCheckImage(unsigned width, unsigned height, unsigned seed, Image& image){
+	CheckRandom random(seed);
+	image.width = width;
+	image.height = height;
+	image.pixels.resize((size_t)width * height * 4);
+	for (unsigned y = 0; y < height; ++y){
+		for (unsigned x = 0; x < width; ++x){
+			unsigned char* pixel = &image.pixels[((size_t)y * width + x) * 4];
+			bool bar = (y / 3) % 4 == 0 && (x / 5) % 3 != 0;
+			pixel[0] = (unsigned char)(bar ? 20 : 40 + x * 180 / width);
+			pixel[1] = (unsigned char)(bar ? 30 : 60 + y * 150 / height);
+			pixel[2] = (unsigned char)(bar ? 120 : 200 - (x + y) * 100 / (width + height));
+			for (unsigned c = 0; c < 3; ++c) pixel[c] = (unsigned char)std::min(255, pixel[c] + (int)random.below(9));
+			pixel[3] = (unsigned char)(128 + random.below(128));
+		}
+	}
+}
+
+/*
+encodeJpeg writes a well formed baseline file that decodes back close to the image, at every
+size of partial edge blocks and across the quality range
+*/
+static bool checkJpeg(){
+	static const unsigned kSizes[][2] = { { 1, 1 }, { 8, 8 }, { 37, 21 }, { 64, 48 }, { 9, 130 } };
+	static const int kQualities[] = { 1, 50, 90, 100 };
+	for (size_t s = 0; s < sizeof(kSizes) / sizeof(kSizes[0]); ++s){
+		Image image;
+		makeCheckImage(kSizes[s][0], kSizes[s][1], (unsigned)s + 10, image);
+		for (size_t q = 0; q < sizeof(kQualities) / sizeof(kQualities[0]); ++q){
+			std::string jpeg;
+			encodeJpeg(image, kQualities[q], jpeg);
+			Image decoded;
+			if (!decodeBaselineJpeg(jpeg, decoded) || decoded.width != image.width || decoded.height != image.height){
+				std::cout << "jpeg: " << image.width << "x" << image.height << " at quality " << kQualities[q] << " doesn't decode\n";
+				return false;
+			}
+			double error = 0;
+			int worst = 0;
+			for (size_t i = 0; i < image.pixels.size(); ++i){
+				if (i % 4 == 3) continue;
+				int difference = std::abs((int)image.pixels[i] - (int)decoded.pixels[i]);
+				error += difference;
+				worst = std::max(worst, difference);
+			}
+			error /= image.pixels.size() / 4 * 3;
+			//Quality 100 quantizes by 1, so only rounding is lost
+			if ((kQualities[q] == 100 && (error > 1.0 || worst > 4)) || (kQualities[q] >= 90 && error > 6.0) || (kQualities[q] >= 50 && error > 12.0)){
+				std::cout << "jpeg: " << image.width << "x" << image.height << " at quality " << kQualities[q] << " is off by " << error << " on average, " << worst << " at worst\n";
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+/*
+Packs codes most significant bit first, as TIFF's LZW does
+*/
+class LzwOutput{
+public:
+	LzwOutput(std::string& out) : mOut(out), mBuffer(0), mCount(0){}
+	void put(unsigned code, unsigned width){
+		mBuffer = (mBuffer << width) | code;
+		mCount += width;
+		while (mCount >= 8){
+			mOut += (char)(mBuffer >> (mCount - 8));
+			mCount -= 8;
+		}
+	}
+	void flush(){
+		if (mCount > 0) mOut += (char)(mBuffer << (8 - mCount));
+		mCount = 0;
+	}
+private:
+	std::string& mOut;
+	unsigned long long mBuffer;
+	unsigned mCount;
+};
+
+/*
+Compresses a strip the way libtiff does: widening once the next free code passes the width, and
+clearing the table when code 4094 would be assigned
+*/
+static void encodeLzw(const unsigned char* data, size_t size, std::string& out){
+	LzwOutput output(out);
+	std::map<unsigned, unsigned> table; //prefix code << 8 | byte
+	unsigned width = 9, next = 258;
+	output.put(256, width);
+	if (size > 0){
+		unsigned current = data[0];
+		for (size_t i = 1; i < size; ++i){
+			unsigned key = current << 8 | data[i];
+			std::map<unsigned, unsigned>::iterator found = table.find(key);
+			if (found != table.end()){
+				current = found->second;
+				continue;
+			}
+			output.put(current, width);
+			table[key] = next++;
+			if (next == 4094){
+				output.put(256, width);
+				table.clear();
+				next = 258;
+				width = 9;
+			}
+			else if (next > (1u << width) - 1){
+				++width;
+			}
+			current = data[i];
+		}
+		output.put(current, width);
+		if (++next == 4094){
+			output.put(256, width);
+			width = 9;
+		}
+		else if (next > (1u << width) - 1){
+			++width;
+		}
+	}
+	output.put(257, width);
+	output.flush();
+}
+
+/*
+Writes a baseline TIFF of 8 bit samples in either byte order, LZW compressed with the horizontal
+predictor, in strips of rowsPerStrip rows
+*/
+static void writeLzwTiff(const std::vector<unsigned char>& samples, unsigned width, unsigned height, unsigned channels, unsigned rowsPerStrip,
+	bool bigEndian, std::string& out){
+	std::vector<unsigned char> differenced(samples);
+	size_t rowBytes = (size_t)width * channels;
+	for (unsigned y = 0; y < height; ++y){
+		unsigned char* line = &differenced[y * rowBytes];
+		for (size_t i = rowBytes; i-- > channels;) line[i] = (unsigned char)(line[i] - line[i - channels]);
+	}
+	std::vector<std::string> strips;
+	for (unsigned first = 0; first < height; first += rowsPerStrip){
+		unsigned rows = std::min(rowsPerStrip, height - first);
+		strips.push_back(std::string());
+		encodeLzw(&differenced[first * rowBytes], rows * rowBytes, strips.back());
+	}
+
+	struct Writer{
+		std::string& out;
+		bool big;
+		void put(unsigned value, unsigned bytes){
+			for (unsigned i = 0; i < bytes; ++i) out += (char)(value >> (8 * (big ? bytes - 1 - i : i)));
+		}
+		void set(size_t at, unsigned value, unsigned bytes){
+			for (unsigned i = 0; i < bytes; ++i) out[at + i] = (char)(value >> (8 * (big ? bytes - 1 - i : i)));
+		}
+	} writer = { out, bigEndian };
+	out = bigEndian ? "MM" : "II";
+	writer.put(42, 2);
+	writer.put(8, 4);
+
+	//Directory entries: tag, type (3 SHORT, 4 LONG), count, then values that fit or an offset to them
+	struct Entry{ unsigned tag, type, count; std::vector<unsigned> values; };
+	std::vector<Entry> entries;
+	Entry entry;
+	entry.type = 3;
+	entry.count = 1;
+	entry.tag = 256; entry.values.assign(1, width); entries.push_back(entry);
+	entry.tag = 257; entry.values.assign(1, height); entries.push_back(entry);
+	entry.tag = 258; entry.count = channels; entry.values.assign(channels, 8); entries.push_back(entry);
+	entry.count = 1;
+	entry.tag = 259; entry.values.assign(1, 5); entries.push_back(entry);
+	entry.tag = 262; entry.values.assign(1, channels >= 3 ? 2 : 1); entries.push_back(entry);
+	entry.tag = 273; entry.type = 4; entry.count = (unsigned)strips.size(); entry.values.assign(strips.size(), 0); entries.push_back(entry);
+	entry.type = 3;
+	entry.count = 1;
+	entry.tag = 277; entry.values.assign(1, channels); entries.push_back(entry);
+	entry.tag = 278; entry.values.assign(1, rowsPerStrip); entries.push_back(entry);
+	entry.tag = 279; entry.type = 4; entry.count = (unsigned)strips.size(); entry.values.clear();
+	for (size_t i = 0; i < strips.size(); ++i) entry.values.push_back((unsigned)strips[i].size());
+	entries.push_back(entry);
+	entry.type = 3;
+	entry.count = 1;
+	entry.tag = 317; entry.values.assign(1, 2); entries.push_back(entry);
+
+	//Strip data and out of line values follow the directory
+	size_t directoryEnd = 8 + 2 + entries.size() * 12 + 4;
+	size_t data = directoryEnd;
+	std::vector<size_t> stripOffsets;
+	for (size_t i = 0; i < strips.size(); ++i){
+		stripOffsets.push_back(data);
+		data += strips[i].size();
+	}
+	entries[5].values.assign(stripOffsets.begin(), stripOffsets.end());
+	writer.put((unsigned)entries.size(), 2);
+	std::vector<std::pair<size_t, size_t> > outOfLine; //offset field, entry
+	for (size_t i = 0; i < entries.size(); ++i){
+		const Entry& e = entries[i];
+		unsigned bytes = e.type == 3 ? 2 : 4;
+		writer.put(e.tag, 2);
+		writer.put(e.type, 2);
+		writer.put(e.count, 4);
+		if (e.count * bytes <= 4){
+			for (unsigned j = 0; j < e.count; ++j) writer.put(e.values[j], bytes);
+			for (unsigned j = e.count * bytes; j < 4; ++j) out += '\0';
+		}
+		else{
+			outOfLine.push_back(std::make_pair(out.size(), i));
+			writer.put(0, 4);
+		}
+	}
+	writer.put(0, 4); //no next directory
+	for (size_t i = 0; i < strips.size(); ++i) out += strips[i];
+	for (size_t i = 0; i < outOfLine.size(); ++i){
+		const Entry& e = entries[outOfLine[i].second];
+		writer.set(outOfLine[i].first, (unsigned)out.size(), 4);
+		for (unsigned j = 0; j < e.count; ++j) writer.put(e.values[j], e.type == 3 ? 2 : 4);
+	}
+}
+
+/*
+decodeTiff reads LZW strips with the horizontal predictor back to the exact samples, in both byte
+orders, for RGB and gray, including strips long enough to fill and clear the code table
+*/
+static bool checkTiffLzw(){
+	CheckRandom random(3);
+	for (unsigned variant = 0; variant < 4; ++variant){
+		unsigned channels = variant % 2 == 0 ? 3 : 1;
+		bool bigEndian = variant >= 2;
+		unsigned width = variant < 2 ? 61 : 257, height = variant < 2 ? 37 : 300;
+		unsigned rowsPerStrip = variant < 2 ? 8 : 300;
+		std::vector<unsigned char> samples((size_t)width * height * channels);
+		for (unsigned y = 0; y < height; ++y){
+			for (unsigned x = 0; x < width; ++x){
+				for (unsigned c = 0; c < channels; ++c){
+					unsigned smooth = (x * (c + 1) + y * 2) & 0xff;
+					samples[((size_t)y * width + x) * channels + c] = (unsigned char)(variant < 2 ? smooth + random.below(4) : random.below(256));
+				}
+			}
+		}
+		std::string file;
+		writeLzwTiff(samples, width, height, channels, rowsPerStrip, bigEndian, file);
+		Image image;
+		if (!decodeTiff((const unsigned char*)file.data(), file.size(), image) || image.width != width || image.height != height){
+			std::cout << "tiff: variant " << variant << " doesn't decode\n";
+			return false;
+		}
+		for (size_t i = 0; i < (size_t)width * height; ++i){
+			const unsigned char* sample = &samples[i * channels];
+			const unsigned char* pixel = &image.pixels[i * 4];
+			unsigned char expected[4] = { sample[0], sample[channels == 3 ? 1 : 0], sample[channels == 3 ? 2 : 0], 255 };
+			if (memcmp(pixel, expected, 4) != 0){
+				std::cout << "tiff: variant " << variant << " differs at pixel " << i << "\n";
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+/*
+resizeImage matches the triangle filter it documents, computed here in double precision one
+channel at a time, to within rounding
+*/
+static bool checkResample(){
+	static const unsigned kSizes[][4] = { { 1013, 637, 400, 250 }, { 7, 5, 23, 17 }, { 64, 64, 64, 64 }, { 50, 3, 1, 1 }, { 3, 200, 9, 40 } };
+	for (size_t s = 0; s < sizeof(kSizes) / sizeof(kSizes[0]); ++s){
+		Image source, out;
+		makeCheckImage(kSizes[s][0], kSizes[s][1], 20 + (unsigned)s, source);
+		unsigned width = kSizes[s][2], height = kSizes[s][3];
+		resizeImage(source, width, height, out);
+		if (out.width != width || out.height != height || out.pixels.size() != (size_t)width * height * 4){
+			std::cout << "resample: wrong size for " << width << "x" << height << "\n";
+			return false;
+		}
+		//Taps of each axis as the header describes them
+		std::vector<std::vector<std::pair<unsigned, double> > > taps[2];
+		for (unsigned axis = 0; axis < 2; ++axis){
+			unsigned inSize = axis == 0 ? source.width : source.height, outSize = axis == 0 ? width : height;
+			double scale = (double)inSize / outSize, support = std::max(scale, 1.0);
+			taps[axis].resize(outSize);
+			for (unsigned i = 0; i < outSize; ++i){
+				double center = (i + 0.5) * scale - 0.5, total = 0;
+				for (int j = 0; j < (int)inSize; ++j){
+					double weight = 1.0 - std::fabs(j - center) / support;
+					if (weight > 0){
+						taps[axis][i].push_back(std::make_pair((unsigned)j, weight));
+						total += weight;
+					}
+				}
+				if (total <= 0){
+					taps[axis][i].assign(1, std::make_pair((unsigned)std::min(std::max(0, (int)(center + 0.5)), (int)inSize - 1), 1.0));
+					total = 1;
+				}
+				for (size_t k = 0; k < taps[axis][i].size(); ++k) taps[axis][i][k].second /= total;
+			}
+		}
+		for (unsigned y = 0; y < height; ++y){
+			for (unsigned x = 0; x < width; ++x){
+				for (unsigned c = 0; c < 4; ++c){
+					double sum = 0;
+					for (size_t ky = 0; ky < taps[1][y].size(); ++ky){
+						for (size_t kx = 0; kx < taps[0][x].size(); ++kx){
+							sum += taps[1][y][ky].second * taps[0][x][kx].second *
+								source.pixels[((size_t)taps[1][y][ky].first * source.width + taps[0][x][kx].first) * 4 + c];
+						}
+					}
+					int expected = (int)std::floor(std::min(255.0, std::max(0.0, sum)) + 0.5);
+					int got = out.pixels[((size_t)y * width + x) * 4 + c];
+					if (std::abs(expected - got) > 1){
+						std::cout << "resample: " << source.width << "x" << source.height << " to " << width << "x" << height << " is "
+							<< got << " at " << x << "," << y << " channel " << c << ", expected " << expected << "\n";
+						return false;
+					}
+				}
+			}
+		}
+	}
+	return true;
+}
+
+static bool sameValues(const RoaringBitmap& bitmap, const std::set<unsigned>& expected){
+	if (bitmap.cardinality() != expected.size() || bitmap.empty() != expected.empty()) return false;
+	std::vector<unsigned> values = bitmap.values();
+	if (values.size() != expected.size() || !std::equal(values.begin(), values.end(), expected.begin())) return false;
+	std::vector<unsigned> visited;
+	bitmap.forEach([&](unsigned value){ visited.push_back(value); });
+	return visited == values;
+}
+
+/*
+RoaringBitmap agrees with std::set through adds and removes that turn containers into bitmaps and
+back, and intersects every pairing of array and bitmap containers correctly
+*/
+static bool checkRoaring(){
+	CheckRandom random(4);
+	for (unsigned round = 0; round < 24; ++round){
+		RoaringBitmap bitmaps[2];
+		std::set<unsigned> sets[2];
+		for (unsigned side = 0; side < 2; ++side){
+			//Dense in a few containers for some rounds, sparse over the whole range for others
+			unsigned kind = (round + side) % 3;
+			unsigned adds = kind == 0 ? 300 : kind == 1 ? 9000 : 20000;
+			std::vector<unsigned> added;
+			for (unsigned i = 0; i < adds; ++i){
+				unsigned value = kind == 0 ? random.next() * 256u + random.below(256) : (random.below(3) << 16) | random.below(kind == 1 ? 65536 : 12000);
+				bitmaps[side].add(value);
+				sets[side].insert(value);
+				added.push_back(value);
+			}
+			//Removing most of them takes full containers back below the array limit, a few leaves them bitmaps
+			unsigned removes = round % 2 == 0 ? adds / 8 : adds - adds / 8;
+			for (unsigned i = 0; i < removes; ++i){
+				unsigned value = added[random.below((unsigned)added.size())];
+				if (random.below(8) == 0) value ^= 1; //sometimes a value that isn't there
+				bitmaps[side].remove(value);
+				sets[side].erase(value);
+			}
+			if (!sameValues(bitmaps[side], sets[side])){
+				std::cout << "roaring: round " << round << " disagrees with std::set after adds and removes\n";
+				return false;
+			}
+			for (unsigned probe = 0; probe < 2000; ++probe){
+				unsigned value = probe % 2 == 0 ? (random.below(3) << 16) | random.below(65536) : random.next();
+				if (bitmaps[side].contains(value) != (sets[side].count(value) != 0)){
+					std::cout << "roaring: round " << round << " contains(" << value << ") is wrong\n";
+					return false;
+				}
+			}
+		}
+		RoaringBitmap both;
+		RoaringBitmap::intersect(bitmaps[0], bitmaps[1], both);
+		std::set<unsigned> expected;
+		std::set_intersection(sets[0].begin(), sets[0].end(), sets[1].begin(), sets[1].end(), std::inserter(expected, expected.end()));
+		if (!sameValues(both, expected)){
+			std::cout << "roaring: round " << round << " intersection disagrees with std::set\n";
+			return false;
+		}
+		RoaringBitmap none;
+		RoaringBitmap::intersect(bitmaps[0], none, both);
+		if (!both.empty()){
+			std::cout << "roaring: intersection with an empty bitmap isn't empty\n";
+			return false;
+		}
+	}
+	return true;
+}
+
+static unsigned referenceEditDistance(const std::string& a, const std::string& b){
+	std::vector<unsigned> previous(b.size() + 1), current(b.size() + 1);
+	for (size_t j = 0; j <= b.size(); ++j) previous[j] = (unsigned)j;
+	for (size_t i = 1; i <= a.size(); ++i){
+		current[0] = (unsigned)i;
+		for (size_t j = 1; j <= b.size(); ++j){
+			unsigned cost = tolower((unsigned char)a[i - 1]) == tolower((unsigned char)b[j - 1]) ? 0 : 1;
+			current[j] = std::min(std::min(previous[j] + 1, current[j - 1] + 1), previous[j - 1] + cost);
+		}
+		previous.swap(current);
+	}
+	return previous[b.size()];
+}
+
+/*
+The batched (SIMD where available) and single edit distances agree with a textbook Levenshtein,
+capped at the bound, on either side of kEditDistanceMaxLength
+*/
+static bool checkEditDistance(){
+	CheckRandom random(5);
+	static const char kLetters[] = "abcAB";
+	for (unsigned round = 0; round < 5000; ++round){
+		std::string query(random.below(round % 3 == 0 ? 13 : 45), 'a');
+		for (size_t i = 0; i < query.size(); ++i) query[i] = kLetters[random.below(5)];
+		std::vector<std::string> candidates;
+		for (unsigned i = 0; i < 11; ++i){
+			std::string candidate = query;
+			if (random.below(2) == 0){
+				candidate.assign(random.below(48), 'a');
+				for (size_t j = 0; j < candidate.size(); ++j) candidate[j] = kLetters[random.below(5)];
+			}
+			else{
+				for (unsigned edits = random.below(5); edits > 0 && !candidate.empty(); --edits) candidate[random.below((unsigned)candidate.size())] = 'z';
+			}
+			candidates.push_back(candidate);
+		}
+		std::vector<const char*> pointers;
+		std::vector<size_t> lengths;
+		for (size_t i = 0; i < candidates.size(); ++i){
+			pointers.push_back(candidates[i].data());
+			lengths.push_back(candidates[i].size());
+		}
+		unsigned bound = random.below(5);
+		std::vector<unsigned> distances(candidates.size());
+		boundedEditDistances(query.data(), query.size(), pointers.data(), lengths.data(), candidates.size(), bound, distances.data());
+		for (size_t i = 0; i < candidates.size(); ++i){
+			unsigned expected = std::min(referenceEditDistance(query, candidates[i]), bound + 1);
+			unsigned single = boundedEditDistance(query.data(), query.size(), candidates[i].data(), candidates[i].size(), bound);
+			if (distances[i] != expected || single != expected){
+				std::cout << "edit distance: \"" << query << "\" to \"" << candidates[i] << "\" within " << bound << " is "
+					<< distances[i] << " batched, " << single << " single, expected " << expected << "\n";
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+static bool readFile(const char* path, std::string& data){
+	std::ifstream in(path, std::ios::binary);
+	if (!in) return false;
+	data.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+	return true;
+}
+
+static void writeFile(const char* path, const std::string& data){
+	std::ofstream out(path, std::ios::binary | std::ios::trunc);
+	out.write(data.data(), data.size());
+}
+
+static unsigned replayCount(RecordLog& log, std::vector<std::string>* values = NULL){
+	unsigned count = 0;
+	log.open(kCheckLogPath, [&](const FieldUpdate& update){
+		++count;
+		if (values != NULL) values->push_back(update.value);
+	});
+	return count;
+}
+
+/*
+The record log replays what was written, cuts a torn tail so appends continue after the last good
+entry, and refuses to open when a bad entry has good ones after it
+*/
+static bool checkRecordLogReplay(){
+	std::remove(kCheckLogPath);
+	{
+		RecordLog log;
+		if (!log.open(kCheckLogPath, [](const FieldUpdate&){})){
+			std::cout << "record log: can't create " << kCheckLogPath << "\n";
+			return false;
+		}
+		unsigned long long last = 0;
+		for (unsigned i = 0; i < 5; ++i){
+			FieldUpdate update;
+			update.ohip = "5584486674YM";
+			update.field = FIELD_PHONE;
+			update.value = "905-888-100" + std::to_string(i);
+			update.time = 1000 + i;
+			last = log.append(update);
+		}
+		if (!log.waitDurable(last)){
+			std::cout << "record log: edits didn't become durable\n";
+			return false;
+		}
+		log.close();
+	}
+	std::string whole;
+	readFile(kCheckLogPath, whole);
+
+	bool passed = true;
+	//A tail torn in the middle of the last entry
+	writeFile(kCheckLogPath, whole.substr(0, whole.size() - 3));
+	{
+		RecordLog log;
+		std::vector<std::string> values;
+		unsigned replayed = replayCount(log, &values);
+		if (replayed != 4 || values.back() != "905-888-1003"){
+			std::cout << "record log: torn tail replayed " << replayed << " edits, expected 4\n";
+			passed = false;
+		}
+		FieldUpdate update;
+		update.ohip = "5584486674YM";
+		update.field = FIELD_NAME;
+		update.value = "after the cut";
+		update.time = 2000;
+		log.waitDurable(log.append(update));
+		log.close();
+	}
+	{
+		RecordLog log;
+		std::vector<std::string> values;
+		unsigned replayed = replayCount(log, &values);
+		log.close();
+		if (replayed != 5 || values.back() != "after the cut"){
+			std::cout << "record log: the edit appended after a torn tail replayed as " << replayed << " edits\n";
+			passed = false;
+		}
+	}
+	//Garbage after the last entry, e.g. a partially written batch
+	writeFile(kCheckLogPath, whole + std::string("\x13\0\0\0garbage", 11));
+	{
+		RecordLog log;
+		unsigned replayed = replayCount(log);
+		log.close();
+		std::string cut;
+		readFile(kCheckLogPath, cut);
+		if (replayed != 5 || cut != whole){
+			std::cout << "record log: garbage tail replayed " << replayed << " edits and left " << cut.size() << " bytes\n";
+			passed = false;
+		}
+	}
+	//A bad entry with good ones after it is left alone
+	std::string damaged = whole;
+	damaged[20] ^= 0x40; //inside the first entry's payload
+	writeFile(kCheckLogPath, damaged);
+	{
+		RecordLog log;
+		bool opened = log.open(kCheckLogPath, [](const FieldUpdate&){});
+		log.close();
+		std::string after;
+		readFile(kCheckLogPath, after);
+		if (opened || after != damaged){
+			std::cout << "record log: opened a log damaged before good edits\n";
+			passed = false;
+		}
+	}
+	std::remove(kCheckLogPath);
+	return passed;
+}
+
+/*
+An edit is visible only once it is durable: while the log is open it is applied and replays, with
+the log closed it is refused and the record is left as it was
+*/
+static bool checkDurableEdits(){
+	std::remove(kCheckLogPath);
+	RecordStore store;
+	store.seed();
+	if (!gRecordLog.open(kCheckLogPath, [](const FieldUpdate&){})) return false;
+	FieldUpdate edit;
+	edit.ohip = "5584-486-674-YM";
+	edit.field = FIELD_ADDRESS;
+	edit.value = "1 Durable Street";
+	edit.time = 1000;
+	UpdateResult applied = store.update(edit, true);
+	gRecordLog.close();
+	std::string json;
+	store.jsonByOhip(edit.ohip, json);
+	if (applied != UPDATE_APPLIED || json.find("1 Durable Street") == std::string::npos){
+		std::cout << "records: a durable edit wasn't applied\n";
+		return false;
+	}
+
+	edit.value = "2 Lost Street";
+	edit.time = 2000;
+	UpdateResult refused = store.update(edit, true);
+	store.jsonByOhip(edit.ohip, json);
+	if (refused != UPDATE_NOT_DURABLE || json.find("2 Lost Street") != std::string::npos){
+		std::cout << "records: an edit the log didn't take is visible\n";
+		return false;
+	}
+
+	RecordStore restarted;
+	restarted.seed();
+	if (!gRecordLog.open(kCheckLogPath, [&](const FieldUpdate& update){ restarted.update(update, false); })) return false;
+	gRecordLog.close();
+	restarted.jsonByOhip(edit.ohip, json);
+	std::remove(kCheckLogPath);
+	if (json.find("1 Durable Street") == std::string::npos){
+		std::cout << "records: a durable edit didn't survive the restart\n";
+		return false;
+	}
+	return true;
+}
+
+/*
+findAllergic(presentOnly) counts a patient from their identification, without a session
+*/
+static bool checkPresentAllergic(){
+	RecordStore store;
+	store.seed();
+	NclProvisionId id;
+	memset(id, 0x42, sizeof(id));
+	ProvisionKey provision = provisionKey(id);
+	if (!store.link(provision, "5584486674YM")) return false;
+	std::vector<std::pair<std::string, std::string> > patients;
+	if (store.findAllergic("penicillin", true, 10, patients) != 0){
+		std::cout << "records: a patient never identified counts as present\n";
+		return false;
+	}
+	store.identified(provision);
+	if (store.findAllergic("Penicillin", true, 10, patients) != 1 || patients.size() != 1 || patients[0].first.find("5584") == std::string::npos){
+		std::cout << "records: an identified patient isn't counted as present\n";
+		return false;
+	}
+	return true;
+}
+
+/*
+Names past kEditDistanceMaxLength are told apart by their tails, and names with more than 255 distinct
+trigrams find themselves
+*/
+static bool checkLongNameSearch(){
+	RecordStore store;
+	PatientRecord record;
+	record.sex = "F";
+	record.born = "1970-01-01";
+	record.expiry = "2030-01-01";
+	record.ohip = "1111-222-333-AA";
+	record.name = "Maximiliana Theodora Fitzgerald-Worthington";
+	store.put(record);
+	record.ohip = "1111-222-334-AA";
+	record.name = "Maximiliana Theodora Fitzgerald-Worthingtoon";
+	store.put(record);
+	//Random letters, so nearly every trigram is a different one
+	CheckRandom random(6);
+	std::string longName;
+	while (longName.size() < 300) longName += longName.size() % 9 == 8 ? ' ' : (char)('a' + random.below(26));
+	record.ohip = "1111-222-335-AA";
+	record.name = longName;
+	store.put(record);
+
+	std::vector<NameMatch> matches;
+	store.searchNames("Maximiliana Theodora Fitzgerald-Worthington", "", 0, 0, 10, matches);
+	if (matches.size() != 2 || matches[0].name != "Maximiliana Theodora Fitzgerald-Worthington" || matches[0].distance != 0 || matches[1].distance != 1){
+		std::cout << "records: long names that share their first " << kEditDistanceMaxLength << " bytes aren't told apart\n";
+		return false;
+	}
+	store.searchNames(longName, "", 0, 0, 10, matches);
+	if (matches.empty() || matches[0].name != longName || matches[0].distance != 0){
+		std::cout << "records: a name with more than 255 trigrams doesn't find itself\n";
+		return false;
+	}
+	return true;
+}
+
+/*
+Rewrites a record with many allergies until the store compacts its arenas several times. The
+allergy ids left behind outgrow the strings left behind, which once made compact() reserve a
+negative size and throw.
+@return false if a rewrite was lost
+*/
+static bool checkRecordCompaction(){
+	RecordStore store;
+	store.seed();
+	PatientRecord record;
+	record.ohip = "5584-486-674-YM";
+	record.name = "Anita Jean Walker";
+	record.sex = "F";
+	record.born = "1981-12-15";
+	record.expiry = "2017-12-15";
+	for (unsigned round = 0; round < 64; ++round){
+		std::ostringstream phone;
+		phone << "905-888-" << 1000 + round;
+		record.phone = phone.str();
+		record.allergies.clear();
+		for (unsigned i = 0; i < 20; ++i){
+			std::ostringstream allergen;
+			allergen << "Allergen " << round + i;
+			record.allergies.push_back(allergen.str());
+		}
+		std::string json;
+		if (!store.put(record) || !store.jsonByOhip(record.ohip, json) || json.find(record.phone) == std::string::npos ||
+			json.find(record.allergies.front()) == std::string::npos || json.find(record.allergies.back()) == std::string::npos){
+			std::cout << "records: rewrite " << round << " was lost\n";
+			return false;
+		}
+	}
+	std::vector<std::pair<std::string, std::string> > patients;
+	if (store.findAllergic("Allergen 70", false, 10, patients) != 1){
+		std::cout << "records: allergen index out of step after compaction\n";
+		return false;
+	}
+	return true;
+}
+
+int runChecks(){
+	struct Check{
+		const char* name;
+		bool (*run)();
+	};
+	static const Check kChecks[] = {
+		{ "gzip", checkGzip },
+		{ "jpeg", checkJpeg },
+		{ "tiff lzw", checkTiffLzw },
+		{ "resample", checkResample },
+		{ "roaring", checkRoaring },
+		{ "edit distance", checkEditDistance },
+		{ "record log replay", checkRecordLogReplay },
+		{ "durable edits", checkDurableEdits },
+		{ "present allergic", checkPresentAllergic },
+		{ "long name search", checkLongNameSearch },
+		{ "record compaction", checkRecordCompaction }
+	};
+	bool passed = true;
+	for (size_t i = 0; i < sizeof(kChecks) / sizeof(kChecks[0]); ++i){
+		bool ok;
+		try{
+			ok = kChecks[i].run();
+		}
+		catch (const std::exception& e){
+			std::cout << kChecks[i].name << ": " << e.what() << "\n";
+			ok = false;
+		}
+		std::cout << (ok ? "passed " : "FAILED ") << kChecks[i].name << "\n";
+		passed = passed && ok;
+	}
+	std::cout << (passed ? "All checks passed\n" : "Checks failed\n");
+	return passed ? 0 : 1;
+}
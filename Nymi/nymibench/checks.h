@@ -0,0 +1,14 @@
+#ifndef CHECKS_H
+#define CHECKS_H
+
+/*
+Regression checks of nymibench --check. Each codec and index is checked against a plain reference
+written here (an inflater, a baseline JPEG decoder, an LZW encoder, std::set, a textbook
+Levenshtein) on inputs chosen to hit the edge cases, then the record store's behaviour that was
+fixed: edits durable before they are visible, presence by identification and long name search.
+Failures are printed with the name of their check.
+@return 0 if every check passed
+*/
+int runChecks();
+
+#endif
@@ -0,0 +1,36 @@
+/*
+NCL stand-in for the replay benchmark: every request succeeds immediately and no event is
+ever delivered, so only the NEA's own event handling is measured
+*/
+#include "ncl.h"
+
+extern "C" {
+
+NclBool nclInit(NclCallback callback, void* userData, const char* neaName, NclMode mode, FILE* errorStream){ return NCL_TRUE; }
+NclBool nclFinish(){ return NCL_TRUE; }
+NclInfo nclInfo(){ NclInfo info = { { 0 } }; return info; }
+NclBool nclUpdate(unsigned timeout){ return NCL_TRUE; }
+NclBool nclSetIpAndPort(const char* ip, int port){ return NCL_TRUE; }
+NclBool nclLockErrorStream(){ return NCL_TRUE; }
+NclBool nclUnlockErrorStream(){ return NCL_TRUE; }
+NclErrorCode nclGetErrorCode(){ return NCL_ERROR_NULL; }
+NclBool nclStartDiscovery(){ return NCL_TRUE; }
+NclBool nclStartFinding(const NclProvision* provisions, unsigned nProvisions, NclBool detect){ return NCL_TRUE; }
+NclBool nclStopScan(){ return NCL_TRUE; }
+NclBool nclClearScannedNymis(){ return NCL_TRUE; }
+NclBool nclHintConnectionParams(unsigned intervalMin, unsigned intervalMax, unsigned timeout, unsigned latency){ return NCL_TRUE; }
+NclBool nclAgree(int nymiHandle){ return NCL_TRUE; }
+NclBool nclProvision(int nymiHandle, NclBool strong){ return NCL_TRUE; }
+NclBool nclValidate(int nymiHandle){ return NCL_TRUE; }
+NclBool nclGetConnected(int* nymiHandles, unsigned* nNymiHandles){ *nNymiHandles = 0; return NCL_TRUE; }
+NclBool nclDisconnect(int nymiHandle){ return NCL_TRUE; }
+NclBool nclNotify(int nymiHandle, NclBool notifyValue){ return NCL_TRUE; }
+NclBool nclStartEcgStream(int nymiHandle){ return NCL_TRUE; }
+NclBool nclStopEcgStream(int nymiHandle){ return NCL_TRUE; }
+NclBool nclCreateSk(int nymiHandle){ return NCL_TRUE; }
+NclBool nclGetSk(int nymiHandle, const NclSkId skId){ return NCL_TRUE; }
+NclBool nclPrg(int nymiHandle){ return NCL_TRUE; }
+NclBool nclGetRssi(int nymiHandle){ return NCL_TRUE; }
+NclBool nclGetFirmwareVersion(int nymiHandle){ return NCL_TRUE; }
+
+}
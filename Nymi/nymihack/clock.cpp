@@ -0,0 +1,32 @@
+#include "clock.h"
+
+#if defined(_WIN32)
+#include <windows.h>
+
+static long long performanceFrequency(){
+	LARGE_INTEGER frequency;
+	QueryPerformanceFrequency(&frequency);
+	return frequency.QuadPart;
+}
+
+static const long long gFrequency = performanceFrequency();
+
+long long monotonicNanos(){
+	LARGE_INTEGER counter;
+	QueryPerformanceCounter(&counter);
+	//Split to avoid overflowing counter * 1e9
+	long long seconds = counter.QuadPart / gFrequency;
+	long long rest = counter.QuadPart % gFrequency;
+	return seconds * 1000000000LL + rest * 1000000000LL / gFrequency;
+}
+#else
+#include <chrono>
+
+long long monotonicNanos(){
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+#endif
+
+long long monotonicMicros(){
+	return monotonicNanos() / 1000;
+}
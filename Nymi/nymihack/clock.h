@@ -0,0 +1,15 @@
+#ifndef CLOCK_H
+#define CLOCK_H
+
+/*
+Monotonic time in microseconds since an arbitrary start point.
+Uses QueryPerformanceCounter on Windows, since steady_clock isn't steady on VS2013.
+*/
+long long monotonicMicros();
+
+/*
+Monotonic time in nanoseconds since an arbitrary start point
+*/
+long long monotonicNanos();
+
+#endif
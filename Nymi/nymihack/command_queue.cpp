@@ -0,0 +1,179 @@
+#include "command_queue.h"
+#include "nclevents.h"
+#include "logger.h"
+#include "metrics.h"
+#include "recovery.h"
+
+
+CommandScheduler gScheduler;
+
+CommandScheduler::CommandScheduler(){}
+
+void CommandScheduler::submit(int nymiHandle, NclEventType completion, NclCommand command, const char* name){
+	Pending pending;
+	pending.completion = completion;
+	pending.command = command;
+	pending.name = name;
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mChannels[nymiHandle].queue.push_back(pending);
+	}
+	dispatch(nymiHandle);
+}
+
+/*
+Issues queued commands for a Nymi until one is in flight or the queue is empty.
+The NCL call is made without holding the lock, since the NCL may deliver the completion event
+on its own thread before the call returns.
+*/
+void CommandScheduler::dispatch(int nymiHandle){
+	while (true){
+		NclCommand command;
+		const char* name;
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			std::map<int, Channel>::iterator it = mChannels.find(nymiHandle);
+			if (it == mChannels.end()) return;
+			Channel& channel = it->second;
+			if (channel.busy || channel.queue.empty()) return;
+			channel.busy = true;
+			channel.awaiting = channel.queue.front().completion;
+			command = channel.queue.front().command;
+			name = channel.queue.front().name;
+		}
+
+		if (command(nymiHandle)) return; //in flight, the completion event dispatches the next one
+
+		NclErrorCode code = nclGetErrorCode();
+		gMetrics.countFailedCall(code);
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			std::map<int, Channel>::iterator it = mChannels.find(nymiHandle);
+			if (it == mChannels.end()) return;
+			Channel& channel = it->second;
+			channel.busy = false;
+			if (code != NCL_ERROR_BUSY) channel.queue.pop_front();
+		}
+		if (code == NCL_ERROR_BUSY){
+			//Someone else holds the channel. Keep the command at the head and retry when the next event
+			//for this Nymi tells us the channel moved on, or after a backoff if no event comes.
+			gLog.log("log: {} waiting for command channel of Nymi {}", name, nymiHandle);
+			gRecovery.retryBusy();
+			return;
+		}
+		gLog.log("log: {} request failed ({})", name, nclErrorName(code));
+	}
+}
+
+void CommandScheduler::onEvent(const NclEvent& event){
+	int nymiHandle = nclEventHandle(event);
+	if (nymiHandle == -1) return;
+	if (event.type == NCL_EVENT_DISCONNECTION){
+		drop(nymiHandle);
+		return;
+	}
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		std::map<int, Channel>::iterator it = mChannels.find(nymiHandle);
+		if (it == mChannels.end()) return;
+		Channel& channel = it->second;
+		if (channel.busy){
+			if (event.type != channel.awaiting) return;
+			channel.busy = false;
+			channel.queue.pop_front();
+		}
+		if (channel.queue.empty()){
+			mChannels.erase(it);
+			return;
+		}
+	}
+	dispatch(nymiHandle);
+}
+
+void CommandScheduler::drop(int nymiHandle){
+	std::lock_guard<std::mutex> lock(mMutex);
+	mChannels.erase(nymiHandle);
+}
+
+void CommandScheduler::park(int nymiHandle, const ProvisionKey& provision){
+	std::lock_guard<std::mutex> lock(mMutex);
+	std::map<int, Channel>::iterator it = mChannels.find(nymiHandle);
+	if (it == mChannels.end()) return;
+	std::deque<Pending>& parked = mParked[provision];
+	parked.insert(parked.end(), it->second.queue.begin(), it->second.queue.end());
+	mChannels.erase(it);
+}
+
+void CommandScheduler::parkAll(const std::vector<Session>& sessions){
+	std::lock_guard<std::mutex> lock(mMutex);
+	for (size_t i = 0; i < sessions.size(); ++i){
+		std::map<int, Channel>::iterator it = mChannels.find(sessions[i].nymiHandle);
+		if (it == mChannels.end()) continue;
+		std::deque<Pending>& parked = mParked[sessions[i].provision];
+		parked.insert(parked.end(), it->second.queue.begin(), it->second.queue.end());
+		mChannels.erase(it);
+	}
+	mChannels.clear(); //commands for Nymis without a session can't be resumed
+}
+
+void CommandScheduler::resume(const ProvisionKey& provision, int nymiHandle){
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		std::map<ProvisionKey, std::deque<Pending> >::iterator it = mParked.find(provision);
+		if (it == mParked.end()) return;
+		Channel& channel = mChannels[nymiHandle];
+		std::deque<Pending>& queue = channel.queue;
+		//Parked commands were queued first, so they go ahead of anything queued since,
+		//but behind the command in flight (typically the validation that triggered the resume)
+		queue.insert(channel.busy ? queue.begin() + 1 : queue.begin(), it->second.begin(), it->second.end());
+		mParked.erase(it);
+		gLog.log("log: resuming {} queued commands on Nymi {}", queue.size(), nymiHandle);
+	}
+	dispatch(nymiHandle);
+}
+
+void CommandScheduler::retryStalled(){
+	std::vector<int> stalled;
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		for (std::map<int, Channel>::iterator it = mChannels.begin(); it != mChannels.end(); ++it){
+			if (!it->second.busy && !it->second.queue.empty()) stalled.push_back(it->first);
+		}
+	}
+	for (size_t i = 0; i < stalled.size(); ++i){
+		dispatch(stalled[i]);
+	}
+}
+
+size_t CommandScheduler::depth(int nymiHandle){
+	std::lock_guard<std::mutex> lock(mMutex);
+	std::map<int, Channel>::iterator it = mChannels.find(nymiHandle);
+	return it == mChannels.end() ? 0 : it->second.queue.size();
+}
+
+size_t CommandScheduler::totalDepth(){
+	std::lock_guard<std::mutex> lock(mMutex);
+	size_t total = 0;
+	for (std::map<int, Channel>::iterator it = mChannels.begin(); it != mChannels.end(); ++it){
+		total += it->second.queue.size();
+	}
+	return total;
+}
+
+std::map<int, size_t> CommandScheduler::depths(){
+	std::lock_guard<std::mutex> lock(mMutex);
+	std::map<int, size_t> depths;
+	for (std::map<int, Channel>::iterator it = mChannels.begin(); it != mChannels.end(); ++it){
+		depths[it->first] = it->second.queue.size();
+	}
+	return depths;
+}
+
+size_t CommandScheduler::parkedDepth(){
+	std::lock_guard<std::mutex> lock(mMutex);
+	size_t total = 0;
+	for (std::map<ProvisionKey, std::deque<Pending> >::iterator it = mParked.begin(); it != mParked.end(); ++it){
+		total += it->second.size();
+	}
+	return total;
+}
@@ -0,0 +1,112 @@
+#ifndef COMMAND_QUEUE_H
+#define COMMAND_QUEUE_H
+
+#include "ncl.h"
+#include "sessions.h"
+
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+
+/*
+A command that takes a Nymi's command channel, e.g. nclSign or nclGetRssi.
+Receives the handle of the Nymi it was queued for and returns what the NCL call returned.
+*/
+typedef std::function<NclBool(int nymiHandle)> NclCommand;
+
+/*
+Per-Nymi command channel scheduler.
+Each Nymi has a single command channel, so issuing a second command before the first one's
+completion event arrives fails with NCL_ERROR_BUSY. The scheduler keeps one FIFO per handle and
+dispatches the next command from inside the callback the moment the completion event of the
+previous one is delivered. Different handles never wait on each other.
+*/
+class CommandScheduler{
+public:
+	CommandScheduler();
+
+	/*
+	Queues a command for a Nymi and dispatches it right away if the channel is free
+	@param[in] nymiHandle handle of the Nymi the command is for
+	@param[in] completion event type that signals the command finished and the channel is free again
+	@param[in] command function issuing the NCL call
+	@param[in] name short label used in logs, e.g. "rssi"
+	*/
+	void submit(int nymiHandle, NclEventType completion, NclCommand command, const char* name);
+
+	/*
+	Feeds an event from the NCL callback. Completion events free the channel and dispatch the next command.
+	*/
+	void onEvent(const NclEvent& event);
+
+	/*
+	Drops every queued command for a Nymi, e.g. after it disconnected
+	*/
+	void drop(int nymiHandle);
+
+	/*
+	Moves a Nymi's queued commands aside, keyed by its session's provision, because its handle is
+	about to become invalid. The command in flight is kept since its completion will never arrive.
+	*/
+	void park(int nymiHandle, const ProvisionKey& provision);
+
+	/*
+	Parks the commands of every handle bound to one of the sessions and drops the rest
+	@param[in] sessions sessions as they were bound before the handles became invalid
+	*/
+	void parkAll(const std::vector<Session>& sessions);
+
+	/*
+	Moves the commands parked for a provision onto the channel of its new handle and dispatches them
+	*/
+	void resume(const ProvisionKey& provision, int nymiHandle);
+
+	/*
+	Retries every channel whose head command is waiting after NCL_ERROR_BUSY
+	*/
+	void retryStalled();
+
+	/*
+	Number of commands queued (including the one in flight) for a Nymi
+	*/
+	size_t depth(int nymiHandle);
+
+	/*
+	Number of commands queued over all Nymis
+	*/
+	size_t totalDepth();
+
+	/*
+	Number of commands queued for each Nymi that has any
+	*/
+	std::map<int, size_t> depths();
+
+	/*
+	Number of commands parked over all provisions
+	*/
+	size_t parkedDepth();
+
+private:
+	struct Pending{
+		NclEventType completion;
+		NclCommand command;
+		const char* name;
+	};
+	struct Channel{
+		Channel() : busy(false), awaiting(NCL_EVENT_ANY){}
+		std::deque<Pending> queue; //front is in flight while busy
+		bool busy; //a command was issued and its completion hasn't arrived yet
+		NclEventType awaiting; //completion event of the command in flight
+	};
+
+	void dispatch(int nymiHandle);
+
+	std::mutex mMutex;
+	std::map<int, Channel> mChannels;
+	std::map<ProvisionKey, std::deque<Pending> > mParked;
+};
+
+extern CommandScheduler gScheduler; //Global command scheduler shared by the main loop and the callback
+
+#endif
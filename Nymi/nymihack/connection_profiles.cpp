@@ -0,0 +1,77 @@
+#include "connection_profiles.h"
+#include "ncl.h"
+#include "logger.h"
+
+#include <mutex>
+
+static std::mutex gHintMutex;
+static bool gHinted = false; //gHintedParams holds what the NCL was last told
+static ConnectionParams gHintedParams;
+static bool gPinned = false;
+
+ConnectionParams connectionParams(ConnectionProfile profile){
+	ConnectionParams params;
+	switch (profile){
+	case PROFILE_VALIDATE:
+		params.intervalMin = 6; //7.5ms
+		params.intervalMax = 12; //15ms
+		params.timeout = 200; //2s
+		params.latency = 0;
+		break;
+	case PROFILE_STREAM:
+		params.intervalMin = 24; //30ms
+		params.intervalMax = 40; //50ms
+		params.timeout = 600; //6s
+		params.latency = 0;
+		break;
+	default:
+		params.intervalMin = 8; //10ms
+		params.intervalMax = 500; //625ms
+		params.timeout = 300; //3s
+		params.latency = 10;
+		break;
+	}
+	return params;
+}
+
+const char* connectionProfileName(ConnectionProfile profile){
+	switch (profile){
+	case PROFILE_VALIDATE: return "validate";
+	case PROFILE_STREAM: return "stream";
+	default: return "default";
+	}
+}
+
+static bool sameParams(const ConnectionParams& a, const ConnectionParams& b){
+	return a.intervalMin == b.intervalMin && a.intervalMax == b.intervalMax && a.timeout == b.timeout && a.latency == b.latency;
+}
+
+//Caller holds gHintMutex
+static bool hintLocked(const ConnectionParams& params){
+	if (gHinted && sameParams(params, gHintedParams)) return true;
+	bool accepted = nclHintConnectionParams(params.intervalMin, params.intervalMax, params.timeout, params.latency) == NCL_TRUE;
+	if (!accepted){
+		gLog.log("log: connection parameters {}-{}/{}/{} not guaranteed", params.intervalMin, params.intervalMax, params.timeout, params.latency);
+	}
+	gHinted = true;
+	gHintedParams = params;
+	return accepted;
+}
+
+bool hintConnection(ConnectionProfile profile){
+	std::lock_guard<std::mutex> lock(gHintMutex);
+	if (gPinned) return true;
+	return hintLocked(connectionParams(profile));
+}
+
+bool pinConnectionParams(const ConnectionParams* params){
+	std::lock_guard<std::mutex> lock(gHintMutex);
+	gPinned = params != NULL;
+	if (!params) return true;
+	return hintLocked(*params);
+}
+
+void resetConnectionHint(){
+	std::lock_guard<std::mutex> lock(gHintMutex);
+	gHinted = false;
+}
@@ -0,0 +1,46 @@
+#ifndef CONNECTION_PROFILES_H
+#define CONNECTION_PROFILES_H
+
+/*
+BLE connection parameters, in the units nclHintConnectionParams takes:
+intervals in 1.25ms, supervision timeout in 10ms, latency in connection events
+*/
+struct ConnectionParams{
+	unsigned intervalMin;
+	unsigned intervalMax;
+	unsigned timeout;
+	unsigned latency;
+};
+
+/*
+Connection parameter profiles, picked per operation before a connection is made
+*/
+enum ConnectionProfile{
+	PROFILE_DEFAULT, //NCL defaults: 10-625ms interval, 3s timeout, latency 10
+	PROFILE_VALIDATE, //short interval, no slave latency: validate and sign bursts finish in few round trips
+	PROFILE_STREAM //longer interval and timeout for long-lived ECG streams, no slave latency so samples aren't delayed
+};
+
+ConnectionParams connectionParams(ConnectionProfile profile);
+const char* connectionProfileName(ConnectionProfile profile);
+
+/*
+Hints the parameters of a profile for the next connection.
+The NCL call is skipped if the same parameters are already hinted, and nothing is hinted while pinned.
+@return false if the NCL didn't guarantee the parameters
+*/
+bool hintConnection(ConnectionProfile profile);
+
+/*
+Pins explicit parameters for every following connection, overriding profiles. Used by the sweep benchmark.
+@param[in] params parameters to pin, or NULL to go back to profiles
+@return false if the NCL didn't guarantee the parameters
+*/
+bool pinConnectionParams(const ConnectionParams* params);
+
+/*
+Forgets what was hinted, e.g. after an NCL reinit, so the next hint is sent again
+*/
+void resetConnectionHint();
+
+#endif
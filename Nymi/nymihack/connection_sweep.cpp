@@ -0,0 +1,178 @@
+#include "connection_sweep.h"
+#include "clock.h"
+#include "command_queue.h"
+#include "logger.h"
+#include "metrics.h"
+#include "nea.h"
+
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+ConnectionSweep gSweep;
+
+//Nominal ECG rate of the Nymi. Events carry NCL_ECG_SAMPLES_PER_EVENT samples each.
+static const unsigned kEcgSamplesPerSecond = 250;
+
+//Parameter sets swept, from tight to relaxed, followed by the NCL defaults
+static const ConnectionParams kSweep[] = {
+	{ 6, 12, 200, 0 },
+	{ 12, 24, 200, 0 },
+	{ 24, 40, 400, 0 },
+	{ 40, 80, 400, 0 },
+	{ 80, 160, 600, 0 },
+	{ 24, 40, 400, 4 },
+	{ 8, 500, 300, 10 }
+};
+
+ConnectionSweep::ConnectionSweep() :
+	mStreamSeconds(0), mRunning(false), mStopRequested(false), mSeen(NCL_EVENT_NOTIFIED + 1, 0),
+	mHandle(-1), mFoundAt(0), mValidatedAt(0), mEcgEvents(0){}
+
+ConnectionSweep::~ConnectionSweep(){
+	stop();
+}
+
+bool ConnectionSweep::start(std::function<bool()> startFinding, unsigned streamSeconds){
+	std::lock_guard<std::mutex> lock(mMutex);
+	if (mRunning) return false;
+	if (mThread.joinable()) mThread.join(); //previous sweep finished on its own
+	mStartFinding = startFinding;
+	mStreamSeconds = streamSeconds;
+	mRunning = true;
+	mStopRequested = false;
+	mResults.clear();
+	mThread = std::thread(&ConnectionSweep::run, this);
+	return true;
+}
+
+void ConnectionSweep::stop(){
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mStopRequested = true;
+	}
+	mWake.notify_all();
+	if (mThread.joinable()) mThread.join();
+}
+
+bool ConnectionSweep::running(){
+	std::lock_guard<std::mutex> lock(mMutex);
+	return mRunning;
+}
+
+void ConnectionSweep::onEvent(const NclEvent& event){
+	std::lock_guard<std::mutex> lock(mMutex);
+	if (!mRunning) return;
+	switch (event.type){
+	case NCL_EVENT_FIND:
+	case NCL_EVENT_DETECTION:
+		//The validation is requested from the scan event that picks the nearest Nymi, and scanning
+		//stops right there, so the last scan event marks when the validation started
+		if (mHandle == -1) mFoundAt = monotonicMicros();
+		return;
+	case NCL_EVENT_VALIDATION:
+		if (mHandle != -1) return;
+		mHandle = event.validation.nymiHandle;
+		mValidatedAt = monotonicMicros();
+		break;
+	case NCL_EVENT_ECG:
+		if (event.ecg.nymiHandle == mHandle) ++mEcgEvents;
+		return; //no one waits on single samples
+	default:
+		break;
+	}
+	if ((unsigned)event.type < mSeen.size()) ++mSeen[event.type];
+	mWake.notify_all();
+}
+
+/*
+Waits until an event of the given type arrives after the call
+@return false on timeout or when the sweep is stopped
+*/
+bool ConnectionSweep::waitFor(std::unique_lock<std::mutex>& lock, NclEventType type, unsigned timeoutMillis){
+	unsigned seen = mSeen[type];
+	return mWake.wait_for(lock, std::chrono::milliseconds(timeoutMillis), [&]{ return mStopRequested || mSeen[type] != seen; }) && !mStopRequested;
+}
+
+/*
+Identification sink while the sweep runs: its validations are measurements, not patients at the desk
+*/
+static void sweepIdentified(int nymiHandle, bool strong){
+	gLog.log("log: sweep validated Nymi {}{}", nymiHandle, strong ? " (strong find)" : "");
+}
+
+void ConnectionSweep::run(){
+	IdentifiedHandler identified = gIdentifiedHandler.exchange(sweepIdentified);
+	std::unique_lock<std::mutex> lock(mMutex);
+	for (size_t i = 0; i < sizeof(kSweep) / sizeof(kSweep[0]) && !mStopRequested; ++i){
+		Result result;
+		result.params = kSweep[i];
+		result.validated = false;
+		result.validationMillis = 0;
+		result.ecgEvents = 0;
+		result.ecgExpected = mStreamSeconds * kEcgSamplesPerSecond / NCL_ECG_SAMPLES_PER_EVENT;
+
+		mHandle = -1;
+		lock.unlock();
+		pinConnectionParams(&kSweep[i]);
+		bool finding = mStartFinding();
+		lock.lock();
+		if (!finding || !waitFor(lock, NCL_EVENT_VALIDATION, 30000)){
+			gLog.log("log: sweep point {} didn't validate", i);
+			mResults.push_back(result);
+			continue;
+		}
+		result.validated = true;
+		result.validationMillis = (mValidatedAt - mFoundAt) / 1000.0;
+		int nymiHandle = mHandle;
+
+		lock.unlock();
+		gScheduler.submit(nymiHandle, NCL_EVENT_ECG_START, nclStartEcgStream, "ecg start");
+		lock.lock();
+		if (waitFor(lock, NCL_EVENT_ECG_START, 5000)){
+			mEcgEvents = 0;
+			mWake.wait_for(lock, std::chrono::seconds(mStreamSeconds), [this]{ return mStopRequested; });
+			result.ecgEvents = mEcgEvents;
+			lock.unlock();
+			gScheduler.submit(nymiHandle, NCL_EVENT_ECG_STOP, nclStopEcgStream, "ecg stop");
+			lock.lock();
+			waitFor(lock, NCL_EVENT_ECG_STOP, 5000);
+		}
+		mResults.push_back(result);
+
+		lock.unlock();
+		gMetrics.checkCall(nclDisconnect(nymiHandle));
+		lock.lock();
+		waitFor(lock, NCL_EVENT_DISCONNECTION, 5000);
+	}
+	lock.unlock();
+	pinConnectionParams(NULL);
+	gIdentifiedHandler.store(identified);
+	lock.lock();
+	report();
+	mRunning = false;
+}
+
+void ConnectionSweep::report(){
+	std::ofstream csv("connection_sweep.csv", std::ios::app);
+	std::cout << "interval(1.25ms)  timeout(10ms)  latency  validation(ms)  ecg events  ecg loss\n";
+	for (size_t i = 0; i < mResults.size(); ++i){
+		const Result& r = mResults[i];
+		double loss = 0;
+		if (r.ecgExpected > 0 && r.ecgEvents < r.ecgExpected) loss = 1.0 - (double)r.ecgEvents / r.ecgExpected;
+		std::ostringstream interval;
+		interval << r.params.intervalMin << "-" << r.params.intervalMax;
+		std::cout << std::left << std::setw(18) << interval.str() << std::setw(15) << r.params.timeout << std::setw(9) << r.params.latency;
+		if (r.validated){
+			std::cout << std::fixed << std::setprecision(1) << std::setw(16) << r.validationMillis << std::setw(12) << r.ecgEvents << loss * 100 << "%\n";
+		}
+		else{
+			std::cout << "not validated\n";
+		}
+		csv << r.params.intervalMin << "," << r.params.intervalMax << "," << r.params.timeout << "," << r.params.latency << ","
+			<< (r.validated ? 1 : 0) << "," << r.validationMillis << "," << r.ecgEvents << "," << r.ecgExpected << "\n";
+	}
+	std::cout.unsetf(std::ios::floatfield | std::ios::adjustfield);
+}
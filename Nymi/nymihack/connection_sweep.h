@@ -0,0 +1,75 @@
+#ifndef CONNECTION_SWEEP_H
+#define CONNECTION_SWEEP_H
+
+#include "connection_profiles.h"
+#include "ncl.h"
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+Benchmark that sweeps BLE connection parameters against a provisioned Nymi.
+For every parameter set it finds and validates the Nymi, measuring validation latency,
+then streams ECG for a while and compares the number of ECG events with the nominal rate.
+Results are printed as a table and appended to connection_sweep.csv.
+While it runs, validations bypass onIdentified, so they aren't published as patients.
+*/
+class ConnectionSweep{
+public:
+	ConnectionSweep();
+	~ConnectionSweep();
+
+	/*
+	Starts the sweep on its own thread
+	@param[in] startFinding starts finding the provisioned Nymis, returns false on failure
+	@param[in] streamSeconds how long to stream ECG for each parameter set
+	@return false if a sweep is already running
+	*/
+	bool start(std::function<bool()> startFinding, unsigned streamSeconds);
+
+	/*
+	Aborts a running sweep and waits for its thread
+	*/
+	void stop();
+
+	/*
+	Feeds events from the NCL callback
+	*/
+	void onEvent(const NclEvent& event);
+
+	bool running();
+
+private:
+	struct Result{
+		ConnectionParams params;
+		bool validated;
+		double validationMillis; //validation request to NCL_EVENT_VALIDATION
+		unsigned ecgEvents;
+		unsigned ecgExpected;
+	};
+
+	void run();
+	bool waitFor(std::unique_lock<std::mutex>& lock, NclEventType type, unsigned timeoutMillis);
+	void report();
+
+	std::mutex mMutex;
+	std::condition_variable mWake;
+	std::thread mThread;
+	std::function<bool()> mStartFinding;
+	unsigned mStreamSeconds;
+	bool mRunning;
+	bool mStopRequested;
+	std::vector<unsigned> mSeen; //events seen per NclEventType, for waitFor
+	int mHandle;
+	long long mFoundAt; //last scan event before the validation
+	long long mValidatedAt;
+	unsigned mEcgEvents;
+	std::vector<Result> mResults;
+};
+
+extern ConnectionSweep gSweep; //Global connection parameter sweep
+
+#endif
@@ -0,0 +1,138 @@
+#include "continuous_finder.h"
+#include "clock.h"
+#include "command_queue.h"
+#include "proximity.h"
+#include "logger.h"
+#include "metrics.h"
+#include "records.h"
+
+ContinuousFinder gContinuousFinder;
+
+static const size_t kMaxConnections = 3; //simultaneous validations
+static const long long kDedupMicros = 5LL * 60 * 1000000; //a patient is identified at most once per 5 minutes
+static const long long kSlotTimeoutMicros = 15LL * 1000000; //give up on a validation that never completed
+
+ContinuousFinder::ContinuousFinder() : mEnabled(false){}
+
+void ContinuousFinder::setIdentifier(std::function<void(int, const ProvisionKey&, bool)> identify){
+	std::lock_guard<std::mutex> lock(mMutex);
+	mIdentify = identify;
+}
+
+void ContinuousFinder::setEnabled(bool enabled){
+	std::lock_guard<std::mutex> lock(mMutex);
+	mEnabled = enabled;
+}
+
+bool ContinuousFinder::enabled(){
+	std::lock_guard<std::mutex> lock(mMutex);
+	return mEnabled;
+}
+
+/*
+Gives up on validations that never completed. Their slots stay taken until the NCL reports the
+disconnection, or for another kSlotTimeoutMicros if it never does, so the connection cap holds.
+@param[out] abandoned handles to disconnect, without the lock
+*/
+void ContinuousFinder::expire(long long now, std::vector<int>& abandoned){
+	for (std::map<int, Slot>::iterator it = mInFlight.begin(); it != mInFlight.end();){
+		if (now - it->second.startedAt <= kSlotTimeoutMicros){
+			++it;
+		}
+		else if (it->second.abandoned || it->second.identified){
+			gLog.log("log: Nymi {} never reported its disconnection, its slot is freed", it->first);
+			mInFlight.erase(it++);
+		}
+		else{
+			gLog.log("log: validation of Nymi {} timed out", it->first);
+			it->second.abandoned = true;
+			it->second.startedAt = now;
+			abandoned.push_back(it->first);
+			++it;
+		}
+	}
+	for (std::map<ProvisionKey, long long>::iterator it = mIdentifiedAt.begin(); it != mIdentifiedAt.end();){
+		if (now - it->second > kDedupMicros) mIdentifiedAt.erase(it++);
+		else ++it;
+	}
+}
+
+bool ContinuousFinder::admit(const ProvisionKey& provision){
+	std::lock_guard<std::mutex> lock(mMutex);
+	std::map<ProvisionKey, long long>::iterator identified = mIdentifiedAt.find(provision);
+	if (identified != mIdentifiedAt.end() && monotonicMicros() - identified->second <= kDedupMicros) return false;
+	//The same provision can show up under a new handle after a MAC rotation
+	for (std::map<int, Slot>::iterator it = mInFlight.begin(); it != mInFlight.end(); ++it){
+		if (it->second.provision == provision) return false;
+	}
+	return true;
+}
+
+void ContinuousFinder::pump(){
+	std::unique_lock<std::mutex> lock(mMutex);
+	if (!mEnabled) return;
+	std::vector<int> abandoned;
+	expire(monotonicMicros(), abandoned);
+	if (!abandoned.empty()){
+		lock.unlock();
+		for (size_t i = 0; i < abandoned.size(); ++i){
+			//Its queued commands and prefetched record would otherwise outlive the connection
+			gScheduler.drop(abandoned[i]);
+			gRecords.dropPrefetch(abandoned[i]);
+			if (!gMetrics.checkCall(nclDisconnect(abandoned[i]))) gLog.log("log: disconnecting timed out Nymi {} failed", abandoned[i]);
+		}
+		lock.lock();
+		if (!mEnabled) return;
+	}
+	while (mInFlight.size() < kMaxConnections){
+		int nymiHandle;
+		ProvisionKey provision;
+		bool strong;
+		if (!gProximity.takeNearest(nymiHandle, provision, strong)) return;
+		if (mIdentifiedAt.count(provision) || mInFlight.count(nymiHandle)) continue;
+		if (strong){
+			//Needs no connection, so it doesn't take a slot
+			mIdentifiedAt[provision] = monotonicMicros();
+		}
+		else{
+			Slot slot;
+			slot.provision = provision;
+			slot.startedAt = monotonicMicros();
+			slot.identified = false;
+			slot.abandoned = false;
+			mInFlight[nymiHandle] = slot;
+		}
+		std::function<void(int, const ProvisionKey&, bool)> identify = mIdentify;
+		lock.unlock();
+		if (identify) identify(nymiHandle, provision, strong);
+		lock.lock();
+	}
+}
+
+void ContinuousFinder::onEvent(const NclEvent& event){
+	if (event.type == NCL_EVENT_VALIDATION){
+		int nymiHandle = event.validation.nymiHandle;
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			std::map<int, Slot>::iterator it = mInFlight.find(nymiHandle);
+			if (it == mInFlight.end()) return;
+			it->second.identified = true;
+			it->second.startedAt = monotonicMicros(); //now waiting for the disconnection
+			mIdentifiedAt[it->second.provision] = it->second.startedAt;
+		}
+		//The slot frees up once the disconnection arrives
+		if (!gMetrics.checkCall(nclDisconnect(nymiHandle))) gLog.log("log: disconnecting identified Nymi {} failed", nymiHandle);
+	}
+	else if (event.type == NCL_EVENT_DISCONNECTION){
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			if (!mInFlight.erase(event.disconnection.nymiHandle)) return;
+		}
+		pump();
+	}
+}
+
+size_t ContinuousFinder::inFlight(){
+	std::lock_guard<std::mutex> lock(mMutex);
+	return mInFlight.size();
+}
@@ -0,0 +1,69 @@
+#ifndef CONTINUOUS_FINDER_H
+#define CONTINUOUS_FINDER_H
+
+#include "ncl.h"
+#include "sessions.h"
+
+#include <functional>
+#include <map>
+#include <mutex>
+#include <vector>
+
+/*
+Continuous finding for busy entrances: the scan keeps running after a find and found Nymis go to a
+validation queue that needs no operator.
+- Repeated finds of the same provision are dropped while it is queued or being validated, and for a
+  while after it was identified, so a patient sitting in the waiting room isn't validated again.
+- The queue is served nearest first (see ProximityTracker) with a bounded number of simultaneous
+  connections. Once a Nymi is identified it is disconnected to free its slot for the next patient.
+*/
+class ContinuousFinder{
+public:
+	ContinuousFinder();
+
+	/*
+	Sets the function that starts identifying a picked Nymi: validates it, or identifies it right away for strong finds
+	*/
+	void setIdentifier(std::function<void(int nymiHandle, const ProvisionKey& provision, bool strong)> identify);
+
+	void setEnabled(bool enabled);
+	bool enabled();
+
+	/*
+	Checks whether a found provision should be queued
+	@return false if it is already being validated or was identified within the deduplication window
+	*/
+	bool admit(const ProvisionKey& provision);
+
+	/*
+	Starts identifying the nearest queued Nymis while connection slots are free
+	*/
+	void pump();
+
+	/*
+	Feeds events from the NCL callback: validations and disconnections free slots
+	*/
+	void onEvent(const NclEvent& event);
+
+	size_t inFlight();
+
+private:
+	struct Slot{
+		ProvisionKey provision;
+		long long startedAt; //monotonicMicros() when the validation was requested, or the disconnection
+		bool identified; //validated and being disconnected
+		bool abandoned; //timed out and being disconnected
+	};
+
+	void expire(long long now, std::vector<int>& abandoned); //caller holds mMutex
+
+	std::mutex mMutex;
+	std::function<void(int, const ProvisionKey&, bool)> mIdentify;
+	bool mEnabled;
+	std::map<int, Slot> mInFlight; //by handle
+	std::map<ProvisionKey, long long> mIdentifiedAt; //monotonicMicros() of the last identification per provision
+};
+
+extern ContinuousFinder gContinuousFinder; //Global continuous finding queue
+
+#endif
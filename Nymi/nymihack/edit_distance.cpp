@@ -0,0 +1,113 @@
+#include "edit_distance.h"
+
+#include <algorithm>
+#include <vector>
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__SSE2__)
+#include <emmintrin.h>
+#define EDIT_DISTANCE_SSE2
+#endif
+
+static const size_t kLanes = 8; //16 bit lanes in an SSE2 register
+
+static unsigned char foldCase(unsigned char c){
+	return c >= 'A' && c <= 'Z' ? (unsigned char)(c | 0x20) : c;
+}
+
+unsigned boundedEditDistance(const char* a, size_t aLength, const char* b, size_t bLength, unsigned bound){
+	if ((aLength > bLength ? aLength - bLength : bLength - aLength) > bound) return bound + 1;
+	unsigned rows[2 * (kEditDistanceMaxLength + 1)];
+	std::vector<unsigned> longRows; //only for candidates past kEditDistanceMaxLength, which are rare
+	if (bLength > kEditDistanceMaxLength) longRows.resize(2 * (bLength + 1));
+	unsigned* previous = longRows.empty() ? rows : longRows.data();
+	unsigned* current = previous + bLength + 1;
+	for (size_t j = 0; j <= bLength; ++j) previous[j] = (unsigned)j;
+	for (size_t i = 1; i <= aLength; ++i){
+		current[0] = (unsigned)i;
+		unsigned rowMin = current[0];
+		for (size_t j = 1; j <= bLength; ++j){
+			unsigned cost = foldCase(a[i - 1]) == foldCase(b[j - 1]) ? 0 : 1;
+			current[j] = std::min(std::min(previous[j] + 1, current[j - 1] + 1), previous[j - 1] + cost);
+			rowMin = std::min(rowMin, current[j]);
+		}
+		if (rowMin > bound) return bound + 1;
+		std::swap(previous, current);
+	}
+	return std::min(previous[bLength], bound + 1);
+}
+
+#if defined(EDIT_DISTANCE_SSE2)
+/*
+Up to kLanes candidates at once. Lanes past count, and columns past a candidate's length, hold
+padding that never reaches the cells that are read back.
+*/
+static void distanceBatch(const char* query, size_t queryLength, const char* const* candidates, const size_t* lengths, size_t count,
+	unsigned bound, unsigned* distances){
+	queryLength = std::min(queryLength, kEditDistanceMaxLength);
+	size_t width = 0;
+	short laneLengths[kLanes];
+	for (size_t lane = 0; lane < kLanes; ++lane){
+		laneLengths[lane] = lane < count ? (short)std::min(lengths[lane], kEditDistanceMaxLength) : 0;
+		width = std::max(width, (size_t)laneLengths[lane]);
+	}
+
+	//Column j of the candidates, one byte per lane widened to 16 bits; -1 never equals a query byte
+	__m128i columns[kEditDistanceMaxLength];
+	for (size_t j = 0; j < width; ++j){
+		short bytes[kLanes];
+		for (size_t lane = 0; lane < kLanes; ++lane){
+			bytes[lane] = (short)(j < (size_t)laneLengths[lane] ? foldCase(candidates[lane][j]) : -1);
+		}
+		columns[j] = _mm_loadu_si128((const __m128i*)bytes);
+	}
+
+	__m128i rows[2][kEditDistanceMaxLength + 1];
+	__m128i* previous = rows[0];
+	__m128i* current = rows[1];
+	const __m128i one = _mm_set1_epi16(1);
+	for (size_t j = 0; j <= width; ++j) previous[j] = _mm_set1_epi16((short)j);
+	const __m128i limit = _mm_set1_epi16((short)bound);
+	bool allPast = false;
+	for (size_t i = 1; i <= queryLength && !allPast; ++i){
+		__m128i letter = _mm_set1_epi16((short)foldCase(query[i - 1]));
+		current[0] = _mm_set1_epi16((short)i);
+		__m128i rowMin = current[0];
+		for (size_t j = 1; j <= width; ++j){
+			__m128i cost = _mm_andnot_si128(_mm_cmpeq_epi16(letter, columns[j - 1]), one);
+			__m128i cell = _mm_min_epi16(_mm_add_epi16(previous[j], one), _mm_add_epi16(current[j - 1], one));
+			cell = _mm_min_epi16(cell, _mm_add_epi16(previous[j - 1], cost));
+			current[j] = cell;
+			rowMin = _mm_min_epi16(rowMin, cell);
+		}
+		//Every lane past the bound on this whole row: it can only grow from here
+		allPast = _mm_movemask_epi8(_mm_cmpgt_epi16(rowMin, limit)) == 0xffff;
+		std::swap(previous, current);
+	}
+	for (size_t lane = 0; lane < count; ++lane){
+		if (allPast){
+			distances[lane] = bound + 1;
+			continue;
+		}
+		short cells[kLanes];
+		_mm_storeu_si128((__m128i*)cells, previous[laneLengths[lane]]);
+		distances[lane] = std::min((unsigned)cells[lane], bound + 1);
+	}
+}
+#endif
+
+void boundedEditDistances(const char* query, size_t queryLength, const char* const* candidates, const size_t* lengths, size_t count,
+	unsigned bound, unsigned* distances){
+#if defined(EDIT_DISTANCE_SSE2)
+	if (queryLength <= kEditDistanceMaxLength){
+		for (size_t start = 0; start < count; start += kLanes){
+			distanceBatch(query, queryLength, candidates + start, lengths + start, std::min(kLanes, count - start), bound, distances + start);
+		}
+		//The batches saw only the first kEditDistanceMaxLength bytes of longer candidates
+		for (size_t i = 0; i < count; ++i){
+			if (lengths[i] > kEditDistanceMaxLength) distances[i] = boundedEditDistance(query, queryLength, candidates[i], lengths[i], bound);
+		}
+		return;
+	}
+#endif
+	for (size_t i = 0; i < count; ++i) distances[i] = boundedEditDistance(query, queryLength, candidates[i], lengths[i], bound);
+}
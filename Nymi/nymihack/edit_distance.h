@@ -0,0 +1,29 @@
+#ifndef EDIT_DISTANCE_H
+#define EDIT_DISTANCE_H
+
+#include <cstddef>
+
+static const size_t kEditDistanceMaxLength = 32; //longest strings compared with SIMD, longer ones are compared one at a time
+
+/*
+Levenshtein distances from a query to many candidates, capped at a bound.
+With SSE2 eight candidates are computed at once, one per 16 bit lane, row by row of the dynamic
+programming matrix; a batch stops as soon as every cell of a row is past the bound, since no
+alignment can get back under it. Without SSE2, or past kEditDistanceMaxLength bytes, each candidate is
+computed on its own the same way.
+@param[in] query query bytes; ASCII letters match regardless of case
+@param[in] candidates candidate strings
+@param[in] lengths candidate lengths
+@param[in] count number of candidates
+@param[in] bound largest distance of interest
+@param[out] distances one per candidate; bound + 1 for every candidate further than bound
+*/
+void boundedEditDistances(const char* query, size_t queryLength, const char* const* candidates, const size_t* lengths, size_t count,
+	unsigned bound, unsigned* distances);
+
+/*
+Single candidate, without SIMD. Same results as boundedEditDistances.
+*/
+unsigned boundedEditDistance(const char* a, size_t aLength, const char* b, size_t bLength, unsigned bound);
+
+#endif
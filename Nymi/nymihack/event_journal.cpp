@@ -0,0 +1,472 @@
+#include "event_journal.h"
+#include "clock.h"
+#include "logger.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+EventJournal gJournal;
+
+static const char kMagic[8] = { 'N', 'C', 'L', 'J', 'R', 'N', 'L', '1' };
+static const unsigned kVersion = 1;
+static const size_t kSegmentBytes = 32 * 1024 * 1024;
+static const unsigned kFlushIntervalMillis = 100;
+static const unsigned kMaxMissingSegments = 4096; //deleted segments skipped looking for the oldest one kept
+static const long long kMaxReplayGapNanos = 60LL * 1000 * 1000 * 1000; //longer gaps are skipped when replaying in real time
+
+struct EventJournal::Segment{
+	std::string path;
+	char* data;
+	size_t capacity;
+	std::atomic<size_t> offset; //next free byte, may run past capacity when the segment fills up
+	size_t flushed; //bytes handed to the OS so far, only touched by the flusher
+#if defined(_WIN32)
+	HANDLE file;
+	HANDLE mapping;
+#else
+	int fd;
+#endif
+};
+
+static size_t pageSize(){
+#if defined(_WIN32)
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return info.dwPageSize;
+#else
+	return (size_t)sysconf(_SC_PAGESIZE);
+#endif
+}
+
+static std::string segmentPath(const std::string& base, unsigned index){
+	std::ostringstream path;
+	path << base << "." << index;
+	return path.str();
+}
+
+static bool fileExists(const std::string& path){
+	std::ifstream file(path.c_str(), std::ios::binary);
+	return file.good();
+}
+
+//Payload sizes, indexed by NclEventType
+static unsigned gPayloadSizes[NCL_EVENT_NOTIFIED + 1];
+
+static bool initPayloadSizes(){
+	gPayloadSizes[NCL_EVENT_ANY] = 0;
+	gPayloadSizes[NCL_EVENT_INIT] = sizeof(NclEventInit);
+	gPayloadSizes[NCL_EVENT_ERROR] = sizeof(NclEventError);
+	gPayloadSizes[NCL_EVENT_DISCOVERY] = sizeof(NclEventDiscovery);
+	gPayloadSizes[NCL_EVENT_FIND] = sizeof(NclEventFind);
+	gPayloadSizes[NCL_EVENT_DETECTION] = sizeof(NclEventDetection);
+	gPayloadSizes[NCL_EVENT_AGREEMENT] = sizeof(NclEventAgreement);
+	gPayloadSizes[NCL_EVENT_PROVISION] = sizeof(NclEventProvision);
+	gPayloadSizes[NCL_EVENT_VALIDATION] = sizeof(NclEventCompletion);
+	gPayloadSizes[NCL_EVENT_DISCONNECTION] = sizeof(NclEventDisconnection);
+	gPayloadSizes[NCL_EVENT_ECG_START] = sizeof(NclEventCompletion);
+	gPayloadSizes[NCL_EVENT_ECG] = sizeof(NclEventEcg);
+	gPayloadSizes[NCL_EVENT_ECG_STOP] = sizeof(NclEventCompletion);
+	gPayloadSizes[NCL_EVENT_VK] = sizeof(NclEventVk);
+	gPayloadSizes[NCL_EVENT_SIG] = sizeof(NclEventSig);
+	gPayloadSizes[NCL_EVENT_GLOBAL_VK] = sizeof(NclEventVk);
+	gPayloadSizes[NCL_EVENT_GLOBAL_SIG] = sizeof(NclEventGlobalSig);
+	gPayloadSizes[NCL_EVENT_CREATED_SK] = sizeof(NclEventCreatedSk);
+	gPayloadSizes[NCL_EVENT_GOT_SK] = sizeof(NclEventGotSk);
+	gPayloadSizes[NCL_EVENT_PRG] = sizeof(NclEventPrg);
+	gPayloadSizes[NCL_EVENT_RSSI] = sizeof(NclEventRssi);
+	gPayloadSizes[NCL_EVENT_FIRMWARE_VERSION] = sizeof(NclEventFirmwareVersion);
+	gPayloadSizes[NCL_EVENT_NOTIFIED] = sizeof(NclEventCompletion);
+	return true;
+}
+
+static const bool gPayloadSizesReady = initPayloadSizes();
+
+unsigned journalPayloadSize(NclEventType type){
+	if ((unsigned)type > NCL_EVENT_NOTIFIED) return 0;
+	return gPayloadSizes[type];
+}
+
+EventJournal::EventJournal() : mCurrent(NULL), mWriters(0), mNextIndex(0), mRunning(false), mAppended(0), mDropped(0){}
+
+EventJournal::~EventJournal(){
+	close();
+}
+
+EventJournal::Segment* EventJournal::createSegment(unsigned index){
+	Segment* segment = new Segment();
+	segment->path = segmentPath(mBase, index);
+	segment->capacity = kSegmentBytes;
+	segment->data = NULL;
+#if defined(_WIN32)
+	segment->file = CreateFileA(segment->path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_NEW, FILE_ATTRIBUTE_NORMAL, NULL);
+	segment->mapping = NULL;
+	if (segment->file != INVALID_HANDLE_VALUE){
+		LARGE_INTEGER size;
+		size.QuadPart = segment->capacity;
+		segment->mapping = CreateFileMappingA(segment->file, NULL, PAGE_READWRITE, size.HighPart, size.LowPart, NULL);
+		if (segment->mapping) segment->data = (char*)MapViewOfFile(segment->mapping, FILE_MAP_WRITE, 0, 0, segment->capacity);
+	}
+	if (!segment->data){
+		if (segment->mapping) CloseHandle(segment->mapping);
+		if (segment->file != INVALID_HANDLE_VALUE) CloseHandle(segment->file);
+		delete segment;
+		return NULL;
+	}
+#else
+	segment->fd = ::open(segment->path.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+	if (segment->fd >= 0 && ftruncate(segment->fd, segment->capacity) == 0){
+		void* data = mmap(NULL, segment->capacity, PROT_READ | PROT_WRITE, MAP_SHARED, segment->fd, 0);
+		if (data != MAP_FAILED) segment->data = (char*)data;
+	}
+	if (!segment->data){
+		if (segment->fd >= 0) ::close(segment->fd);
+		delete segment;
+		return NULL;
+	}
+#endif
+	JournalFileHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, kMagic, sizeof(kMagic));
+	header.version = kVersion;
+	header.headerSize = sizeof(JournalFileHeader);
+	header.createdNanos = monotonicNanos();
+	memcpy(segment->data, &header, sizeof(header));
+	segment->offset = sizeof(JournalFileHeader);
+	segment->flushed = 0;
+	return segment;
+}
+
+/*
+Flushes, unmaps and truncates a segment to the bytes actually written
+*/
+void EventJournal::destroySegment(Segment* segment){
+	size_t used = segment->offset;
+	if (used > segment->capacity) used = segment->capacity;
+#if defined(_WIN32)
+	FlushViewOfFile(segment->data, used);
+	UnmapViewOfFile(segment->data);
+	CloseHandle(segment->mapping);
+	LARGE_INTEGER size;
+	size.QuadPart = used;
+	SetFilePointerEx(segment->file, size, NULL, FILE_BEGIN);
+	SetEndOfFile(segment->file);
+	CloseHandle(segment->file);
+#else
+	msync(segment->data, used, MS_SYNC);
+	munmap(segment->data, segment->capacity);
+	if (ftruncate(segment->fd, used) != 0) gLog.log("log: truncating {} failed", segment->path);
+	::close(segment->fd);
+#endif
+	delete segment;
+}
+
+/*
+Finds the segments of a journal: the oldest ones may have been deleted during the last run
+@param[out] first index of the oldest segment kept
+@return number of segments from first on
+*/
+static unsigned findSegments(const std::string& base, unsigned& first){
+	for (first = 0; first < kMaxMissingSegments; ++first){
+		if (fileExists(segmentPath(base, first))) break;
+	}
+	if (first == kMaxMissingSegments) first = 0;
+	unsigned count = 0;
+	while (fileExists(segmentPath(base, first + count))) ++count;
+	return count;
+}
+
+/*
+Deletes the oldest segments so that, with a new one, at most kMaxJournalSegments remain, and
+renumbers the rest from 0
+@return number of segments left
+*/
+static unsigned pruneSegments(const std::string& base){
+	unsigned first;
+	unsigned count = findSegments(base, first);
+	unsigned drop = count < kMaxJournalSegments ? 0 : count - kMaxJournalSegments + 1;
+	for (unsigned i = 0; i < drop; ++i) remove(segmentPath(base, first + i).c_str());
+	for (unsigned i = drop; i < count; ++i){
+		if (first + drop == 0) break;
+		if (rename(segmentPath(base, first + i).c_str(), segmentPath(base, i - drop).c_str()) != 0){
+			gLog.log("log: renumbering journal segment {} failed", segmentPath(base, first + i));
+			return i - drop; //open() creates the next segment after the last one, never overwriting one
+		}
+	}
+	if (drop > 0) gLog.log("log: {} old journal segments deleted", drop);
+	return count - drop;
+}
+
+bool EventJournal::open(const std::string& base){
+	close();
+	mBase = base;
+	mNextIndex = pruneSegments(mBase);
+	while (fileExists(segmentPath(mBase, mNextIndex))) ++mNextIndex; //never overwrite an older journal
+	Segment* segment = createSegment(mNextIndex++);
+	if (!segment) return false;
+	mCurrent.store(segment);
+	{
+		std::lock_guard<std::mutex> lock(mFlushMutex);
+		mRunning = true;
+	}
+	mFlusher = std::thread(&EventJournal::flushLoop, this);
+	return true;
+}
+
+void EventJournal::close(){
+	{
+		std::lock_guard<std::mutex> lock(mFlushMutex);
+		if (!mRunning) return;
+		mRunning = false;
+	}
+	mFlushWake.notify_all();
+	mFlusher.join();
+
+	std::vector<Segment*> segments;
+	{
+		std::lock_guard<std::mutex> lock(mRollMutex);
+		Segment* segment = mCurrent.exchange(NULL);
+		if (segment) mRetired.push_back(segment);
+		segments.swap(mRetired);
+	}
+	//Not under mRollMutex: an append waiting for it in roll() is one of the writers
+	while (mWriters.load() != 0) std::this_thread::yield();
+	for (size_t i = 0; i < segments.size(); ++i) destroySegment(segments[i]);
+}
+
+void EventJournal::append(const NclEvent& event){
+	unsigned payload = journalPayloadSize(event.type);
+	size_t size = (sizeof(JournalRecordHeader) + payload + 7) & ~(size_t)7;
+	long long timestamp = monotonicNanos();
+	//Never put secrets on disk
+	const NclEvent* source = &event;
+	NclEvent scrubbed;
+	switch (event.type){
+	case NCL_EVENT_PROVISION:
+		scrubbed = event;
+		memset(scrubbed.provision.provision.key, 0, NCL_PROVISION_KEY_SIZE);
+		source = &scrubbed;
+		break;
+	case NCL_EVENT_CREATED_SK:
+		scrubbed = event;
+		memset(scrubbed.createdSk.sk, 0, NCL_SK_SIZE);
+		source = &scrubbed;
+		break;
+	case NCL_EVENT_GOT_SK:
+		scrubbed = event;
+		memset(scrubbed.gotSk.sk, 0, NCL_SK_SIZE);
+		source = &scrubbed;
+		break;
+	default:
+		break;
+	}
+	//Counted before the segment is loaded, so a retired segment outlives every append that saw it
+	mWriters.fetch_add(1);
+	for (;;){
+		Segment* segment = mCurrent.load();
+		if (!segment) break;
+		size_t at = segment->offset.fetch_add(size);
+		if (at + size <= segment->capacity){
+			char* record = segment->data + at;
+			JournalRecordHeader* header = (JournalRecordHeader*)record;
+			header->reserved = 0;
+			header->timestamp = timestamp;
+			memcpy(record + sizeof(JournalRecordHeader), &source->init, payload);
+			std::atomic_thread_fence(std::memory_order_release);
+			*(volatile unsigned*)&header->tag = (unsigned)(size << 16) | (unsigned)event.type; //published last
+			mAppended.fetch_add(1, std::memory_order_relaxed);
+			break;
+		}
+		if (!roll(segment)){
+			mDropped.fetch_add(1, std::memory_order_relaxed);
+			break;
+		}
+	}
+	mWriters.fetch_sub(1);
+}
+
+/*
+Replaces a full segment with a new one. Only the first writer to overflow creates it.
+*/
+bool EventJournal::roll(Segment* full){
+	std::lock_guard<std::mutex> lock(mRollMutex);
+	if (mCurrent.load() != full) return mCurrent.load() != NULL;
+	unsigned index = mNextIndex++;
+	Segment* next = createSegment(index);
+	if (!next) return false;
+	mCurrent.store(next);
+	mRetired.push_back(full);
+	//Keeps kMaxJournalSegments during long runs too; that segment was retired and unmapped long ago
+	if (index >= kMaxJournalSegments) remove(segmentPath(mBase, index - kMaxJournalSegments).c_str());
+	return true;
+}
+
+void EventJournal::flushLoop(){
+	size_t page = pageSize();
+	std::unique_lock<std::mutex> flushLock(mFlushMutex);
+	while (mRunning){
+		mFlushWake.wait_for(flushLock, std::chrono::milliseconds(kFlushIntervalMillis));
+		std::lock_guard<std::mutex> lock(mRollMutex);
+		Segment* segment = mCurrent.load();
+		if (segment){
+			size_t used = segment->offset;
+			if (used > segment->capacity) used = segment->capacity;
+			size_t from = segment->flushed & ~(page - 1);
+			if (used > from){
+#if defined(_WIN32)
+				FlushViewOfFile(segment->data + from, used - from);
+#else
+				msync(segment->data + from, used - from, MS_ASYNC);
+#endif
+				segment->flushed = used;
+			}
+		}
+		//With no append running, none can still hold a segment retired before now: later ones load
+		//the current segment. Rolls happen under mRollMutex, held here, so the list can't grow meanwhile.
+		if (!mRetired.empty() && mWriters.load() == 0){
+			for (size_t i = 0; i < mRetired.size(); ++i) destroySegment(mRetired[i]);
+			mRetired.clear();
+		}
+	}
+}
+
+unsigned long long EventJournal::appended(){
+	return mAppended.load();
+}
+
+unsigned long long EventJournal::dropped(){
+	return mDropped.load();
+}
+
+/*
+Read-only mapping of a journal segment
+*/
+struct JournalReader{
+	const char* data;
+	size_t size;
+#if defined(_WIN32)
+	HANDLE file;
+	HANDLE mapping;
+#else
+	int fd;
+#endif
+
+	JournalReader() : data(NULL), size(0){}
+
+	bool open(const std::string& path){
+#if defined(_WIN32)
+		file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (file == INVALID_HANDLE_VALUE) return false;
+		LARGE_INTEGER fileSize;
+		GetFileSizeEx(file, &fileSize);
+		size = (size_t)fileSize.QuadPart;
+		mapping = size ? CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL) : NULL;
+		if (mapping) data = (const char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+		if (!data){
+			if (mapping) CloseHandle(mapping);
+			CloseHandle(file);
+			return false;
+		}
+#else
+		fd = ::open(path.c_str(), O_RDONLY);
+		if (fd < 0) return false;
+		struct stat info;
+		if (fstat(fd, &info) != 0 || info.st_size == 0){
+			::close(fd);
+			return false;
+		}
+		size = (size_t)info.st_size;
+		void* mapped = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+		if (mapped == MAP_FAILED){
+			::close(fd);
+			return false;
+		}
+		data = (const char*)mapped;
+#endif
+		return size >= sizeof(JournalFileHeader) && memcmp(data, kMagic, sizeof(kMagic)) == 0;
+	}
+
+	~JournalReader(){
+		if (!data) return;
+#if defined(_WIN32)
+		UnmapViewOfFile(data);
+		CloseHandle(mapping);
+		CloseHandle(file);
+#else
+		munmap((void*)data, size);
+		::close(fd);
+#endif
+	}
+};
+
+/*
+Replays one segment
+@param[in,out] firstTimestamp timestamp of the first replayed event, 0 before any
+@param[in,out] lastTimestamp timestamp of the previously replayed event
+@param[in,out] startedAt monotonicNanos() when the first event was replayed
+*/
+static unsigned long long replaySegment(const std::string& path, NclCallback handler, void* userData, bool realtime, long long& firstTimestamp, long long& lastTimestamp, long long& startedAt){
+	JournalReader reader;
+	if (!reader.open(path)){
+		gLog.log("log: {} is not a journal", path);
+		return 0;
+	}
+	const JournalFileHeader* header = (const JournalFileHeader*)reader.data;
+	unsigned long long replayed = 0;
+	size_t at = header->headerSize;
+	while (at + sizeof(JournalRecordHeader) <= reader.size){
+		const JournalRecordHeader* record = (const JournalRecordHeader*)(reader.data + at);
+		unsigned size = record->tag >> 16;
+		NclEventType type = (NclEventType)(record->tag & 0xffff);
+		if (size < sizeof(JournalRecordHeader) || at + size > reader.size) break; //end of the written records
+		unsigned payload = journalPayloadSize(type);
+		if (sizeof(JournalRecordHeader) + payload > size) break;
+
+		NclEvent event;
+		memset(&event, 0, sizeof(event));
+		event.type = type;
+		memcpy(&event.init, reader.data + at + sizeof(JournalRecordHeader), payload);
+
+		long long gap = record->timestamp - lastTimestamp;
+		if (firstTimestamp == 0 || gap < 0 || gap > kMaxReplayGapNanos){
+			//First event, or the journal spans several runs of the NEA: restart the clock here
+			firstTimestamp = record->timestamp;
+			startedAt = monotonicNanos();
+		}
+		else if (realtime){
+			long long due = startedAt + (record->timestamp - firstTimestamp);
+			long long wait = due - monotonicNanos();
+			if (wait > 0) std::this_thread::sleep_for(std::chrono::nanoseconds(wait));
+		}
+		lastTimestamp = record->timestamp;
+		handler(event, userData);
+		++replayed;
+		at += size;
+	}
+	return replayed;
+}
+
+unsigned long long replayJournal(const std::string& base, NclCallback handler, void* userData, bool realtime){
+	long long firstTimestamp = 0, lastTimestamp = 0, startedAt = 0;
+	unsigned first;
+	unsigned count = findSegments(base, first);
+	if (count == 0){
+		return replaySegment(base, handler, userData, realtime, firstTimestamp, lastTimestamp, startedAt);
+	}
+	unsigned long long replayed = 0;
+	for (unsigned index = first; index < first + count; ++index){
+		replayed += replaySegment(segmentPath(base, index), handler, userData, realtime, firstTimestamp, lastTimestamp, startedAt);
+	}
+	return replayed;
+}
@@ -0,0 +1,113 @@
+#ifndef EVENT_JOURNAL_H
+#define EVENT_JOURNAL_H
+
+#include "ncl.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+Append-only binary journal of every NclEvent the NCL delivered, so incidents can be replayed.
+
+The journal is a series of segment files <base>.0, <base>.1, ... each memory-mapped and
+preallocated. A segment starts with a JournalFileHeader followed by 8-byte aligned records:
+a JournalRecordHeader (type tag, record size, monotonic timestamp) and the bytes of the event's
+data member for that type. Integers are in host byte order.
+
+Appending from the callback is a fetch_add on the write offset and a memcpy into the mapping;
+the size/type word is stored last, so a reader stops at the first record that isn't complete.
+A background thread flushes dirty pages in batches. Secrets (provision keys and symmetric keys)
+are zeroed in the journal copy. A full segment is unmapped only once no append that could have
+loaded it is still running. At most kMaxJournalSegments segments are kept: each new one deletes
+the one kMaxJournalSegments before it, and opening the journal deletes the oldest and renumbers
+the rest from 0.
+*/
+
+static const unsigned kMaxJournalSegments = 16; //segment files kept, of 32 MB at most each
+
+struct JournalFileHeader{
+	char magic[8]; //"NCLJRNL1"
+	unsigned version;
+	unsigned headerSize; //offset of the first record
+	long long createdNanos; //monotonicNanos() when the segment was created
+	long long reserved;
+};
+
+struct JournalRecordHeader{
+	unsigned tag; //record size in bytes << 16 | NclEventType, 0 past the last record
+	unsigned reserved;
+	long long timestamp; //monotonicNanos() when the event was delivered
+};
+
+class EventJournal{
+public:
+	EventJournal();
+	~EventJournal();
+
+	/*
+	Starts journaling into a new segment after the last existing one
+	@param[in] base path of the journal, segments are named base.0, base.1, ...
+	@return false if the segment couldn't be created and mapped
+	*/
+	bool open(const std::string& base);
+
+	/*
+	Flushes and closes the journal. Segments are truncated to their used size.
+	*/
+	void close();
+
+	/*
+	Appends an event. Cheap enough to call first thing in the NCL callback; a no-op while closed.
+	*/
+	void append(const NclEvent& event);
+
+	unsigned long long appended();
+	unsigned long long dropped(); //events lost because a new segment couldn't be created
+
+private:
+	struct Segment;
+
+	Segment* createSegment(unsigned index);
+	void destroySegment(Segment* segment);
+	bool roll(Segment* full);
+	void flushLoop();
+
+	std::string mBase;
+	std::atomic<Segment*> mCurrent;
+	std::mutex mRollMutex; //taken only when a segment is full
+	std::vector<Segment*> mRetired; //full segments waiting for the appends that may still write into them
+	std::atomic<unsigned> mWriters; //appends in progress, on any segment
+	unsigned mNextIndex;
+
+	std::mutex mFlushMutex;
+	std::condition_variable mFlushWake;
+	std::thread mFlusher;
+	bool mRunning;
+
+	std::atomic<unsigned long long> mAppended;
+	std::atomic<unsigned long long> mDropped;
+};
+
+extern EventJournal gJournal; //Global event journal
+
+/*
+Feeds a journal back through an event handler
+@param[in] base path of the journal as given to EventJournal::open; every segment is replayed in order.
+A single segment file can also be given directly.
+@param[in] handler function receiving the events, e.g. the NEA's event handler
+@param[in] userData passed to the handler
+@param[in] realtime true to keep the recorded spacing between events, false to replay as fast as possible
+@return number of events replayed
+*/
+unsigned long long replayJournal(const std::string& base, NclCallback handler, void* userData, bool realtime);
+
+/*
+Size in bytes of the data member that goes with an event type, 0 for unknown types
+*/
+unsigned journalPayloadSize(NclEventType type);
+
+#endif
@@ -0,0 +1,375 @@
+#include "gzip.h"
+
+#include <algorithm>
+#include <functional>
+#include <queue>
+#include <vector>
+
+static const unsigned kWindowBytes = 32768;
+static const unsigned kMinMatch = 3;
+static const unsigned kMaxMatch = 258;
+static const unsigned kHashBits = 15;
+static const unsigned kMaxChain = 128; //candidates tried per position
+static const unsigned kNiceMatch = 128; //a match this long is taken without looking further
+static const unsigned kTooFar = 4096; //3-byte matches further back than this cost more than their literals
+static const size_t kBlockTokens = 1 << 16; //tokens per deflate block, each block getting codes for its own statistics
+
+static const unsigned short kLengthBase[29] = {
+	3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static const unsigned char kLengthExtra[29] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+static const unsigned short kDistanceBase[30] = {
+	1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073,
+	4097, 6145, 8193, 12289, 16385, 24577
+};
+static const unsigned char kDistanceExtra[30] = {
+	0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+static const unsigned char kCodeLengthOrder[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+static unsigned gCrcTable[256];
+
+static bool initCrcTable(){
+	for (unsigned i = 0; i < 256; ++i){
+		unsigned crc = i;
+		for (int bit = 0; bit < 8; ++bit) crc = crc & 1 ? 0xedb88320u ^ (crc >> 1) : crc >> 1;
+		gCrcTable[i] = crc;
+	}
+	return true;
+}
+
+static const bool gCrcTableReady = initCrcTable();
+
+unsigned crc32(const char* data, size_t size){
+	unsigned crc = 0xffffffffu;
+	for (size_t i = 0; i < size; ++i) crc = gCrcTable[(crc ^ (unsigned char)data[i]) & 0xff] ^ (crc >> 8);
+	return crc ^ 0xffffffffu;
+}
+
+/*
+Deflate's bit order: values are packed from the least significant bit of each byte
+*/
+class BitWriter{
+public:
+	explicit BitWriter(std::string& out) : mOut(out), mBits(0), mCount(0){}
+
+	void put(unsigned value, unsigned bits){
+		mBits |= value << mCount;
+		mCount += bits;
+		while (mCount >= 8){
+			mOut += (char)(mBits & 0xff);
+			mBits >>= 8;
+			mCount -= 8;
+		}
+	}
+
+	void flush(){
+		if (mCount > 0) mOut += (char)(mBits & 0xff);
+		mBits = 0;
+		mCount = 0;
+	}
+
+private:
+	std::string& mOut;
+	unsigned mBits;
+	unsigned mCount;
+};
+
+/*
+A literal (distance 0) or a match of length bytes, distance back
+*/
+struct Token{
+	unsigned short value;
+	unsigned short distance;
+};
+
+/*
+Huffman code lengths for symbol frequencies, none longer than maxBits. Frequencies are flattened
+until the tree fits, which costs a little compression only on the rare block that needs it.
+*/
+static void buildLengths(const std::vector<unsigned>& frequencies, unsigned maxBits, std::vector<unsigned char>& lengths){
+	std::vector<unsigned> weights(frequencies);
+	while (true){
+		typedef std::pair<unsigned long long, unsigned> Node; //weight, index into parents
+		std::priority_queue<Node, std::vector<Node>, std::greater<Node> > queue;
+		std::vector<unsigned> parents, symbols;
+		for (size_t i = 0; i < weights.size(); ++i){
+			if (weights[i] == 0) continue;
+			queue.push(Node(weights[i], (unsigned)parents.size()));
+			parents.push_back(0);
+			symbols.push_back((unsigned)i);
+		}
+		while (queue.size() > 1){
+			Node first = queue.top();
+			queue.pop();
+			Node second = queue.top();
+			queue.pop();
+			unsigned joined = (unsigned)parents.size();
+			parents[first.second] = parents[second.second] = joined;
+			parents.push_back(0);
+			queue.push(Node(first.first + second.first, joined));
+		}
+		//Parents always come after their children, so depths fill in from the root down
+		std::vector<unsigned> depths(parents.size(), 0);
+		for (size_t i = parents.size() - 1; i-- > 0;) depths[i] = depths[parents[i]] + 1;
+		lengths.assign(weights.size(), 0);
+		unsigned longest = 0;
+		for (size_t i = 0; i < symbols.size(); ++i){
+			lengths[symbols[i]] = (unsigned char)depths[i];
+			longest = std::max(longest, depths[i]);
+		}
+		if (longest <= maxBits) return;
+		for (size_t i = 0; i < weights.size(); ++i){
+			if (weights[i] > 0) weights[i] = weights[i] / 2 + 1;
+		}
+	}
+}
+
+/*
+Canonical codes for code lengths, bit reversed since deflate sends Huffman codes most significant bit first
+*/
+static void buildCodes(const std::vector<unsigned char>& lengths, std::vector<unsigned short>& codes){
+	unsigned counts[16] = { 0 }, next[16] = { 0 };
+	for (size_t i = 0; i < lengths.size(); ++i) if (lengths[i]) counts[lengths[i]]++;
+	unsigned code = 0;
+	for (unsigned bits = 1; bits < 16; ++bits){
+		code = (code + counts[bits - 1]) << 1;
+		next[bits] = code;
+	}
+	codes.assign(lengths.size(), 0);
+	for (size_t i = 0; i < lengths.size(); ++i){
+		unsigned length = lengths[i];
+		if (length == 0) continue;
+		unsigned forward = next[length]++, reversed = 0;
+		for (unsigned bit = 0; bit < length; ++bit) reversed |= ((forward >> bit) & 1) << (length - 1 - bit);
+		codes[i] = (unsigned short)reversed;
+	}
+}
+
+/*
+Inflaters reject a code of a single symbol in some alphabets, so every code gets at least two
+*/
+static void useTwoSymbols(std::vector<unsigned>& frequencies){
+	size_t used = 0;
+	for (size_t i = 0; i < frequencies.size(); ++i) if (frequencies[i]) ++used;
+	for (size_t i = 0; i < frequencies.size() && used < 2; ++i){
+		if (frequencies[i] == 0){
+			frequencies[i] = 1;
+			++used;
+		}
+	}
+}
+
+static unsigned lengthCode(unsigned length){
+	return (unsigned)(std::upper_bound(kLengthBase, kLengthBase + 29, length) - kLengthBase) - 1;
+}
+
+static unsigned distanceCode(unsigned distance){
+	return (unsigned)(std::upper_bound(kDistanceBase, kDistanceBase + 30, distance) - kDistanceBase) - 1;
+}
+
+/*
+Writes tokens as one deflate block with dynamic Huffman codes (BTYPE 10)
+*/
+static void writeBlock(BitWriter& writer, const std::vector<Token>& tokens, bool last){
+	std::vector<unsigned> literalFrequencies(286, 0), distanceFrequencies(30, 0);
+	for (size_t i = 0; i < tokens.size(); ++i){
+		if (tokens[i].distance == 0){
+			literalFrequencies[tokens[i].value]++;
+		}
+		else{
+			literalFrequencies[257 + lengthCode(tokens[i].value)]++;
+			distanceFrequencies[distanceCode(tokens[i].distance)]++;
+		}
+	}
+	literalFrequencies[256] = 1; //end of block
+	useTwoSymbols(literalFrequencies);
+	useTwoSymbols(distanceFrequencies);
+	std::vector<unsigned char> literalLengths, distanceLengths;
+	buildLengths(literalFrequencies, 15, literalLengths);
+	buildLengths(distanceFrequencies, 15, distanceLengths);
+	std::vector<unsigned short> literalCodes, distanceCodes;
+	buildCodes(literalLengths, literalCodes);
+	buildCodes(distanceLengths, distanceCodes);
+
+	unsigned literalCount = 286, distanceCount = 30;
+	while (literalCount > 257 && literalLengths[literalCount - 1] == 0) --literalCount;
+	while (distanceCount > 1 && distanceLengths[distanceCount - 1] == 0) --distanceCount;
+
+	//Both code length lists, run-length encoded with symbols 16 (repeat), 17 and 18 (zeros)
+	std::vector<unsigned char> all(literalLengths.begin(), literalLengths.begin() + literalCount);
+	all.insert(all.end(), distanceLengths.begin(), distanceLengths.begin() + distanceCount);
+	std::vector<std::pair<unsigned char, unsigned char> > runs; //symbol, extra bits value
+	for (size_t i = 0; i < all.size();){
+		size_t run = 1;
+		while (i + run < all.size() && all[i + run] == all[i]) ++run;
+		size_t left = run;
+		if (all[i] == 0){
+			while (left >= 11){
+				size_t take = std::min(left, (size_t)138);
+				runs.push_back(std::make_pair((unsigned char)18, (unsigned char)(take - 11)));
+				left -= take;
+			}
+			if (left >= 3){
+				runs.push_back(std::make_pair((unsigned char)17, (unsigned char)(left - 3)));
+				left = 0;
+			}
+		}
+		else{
+			runs.push_back(std::make_pair(all[i], (unsigned char)0));
+			--left;
+			while (left >= 3){
+				size_t take = std::min(left, (size_t)6);
+				runs.push_back(std::make_pair((unsigned char)16, (unsigned char)(take - 3)));
+				left -= take;
+			}
+		}
+		for (; left > 0; --left) runs.push_back(std::make_pair(all[i], (unsigned char)0));
+		i += run;
+	}
+	std::vector<unsigned> codeLengthFrequencies(19, 0);
+	for (size_t i = 0; i < runs.size(); ++i) codeLengthFrequencies[runs[i].first]++;
+	useTwoSymbols(codeLengthFrequencies);
+	std::vector<unsigned char> codeLengthLengths;
+	std::vector<unsigned short> codeLengthCodes;
+	buildLengths(codeLengthFrequencies, 7, codeLengthLengths);
+	buildCodes(codeLengthLengths, codeLengthCodes);
+	unsigned codeLengthCount = 19;
+	while (codeLengthCount > 4 && codeLengthLengths[kCodeLengthOrder[codeLengthCount - 1]] == 0) --codeLengthCount;
+
+	writer.put(last ? 1 : 0, 1);
+	writer.put(2, 2);
+	writer.put(literalCount - 257, 5);
+	writer.put(distanceCount - 1, 5);
+	writer.put(codeLengthCount - 4, 4);
+	for (unsigned i = 0; i < codeLengthCount; ++i) writer.put(codeLengthLengths[kCodeLengthOrder[i]], 3);
+	for (size_t i = 0; i < runs.size(); ++i){
+		unsigned symbol = runs[i].first;
+		writer.put(codeLengthCodes[symbol], codeLengthLengths[symbol]);
+		if (symbol == 16) writer.put(runs[i].second, 2);
+		else if (symbol == 17) writer.put(runs[i].second, 3);
+		else if (symbol == 18) writer.put(runs[i].second, 7);
+	}
+
+	for (size_t i = 0; i < tokens.size(); ++i){
+		const Token& token = tokens[i];
+		if (token.distance == 0){
+			writer.put(literalCodes[token.value], literalLengths[token.value]);
+			continue;
+		}
+		unsigned length = lengthCode(token.value);
+		writer.put(literalCodes[257 + length], literalLengths[257 + length]);
+		writer.put(token.value - kLengthBase[length], kLengthExtra[length]);
+		unsigned distance = distanceCode(token.distance);
+		writer.put(distanceCodes[distance], distanceLengths[distance]);
+		writer.put(token.distance - kDistanceBase[distance], kDistanceExtra[distance]);
+	}
+	writer.put(literalCodes[256], literalLengths[256]);
+}
+
+/*
+Finds repeated strings through chains of earlier positions sharing the hash of their first 3 bytes
+*/
+class Matcher{
+public:
+	Matcher(const unsigned char* data, size_t size) : mData(data), mSize(size), mHead((size_t)1 << kHashBits, -1), mPrevious(kWindowBytes, -1){}
+
+	/*
+	Adds a position to the chains, for positions after it to match against
+	*/
+	void insert(size_t position){
+		if (position + kMinMatch > mSize) return;
+		unsigned hash = hashAt(position);
+		mPrevious[position & (kWindowBytes - 1)] = mHead[hash];
+		mHead[hash] = (int)position;
+	}
+
+	/*
+	Longest match for a position among those inserted before it
+	@param[out] distance how far back it starts
+	@return its length, below kMinMatch if there is none worth taking
+	*/
+	unsigned find(size_t position, unsigned& distance){
+		if (position + kMinMatch > mSize) return 0;
+		unsigned limit = (unsigned)std::min((size_t)kMaxMatch, mSize - position);
+		unsigned best = 0, chain = kMaxChain;
+		const unsigned char* here = mData + position;
+		int candidate = mHead[hashAt(position)];
+		while (candidate >= 0 && position - candidate <= kWindowBytes && chain-- > 0){
+			const unsigned char* there = mData + candidate;
+			if (there[best] == here[best] && there[0] == here[0]){
+				unsigned length = 0;
+				while (length < limit && there[length] == here[length]) ++length;
+				if (length > best){
+					best = length;
+					distance = (unsigned)(position - candidate);
+					if (best >= kNiceMatch || best == limit) break;
+				}
+			}
+			int older = mPrevious[candidate & (kWindowBytes - 1)];
+			if (older >= candidate) break; //overwritten by a position a window later, the chain ends here
+			candidate = older;
+		}
+		if (best == kMinMatch && distance > kTooFar) return 0;
+		return best;
+	}
+
+private:
+	unsigned hashAt(size_t position) const{
+		unsigned value = mData[position] | mData[position + 1] << 8 | mData[position + 2] << 16;
+		return (value * 2654435761u) >> (32 - kHashBits);
+	}
+
+	const unsigned char* mData;
+	size_t mSize;
+	std::vector<int> mHead; //newest position by hash
+	std::vector<int> mPrevious; //next older position with the same hash, by position within the window
+};
+
+void gzipCompress(const char* data, size_t size, std::string& out){
+	static const unsigned char kHeader[10] = { 0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 0xff }; //deflate, no name or time, unknown OS
+	out.assign((const char*)kHeader, sizeof(kHeader));
+	out.reserve(size / 3 + 64);
+
+	const unsigned char* bytes = (const unsigned char*)data;
+	Matcher matcher(bytes, size);
+	BitWriter writer(out);
+	std::vector<Token> tokens;
+	tokens.reserve(std::min(size, kBlockTokens) + 1);
+	size_t position = 0;
+	while (position < size){
+		unsigned distance = 0;
+		unsigned length = matcher.find(position, distance);
+		matcher.insert(position);
+		if (length >= kMinMatch && length < kNiceMatch){
+			//Lazy matching: a longer match one byte on is worth a literal here
+			unsigned nextDistance = 0;
+			if (matcher.find(position + 1, nextDistance) > length) length = 0;
+		}
+		Token token;
+		if (length >= kMinMatch){
+			token.value = (unsigned short)length;
+			token.distance = (unsigned short)distance;
+			for (size_t i = position + 1; i < position + length; ++i) matcher.insert(i);
+			position += length;
+		}
+		else{
+			token.value = bytes[position];
+			token.distance = 0;
+			++position;
+		}
+		tokens.push_back(token);
+		if (tokens.size() >= kBlockTokens && position < size){
+			writeBlock(writer, tokens, false);
+			tokens.clear();
+		}
+	}
+	writeBlock(writer, tokens, true);
+	writer.flush();
+
+	unsigned crc = crc32(data, size);
+	for (int i = 0; i < 4; ++i) out += (char)((crc >> (8 * i)) & 0xff);
+	for (int i = 0; i < 4; ++i) out += (char)((size >> (8 * i)) & 0xff);
+}
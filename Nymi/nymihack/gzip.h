@@ -0,0 +1,19 @@
+#ifndef GZIP_H
+#define GZIP_H
+
+#include <string>
+
+/*
+CRC-32 of gzip and zip (reflected polynomial 0xedb88320), also the record log's checksum
+*/
+unsigned crc32(const char* data, size_t size);
+
+/*
+Compresses data as one gzip member (RFC 1952): deflate blocks with their own Huffman codes, from
+LZ77 matches found on hash chains with one step of lazy matching. Far slower than zlib's fast
+levels, so it's meant for content compressed once and then sent many times.
+@param[out] out the .gz bytes
+*/
+void gzipCompress(const char* data, size_t size, std::string& out);
+
+#endif
@@ -0,0 +1,547 @@
+#include "http_server.h"
+#include "clock.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+
+#if defined(_WIN32)
+#include <winsock2.h>
+#include <mswsock.h>
+#include <ws2tcpip.h>
+#pragma comment(lib, "ws2_32.lib")
+#pragma comment(lib, "mswsock.lib")
+typedef SOCKET Socket;
+typedef int SocketLength;
+typedef WSAPOLLFD PollEntry;
+static const Socket kNoSocket = INVALID_SOCKET;
+static void closeSocket(Socket s){ closesocket(s); }
+static int pollSockets(PollEntry* entries, size_t count, int timeoutMillis){ return WSAPoll(entries, (ULONG)count, timeoutMillis); }
+static void setNonBlocking(Socket s){
+	u_long nonBlocking = 1;
+	ioctlsocket(s, FIONBIO, &nonBlocking);
+}
+static bool startSockets(){
+	WSADATA data;
+	return WSAStartup(MAKEWORD(2, 2), &data) == 0;
+}
+#else
+#include <arpa/inet.h>
+#include <cerrno>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <csignal>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <sys/sendfile.h>
+#endif
+typedef int Socket;
+typedef socklen_t SocketLength;
+typedef pollfd PollEntry;
+static const Socket kNoSocket = -1;
+static void closeSocket(Socket s){ close(s); }
+static int pollSockets(PollEntry* entries, size_t count, int timeoutMillis){ return poll(entries, (nfds_t)count, timeoutMillis); }
+static void setNonBlocking(Socket s){ fcntl(s, F_SETFL, fcntl(s, F_GETFL, 0) | O_NONBLOCK); }
+static bool startSockets(){
+	//A client closing mid-response must fail the send, not end the process. sendfile can't take MSG_NOSIGNAL.
+	signal(SIGPIPE, SIG_IGN);
+	return true;
+}
+#endif
+#if !defined(MSG_NOSIGNAL)
+#define MSG_NOSIGNAL 0
+#endif
+
+static const size_t kMaxHeaderBytes = 16 * 1024;
+static const size_t kMaxBodyBytes = 1024 * 1024;
+static const unsigned kReceiveTimeoutMillis = 5000;
+static const size_t kCoalesceBodyBytes = 64 * 1024; //bodies up to this are sent together with the head
+static const size_t kMaxWaitingClients = 256; //accepted connections past this are closed unanswered
+static const long long kKeepAliveMillis = 15000; //a kept-alive connection without a request for this long is closed
+static const size_t kMaxIdleConnections = 1024; //kept-alive connections past this are closed, the longest idle first
+static const int kIdleCheckMillis = 1000;
+static const bool gSocketsStarted = startSockets();
+
+std::string HttpRequest::header(const std::string& name) const{
+	std::map<std::string, std::string>::const_iterator it = headers.find(name);
+	return it == headers.end() ? std::string() : it->second;
+}
+
+std::string HttpRequest::param(const std::string& name) const{
+	size_t start = 0;
+	while (start <= query.size()){
+		size_t end = query.find('&', start);
+		if (end == std::string::npos) end = query.size();
+		size_t equals = query.find('=', start);
+		if (equals > end) equals = end;
+		if (urlDecode(query.substr(start, equals - start)) == name){
+			return equals == end ? std::string() : urlDecode(query.substr(equals + 1, end - equals - 1));
+		}
+		start = end + 1;
+	}
+	return std::string();
+}
+
+std::string urlDecode(const std::string& text){
+	std::string decoded;
+	decoded.reserve(text.size());
+	for (size_t i = 0; i < text.size(); ++i){
+		if (text[i] == '+'){
+			decoded += ' ';
+		}
+		else if (text[i] == '%' && i + 2 < text.size() && isxdigit((unsigned char)text[i + 1]) && isxdigit((unsigned char)text[i + 2])){
+			decoded += (char)strtol(text.substr(i + 1, 2).c_str(), NULL, 16);
+			i += 2;
+		}
+		else{
+			decoded += text[i];
+		}
+	}
+	return decoded;
+}
+
+bool matchesEtag(const std::string& ifNoneMatch, const std::string& etag){
+	if (ifNoneMatch.empty()) return false;
+	return ifNoneMatch == "*" || ifNoneMatch.find(etag) != std::string::npos;
+}
+
+const char* httpStatusText(int status){
+	switch (status){
+	case 200: return "OK";
+	case 204: return "No Content";
+	case 304: return "Not Modified";
+	case 400: return "Bad Request";
+	case 404: return "Not Found";
+	case 405: return "Method Not Allowed";
+	case 409: return "Conflict";
+	case 413: return "Payload Too Large";
+	case 500: return "Internal Server Error";
+	case 503: return "Service Unavailable";
+	default: return "Unknown";
+	}
+}
+
+#if defined(_WIN32)
+/*
+FILETIME counts 100 ns intervals since 1601
+*/
+static long long unixSeconds(const FILETIME& time){
+	unsigned long long ticks = (unsigned long long)time.dwHighDateTime << 32 | time.dwLowDateTime;
+	return (long long)(ticks / 10000000ULL) - 11644473600LL;
+}
+#endif
+
+OpenFile::OpenFile(long long handle, unsigned long long size, long long modified) : mHandle(handle), mSize(size), mModified(modified){}
+
+std::shared_ptr<OpenFile> OpenFile::open(const std::string& path){
+#if defined(_WIN32)
+	HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL,
+		OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (file == INVALID_HANDLE_VALUE) return std::shared_ptr<OpenFile>();
+	LARGE_INTEGER size;
+	FILETIME written;
+	if (!GetFileSizeEx(file, &size) || !GetFileTime(file, NULL, NULL, &written)){
+		CloseHandle(file);
+		return std::shared_ptr<OpenFile>();
+	}
+	return std::shared_ptr<OpenFile>(new OpenFile((long long)file, (unsigned long long)size.QuadPart, unixSeconds(written)));
+#else
+	int file = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (file < 0) return std::shared_ptr<OpenFile>();
+	struct stat info;
+	if (fstat(file, &info) != 0 || !S_ISREG(info.st_mode)){
+		close(file);
+		return std::shared_ptr<OpenFile>();
+	}
+	return std::shared_ptr<OpenFile>(new OpenFile(file, (unsigned long long)info.st_size, (long long)info.st_mtime));
+#endif
+}
+
+bool OpenFile::stat(const std::string& path, unsigned long long& size, long long& modified){
+#if defined(_WIN32)
+	WIN32_FILE_ATTRIBUTE_DATA data;
+	if (!GetFileAttributesExA(path.c_str(), GetFileExInfoStandard, &data) || (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) return false;
+	size = (unsigned long long)data.nFileSizeHigh << 32 | data.nFileSizeLow;
+	modified = unixSeconds(data.ftLastWriteTime);
+#else
+	struct stat info;
+	if (::stat(path.c_str(), &info) != 0 || !S_ISREG(info.st_mode)) return false;
+	size = (unsigned long long)info.st_size;
+	modified = (long long)info.st_mtime;
+#endif
+	return true;
+}
+
+OpenFile::~OpenFile(){
+#if defined(_WIN32)
+	CloseHandle((HANDLE)mHandle);
+#else
+	close((int)mHandle);
+#endif
+}
+
+long long OpenFile::handle() const{
+	return mHandle;
+}
+
+unsigned long long OpenFile::size() const{
+	return mSize;
+}
+
+long long OpenFile::modified() const{
+	return mModified;
+}
+
+HttpServer::HttpServer() : mListener(-1), mWake(-1), mPort(0), mRunning(false){}
+
+HttpServer::~HttpServer(){
+	stop();
+}
+
+bool HttpServer::start(const char* address, unsigned short port, HttpHandler handler, unsigned workers){
+	if (!gSocketsStarted || mRunning) return false;
+
+	Socket listener = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	if (listener == kNoSocket) return false;
+	int reuse = 1;
+	setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, (const char*)&reuse, sizeof(reuse));
+
+	sockaddr_in bound;
+	memset(&bound, 0, sizeof(bound));
+	bound.sin_family = AF_INET;
+	bound.sin_port = htons(port);
+	if (inet_pton(AF_INET, address, &bound.sin_addr) != 1 ||
+		bind(listener, (sockaddr*)&bound, sizeof(bound)) != 0 ||
+		listen(listener, SOMAXCONN) != 0){
+		closeSocket(listener);
+		return false;
+	}
+	SocketLength length = sizeof(bound);
+	getsockname(listener, (sockaddr*)&bound, &length);
+
+	//Socket pairs don't exist on Windows, so run() is woken through a UDP socket sending to itself
+	Socket wake = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	sockaddr_in loopback;
+	memset(&loopback, 0, sizeof(loopback));
+	loopback.sin_family = AF_INET;
+	loopback.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	length = sizeof(loopback);
+	if (wake == kNoSocket ||
+		bind(wake, (sockaddr*)&loopback, sizeof(loopback)) != 0 ||
+		getsockname(wake, (sockaddr*)&loopback, &length) != 0 ||
+		connect(wake, (sockaddr*)&loopback, sizeof(loopback)) != 0){
+		if (wake != kNoSocket) closeSocket(wake);
+		closeSocket(listener);
+		return false;
+	}
+	setNonBlocking(wake);
+
+	mListener = (long long)listener;
+	mWake = (long long)wake;
+	mPort = ntohs(bound.sin_port);
+	mHandler = handler;
+	mRunning = true;
+	for (unsigned i = 0; i < std::max(workers, 1u); ++i) mWorkers.push_back(std::thread(&HttpServer::work, this));
+	mThread = std::thread(&HttpServer::run, this);
+	return true;
+}
+
+void HttpServer::stop(){
+	if (!mRunning.exchange(false)) return;
+	wake();
+	mThread.join();
+	closeSocket((Socket)mListener);
+	closeSocket((Socket)mWake);
+	mListener = -1;
+	mWake = -1;
+	{
+		std::lock_guard<std::mutex> lock(mMutex); //a worker between its mRunning check and its wait would miss the notify
+	}
+	mAccepted.notify_all();
+	for (size_t i = 0; i < mWorkers.size(); ++i) mWorkers[i].join();
+	mWorkers.clear();
+	for (size_t i = 0; i < mClients.size(); ++i) closeSocket((Socket)mClients[i]);
+	mClients.clear();
+	for (size_t i = 0; i < mReturned.size(); ++i) closeSocket((Socket)mReturned[i]);
+	mReturned.clear();
+}
+
+unsigned short HttpServer::port(){
+	return mPort;
+}
+
+void HttpServer::wake(){
+	char byte = 0;
+	send((Socket)mWake, &byte, 1, 0);
+}
+
+void HttpServer::run(){
+	Socket listener = (Socket)mListener;
+	Socket wake = (Socket)mWake;
+	std::vector<std::pair<Socket, long long> > idle; //kept-alive connections, since when
+	std::vector<PollEntry> entries;
+	std::vector<Socket> ready; //for a worker
+	while (mRunning){
+		entries.resize(2 + idle.size());
+		entries[0].fd = listener;
+		entries[1].fd = wake;
+		for (size_t i = 0; i < idle.size(); ++i) entries[2 + i].fd = idle[i].first;
+		for (size_t i = 0; i < entries.size(); ++i){
+			entries[i].events = POLLIN;
+			entries[i].revents = 0;
+		}
+		if (pollSockets(&entries[0], entries.size(), kIdleCheckMillis) < 0 || !mRunning) continue;
+		long long now = monotonicMicros();
+
+		//A request arriving on an idle connection, or it closing, goes to a worker, which finds out which
+		ready.clear();
+		size_t kept = 0;
+		for (size_t i = 0; i < idle.size(); ++i){
+			if (entries[2 + i].revents != 0) ready.push_back(idle[i].first);
+			else if (now - idle[i].second > kKeepAliveMillis * 1000) closeSocket(idle[i].first);
+			else idle[kept++] = idle[i];
+		}
+		idle.resize(kept);
+		if (entries[1].revents != 0){
+			char bytes[64];
+			while (recv(wake, bytes, sizeof(bytes), 0) > 0){}
+			std::lock_guard<std::mutex> lock(mMutex);
+			for (size_t i = 0; i < mReturned.size(); ++i) idle.push_back(std::make_pair((Socket)mReturned[i], now));
+			mReturned.clear();
+		}
+		if (idle.size() > kMaxIdleConnections){
+			for (size_t i = 0; i < idle.size() - kMaxIdleConnections; ++i) closeSocket(idle[i].first);
+			idle.erase(idle.begin(), idle.end() - kMaxIdleConnections);
+		}
+		if (entries[0].revents != 0){
+			Socket client = accept(listener, NULL, NULL);
+			if (client != kNoSocket){
+#if defined(_WIN32)
+				DWORD timeout = kReceiveTimeoutMillis;
+#else
+				timeval timeout;
+				timeout.tv_sec = kReceiveTimeoutMillis / 1000;
+				timeout.tv_usec = (kReceiveTimeoutMillis % 1000) * 1000;
+#endif
+				setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, (const char*)&timeout, sizeof(timeout));
+				int noDelay = 1; //answers are written whole, Nagle would only hold back their last segment
+				setsockopt(client, IPPROTO_TCP, TCP_NODELAY, (const char*)&noDelay, sizeof(noDelay));
+				ready.push_back(client);
+			}
+		}
+		if (ready.empty()) continue;
+
+		size_t handed = 0;
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			for (; handed < ready.size() && mClients.size() < kMaxWaitingClients; ++handed) mClients.push_back((long long)ready[handed]);
+		}
+		for (size_t i = handed; i < ready.size(); ++i) closeSocket(ready[i]);
+		if (handed == 1) mAccepted.notify_one();
+		else if (handed > 1) mAccepted.notify_all();
+	}
+	for (size_t i = 0; i < idle.size(); ++i) closeSocket(idle[i].first);
+}
+
+void HttpServer::work(){
+	while (true){
+		Socket client;
+		{
+			std::unique_lock<std::mutex> lock(mMutex);
+			while (mRunning && mClients.empty()) mAccepted.wait(lock);
+			if (!mRunning) return;
+			client = (Socket)mClients.front();
+			mClients.pop_front();
+		}
+		if (serve((long long)client)){
+			bool returned = false;
+			{
+				std::lock_guard<std::mutex> lock(mMutex);
+				if (mRunning){
+					mReturned.push_back((long long)client);
+					returned = true;
+				}
+			}
+			if (returned){
+				wake();
+				continue;
+			}
+		}
+		closeSocket(client);
+	}
+}
+
+static bool sendAll(Socket s, const char* data, size_t size, int flags = 0){
+	while (size > 0){
+		int sent = send(s, data, (int)std::min(size, (size_t)(1 << 20)), flags | MSG_NOSIGNAL);
+		if (sent <= 0) return false;
+		data += sent;
+		size -= sent;
+	}
+	return true;
+}
+
+static std::string lowercase(std::string text){
+	std::transform(text.begin(), text.end(), text.begin(), ::tolower);
+	return text;
+}
+
+static std::string trim(const std::string& text){
+	size_t begin = text.find_first_not_of(" \t");
+	if (begin == std::string::npos) return std::string();
+	size_t end = text.find_last_not_of(" \t\r");
+	return text.substr(begin, end - begin + 1);
+}
+
+/*
+Parses the request line and headers
+@return false if the request is malformed
+*/
+static bool parseHead(const std::string& head, HttpRequest& request){
+	std::istringstream lines(head);
+	std::string line, target;
+	if (!std::getline(lines, line)) return false;
+	std::istringstream requestLine(line);
+	if (!(requestLine >> request.method >> target >> request.version)) return false;
+	size_t question = target.find('?');
+	request.path = target.substr(0, question);
+	if (question != std::string::npos) request.query = target.substr(question + 1);
+	while (std::getline(lines, line)){
+		size_t colon = line.find(':');
+		if (colon == std::string::npos) continue;
+		request.headers[lowercase(trim(line.substr(0, colon)))] = trim(line.substr(colon + 1));
+	}
+	return true;
+}
+
+/*
+Whether the client wants the connection kept after its request: by default from HTTP/1.1 on
+*/
+static bool keepsAlive(const HttpRequest& request){
+	std::string connection = lowercase(request.header("connection"));
+	if (request.version == "HTTP/1.0") return connection.find("keep-alive") != std::string::npos;
+	return connection.find("close") == std::string::npos;
+}
+
+/*
+Sends the head, then the file without copying it through user space
+*/
+static bool sendFile(Socket client, const std::string& head, const OpenFile& file){
+#if defined(_WIN32)
+	//Overlapped, so the offset is ours and not the handle's shared file pointer. On client editions of
+	//Windows only two TransmitFile calls run at once and the rest queue, which is fine for a few terminals.
+	TRANSMIT_FILE_BUFFERS buffers;
+	buffers.Head = (void*)head.data();
+	buffers.HeadLength = (DWORD)head.size();
+	buffers.Tail = NULL;
+	buffers.TailLength = 0;
+	OVERLAPPED overlapped;
+	memset(&overlapped, 0, sizeof(overlapped));
+	overlapped.hEvent = WSACreateEvent();
+	if (overlapped.hEvent == WSA_INVALID_EVENT) return false;
+	bool sent = TransmitFile(client, (HANDLE)file.handle(), 0, 0, &overlapped, &buffers, 0) != FALSE || WSAGetLastError() == WSA_IO_PENDING;
+	DWORD bytes, flags;
+	if (sent) sent = WSAGetOverlappedResult(client, &overlapped, &bytes, TRUE, &flags) != FALSE;
+	WSACloseEvent(overlapped.hEvent);
+	return sent;
+#elif defined(__linux__)
+	if (!sendAll(client, head.data(), head.size(), MSG_MORE)) return false; //leaves with the file's first bytes
+	off_t offset = 0;
+	unsigned long long left = file.size();
+	while (left > 0){
+		ssize_t sent = sendfile(client, (int)file.handle(), &offset, (size_t)std::min(left, 1ULL << 30));
+		if (sent < 0 && errno == EINTR) continue;
+		if (sent <= 0) return false;
+		left -= sent;
+	}
+	return true;
+#else
+	if (!sendAll(client, head.data(), head.size())) return false;
+	char buffer[64 * 1024];
+	unsigned long long offset = 0;
+	while (offset < file.size()){
+		ssize_t got = pread((int)file.handle(), buffer, (size_t)std::min(file.size() - offset, (unsigned long long)sizeof(buffer)), (off_t)offset);
+		if (got <= 0 || !sendAll(client, buffer, got)) return false;
+		offset += got;
+	}
+	return true;
+#endif
+}
+
+/*
+@param[in] headOnly answering a HEAD request: the head a GET would get, without the body
+@param[in] keepAlive whether the connection stays open for another request
+@return false if the response couldn't be sent whole
+*/
+static bool writeResponse(Socket client, HttpResponse& response, bool headOnly = false, bool keepAlive = false){
+	const std::string& body = response.sharedBody ? *response.sharedBody : response.body;
+	unsigned long long length = response.file ? response.file->size() : body.size();
+	std::ostringstream head;
+	head << "HTTP/1.1 " << response.status << " " << httpStatusText(response.status) << "\r\n";
+	if (response.status != 304 && response.status != 204){
+		head << "Content-Type: " << response.contentType << "\r\n";
+		head << "Content-Length: " << length << "\r\n";
+	}
+	for (std::map<std::string, std::string>::iterator it = response.headers.begin(); it != response.headers.end(); ++it){
+		head << it->first << ": " << it->second << "\r\n";
+	}
+	if (keepAlive) head << "Connection: keep-alive\r\nKeep-Alive: timeout=" << kKeepAliveMillis / 1000 << "\r\n\r\n";
+	else head << "Connection: close\r\n\r\n";
+	std::string text = head.str();
+	bool hasBody = response.status != 304 && response.status != 204 && !headOnly;
+	if (hasBody && response.file) return sendFile(client, text, *response.file);
+	if (hasBody && body.size() <= kCoalesceBodyBytes){
+		text += body; //one send, so a small answer leaves in one segment
+		return sendAll(client, text.data(), text.size());
+	}
+	if (!sendAll(client, text.data(), text.size())) return false;
+	return !hasBody || sendAll(client, body.data(), body.size());
+}
+
+bool HttpServer::serve(long long socket){
+	Socket client = (Socket)socket;
+	std::string data; //received and not yet served, e.g. a pipelined request
+	char chunk[4096];
+	while (true){
+		size_t headEnd;
+		while ((headEnd = data.find("\r\n\r\n")) == std::string::npos){
+			if (data.size() > kMaxHeaderBytes) return false;
+			int received = recv(client, chunk, sizeof(chunk), 0);
+			if (received <= 0) return false;
+			data.append(chunk, received);
+		}
+
+		HttpRequest request;
+		HttpResponse response;
+		if (!parseHead(data.substr(0, headEnd), request)){
+			response.status = 400;
+			writeResponse(client, response);
+			return false;
+		}
+		size_t bodySize = (size_t)strtoul(request.header("content-length").c_str(), NULL, 10);
+		if (bodySize > kMaxBodyBytes){
+			response.status = 413;
+			writeResponse(client, response);
+			return false;
+		}
+		while (data.size() < headEnd + 4 + bodySize){
+			int received = recv(client, chunk, sizeof(chunk), 0);
+			if (received <= 0) return false;
+			data.append(chunk, received);
+		}
+		request.body = data.substr(headEnd + 4, bodySize);
+		data.erase(0, headEnd + 4 + bodySize);
+
+		bool keepAlive = mRunning && keepsAlive(request);
+		mHandler(request, response);
+		if (!writeResponse(client, response, request.method == "HEAD", keepAlive) || !keepAlive) return false;
+		if (data.empty()) return true; //nothing more sent yet, run() watches for it
+	}
+}
@@ -0,0 +1,144 @@
+#ifndef HTTP_SERVER_H
+#define HTTP_SERVER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct HttpRequest{
+	std::string method;
+	std::string path; //without the query string
+	std::string query;
+	std::string version; //e.g. HTTP/1.1
+	std::map<std::string, std::string> headers; //names lowercased
+	std::string body;
+
+	/*
+	Returns a header's value, or an empty string if the request doesn't have it
+	@param[in] name lowercase header name
+	*/
+	std::string header(const std::string& name) const;
+
+	/*
+	Returns a query string parameter, decoded, or an empty string if the request doesn't have it
+	*/
+	std::string param(const std::string& name) const;
+};
+
+/*
+A file held open for responses to send straight from the kernel's cache (sendfile, TransmitFile),
+closed once the last response or cache holding it lets go
+*/
+class OpenFile{
+public:
+	/*
+	@return NULL if the file can't be opened
+	*/
+	static std::shared_ptr<OpenFile> open(const std::string& path);
+
+	/*
+	Reads a file's size and modification time without opening it
+	@param[out] modified seconds since 1970
+	@return false if there is no such file
+	*/
+	static bool stat(const std::string& path, unsigned long long& size, long long& modified);
+
+	~OpenFile();
+
+	long long handle() const; //HANDLE or file descriptor
+	unsigned long long size() const; //when opened
+	long long modified() const; //when opened, seconds since 1970
+
+private:
+	OpenFile(long long handle, unsigned long long size, long long modified);
+	OpenFile(const OpenFile&);
+	OpenFile& operator=(const OpenFile&);
+
+	long long mHandle;
+	unsigned long long mSize;
+	long long mModified;
+};
+
+struct HttpResponse{
+	HttpResponse() : status(200), contentType("text/plain"){}
+	int status;
+	std::string contentType;
+	std::map<std::string, std::string> headers; //extra headers, e.g. ETag
+	std::string body;
+	std::shared_ptr<const std::string> sharedBody; //sent instead of body if set, so cached bytes aren't copied per response
+	std::shared_ptr<OpenFile> file; //sent instead of either if set, straight from the file
+};
+
+typedef std::function<void(const HttpRequest& request, HttpResponse& response)> HttpHandler;
+
+/*
+Minimal HTTP/1.1 server for local endpoints (metrics, records, ...).
+One thread accepts connections and hands them to a pool of workers, so a handler that blocks (e.g.
+on a disk sync) doesn't hold up the others. Connections are kept alive: between requests a worker
+hands its connection back to the accepting thread, which polls it along with the listener and gives
+it to a worker again once the next request arrives, so hundreds of idle terminals hold no worker.
+Connections idle for 15 s are closed.
+*/
+class HttpServer{
+public:
+	HttpServer();
+	~HttpServer();
+
+	/*
+	Starts listening and serving requests on a background thread
+	@param[in] address address to bind, e.g. "127.0.0.1" to stay local
+	@param[in] port TCP port
+	@param[in] handler called for every request, from up to workers threads at once
+	@param[in] workers threads serving connections
+	@return false if the socket couldn't be bound
+	*/
+	bool start(const char* address, unsigned short port, HttpHandler handler, unsigned workers = 1);
+	void stop();
+
+	unsigned short port(); //port actually bound, useful when started on port 0
+
+private:
+	void run();
+	void work();
+	void wake();
+
+	/*
+	Serves a connection's requests until it has none waiting
+	@return whether to keep the connection for its next request
+	*/
+	bool serve(long long client);
+
+	long long mListener; //SOCKET or file descriptor, -1 when closed
+	long long mWake; //UDP socket connected to itself: a byte sent to it wakes run() from its poll
+	unsigned short mPort;
+	HttpHandler mHandler;
+	std::thread mThread;
+	std::vector<std::thread> mWorkers;
+	std::mutex mMutex;
+	std::condition_variable mAccepted;
+	std::deque<long long> mClients; //accepted or with a request arrived, waiting for a worker
+	std::vector<long long> mReturned; //kept alive by workers, waiting for run() to watch them
+	std::atomic<bool> mRunning;
+};
+
+const char* httpStatusText(int status);
+
+/*
+Decodes %XX escapes, and + as a space, of a path segment or query parameter
+*/
+std::string urlDecode(const std::string& text);
+
+/*
+Whether an If-None-Match header names an ETag, or is *
+@param[in] etag quoted, as sent
+*/
+bool matchesEtag(const std::string& ifNoneMatch, const std::string& etag);
+
+#endif
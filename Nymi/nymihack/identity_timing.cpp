@@ -0,0 +1,53 @@
+#include "identity_timing.h"
+#include "clock.h"
+
+#include <algorithm>
+#include <iomanip>
+
+IdentityTiming gIdentityTiming;
+
+IdentityTiming::IdentityTiming() : mScanStartedAt(0){}
+
+void IdentityTiming::scanStarted(){
+	std::lock_guard<std::mutex> lock(mMutex);
+	mScanStartedAt = monotonicMicros();
+}
+
+void IdentityTiming::identified(bool strong, long long roundtripMicros){
+	long long now = monotonicMicros();
+	std::lock_guard<std::mutex> lock(mMutex);
+	if (mScanStartedAt == 0) return;
+	Samples& samples = strong ? mStrong : mValidated;
+	samples.total.push_back((now - mScanStartedAt) / 1000.0);
+	samples.roundtrip.push_back(roundtripMicros / 1000.0);
+}
+
+static double percentile(const std::vector<double>& sorted, double p){
+	size_t index = (size_t)(p * (sorted.size() - 1) + 0.5);
+	return sorted[index];
+}
+
+void IdentityTiming::reportPath(std::ostream& out, const char* name, Samples& samples){
+	out << name << ": " << samples.total.size() << " identified";
+	if (samples.total.empty()){
+		out << "\n";
+		return;
+	}
+	std::vector<double> total = samples.total;
+	std::sort(total.begin(), total.end());
+	double sum = 0, roundtrip = 0;
+	for (size_t i = 0; i < total.size(); ++i) sum += total[i];
+	for (size_t i = 0; i < samples.roundtrip.size(); ++i) roundtrip += samples.roundtrip[i];
+	out << std::fixed << std::setprecision(1)
+		<< ", time-to-identity mean " << sum / total.size() << " ms"
+		<< ", p50 " << percentile(total, 0.5) << " ms"
+		<< ", p95 " << percentile(total, 0.95) << " ms"
+		<< ", validation roundtrip mean " << roundtrip / samples.roundtrip.size() << " ms\n";
+	out.unsetf(std::ios::floatfield);
+}
+
+void IdentityTiming::report(std::ostream& out){
+	std::lock_guard<std::mutex> lock(mMutex);
+	reportPath(out, "strong find", mStrong);
+	reportPath(out, "validated", mValidated);
+}
@@ -0,0 +1,47 @@
+#ifndef IDENTITY_TIMING_H
+#define IDENTITY_TIMING_H
+
+#include <mutex>
+#include <ostream>
+#include <vector>
+
+/*
+Measures time-to-identity: from the start of a finding scan to the moment a patient's identity is
+established, either by a strong find (no connection) or by a completed nclValidate.
+Kept separately per path so strong and weak provisions can be compared on the same desk.
+*/
+class IdentityTiming{
+public:
+	IdentityTiming();
+
+	void scanStarted();
+
+	/*
+	Records an identification
+	@param[in] strong true for the strong-find fast path, false for a validation
+	@param[in] roundtripMicros time spent between the validation request and its completion, 0 for strong finds
+	*/
+	void identified(bool strong, long long roundtripMicros);
+
+	/*
+	Prints count, mean and percentiles of both paths
+	*/
+	void report(std::ostream& out);
+
+private:
+	struct Samples{
+		std::vector<double> total; //ms from scan start to identity
+		std::vector<double> roundtrip; //ms spent in the validation roundtrip
+	};
+
+	void reportPath(std::ostream& out, const char* name, Samples& samples);
+
+	std::mutex mMutex;
+	long long mScanStartedAt;
+	Samples mStrong;
+	Samples mValidated;
+};
+
+extern IdentityTiming gIdentityTiming; //Global time-to-identity statistics
+
+#endif
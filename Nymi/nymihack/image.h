@@ -0,0 +1,16 @@
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include <vector>
+
+/*
+Decoded image, 8 bit RGBA, rows top down without padding
+*/
+struct Image{
+	Image() : width(0), height(0){}
+	unsigned width;
+	unsigned height;
+	std::vector<unsigned char> pixels; //width * height * 4 bytes
+};
+
+#endif
@@ -0,0 +1,132 @@
+#include "image_store.h"
+#include "image.h"
+#include "jpeg.h"
+#include "resample.h"
+#include "tiff.h"
+
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <vector>
+
+ImageStore gImages;
+
+static const char kImagesPrefix[] = "/images/";
+
+/*
+Strong validator of a variant: FNV-1a of its bytes, in hex and quotes
+*/
+static std::string etagOf(const std::string& bytes){
+	unsigned long long hash = 14695981039346656037ULL;
+	for (size_t i = 0; i < bytes.size(); ++i){
+		hash ^= (unsigned char)bytes[i];
+		hash *= 1099511628211ULL;
+	}
+	static const char kHex[] = "0123456789abcdef";
+	std::string etag = "\"";
+	for (int shift = 60; shift >= 0; shift -= 4) etag += kHex[(hash >> shift) & 0xf];
+	etag += '"';
+	return etag;
+}
+
+/*
+Sizes the pages show the images at, the only ones resampled
+*/
+struct ImageSize{
+	unsigned width, height;
+};
+static const ImageSize kImageSizes[] = { { 400, 250 } }; //infoPage.php's health card
+
+static unsigned long long sizeKey(unsigned long long width, unsigned long long height){
+	return width << 32 | height;
+}
+
+/*
+Encodes an image at a size, never larger than the original
+*/
+static void makeVariant(const Image& image, unsigned width, unsigned height, std::string& jpeg){
+	if (width > image.width) width = image.width;
+	if (height > image.height) height = image.height;
+	if (width == image.width && height == image.height){
+		encodeJpeg(image, kJpegQuality, jpeg);
+		return;
+	}
+	Image resized;
+	resizeImage(image, width, height, resized);
+	encodeJpeg(resized, kJpegQuality, jpeg);
+}
+
+ImageStore::ImageStore(){}
+
+bool ImageStore::load(const std::string& name, const std::string& path){
+	std::ifstream in(path.c_str(), std::ios::binary);
+	if (!in) return false;
+	std::vector<unsigned char> data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+	Image image;
+	if (data.empty() || !decodeTiff(data.data(), data.size(), image)) return false;
+
+	//Every size is encoded up front, the decoded pixels aren't kept
+	Source source;
+	size_t sizes = sizeof(kImageSizes) / sizeof(kImageSizes[0]);
+	for (size_t i = 0; i <= sizes; ++i){
+		bool original = i == sizes;
+		unsigned width = original ? image.width : kImageSizes[i].width;
+		unsigned height = original ? image.height : kImageSizes[i].height;
+		std::shared_ptr<std::string> jpeg = std::make_shared<std::string>();
+		makeVariant(image, width, height, *jpeg);
+		Variant& variant = source.variants[original ? 0 : sizeKey(width, height)];
+		variant.etag = etagOf(*jpeg);
+		variant.jpeg = jpeg;
+	}
+	std::lock_guard<std::mutex> lock(mMutex);
+	mImages[name].variants.swap(source.variants);
+	return true;
+}
+
+void ImageStore::serve(const HttpRequest& request, HttpResponse& response){
+	if (request.method != "GET"){
+		response.status = 405;
+		return;
+	}
+	if (request.path.compare(0, sizeof(kImagesPrefix) - 1, kImagesPrefix) != 0){
+		response.status = 404;
+		return;
+	}
+	std::map<std::string, Source>::iterator found = mImages.find(urlDecode(request.path.substr(sizeof(kImagesPrefix) - 1)));
+	if (found == mImages.end()){
+		response.status = 404;
+		return;
+	}
+
+	//Requested size, one of kImageSizes or the original
+	std::string widthText = request.param("w"), heightText = request.param("h");
+	unsigned long long key = 0;
+	if (!widthText.empty() || !heightText.empty()) key = sizeKey(strtoul(widthText.c_str(), NULL, 10), strtoul(heightText.c_str(), NULL, 10));
+	std::map<unsigned long long, Variant>::const_iterator variant = found->second.variants.find(key);
+	if (variant == found->second.variants.end()){
+		response.status = 400;
+		return;
+	}
+
+	response.contentType = "image/jpeg";
+	response.headers["Cache-Control"] = "private, max-age=3600"; //a patient's card, never kept by shared caches
+	response.headers["ETag"] = variant->second.etag;
+	if (matchesEtag(request.header("if-none-match"), variant->second.etag)) response.status = 304;
+	else response.sharedBody = variant->second.jpeg;
+}
+
+size_t ImageStore::size(){
+	std::lock_guard<std::mutex> lock(mMutex);
+	return mImages.size();
+}
+
+size_t ImageStore::memoryBytes(){
+	std::lock_guard<std::mutex> lock(mMutex);
+	size_t bytes = 0;
+	for (std::map<std::string, Source>::iterator i = mImages.begin(); i != mImages.end(); ++i){
+		for (std::map<unsigned long long, Variant>::iterator j = i->second.variants.begin(); j != i->second.variants.end(); ++j){
+			bytes += j->second.jpeg->capacity();
+		}
+	}
+	return bytes;
+}
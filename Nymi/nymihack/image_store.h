@@ -0,0 +1,55 @@
+#ifndef IMAGE_STORE_H
+#define IMAGE_STORE_H
+
+#include "http_server.h"
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+static const int kJpegQuality = 85;
+
+/*
+Health card images for infoPage.php, served as JPEG by size by serve():
+	GET /images/<name>[?w=400&h=250]   the original size without w and h, else one of the sizes
+	                                    the pages show (kImageSizes in image_store.cpp), 400 for others
+Each image is decoded from the lossless TIFF scan, resampled (see resizeImage) and encoded once per
+size when loaded, so serving never encodes: the server is reachable from the terminals' network and
+mustn't re-encode on demand. Responses share the cached bytes. Every variant has a strong ETag, so a
+browser revalidating with If-None-Match gets a 304 without them.
+*/
+class ImageStore{
+public:
+	ImageStore();
+
+	/*
+	Decodes an image and serves it under a name. Called before serving starts.
+	@return false if the file couldn't be read or decoded
+	*/
+	bool load(const std::string& name, const std::string& path);
+
+	/*
+	HTTP handler for the endpoint above
+	*/
+	void serve(const HttpRequest& request, HttpResponse& response);
+
+	size_t size(); //images loaded
+	size_t memoryBytes(); //of the encoded variants
+
+private:
+	struct Variant{
+		std::shared_ptr<const std::string> jpeg;
+		std::string etag; //quoted, as sent
+	};
+	struct Source{
+		std::map<unsigned long long, Variant> variants; //by requested width << 32 | height, 0 for the original
+	};
+
+	std::mutex mMutex;
+	std::map<std::string, Source> mImages; //not changed once serving started, so images are read unlocked
+};
+
+extern ImageStore gImages; //Global image store
+
+#endif
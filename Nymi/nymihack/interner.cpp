@@ -0,0 +1,72 @@
+#include "interner.h"
+
+#include <cstring>
+
+static const size_t kInitialSlots = 64; //power of two
+
+/*
+FNV-1a, short strings hash in a few cycles
+*/
+static size_t hashText(const char* text, size_t length){
+	unsigned hash = 2166136261u;
+	for (size_t i = 0; i < length; ++i){
+		hash ^= (unsigned char)text[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+StringInterner::StringInterner(){
+	mOffsets.push_back(0);
+	mOffsets.push_back(0); //id 0, the empty string
+	mSlots.assign(kInitialSlots, 0);
+	mSlots[hashText("", 0) & (kInitialSlots - 1)] = 1;
+}
+
+/*
+Finds the slot holding a string, or the empty slot where it would go
+*/
+size_t StringInterner::slotOf(const char* text, size_t length) const{
+	size_t mask = mSlots.size() - 1;
+	size_t slot = hashText(text, length) & mask;
+	while (mSlots[slot] != 0){
+		unsigned id = mSlots[slot] - 1;
+		if (this->length(id) == length && memcmp(this->text(id), text, length) == 0) return slot;
+		slot = (slot + 1) & mask;
+	}
+	return slot;
+}
+
+unsigned StringInterner::intern(const char* text, size_t length){
+	size_t slot = slotOf(text, length);
+	if (mSlots[slot] != 0) return mSlots[slot] - 1;
+
+	unsigned id = (unsigned)size();
+	mArena.insert(mArena.end(), text, text + length);
+	mOffsets.push_back((unsigned)mArena.size());
+	mSlots[slot] = id + 1;
+	if (size() * 2 > mSlots.size()) grow(); //kept at most half full so probes stay short
+	return id;
+}
+
+bool StringInterner::find(const std::string& text, unsigned& id) const{
+	size_t slot = slotOf(text.data(), text.size());
+	if (mSlots[slot] == 0) return false;
+	id = mSlots[slot] - 1;
+	return true;
+}
+
+void StringInterner::grow(){
+	std::vector<unsigned> slots(mSlots.size() * 2, 0);
+	size_t mask = slots.size() - 1;
+	for (unsigned id = 0; id < size(); ++id){
+		size_t slot = hashText(text(id), length(id)) & mask;
+		while (slots[slot] != 0) slot = (slot + 1) & mask;
+		slots[slot] = id + 1;
+	}
+	mSlots.swap(slots);
+}
+
+size_t StringInterner::memoryBytes() const{
+	return mArena.capacity() + mOffsets.capacity() * sizeof(unsigned) + mSlots.capacity() * sizeof(unsigned);
+}
@@ -0,0 +1,45 @@
+#ifndef INTERNER_H
+#define INTERNER_H
+
+#include <string>
+#include <vector>
+
+/*
+Dictionary of repeated strings (allergens, sex codes, relationships, donor codes).
+Each distinct string is stored once in a contiguous arena and named by a dense id, so a record
+holds 4 bytes instead of a std::string. Id 0 is always the empty string. Ids are never freed.
+Not synchronized: the owner locks around it.
+*/
+class StringInterner{
+public:
+	StringInterner();
+
+	/*
+	Returns the id of a string, adding it if it's new
+	*/
+	unsigned intern(const char* text, size_t length);
+	unsigned intern(const std::string& text){ return intern(text.data(), text.size()); }
+
+	/*
+	Looks up a string without adding it
+	@return false if the string was never interned
+	*/
+	bool find(const std::string& text, unsigned& id) const;
+
+	const char* text(unsigned id) const{ return mArena.data() + mOffsets[id]; }
+	size_t length(unsigned id) const{ return mOffsets[id + 1] - mOffsets[id]; }
+	std::string str(unsigned id) const{ return std::string(text(id), length(id)); }
+
+	size_t size() const{ return mOffsets.size() - 1; } //number of distinct strings
+	size_t memoryBytes() const;
+
+private:
+	size_t slotOf(const char* text, size_t length) const;
+	void grow();
+
+	std::vector<char> mArena;
+	std::vector<unsigned> mOffsets; //start of every string in mArena, plus the end of the last one
+	std::vector<unsigned> mSlots; //open addressing table of id + 1, 0 for an empty slot
+};
+
+#endif
@@ -0,0 +1,266 @@
+#include "jpeg.h"
+
+#include <algorithm>
+#include <cmath>
+
+//Natural order index of each coefficient in zigzag order
+static const unsigned char kZigzag[64] = {
+	0, 1, 8, 16, 9, 2, 3, 10, 17, 24, 32, 25, 18, 11, 4, 5, 12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13, 6, 7, 14, 21, 28,
+	35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51, 58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63
+};
+
+//Example quantization tables of the JPEG standard, Annex K, in natural order
+static const unsigned char kLumaQuantization[64] = {
+	16, 11, 10, 16, 24, 40, 51, 61, 12, 12, 14, 19, 26, 58, 60, 55, 14, 13, 16, 24, 40, 57, 69, 56, 14, 17, 22, 29, 51, 87, 80, 62,
+	18, 22, 37, 56, 68, 109, 103, 77, 24, 35, 55, 64, 81, 104, 113, 92, 49, 64, 78, 87, 103, 121, 120, 101, 72, 92, 95, 98, 112, 100, 103, 99
+};
+static const unsigned char kChromaQuantization[64] = {
+	17, 18, 24, 47, 99, 99, 99, 99, 18, 21, 26, 66, 99, 99, 99, 99, 24, 26, 56, 99, 99, 99, 99, 99, 47, 66, 99, 99, 99, 99, 99, 99,
+	99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99
+};
+
+//Example Huffman tables of Annex K: codes per length 1 to 16, then the symbols
+static const unsigned char kDcLumaBits[16] = { 0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0 };
+static const unsigned char kDcChromaBits[16] = { 0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0 };
+static const unsigned char kDcValues[12] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11 };
+static const unsigned char kAcLumaBits[16] = { 0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7d };
+static const unsigned char kAcLumaValues[162] = {
+	0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07,
+	0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xa1, 0x08, 0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52, 0xd1, 0xf0,
+	0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0a, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x25, 0x26, 0x27, 0x28,
+	0x29, 0x2a, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49,
+	0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69,
+	0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+	0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7,
+	0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5,
+	0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe1, 0xe2,
+	0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+	0xf9, 0xfa
+};
+static const unsigned char kAcChromaBits[16] = { 0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77 };
+static const unsigned char kAcChromaValues[162] = {
+	0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61, 0x71,
+	0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91, 0xa1, 0xb1, 0xc1, 0x09, 0x23, 0x33, 0x52, 0xf0,
+	0x15, 0x62, 0x72, 0xd1, 0x0a, 0x16, 0x24, 0x34, 0xe1, 0x25, 0xf1, 0x17, 0x18, 0x19, 0x1a, 0x26,
+	0x27, 0x28, 0x29, 0x2a, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48,
+	0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68,
+	0x69, 0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+	0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5,
+	0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3,
+	0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda,
+	0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+	0xf9, 0xfa
+};
+
+/*
+Code and length of every symbol of a Huffman table
+*/
+struct HuffmanCodes{
+	unsigned short code[256];
+	unsigned char length[256];
+};
+
+static void buildCodes(const unsigned char* bits, const unsigned char* values, HuffmanCodes& codes){
+	std::fill(codes.length, codes.length + 256, 0);
+	unsigned code = 0;
+	size_t k = 0;
+	for (unsigned length = 1; length <= 16; ++length){
+		for (unsigned i = 0; i < bits[length - 1]; ++i, ++k){
+			codes.code[values[k]] = (unsigned short)code++;
+			codes.length[values[k]] = (unsigned char)length;
+		}
+		code <<= 1;
+	}
+}
+
+/*
+Entropy coded segment, with a zero stuffed after every 0xff byte
+*/
+class BitWriter{
+public:
+	BitWriter(std::string& out) : mOut(out), mBuffer(0), mCount(0){}
+
+	void put(unsigned bits, unsigned length){
+		mBuffer = (mBuffer << length) | (bits & ((1u << length) - 1));
+		mCount += length;
+		while (mCount >= 8){
+			unsigned char byte = (unsigned char)(mBuffer >> (mCount - 8));
+			mOut += (char)byte;
+			if (byte == 0xff) mOut += '\0';
+			mCount -= 8;
+		}
+	}
+
+	void flush(){
+		if (mCount > 0) put(0x7f, 8 - mCount); //padded with ones
+	}
+
+private:
+	std::string& mOut;
+	unsigned mBuffer;
+	unsigned mCount;
+};
+
+static void putWord(std::string& out, unsigned value){
+	out += (char)(value >> 8);
+	out += (char)(value & 0xff);
+}
+
+static void putHuffmanTable(std::string& out, unsigned classAndId, const unsigned char* bits, const unsigned char* values, size_t count){
+	out += (char)classAndId;
+	out.append((const char*)bits, 16);
+	out.append((const char*)values, count);
+}
+
+/*
+Magnitude category of a coefficient, the low bits of its symbol
+@param[out] bits what follows the symbol: the value in that many bits, less one if negative
+*/
+static unsigned category(int value, unsigned& bits){
+	unsigned magnitude = (unsigned)(value < 0 ? -value : value);
+	unsigned length = 0;
+	while (magnitude >> length) ++length;
+	bits = value < 0 ? (unsigned)(value - 1) : (unsigned)value;
+	return length;
+}
+
+static float gCosines[8][8]; //[x][u] of the forward DCT, scaled by C(u) / 2
+
+static bool initCosines(){
+	const double pi = 3.14159265358979323846;
+	for (int x = 0; x < 8; ++x){
+		for (int u = 0; u < 8; ++u){
+			gCosines[x][u] = (float)(std::cos((2 * x + 1) * u * pi / 16) * (u == 0 ? std::sqrt(0.5) : 1.0) * 0.5);
+		}
+	}
+	return true;
+}
+
+static const bool gCosinesReady = initCosines();
+
+/*
+Transforms, quantizes and entropy codes one 8x8 block of level shifted samples
+@param[in,out] dc previous DC coefficient of the component
+*/
+static void encodeBlock(BitWriter& writer, const float* block, const float* divisors, const HuffmanCodes& dcCodes, const HuffmanCodes& acCodes, int& dc){
+	float rows[64], coefficients[64];
+	for (int y = 0; y < 8; ++y){
+		for (int u = 0; u < 8; ++u){
+			float sum = 0;
+			for (int x = 0; x < 8; ++x) sum += block[y * 8 + x] * gCosines[x][u];
+			rows[y * 8 + u] = sum;
+		}
+	}
+	for (int u = 0; u < 8; ++u){
+		for (int v = 0; v < 8; ++v){
+			float sum = 0;
+			for (int y = 0; y < 8; ++y) sum += rows[y * 8 + u] * gCosines[y][v];
+			coefficients[v * 8 + u] = sum;
+		}
+	}
+	int quantized[64];
+	for (int k = 0; k < 64; ++k){
+		float value = coefficients[kZigzag[k]] * divisors[k];
+		quantized[k] = (int)(value < 0 ? value - 0.5f : value + 0.5f);
+	}
+
+	unsigned bits;
+	unsigned length = category(quantized[0] - dc, bits);
+	dc = quantized[0];
+	writer.put(dcCodes.code[length], dcCodes.length[length]);
+	if (length > 0) writer.put(bits, length);
+	int last = 63;
+	while (last > 0 && quantized[last] == 0) --last;
+	unsigned run = 0;
+	for (int k = 1; k <= last; ++k){
+		if (quantized[k] == 0){
+			++run;
+			continue;
+		}
+		while (run > 15){
+			writer.put(acCodes.code[0xf0], acCodes.length[0xf0]); //sixteen zeros
+			run -= 16;
+		}
+		length = category(quantized[k], bits);
+		unsigned symbol = (run << 4) | length;
+		writer.put(acCodes.code[symbol], acCodes.length[symbol]);
+		writer.put(bits, length);
+		run = 0;
+	}
+	if (last < 63) writer.put(acCodes.code[0x00], acCodes.length[0x00]); //end of block
+}
+
+void encodeJpeg(const Image& image, int quality, std::string& out){
+	quality = std::min(100, std::max(1, quality));
+	int scale = quality < 50 ? 5000 / quality : 200 - quality * 2;
+	unsigned char luma[64], chroma[64]; //in zigzag order, as DQT stores them
+	float lumaDivisors[64], chromaDivisors[64];
+	for (int k = 0; k < 64; ++k){
+		luma[k] = (unsigned char)std::min(255, std::max(1, (kLumaQuantization[kZigzag[k]] * scale + 50) / 100));
+		chroma[k] = (unsigned char)std::min(255, std::max(1, (kChromaQuantization[kZigzag[k]] * scale + 50) / 100));
+		lumaDivisors[k] = 1.0f / luma[k];
+		chromaDivisors[k] = 1.0f / chroma[k];
+	}
+	HuffmanCodes dcLuma, acLuma, dcChroma, acChroma;
+	buildCodes(kDcLumaBits, kDcValues, dcLuma);
+	buildCodes(kAcLumaBits, kAcLumaValues, acLuma);
+	buildCodes(kDcChromaBits, kDcValues, dcChroma);
+	buildCodes(kAcChromaBits, kAcChromaValues, acChroma);
+
+	out.clear();
+	out.reserve((size_t)image.width * image.height / 2 + 1024);
+	static const unsigned char kHeader[] = {
+		0xff, 0xd8, //start of image
+		0xff, 0xe0, 0, 16, 'J', 'F', 'I', 'F', 0, 1, 1, 0, 0, 1, 0, 1, 0, 0 //JFIF 1.01, square pixels
+	};
+	out.append((const char*)kHeader, sizeof(kHeader));
+	putWord(out, 0xffdb);
+	putWord(out, 2 + 2 * 65);
+	out += '\0';
+	out.append((const char*)luma, 64);
+	out += '\1';
+	out.append((const char*)chroma, 64);
+	putWord(out, 0xffc0); //baseline frame, three components sampled 1x1
+	putWord(out, 17);
+	out += (char)8;
+	putWord(out, image.height);
+	putWord(out, image.width);
+	out += (char)3;
+	static const unsigned char kComponents[] = { 1, 0x11, 0, 2, 0x11, 1, 3, 0x11, 1 };
+	out.append((const char*)kComponents, sizeof(kComponents));
+	putWord(out, 0xffc4);
+	putWord(out, 2 + 4 * 17 + 2 * sizeof(kDcValues) + 2 * sizeof(kAcLumaValues));
+	putHuffmanTable(out, 0x00, kDcLumaBits, kDcValues, sizeof(kDcValues));
+	putHuffmanTable(out, 0x10, kAcLumaBits, kAcLumaValues, sizeof(kAcLumaValues));
+	putHuffmanTable(out, 0x01, kDcChromaBits, kDcValues, sizeof(kDcValues));
+	putHuffmanTable(out, 0x11, kAcChromaBits, kAcChromaValues, sizeof(kAcChromaValues));
+	putWord(out, 0xffda);
+	putWord(out, 12);
+	static const unsigned char kScan[] = { 3, 1, 0x00, 2, 0x11, 3, 0x11, 0, 63, 0 };
+	out.append((const char*)kScan, sizeof(kScan));
+
+	BitWriter writer(out);
+	int dcY = 0, dcCb = 0, dcCr = 0;
+	float y[64], cb[64], cr[64];
+	for (unsigned top = 0; top < image.height; top += 8){
+		for (unsigned left = 0; left < image.width; left += 8){
+			for (unsigned row = 0; row < 8; ++row){
+				//Blocks past the edge repeat its last row and column
+				unsigned sy = std::min(top + row, image.height - 1);
+				for (unsigned column = 0; column < 8; ++column){
+					unsigned sx = std::min(left + column, image.width - 1);
+					const unsigned char* pixel = &image.pixels[((size_t)sy * image.width + sx) * 4];
+					float r = pixel[0], g = pixel[1], b = pixel[2];
+					y[row * 8 + column] = 0.299f * r + 0.587f * g + 0.114f * b - 128;
+					cb[row * 8 + column] = -0.168736f * r - 0.331264f * g + 0.5f * b;
+					cr[row * 8 + column] = 0.5f * r - 0.418688f * g - 0.081312f * b;
+				}
+			}
+			encodeBlock(writer, y, lumaDivisors, dcLuma, acLuma, dcY);
+			encodeBlock(writer, cb, chromaDivisors, dcChroma, acChroma, dcCb);
+			encodeBlock(writer, cr, chromaDivisors, dcChroma, acChroma, dcCr);
+		}
+	}
+	writer.flush();
+	putWord(out, 0xffd9); //end of image
+}
@@ -0,0 +1,16 @@
+#ifndef JPEG_H
+#define JPEG_H
+
+#include "image.h"
+
+#include <string>
+
+/*
+Encodes an image as a baseline JFIF JPEG: YCbCr without chroma subsampling, so the small print on
+a health card keeps its colour edges, with the example tables of the JPEG standard. Alpha is ignored.
+@param[in] quality 1 to 100, scaling the quantization tables like libjpeg does
+@param[out] out the file
+*/
+void encodeJpeg(const Image& image, int quality, std::string& out);
+
+#endif
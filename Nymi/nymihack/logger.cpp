@@ -0,0 +1,202 @@
+#include "logger.h"
+#include "clock.h"
+#include "ncl.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <sstream>
+
+#if defined(_WIN32)
+#include <windows.h>
+#define LOG_THREAD_LOCAL __declspec(thread)
+#else
+#include <pthread.h>
+#define LOG_THREAD_LOCAL __thread
+#endif
+
+AsyncLogger gLog;
+
+static const unsigned kBufferEntries = 1024; //per thread, a power of two
+static const unsigned kWriteIntervalMillis = 20;
+
+struct AsyncLogger::Buffer{
+	Buffer() : head(0), tail(0), dropped(0), retired(false){}
+	LogEntry entries[kBufferEntries];
+	std::atomic<unsigned> head; //next entry the writer reads
+	std::atomic<unsigned> tail; //next entry the owning thread fills
+	std::atomic<unsigned long long> dropped;
+	std::atomic<bool> retired; //owning thread exited, freed once drained
+};
+
+static LOG_THREAD_LOCAL AsyncLogger::Buffer* tBuffer = NULL;
+
+/*
+Marks a thread's buffer retired when the thread exits, so the writer can free it after draining
+*/
+#if defined(_WIN32)
+static VOID WINAPI retireBuffer(PVOID buffer){
+	if (buffer) ((AsyncLogger::Buffer*)buffer)->retired = true;
+}
+static DWORD gExitSlot = FlsAlloc(retireBuffer);
+#else
+static void retireBuffer(void* buffer){
+	if (buffer) ((AsyncLogger::Buffer*)buffer)->retired = true;
+}
+static pthread_key_t makeExitSlot(){
+	pthread_key_t key;
+	pthread_key_create(&key, retireBuffer);
+	return key;
+}
+static pthread_key_t gExitSlot = makeExitSlot();
+#endif
+
+AsyncLogger::AsyncLogger() : mStream(NULL), mStartedAt(0), mRetiredDropped(0), mRunning(false){}
+
+AsyncLogger::~AsyncLogger(){
+	stop();
+}
+
+void AsyncLogger::start(FILE* stream){
+	std::lock_guard<std::mutex> lock(mMutex);
+	if (mRunning) return;
+	mStream = stream;
+	mStartedAt = monotonicNanos();
+	mRunning = true;
+	mWriter = std::thread(&AsyncLogger::run, this);
+}
+
+void AsyncLogger::stop(){
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		if (!mRunning) return;
+		mRunning = false;
+	}
+	mWake.notify_all();
+	mWriter.join();
+}
+
+FILE* AsyncLogger::stream(){
+	return mStream;
+}
+
+AsyncLogger::Buffer* AsyncLogger::registerThread(){
+	Buffer* buffer = new Buffer();
+#if defined(_WIN32)
+	FlsSetValue(gExitSlot, buffer);
+#else
+	pthread_setspecific(gExitSlot, buffer);
+#endif
+	std::lock_guard<std::mutex> lock(mBuffersMutex);
+	mBuffers.push_back(buffer);
+	return buffer;
+}
+
+LogEntry* AsyncLogger::reserve(){
+	Buffer* buffer = tBuffer;
+	if (!buffer) buffer = tBuffer = registerThread();
+	unsigned tail = buffer->tail.load(std::memory_order_relaxed);
+	if (tail - buffer->head.load(std::memory_order_acquire) == kBufferEntries){
+		buffer->dropped.fetch_add(1, std::memory_order_relaxed);
+		return NULL;
+	}
+	LogEntry* entry = &buffer->entries[tail & (kBufferEntries - 1)];
+	entry->timestamp = monotonicNanos();
+	return entry;
+}
+
+void AsyncLogger::commit(){
+	Buffer* buffer = tBuffer;
+	buffer->tail.store(buffer->tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+/*
+Moves every committed entry out of the thread buffers and frees buffers of exited threads
+@return number of entries taken
+*/
+size_t AsyncLogger::drain(std::vector<LogEntry>& entries){
+	std::lock_guard<std::mutex> lock(mBuffersMutex);
+	size_t before = entries.size();
+	for (size_t i = 0; i < mBuffers.size();){
+		Buffer* buffer = mBuffers[i];
+		bool retired = buffer->retired.load(); //read first: entries committed before retiring are drained below
+		unsigned head = buffer->head.load(std::memory_order_relaxed);
+		unsigned tail = buffer->tail.load(std::memory_order_acquire);
+		for (; head != tail; ++head){
+			entries.push_back(buffer->entries[head & (kBufferEntries - 1)]);
+		}
+		buffer->head.store(head, std::memory_order_release);
+		if (retired){
+			mRetiredDropped += buffer->dropped.load();
+			delete buffer;
+			mBuffers.erase(mBuffers.begin() + i);
+		}
+		else{
+			++i;
+		}
+	}
+	return entries.size() - before;
+}
+
+static bool earlier(const LogEntry& a, const LogEntry& b){
+	return a.timestamp < b.timestamp;
+}
+
+/*
+Formats entries in the order they were logged and writes them in one go
+*/
+void AsyncLogger::write(std::vector<LogEntry>& entries){
+	if (!mStream) return;
+	std::stable_sort(entries.begin(), entries.end(), earlier);
+	std::ostringstream out;
+	for (size_t i = 0; i < entries.size(); ++i){
+		const LogEntry& entry = entries[i];
+		out << "[" << std::fixed << std::setprecision(6) << std::setw(12) << (entry.timestamp - mStartedAt) / 1e9 << "] ";
+		out.unsetf(std::ios::floatfield);
+		out << std::setprecision(6);
+		unsigned arg = 0;
+		for (const char* c = entry.format; *c; ++c){
+			if (c[0] == '{' && c[1] == '}' && arg < entry.count){
+				switch (entry.types[arg]){
+				case LogEntry::ARG_INT: out << entry.args[arg].i; break;
+				case LogEntry::ARG_UINT: out << entry.args[arg].u; break;
+				case LogEntry::ARG_DOUBLE: out << entry.args[arg].d; break;
+				case LogEntry::ARG_TEXT: out.write(entry.text + entry.args[arg].text.offset, entry.args[arg].text.length); break;
+				}
+				++arg;
+				++c;
+			}
+			else{
+				out << *c;
+			}
+		}
+		out << "\n";
+	}
+	std::string text = out.str();
+	//Fails before nclInit and in synchronous mode, when the NCL isn't writing on its own anyway
+	bool locked = nclLockErrorStream() == NCL_TRUE;
+	fwrite(text.data(), 1, text.size(), mStream);
+	fflush(mStream);
+	if (locked) nclUnlockErrorStream();
+}
+
+void AsyncLogger::run(){
+	std::vector<LogEntry> entries;
+	std::unique_lock<std::mutex> lock(mMutex);
+	while (true){
+		mWake.wait_for(lock, std::chrono::milliseconds(kWriteIntervalMillis), [this]{ return !mRunning; });
+		bool running = mRunning;
+		lock.unlock();
+		entries.clear();
+		if (drain(entries)) write(entries);
+		lock.lock();
+		if (!running) return;
+	}
+}
+
+unsigned long long AsyncLogger::dropped(){
+	std::lock_guard<std::mutex> lock(mBuffersMutex);
+	unsigned long long total = mRetiredDropped.load();
+	for (size_t i = 0; i < mBuffers.size(); ++i) total += mBuffers[i]->dropped.load();
+	return total;
+}
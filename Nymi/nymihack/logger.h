@@ -0,0 +1,144 @@
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+static const unsigned kMaxLogArgs = 6;
+static const unsigned kLogTextBytes = 64; //room for copies of string arguments in one entry
+
+/*
+One log call as it sits in a thread's buffer, not yet formatted
+*/
+struct LogEntry{
+	enum ArgType{ ARG_INT, ARG_UINT, ARG_DOUBLE, ARG_TEXT };
+
+	long long timestamp; //monotonicNanos() of the call
+	const char* format; //string literal with a {} per argument
+	unsigned char count;
+	unsigned char textUsed;
+	unsigned char types[kMaxLogArgs];
+	union{
+		long long i;
+		unsigned long long u;
+		double d;
+		struct{ unsigned short offset, length; } text; //copied into text below
+	} args[kMaxLogArgs];
+	char text[kLogTextBytes];
+};
+
+inline void logArg(LogEntry& entry, long long value){
+	if (entry.count == kMaxLogArgs) return;
+	entry.types[entry.count] = LogEntry::ARG_INT;
+	entry.args[entry.count++].i = value;
+}
+inline void logArg(LogEntry& entry, unsigned long long value){
+	if (entry.count == kMaxLogArgs) return;
+	entry.types[entry.count] = LogEntry::ARG_UINT;
+	entry.args[entry.count++].u = value;
+}
+inline void logArg(LogEntry& entry, double value){
+	if (entry.count == kMaxLogArgs) return;
+	entry.types[entry.count] = LogEntry::ARG_DOUBLE;
+	entry.args[entry.count++].d = value;
+}
+inline void logArg(LogEntry& entry, const char* value, size_t length){
+	if (entry.count == kMaxLogArgs) return;
+	if (length > kLogTextBytes - entry.textUsed) length = kLogTextBytes - entry.textUsed; //truncated
+	memcpy(entry.text + entry.textUsed, value, length);
+	entry.types[entry.count] = LogEntry::ARG_TEXT;
+	entry.args[entry.count].text.offset = entry.textUsed;
+	entry.args[entry.count++].text.length = (unsigned short)length;
+	entry.textUsed += (unsigned char)length;
+}
+inline void logArg(LogEntry& entry, int value){ logArg(entry, (long long)value); }
+inline void logArg(LogEntry& entry, long value){ logArg(entry, (long long)value); }
+inline void logArg(LogEntry& entry, unsigned value){ logArg(entry, (unsigned long long)value); }
+inline void logArg(LogEntry& entry, unsigned long value){ logArg(entry, (unsigned long long)value); }
+inline void logArg(LogEntry& entry, bool value){ logArg(entry, (long long)value); }
+inline void logArg(LogEntry& entry, const char* value){ logArg(entry, value ? value : "(null)", value ? strlen(value) : 6); }
+inline void logArg(LogEntry& entry, const std::string& value){ logArg(entry, value.data(), value.size()); }
+
+inline void logArgs(LogEntry&){}
+
+template <typename T, typename... Rest>
+void logArgs(LogEntry& entry, const T& value, const Rest&... rest){
+	logArg(entry, value);
+	logArgs(entry, rest...);
+}
+
+/*
+Asynchronous logger for the NCL callback and the worker threads.
+A log call copies its format pointer and arguments into a lock-free single-producer buffer owned
+by the calling thread, so the event path never formats or makes a syscall. A background thread
+drains all buffers, formats the entries in timestamp order and writes them to the stream the NCL
+was given, holding nclLockErrorStream while it writes so NCL errors and our lines don't interleave.
+A full buffer drops the entry and counts it rather than blocking.
+*/
+class AsyncLogger{
+public:
+	AsyncLogger();
+	~AsyncLogger();
+
+	/*
+	Takes ownership of the stream and starts the writer thread
+	@param[in] stream stream for both our log lines and the NCL's errors, passed on to nclInit through
+	stream(). NULL discards log lines.
+	*/
+	void start(FILE* stream);
+
+	/*
+	Writes what is still buffered and stops the writer thread
+	*/
+	void stop();
+
+	FILE* stream();
+
+	/*
+	Logs a line. The format must be a string literal: it is read later, on the writer thread.
+	Each {} is replaced by the next argument; a newline is appended.
+	*/
+	template <typename... Args>
+	void log(const char* format, const Args&... args){
+		LogEntry* entry = reserve();
+		if (!entry) return;
+		entry->format = format;
+		entry->count = 0;
+		entry->textUsed = 0;
+		logArgs(*entry, args...);
+		commit();
+	}
+
+	unsigned long long dropped(); //entries lost to full buffers
+
+	struct Buffer;
+
+private:
+	LogEntry* reserve();
+	void commit();
+	Buffer* registerThread();
+	void run();
+	size_t drain(std::vector<LogEntry>& entries);
+	void write(std::vector<LogEntry>& entries);
+
+	FILE* mStream;
+	long long mStartedAt;
+	std::mutex mBuffersMutex;
+	std::vector<Buffer*> mBuffers;
+	std::atomic<unsigned long long> mRetiredDropped; //dropped by buffers already freed
+
+	std::mutex mMutex;
+	std::condition_variable mWake;
+	std::thread mWriter;
+	bool mRunning;
+};
+
+extern AsyncLogger gLog; //Global logger, started by main with the NCL error stream
+
+#endif
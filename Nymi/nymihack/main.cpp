@@ -1,106 +1,49 @@
 
 #include "ncl.h"
+#include "nea.h"
+#include "command_queue.h"
+#include "connection_profiles.h"
+#include "connection_sweep.h"
+#include "continuous_finder.h"
+#include "event_journal.h"
+#include "http_server.h"
+#include "image_store.h"
+#include "logger.h"
+#include "metrics.h"
+#include "nclevents.h"
+#include "identity_timing.h"
+#include "proximity.h"
+#include "scan_maintenance.h"
+#include "reconnect.h"
+#include "records.h"
+#include "recovery.h"
+#include "sessions.h"
+#include "static_files.h"
+#include "validation_bus.h"
+#include "validation_status.h"
 
 #include <string>
+#include <cstring>
 #include <iostream>
 #include <vector>
 #include <fstream>
 using namespace std;
-bool gNclInitialized = false;	//Global variable to maintain the state of the NCL
-int gHandle = -1; //Global variable to maintain the current connected Nymi handle
-std::vector<NclProvision> gProvisions; //Global vector for storing the list of provisioned Nymi
-int retval = 0;
-ofstream myfile;
+static const unsigned short kMetricsPort = 9108;
+static const unsigned short kRecordsPort = 9109;
+static const unsigned kRecordWorkers = 8; //edits waiting on the disk leave the others to serve reads
+static const unsigned short kWebPort = 9110;
+static const unsigned kWebWorkers = 4;
+static const char kWebRoot[] = "../../Web/"; //the site, from the project directory the NEA runs in
+
 /*
-Function for handling the events thrown by the NCL
-@param[in] event NclEvent that contains the event type and member variables
-@param[in] userData Data that needs to be passed to the callback functions if provided
+Prints a replayed event, touching nothing of the running NEA's state
 */
-void callback(NclEvent event, void* userData){
-	NclBool res;
-	switch (event.type){
-	case NCL_EVENT_INIT:
-		if (event.init.success){
-			gNclInitialized = true;
-			std::cout << "log: init succeeded, getting info\n";
-			//NclInfo info = nclInfo(); //Prints current initialization configuration
-			//std::cout << info.string;
-		}
-		else exit(-1);
-		break;
-	case NCL_EVENT_ERROR:
-		exit(-1);
-		break;
-	case NCL_EVENT_DISCOVERY:
-		std::cout << "log: Nymi discovered\n";
-		res = nclStopScan();	//Stops scanning to prevent discovering new Nymis
-		if (res){
-			std::cout << "Stopping Scan successful\n";
-		}
-		else{
-			std::cout << "Stopping Scan failed\n";
-		}
-
-		gHandle = event.discovery.nymiHandle;
-		res = nclAgree(gHandle); //Initiates the provisioning process with discovered Nymi
-		if (res){
-			std::cout << "Agree request successful\n";
-		}
-		else{
-			std::cout << "Agree request failed\n";
-		}
-		break;
-	case NCL_EVENT_FIND:
-		std::cout << "log: Nymi found\n";
-		res = nclStopScan(); //Stops scanning to prevent more find events
-		if (res){
-			std::cout << "Stopping Scan successful\n";
-		}
-		else{
-			std::cout << "Stopping Scan failed\n";
-		}
-
-		gHandle = event.find.nymiHandle;
-		res = nclValidate(gHandle); //Validates the found Nymi
-		if (res){
-			std::cout << "Validate request successful\n";
-		}
-		else{
-			std::cout << "Validaterequest failed\n";
-		}
-		break;
-	case NCL_EVENT_DISCONNECTION:
-		std::cout << "log: disconnected\n";
-		gHandle = -1; //Uninitialize the Nymi handle
-		break;
-	case NCL_EVENT_AGREEMENT:
-		//Displays the LED pattern for user confirmation
-		std::cout << "Is this:\n";
-		for (unsigned i = 0; i<NCL_AGREEMENT_PATTERNS; ++i){
-			for (unsigned j = 0; j<NCL_LEDS; ++j)
-				std::cout << event.agreement.leds[i][j];
-			std::cout << "\n";
-		}
-		std::cout << "the correct LED pattern (agree/reject)?\n";
-		break;
-	case NCL_EVENT_PROVISION:
-		//Store the provision information in a vector. Ideally this information
-		//is stored in persistent memory to be used later for future validations
-		gProvisions.push_back(event.provision.provision);
-		std::cout << "log: provisioned\n";
-		break;
-	case NCL_EVENT_VALIDATION:
-		std::cout << "Nymi validated! Now trusted user requests can happen, such as request Symmetric Keys!\n";
-		retval = 1;
-		bool auth = true;
-		myfile.open("C:/Users/Danielle/Documents/Visual Studio 2013/Projects/nymihack/nymihack/example.txt");
-		//retval = 220;
-		myfile << auth;
-		myfile.close();
-		
-		break;
-//	default: break;
-	}
+static void printReplayedEvent(NclEvent event, void* userData){
+	std::cout << nclEventName(event.type);
+	int nymiHandle = nclEventHandle(event);
+	if (nymiHandle != -1) std::cout << " Nymi " << nymiHandle;
+	if (event.type == NCL_EVENT_RSSI) std::cout << " rssi " << event.rssi.rssi;
+	std::cout << "\n";
 }
 
 /*
@@ -109,12 +52,39 @@ Main program function
 int main(){
 	std::cout << "Welcome to Hello Nymi!\n";
 	std::cout << "Enter \"provision\" if you want to start trusting a new Nymi.\n";
-	std::cout << "Enter \"validate\" if you want to find trusted Nymis and validate the first one found.\n";
-	std::cout << "Enter \"quit\" to quit.\n\n";
+	std::cout << "Enter \"validate\" if you want to find trusted Nymis and validate the nearest one.\n";
+	std::cout << "Enter \"continuous\" to keep finding and validate every arriving patient without an operator (again to stop).\n";
+	std::cout << "Enter \"proximity\" to list Nymis nearest first, \"desk <dB>\" to set how close a Nymi must be to get validated.\n";
+	std::cout << "Enter \"agree strong\" instead of \"agree\" to allow strong finds, which skip validation.\n";
+	std::cout << "Enter \"identity\" to compare time-to-identity of strong finds and validations.\n";
+	std::cout << "Enter \"gc\" to clear the list of scanned Nymis now.\n";
+	std::cout << "Enter \"stream\" to validate with streaming connection parameters and start ECG, \"ecgstop\" to stop it.\n";
+	std::cout << "Enter \"sweep\" to benchmark validation latency and ECG loss across connection parameters.\n";
+	std::cout << "Enter \"rssi\", \"firmware\", \"prg\", \"createsk\" or \"getsk\" to send a command to the validated Nymi.\n";
+	std::cout << "Enter \"link <health number>\" to link the validated Nymi to a patient's record.\n";
+	std::cout << "Enter \"station <id>\" to name the triage station this reader is at; its terminals open loading.php?station=<id>.\n";
+	std::cout << "Enter \"loadtest\" to let nymiload publish validations to the terminals as if this reader made them (again to stop).\n";
+	std::cout << "Enter \"allergic <allergen>\" to list the patients identified at the desk in the last two minutes who are allergic to it.\n";
+	std::cout << "Enter \"search <name>\" to find the records of a patient known only by name.\n";
+	std::cout << "Enter \"history <health number>\" to list the changes made to a patient's record.\n";
+	std::cout << "Enter \"replay <journal>\" to list a recorded event journal's events as they happened, \"replay <journal> fast\" to skip the recorded delays.\n";
+	std::cout << "To run them through the event handlers, replay the journal offline with nymibench <journal>.\n";
+	std::cout << "Enter \"quit\" to quit.\n";
+	std::cout << "Counters are served for Prometheus at http://127.0.0.1:" << kMetricsPort << "/metrics\n";
+	std::cout << "Patient records are served at http://127.0.0.1:" << kRecordsPort << "/records/current, whether one was just validated at /status?station=<id>\n";
+	std::cout << "Health card images are served to the terminals on port " << kWebPort << ", e.g. /images/healthCardFront?w=400&h=250\n";
+	std::cout << "So are the site's static files, e.g. /css/bootstrap.min.css\n\n";
 	
 	myfile.open("C:/Users/Danielle/Documents/Visual Studio 2013/Projects/nymihack/nymihack/example.txt");
 	myfile << "0";
 	myfile.close();
+	//Our log lines share stderr with the NCL's error messages; gLog writes them in batches
+	//from its own thread, holding the NCL's error stream lock
+	gLog.start(stderr);
+	//Records every NCL event to nymihack.journal.N for replaying incidents
+	if (!gJournal.open("nymihack.journal")){
+		gLog.log("log: event journal couldn't be opened, events won't be recorded");
+	}
 	//Only if using the Nymulator.
 	//127.0.0.1 is the localhost computer. Supply a different IP if using a different host computer
 	//9089 is the port the Nymulator is listening on
@@ -125,21 +95,93 @@ int main(){
 	//NULL indicates there is no data to be passed to the NCL callbacks
 	//'HelloNymi' is the name of this NEA program that will be provisioned in the Nymi
 	//NCL_MODE_DEFAULT to run NCL in the default mode
-	//stderr refers to the stream where the NCL logs will be printed
-	if (!nclInit(callback, NULL, "HelloNymi", NCL_MODE_DEFAULT, stderr)) return -1;
+	//gLog.stream() (stderr) refers to the stream where the NCL logs will be printed
+	//gRecovery keeps these parameters to reinitialize the NCL in-process if the dongle or ecodaemon fails
+	gRecovery.setRecoveredHandler(resumeAfterRecovery);
+	if (!gRecovery.init(callback, NULL, "HelloNymi", NCL_MODE_DEFAULT, gLog.stream())) return -1;
+	gContinuousFinder.setIdentifier(beginIdentification);
+	//Clears the NCL's list of scanned Nymis whenever nothing is connected and it has grown
+	gScanMaintenance.start(pauseScan, resumeScan);
+	//Reconnects validated sessions whose Nymi timed out, without the operator
+	gReconnect.start(lookupProvision, restoreScan, gScanMutex);
+
+	//Prometheus scrape endpoint, local only
+	HttpServer metricsServer;
+	bool serving = metricsServer.start("127.0.0.1", kMetricsPort, [](const HttpRequest& request, HttpResponse& response){
+		if (request.path != "/metrics"){
+			response.status = 404;
+			return;
+		}
+		response.contentType = "text/plain; version=0.0.4";
+		response.body = gMetrics.render();
+	});
+	if (!serving) gLog.log("log: metrics endpoint couldn't listen on port {}", kMetricsPort);
+
+	//Patient records for infoPage.php, local only. nymihack.records replaces the sample patient.
+	if (!gRecords.load("nymihack.records")) gRecords.seed();
+	//Edits made from infoPage.php since, replayed over it
+	if (!gRecordLog.open("nymihack.wal", [](const FieldUpdate& edit){ gRecords.update(edit, false); })){
+		gLog.log("log: record log nymihack.wal couldn't be opened, edits won't be saved");
+	}
+	gLog.log("log: {} patient records loaded in {} bytes", (unsigned long long)gRecords.size(), (unsigned long long)gRecords.memoryBytes());
+	HttpServer recordServer;
+	if (!recordServer.start("127.0.0.1", kRecordsPort, [](const HttpRequest& request, HttpResponse& response){
+		if (request.path == "/status") gValidationStatus.serve(request, response);
+		else if (request.path.compare(0, 10, "/stations/") == 0 || request.path.compare(0, 13, "/subscribers/") == 0) gValidations.serve(request, response);
+		else gRecords.serve(request, response);
+	}, kRecordWorkers)){
+		gLog.log("log: record service couldn't listen on port {}", kRecordsPort);
+	}
+
+	//Health card images for infoPage.php, decoded once from the TIFF scans. The browsers of the
+	//triage terminals load them directly, so this one listens on every interface.
+	const char* cards[] = { "healthCardFront", "healthCardBack" };
+	for (size_t i = 0; i < sizeof(cards) / sizeof(cards[0]); ++i){
+		if (!gImages.load(cards[i], std::string(kWebRoot) + cards[i] + ".tiff")) gLog.log("log: {}.tiff couldn't be decoded", cards[i]);
+	}
+	//The site's css, scripts and fonts too, gzipped once here rather than on every page load
+	size_t staticFiles = gStaticFiles.load(kWebRoot);
+	gLog.log("log: {} static files found, {} bytes gzipped", (unsigned long long)staticFiles, (unsigned long long)gStaticFiles.memoryBytes());
+	HttpServer webServer;
+	bool webServing = webServer.start("0.0.0.0", kWebPort, [](const HttpRequest& request, HttpResponse& response){
+		if (request.path.compare(0, 8, "/images/") == 0) gImages.serve(request, response);
+		else gStaticFiles.serve(request, response);
+	}, kWebWorkers);
+	if (!webServing) gLog.log("log: web server couldn't listen on port {}", kWebPort);
 
 	//Main loop for continuously polling user input
 	while (true){
 		std::string input;
 		std::cin >> input; //retreives and stores user input
 
+		//Replays don't need the NCL. They only print the events: this NEA is live, and handling them here
+		//would move its sessions and scan and show the terminals patients who aren't at the desk.
+		if (input == "replay"){
+			std::string path, option;
+			std::cin >> path;
+			std::getline(std::cin, option);
+			bool realtime = option.find("fast") == std::string::npos;
+			unsigned long long replayed = replayJournal(path, printReplayedEvent, NULL, realtime);
+			std::cout << "Replayed " << replayed << " events from " << path << "\n";
+			continue;
+		}
+
 		//Ensures no commands are handled until NCL has completed initialization
 		if (!gNclInitialized){
 			std::cout << "error: NCL didn't finished initializing yet!\n";
 			continue;
 		}
+		if (gRecovery.recovering()){
+			std::cout << "error: NCL is reinitializing, try again in a moment\n";
+			continue;
+		}
 		if (input == "provision"){
-			NclBool res = nclStartDiscovery();
+			NclBool res;
+			{
+				std::lock_guard<std::mutex> scanLock(gScanMutex);
+				res = gMetrics.checkCall(nclStartDiscovery());
+				if (res) gScanMode = SCAN_DISCOVERY;
+			}
 			if (res){
 				std::cout << "Discovery started successfully\n";
 			}
@@ -148,36 +190,109 @@ int main(){
 			}
 		}
 		else if (input == "agree"){
-			NclBool res = nclProvision(gHandle, NCL_FALSE);
-			if (res){
-				std::cout << "Provision request successful\n";
-			}
-			else{
-				std::cout << "Provisioning failed\n";
-			}
+			//"agree strong" enables strong finds for this provision, which skip validation later
+			std::string option;
+			std::getline(std::cin, option);
+			NclBool strong = option.find("strong") != std::string::npos ? NCL_TRUE : NCL_FALSE;
+			queueCommand(NCL_EVENT_PROVISION, [strong](int nymiHandle){ return nclProvision(nymiHandle, strong); }, "provision");
 		}
 		else if (input == "reject"){
 			//Attempt to disconnect from currently connected Nymi
-			if (!nclDisconnect(gHandle)){
+			if (!gMetrics.checkCall(nclDisconnect(gHandle))){
 				std::cout << "Disconnection Failed!\n";
 			}
 		}
 		else if (input == "validate"){
-			NclBool res = nclStartFinding(gProvisions.data(), gProvisions.size(), NCL_FALSE);
-			if (res){
+			if (startFinding()){
 				std::cout << "Finding started successfully\n";
 			}
 			else{
 				std::cout << "Finding failed to start\n";
 			}
 		}
+		else if (input == "continuous"){
+			//Toggles continuous finding: the scan keeps running and patients are validated as they arrive
+			if (gContinuousFinder.enabled()){
+				gContinuousFinder.setEnabled(false);
+				{
+					std::lock_guard<std::mutex> scanLock(gScanMutex);
+					if (gScanMode == SCAN_FINDING){
+						gMetrics.checkCall(nclStopScan());
+						gScanMode = SCAN_NONE;
+					}
+				}
+				std::cout << "Continuous finding stopped\n";
+				continue;
+			}
+			gContinuousFinder.setEnabled(true);
+			if (startFinding()){
+				std::cout << "Continuous finding started\n";
+			}
+			else{
+				gContinuousFinder.setEnabled(false);
+				std::cout << "Finding failed to start\n";
+			}
+		}
+		else if (input == "stream"){
+			//Like validate, but the connection is made with the streaming profile and ECG starts once validated
+			gStreamOnValidate = true;
+			if (startFinding()){
+				std::cout << "Finding started successfully, ECG will stream once validated\n";
+			}
+			else{
+				gStreamOnValidate = false;
+				std::cout << "Finding failed to start\n";
+			}
+		}
+		else if (input == "ecgstop"){
+			queueCommand(NCL_EVENT_ECG_STOP, nclStopEcgStream, "ecg stop");
+		}
+		else if (input == "sweep"){
+			if (gHandle != -1){
+				std::cout << "Disconnect first, the sweep makes its own connections\n";
+				continue;
+			}
+			if (gSweep.start(startFinding, 10)){
+				std::cout << "Connection parameter sweep started\n";
+			}
+			else{
+				std::cout << "A sweep is already running\n";
+			}
+		}
+		else if (input == "proximity"){
+			std::vector<std::pair<int, double> > ranked = gProximity.ranked();
+			std::cout << "Desk threshold " << gProximity.deskRssi() << " dB\n";
+			for (size_t i = 0; i < ranked.size(); ++i){
+				std::cout << "Nymi " << ranked[i].first << ": " << ranked[i].second << " dB\n";
+			}
+		}
+		else if (input == "desk"){
+			double rssi;
+			if (std::cin >> rssi){
+				gProximity.setDeskRssi(rssi);
+				std::cout << "Nymis are validated once their smoothed RSSI reaches " << rssi << " dB\n";
+			}
+			else{
+				std::cin.clear();
+				std::cout << "Usage: desk <RSSI in dB, e.g. -70>\n";
+			}
+		}
+		else if (input == "identity"){
+			gIdentityTiming.report(std::cout);
+		}
+		else if (input == "gc"){
+			std::cout << gScanMaintenance.seenHandles() << " Nymis scanned since the last clear\n";
+			if (!gScanMaintenance.clearNow()){
+				std::cout << "Not cleared, a Nymi is connected or busy\n";
+			}
+		}
 		else if (input == "disconnect"){
 			if (gHandle == -1){
 				std::cout << "NEA Not connected to a Nymi. Cannot Disconnect\n";
 				continue;
 			}
 
-			NclBool res = nclDisconnect(gHandle);
+			NclBool res = gMetrics.checkCall(nclDisconnect(gHandle));
 			if (res){
 				std::cout << "Disconnection request successfull\n";
 			}
@@ -185,9 +300,95 @@ int main(){
 				std::cout << "Disconnection failed\n";
 			}
 		}
+		else if (input == "rssi"){
+			queueCommand(NCL_EVENT_RSSI, nclGetRssi, "rssi");
+		}
+		else if (input == "firmware"){
+			queueCommand(NCL_EVENT_FIRMWARE_VERSION, nclGetFirmwareVersion, "firmware");
+		}
+		else if (input == "prg"){
+			queueCommand(NCL_EVENT_PRG, nclPrg, "prg");
+		}
+		else if (input == "createsk"){
+			queueCommand(NCL_EVENT_CREATED_SK, nclCreateSk, "createsk");
+		}
+		else if (input == "getsk"){
+			if (!gHaveSkId){
+				std::cout << "No symmetric key created yet\n";
+				continue;
+			}
+			//Copy of the ID is captured so later "createsk" calls don't change a queued request
+			std::vector<NclUInt8> skId(gSkId, gSkId + NCL_SK_ID_SIZE);
+			queueCommand(NCL_EVENT_GOT_SK, [skId](int nymiHandle){ return nclGetSk(nymiHandle, skId.data()); }, "getsk");
+		}
+		else if (input == "link"){
+			std::string ohip;
+			std::cin >> ohip;
+			ProvisionKey provision;
+			if (gHandle == -1 || !gSessions.provisionOf(gHandle, provision)){
+				std::cout << "Validate the patient's Nymi first\n";
+			}
+			else if (gRecords.link(provision, ohip)){
+				gRecords.setCurrent(provision);
+				std::cout << "Nymi " << provisionHex(provision) << " linked to " << ohip << "\n";
+			}
+			else{
+				std::cout << "No record with health number " << ohip << "\n";
+			}
+		}
+		else if (input == "station"){
+			std::string station;
+			std::cin >> station;
+			if (validStation(station)){
+				gStation = station;
+				std::cout << "Validations go to the terminals of station " << gStation << "\n";
+			}
+			else{
+				std::cout << "A station id is up to " << kMaxStationBytes << " letters, digits, - or _\n";
+			}
+		}
+		else if (input == "loadtest"){
+			gValidations.setTestPublishing(!gValidations.testPublishing());
+			if (gValidations.testPublishing()) std::cout << "Test validations accepted at POST /stations/<id>/validations, for nymiload\n";
+			else std::cout << "Test validations refused\n";
+		}
+		else if (input == "allergic"){
+			std::string allergen;
+			std::getline(std::cin, allergen);
+			std::vector<std::pair<std::string, std::string> > patients;
+			unsigned long long count = gRecords.findAllergic(allergen, true, 50, patients);
+			std::cout << count << " patients identified lately allergic to " << normalizeAllergen(allergen) << "\n";
+			for (size_t i = 0; i < patients.size(); ++i){
+				std::cout << patients[i].first << " " << patients[i].second << "\n";
+			}
+		}
+		else if (input == "search"){
+			std::string name;
+			std::getline(std::cin, name);
+			name.erase(0, name.find_first_not_of(" \t")); //what follows the command's space
+			std::vector<NameMatch> matches;
+			gRecords.searchNames(name, "", 0, 0, 10, matches);
+			if (matches.empty()) std::cout << "No patient named like " << name << "\n";
+			for (size_t i = 0; i < matches.size(); ++i){
+				std::cout << matches[i].ohip << " " << matches[i].name << " " << matches[i].sex << " " << matches[i].born << "\n";
+			}
+		}
+		else if (input == "history"){
+			std::string ohip;
+			std::cin >> ohip;
+			std::vector<RecordChange> changes;
+			if (!gRecords.history(ohip, changes)){
+				std::cout << "No record with health number " << ohip << "\n";
+				continue;
+			}
+			if (changes.empty()) std::cout << "No changes to " << ohip << "\n";
+			for (size_t i = 0; i < changes.size(); ++i){
+				std::cout << changes[i].time << " " << recordFieldName(changes[i].field) << ": " << quotedValue(changes[i].before) << " -> " << quotedValue(changes[i].after) << "\n";
+			}
+		}
 		else if (input == "quit"){
 			if (gHandle != -1){
-				nclDisconnect(gHandle);
+				gMetrics.checkCall(nclDisconnect(gHandle));
 			}
 			break;
 		}
@@ -196,6 +397,16 @@ int main(){
 		}
 	}
 
+	webServer.stop();
+	recordServer.stop();
+	gRecordLog.close();
+	metricsServer.stop();
+	gSweep.stop();
+	gReconnect.stop();
+	gScanMaintenance.stop();
+	gRecovery.stop();
 	nclFinish(); //closes the NCL
+	gJournal.close();
+	gLog.stop();
 	return 0; //Quits program
 }
@@ -0,0 +1,162 @@
+#include "metrics.h"
+#include "command_queue.h"
+#include "event_journal.h"
+#include "logger.h"
+#include "nclevents.h"
+#include "reconnect.h"
+#include "record_log.h"
+#include "records.h"
+#include "recovery.h"
+#include "static_files.h"
+#include "validation_bus.h"
+#include "validation_status.h"
+
+#include <map>
+#include <sstream>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <sched.h>
+#endif
+
+Metrics gMetrics;
+
+static const unsigned kMaxConnected = 64;
+
+Metrics::Metrics(){
+	for (unsigned s = 0; s < kMetricShards; ++s){
+		Shard& shard = mShards[s];
+		for (unsigned i = 0; i <= NCL_EVENT_NOTIFIED; ++i) shard.events[i] = 0;
+		for (unsigned i = 0; i <= NCL_ERROR_NYMI_FAILED; ++i) shard.errorEvents[i] = shard.failedCalls[i] = 0;
+		for (unsigned i = 0; i <= NCL_DISCONNECTION_OTHER; ++i) shard.disconnections[i] = 0;
+	}
+}
+
+Metrics::Shard& Metrics::shard(){
+#if defined(_WIN32)
+	unsigned cpu = GetCurrentProcessorNumber();
+#else
+	int cpu = sched_getcpu();
+	if (cpu < 0) cpu = 0;
+#endif
+	return mShards[(unsigned)cpu % kMetricShards];
+}
+
+void Metrics::onEvent(const NclEvent& event){
+	Shard& counters = shard();
+	if ((unsigned)event.type <= NCL_EVENT_NOTIFIED) counters.events[event.type].fetch_add(1, std::memory_order_relaxed);
+	if (event.type == NCL_EVENT_ERROR && (unsigned)event.error.code <= NCL_ERROR_NYMI_FAILED){
+		counters.errorEvents[event.error.code].fetch_add(1, std::memory_order_relaxed);
+	}
+	else if (event.type == NCL_EVENT_DISCONNECTION && (unsigned)event.disconnection.reason <= NCL_DISCONNECTION_OTHER){
+		counters.disconnections[event.disconnection.reason].fetch_add(1, std::memory_order_relaxed);
+	}
+}
+
+void Metrics::countFailedCall(NclErrorCode code){
+	if ((unsigned)code > NCL_ERROR_NYMI_FAILED) return;
+	shard().failedCalls[code].fetch_add(1, std::memory_order_relaxed);
+}
+
+NclBool Metrics::checkCall(NclBool result){
+	if (!result) countFailedCall(nclGetErrorCode());
+	return result;
+}
+
+/*
+Sums one counter over all shards
+*/
+template <typename Field>
+static unsigned long long total(const Field& field, unsigned index){
+	unsigned long long sum = 0;
+	for (unsigned s = 0; s < kMetricShards; ++s) sum += field(s)[index].load(std::memory_order_relaxed);
+	return sum;
+}
+
+static void header(std::ostringstream& out, const char* name, const char* type, const char* help){
+	out << "# HELP " << name << " " << help << "\n";
+	out << "# TYPE " << name << " " << type << "\n";
+}
+
+std::string Metrics::render(){
+	std::ostringstream out;
+
+	header(out, "nymi_ncl_events_total", "counter", "NCL events delivered to the callback, by type.");
+	for (unsigned i = NCL_EVENT_INIT; i <= NCL_EVENT_NOTIFIED; ++i){
+		out << "nymi_ncl_events_total{type=\"" << nclEventName((NclEventType)i) << "\"} "
+			<< total([this](unsigned s){ return mShards[s].events; }, i) << "\n";
+	}
+
+	header(out, "nymi_ncl_errors_total", "counter", "NCL errors by code, from NCL_EVENT_ERROR events and from failed NCL calls.");
+	for (unsigned i = 0; i <= NCL_ERROR_NYMI_FAILED; ++i){
+		const char* name = nclErrorName((NclErrorCode)i);
+		out << "nymi_ncl_errors_total{code=\"" << name << "\",source=\"event\"} "
+			<< total([this](unsigned s){ return mShards[s].errorEvents; }, i) << "\n";
+		out << "nymi_ncl_errors_total{code=\"" << name << "\",source=\"call\"} "
+			<< total([this](unsigned s){ return mShards[s].failedCalls; }, i) << "\n";
+	}
+
+	header(out, "nymi_ncl_disconnections_total", "counter", "Nymi disconnections by reason.");
+	for (unsigned i = 0; i <= NCL_DISCONNECTION_OTHER; ++i){
+		out << "nymi_ncl_disconnections_total{reason=\"" << nclDisconnectionName((NclDisconnectionReason)i) << "\"} "
+			<< total([this](unsigned s){ return mShards[s].disconnections; }, i) << "\n";
+	}
+
+	int handles[kMaxConnected];
+	unsigned connected = kMaxConnected;
+	header(out, "nymi_connected_nymis", "gauge", "Nymis connected right now, from nclGetConnected.");
+	if (nclGetConnected(handles, &connected)) out << "nymi_connected_nymis " << connected << "\n";
+
+	header(out, "nymi_command_queue_depth", "gauge", "Commands queued on a Nymi's command channel, including the one in flight.");
+	std::map<int, size_t> depths = gScheduler.depths();
+	for (std::map<int, size_t>::iterator it = depths.begin(); it != depths.end(); ++it){
+		out << "nymi_command_queue_depth{nymi=\"" << it->first << "\"} " << it->second << "\n";
+	}
+	header(out, "nymi_command_queue_depth_total", "gauge", "Commands queued over all Nymis.");
+	out << "nymi_command_queue_depth_total " << gScheduler.totalDepth() << "\n";
+	header(out, "nymi_parked_commands", "gauge", "Commands parked until their Nymi is validated again.");
+	out << "nymi_parked_commands " << gScheduler.parkedDepth() << "\n";
+
+	header(out, "nymi_ncl_recoveries_total", "counter", "In-process NCL reinitializations.");
+	out << "nymi_ncl_recoveries_total " << gRecovery.recoveries() << "\n";
+	header(out, "nymi_reconnects_total", "counter", "Validated sessions reconnected after a timeout, or given up.");
+	out << "nymi_reconnects_total{result=\"recovered\"} " << gReconnect.recovered() << "\n";
+	out << "nymi_reconnects_total{result=\"abandoned\"} " << gReconnect.abandoned() << "\n";
+	header(out, "nymi_reconnects_pending", "gauge", "Sessions being reconnected.");
+	out << "nymi_reconnects_pending " << gReconnect.pending() << "\n";
+	header(out, "nymi_record_prefetches_total", "counter", "Records rendered on find, by whether validation published them.");
+	out << "nymi_record_prefetches_total{result=\"published\"} " << gRecords.prefetchesPublished() << "\n";
+	out << "nymi_record_prefetches_total{result=\"missed\"} " << gRecords.prefetchesMissed() << "\n";
+	out << "nymi_record_prefetches_total{result=\"dropped\"} " << gRecords.prefetchesDropped() << "\n";
+	header(out, "nymi_coalesced_requests_total", "counter", "Record lookups and status polls, by whether they were computed or shared another one's response.");
+	out << "nymi_coalesced_requests_total{endpoint=\"records\",result=\"computed\"} " << gRecords.lookupsComputed() << "\n";
+	out << "nymi_coalesced_requests_total{endpoint=\"records\",result=\"shared\"} " << gRecords.lookupsShared() << "\n";
+	out << "nymi_coalesced_requests_total{endpoint=\"status\",result=\"computed\"} " << gValidationStatus.pollsComputed() << "\n";
+	out << "nymi_coalesced_requests_total{endpoint=\"status\",result=\"shared\"} " << gValidationStatus.pollsShared() << "\n";
+	header(out, "nymi_status_not_modified_total", "counter", "Status polls answered 304 because the validation state hadn't changed.");
+	out << "nymi_status_not_modified_total " << gValidationStatus.pollsNotModified() << "\n";
+	header(out, "nymi_validations_routed_total", "counter", "Validations published to their station's subscribers, taken by a subscriber, or dropped from a full queue.");
+	out << "nymi_validations_routed_total{result=\"published\"} " << gValidations.published() << "\n";
+	out << "nymi_validations_routed_total{result=\"delivered\"} " << gValidations.delivered() << "\n";
+	out << "nymi_validations_routed_total{result=\"dropped\"} " << gValidations.dropped() << "\n";
+	header(out, "nymi_validation_subscribers", "gauge", "Terminals subscribed to their station's validations.");
+	out << "nymi_validation_subscribers " << gValidations.subscribers() << "\n";
+	header(out, "nymi_record_edits_total", "counter", "Record edits appended to the record log.");
+	out << "nymi_record_edits_total " << gRecordLog.appended() << "\n";
+	header(out, "nymi_record_log_syncs_total", "counter", "Group commits of the record log, each covering one or more edits.");
+	out << "nymi_record_log_syncs_total " << gRecordLog.syncs() << "\n";
+	header(out, "nymi_static_responses_total", "counter", "Static file responses, by what was sent.");
+	out << "nymi_static_responses_total{sent=\"file\"} " << gStaticFiles.sentFiles() << "\n";
+	out << "nymi_static_responses_total{sent=\"gzip\"} " << gStaticFiles.sentGzipped() << "\n";
+	out << "nymi_static_responses_total{sent=\"not_modified\"} " << gStaticFiles.notModified() << "\n";
+	header(out, "nymi_static_open_files", "gauge", "Static files held open for sending.");
+	out << "nymi_static_open_files " << gStaticFiles.openFiles() << "\n";
+	header(out, "nymi_journal_events_total", "counter", "Events written to the event journal.");
+	out << "nymi_journal_events_total " << gJournal.appended() << "\n";
+	header(out, "nymi_journal_dropped_total", "counter", "Events the event journal had no room for.");
+	out << "nymi_journal_dropped_total " << gJournal.dropped() << "\n";
+	header(out, "nymi_log_dropped_total", "counter", "Log lines dropped because a thread's log buffer was full.");
+	out << "nymi_log_dropped_total " << gLog.dropped() << "\n";
+	return out.str();
+}
@@ -0,0 +1,58 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include "ncl.h"
+
+#include <atomic>
+#include <string>
+
+static const unsigned kMetricShards = 16; //counters are spread over CPUs to keep the event path uncontended
+
+/*
+Counters of what the NCL delivered, for capacity planning and regression alerts.
+Counting is a relaxed atomic increment in the shard of the CPU the caller runs on, so threads on
+different cores never touch the same cache line. Shards are summed when the counters are rendered.
+Gauges (connected Nymis, command queue depths) are sampled at render time.
+*/
+class Metrics{
+public:
+	Metrics();
+
+	/*
+	Counts an event from the NCL callback: its type, and the error code or disconnection reason it carries
+	*/
+	void onEvent(const NclEvent& event);
+
+	/*
+	Counts an NCL call that failed with an error code, e.g. a command the scheduler issued
+	*/
+	void countFailedCall(NclErrorCode code);
+
+	/*
+	Passes a direct NCL call's result through, counting the call if it failed, e.g.
+	if (!gMetrics.checkCall(nclStopScan())) ...
+	*/
+	NclBool checkCall(NclBool result);
+
+	/*
+	Renders every counter and gauge in the Prometheus text exposition format
+	*/
+	std::string render();
+
+private:
+	struct Shard{
+		std::atomic<unsigned long long> events[NCL_EVENT_NOTIFIED + 1];
+		std::atomic<unsigned long long> errorEvents[NCL_ERROR_NYMI_FAILED + 1];
+		std::atomic<unsigned long long> failedCalls[NCL_ERROR_NYMI_FAILED + 1];
+		std::atomic<unsigned long long> disconnections[NCL_DISCONNECTION_OTHER + 1];
+		char padding[64]; //keeps neighbouring shards off each other's cache lines
+	};
+
+	Shard& shard();
+
+	Shard mShards[kMetricShards];
+};
+
+extern Metrics gMetrics; //Global metrics, fed by the NCL callback
+
+#endif
@@ -0,0 +1,89 @@
+#include "nclevents.h"
+
+int nclEventHandle(const NclEvent& event){
+	switch (event.type){
+	case NCL_EVENT_DISCOVERY: return event.discovery.nymiHandle;
+	case NCL_EVENT_FIND: return event.find.nymiHandle;
+	case NCL_EVENT_DETECTION: return event.detection.nymiHandle;
+	case NCL_EVENT_AGREEMENT: return event.agreement.nymiHandle;
+	case NCL_EVENT_PROVISION: return event.provision.nymiHandle;
+	case NCL_EVENT_VALIDATION: return event.validation.nymiHandle;
+	case NCL_EVENT_DISCONNECTION: return event.disconnection.nymiHandle;
+	case NCL_EVENT_ECG_START: return event.ecgStart.nymiHandle;
+	case NCL_EVENT_ECG: return event.ecg.nymiHandle;
+	case NCL_EVENT_ECG_STOP: return event.ecgStop.nymiHandle;
+	case NCL_EVENT_VK: return event.vk.nymiHandle;
+	case NCL_EVENT_SIG: return event.sig.nymiHandle;
+	case NCL_EVENT_GLOBAL_VK: return event.globalVk.nymiHandle;
+	case NCL_EVENT_GLOBAL_SIG: return event.globalSig.nymiHandle;
+	case NCL_EVENT_CREATED_SK: return event.createdSk.nymiHandle;
+	case NCL_EVENT_GOT_SK: return event.gotSk.nymiHandle;
+	case NCL_EVENT_PRG: return event.prg.nymiHandle;
+	case NCL_EVENT_RSSI: return event.rssi.nymiHandle;
+	case NCL_EVENT_FIRMWARE_VERSION: return event.firmwareVersion.nymiHandle;
+	case NCL_EVENT_NOTIFIED: return event.notified.nymiHandle;
+	default: return -1;
+	}
+}
+
+const char* nclEventName(NclEventType type){
+	switch (type){
+	case NCL_EVENT_ANY: return "NCL_EVENT_ANY";
+	case NCL_EVENT_INIT: return "NCL_EVENT_INIT";
+	case NCL_EVENT_ERROR: return "NCL_EVENT_ERROR";
+	case NCL_EVENT_DISCOVERY: return "NCL_EVENT_DISCOVERY";
+	case NCL_EVENT_FIND: return "NCL_EVENT_FIND";
+	case NCL_EVENT_DETECTION: return "NCL_EVENT_DETECTION";
+	case NCL_EVENT_AGREEMENT: return "NCL_EVENT_AGREEMENT";
+	case NCL_EVENT_PROVISION: return "NCL_EVENT_PROVISION";
+	case NCL_EVENT_VALIDATION: return "NCL_EVENT_VALIDATION";
+	case NCL_EVENT_DISCONNECTION: return "NCL_EVENT_DISCONNECTION";
+	case NCL_EVENT_ECG_START: return "NCL_EVENT_ECG_START";
+	case NCL_EVENT_ECG: return "NCL_EVENT_ECG";
+	case NCL_EVENT_ECG_STOP: return "NCL_EVENT_ECG_STOP";
+	case NCL_EVENT_VK: return "NCL_EVENT_VK";
+	case NCL_EVENT_SIG: return "NCL_EVENT_SIG";
+	case NCL_EVENT_GLOBAL_VK: return "NCL_EVENT_GLOBAL_VK";
+	case NCL_EVENT_GLOBAL_SIG: return "NCL_EVENT_GLOBAL_SIG";
+	case NCL_EVENT_CREATED_SK: return "NCL_EVENT_CREATED_SK";
+	case NCL_EVENT_GOT_SK: return "NCL_EVENT_GOT_SK";
+	case NCL_EVENT_PRG: return "NCL_EVENT_PRG";
+	case NCL_EVENT_RSSI: return "NCL_EVENT_RSSI";
+	case NCL_EVENT_FIRMWARE_VERSION: return "NCL_EVENT_FIRMWARE_VERSION";
+	case NCL_EVENT_NOTIFIED: return "NCL_EVENT_NOTIFIED";
+	default: return "NCL_EVENT_UNKNOWN";
+	}
+}
+
+const char* nclErrorName(NclErrorCode code){
+	switch (code){
+	case NCL_ERROR_NULL: return "NCL_ERROR_NULL";
+	case NCL_ERROR_NOT_INITED: return "NCL_ERROR_NOT_INITED";
+	case NCL_ERROR_NCL_FAILED: return "NCL_ERROR_NCL_FAILED";
+	case NCL_ERROR_ECODAEMON_MISSING: return "NCL_ERROR_ECODAEMON_MISSING";
+	case NCL_ERROR_SERIAL_FAILED: return "NCL_ERROR_SERIAL_FAILED";
+	case NCL_ERROR_INVALID_HANDLE: return "NCL_ERROR_INVALID_HANDLE";
+	case NCL_ERROR_MISMATCH: return "NCL_ERROR_MISMATCH";
+	case NCL_ERROR_WRONG_STATE: return "NCL_ERROR_WRONG_STATE";
+	case NCL_ERROR_BUSY: return "NCL_ERROR_BUSY";
+	case NCL_ERROR_BAD_VALUE: return "NCL_ERROR_BAD_VALUE";
+	case NCL_ERROR_BAD_PARTNER_KEY: return "NCL_ERROR_BAD_PARTNER_KEY";
+	case NCL_ERROR_OUT_OF_MEMORY: return "NCL_ERROR_OUT_OF_MEMORY";
+	case NCL_ERROR_LOW_BATTERY: return "NCL_ERROR_LOW_BATTERY";
+	case NCL_ERROR_NYMI_FAILED: return "NCL_ERROR_NYMI_FAILED";
+	default: return "NCL_ERROR_UNKNOWN";
+	}
+}
+
+const char* nclDisconnectionName(NclDisconnectionReason reason){
+	switch (reason){
+	case NCL_DISCONNECTION_LOCAL: return "NCL_DISCONNECTION_LOCAL";
+	case NCL_DISCONNECTION_TIMEOUT: return "NCL_DISCONNECTION_TIMEOUT";
+	case NCL_DISCONNECTION_FAILURE: return "NCL_DISCONNECTION_FAILURE";
+	case NCL_DISCONNECTION_REMOTE: return "NCL_DISCONNECTION_REMOTE";
+	case NCL_DISCONNECTION_CONNECTION_TIMEOUT: return "NCL_DISCONNECTION_CONNECTION_TIMEOUT";
+	case NCL_DISCONNECTION_LL_RESPONSE_TIMEOUT: return "NCL_DISCONNECTION_LL_RESPONSE_TIMEOUT";
+	case NCL_DISCONNECTION_OTHER: return "NCL_DISCONNECTION_OTHER";
+	default: return "NCL_DISCONNECTION_UNKNOWN";
+	}
+}
@@ -0,0 +1,28 @@
+#ifndef NCLEVENTS_H
+#define NCLEVENTS_H
+
+#include "ncl.h"
+
+/*
+Returns the Nymi handle carried by an event
+@param[in] event NclEvent to inspect
+@return the handle, or -1 for events that don't belong to a Nymi (init, error)
+*/
+int nclEventHandle(const NclEvent& event);
+
+/*
+Returns a printable name for an event type, e.g. "NCL_EVENT_FIND"
+*/
+const char* nclEventName(NclEventType type);
+
+/*
+Returns a printable name for an error code, e.g. "NCL_ERROR_BUSY"
+*/
+const char* nclErrorName(NclErrorCode code);
+
+/*
+Returns a printable name for a disconnection reason, e.g. "NCL_DISCONNECTION_TIMEOUT"
+*/
+const char* nclDisconnectionName(NclDisconnectionReason reason);
+
+#endif
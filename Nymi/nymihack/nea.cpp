@@ -0,0 +1,373 @@
+#include "nea.h"
+#include "connection_profiles.h"
+#include "connection_sweep.h"
+#include "continuous_finder.h"
+#include "event_journal.h"
+#include "identity_timing.h"
+#include "metrics.h"
+#include "proximity.h"
+#include "reconnect.h"
+#include "records.h"
+#include "scan_maintenance.h"
+#include "recovery.h"
+#include "validation_bus.h"
+#include "validation_status.h"
+#include "logger.h"
+
+#include <string>
+#include <cstring>
+#include <iostream>
+using namespace std;
+bool gNclInitialized = false;	//Global variable to maintain the state of the NCL
+int gHandle = -1; //Global variable to maintain the current connected Nymi handle
+std::vector<NclProvision> gProvisions; //Global vector for storing the list of provisioned Nymi
+NclSkId gSkId; //ID of the last symmetric key created, used by "getsk"
+bool gHaveSkId = false;
+ScanMode gScanMode = SCAN_NONE; //Scan the NEA asked for, restarted after an NCL recovery
+ScanMode gPausedScan = SCAN_NONE; //Scan stopped while the scanned Nymi list is cleared
+std::mutex gScanMutex; //Scan maintenance, recovery and reconnect threads change the scan too
+bool gStreamOnValidate = false; //Set by "stream": connect with the streaming profile and start ECG once validated
+std::string gStation = "desk"; //Triage station this NEA's reader is at, whose terminals get its validations
+int retval = 0;
+ofstream myfile;
+std::atomic<IdentifiedHandler> gIdentifiedHandler(onIdentified);
+/*
+Called once a patient's identity is established
+@param[in] nymiHandle handle of the patient's Nymi
+@param[in] strong true if it came from a strong find, which needs no connection
+*/
+void onIdentified(int nymiHandle, bool strong){
+	Session session;
+	long long roundtrip = 0;
+	if (!strong && gSessions.find(nymiHandle, session)) roundtrip = session.validatedAt - session.foundAt;
+	gIdentityTiming.identified(strong, roundtrip);
+	ProvisionKey provision;
+	if (gSessions.provisionOf(nymiHandle, provision)){
+		gRecords.publish(nymiHandle, provision); //infoPage.php shows this patient
+		gRecords.identified(provision); //on the ward for "allergic", even once the Nymi left
+		std::string ohip;
+		gRecords.ohipByProvision(provision, ohip);
+		gValidations.publish(gStation, ohip, provision); //to this station's terminals only
+	}
+	gValidationStatus.identified(gStation); //a new generation for the station's pollers
+
+	retval = 1;
+	bool auth = true;
+	myfile.open("C:/Users/Danielle/Documents/Visual Studio 2013/Projects/nymihack/nymihack/example.txt");
+	//retval = 220;
+	myfile << auth;
+	myfile.close();
+}
+
+/*
+Starts identifying a found Nymi picked at the desk
+A Nymi found strongly is identified right away: the strong provision already proves it's the
+Nymi we provisioned, so the connection and validation roundtrip are skipped.
+@param[in] nymiHandle handle of the Nymi
+@param[in] provision provision it was found with
+@param[in] strong whether the find was strong
+*/
+void beginIdentification(int nymiHandle, const ProvisionKey& provision, bool strong){
+	gSessions.onFind(nymiHandle, provision);
+	if (strong){
+		gSessions.onValidation(nymiHandle);
+		gLog.log("Nymi found strongly, identity established without validation");
+		gIdentifiedHandler.load()(nymiHandle, true);
+		return;
+	}
+	hintConnection(gStreamOnValidate ? PROFILE_STREAM : PROFILE_VALIDATE);
+	gScheduler.submit(nymiHandle, NCL_EVENT_VALIDATION, nclValidate, "validate"); //Validates the found Nymi
+}
+
+/*
+Validates the nearest found Nymi, if it is close enough to be at the desk and no other Nymi is
+being validated. Scanning stops once one is picked, like it did on the first find before.
+In continuous mode the scan keeps running and gContinuousFinder serves the queue instead.
+*/
+void validateNearest(){
+	std::lock_guard<std::mutex> lock(gScanMutex);
+	if (gScanMode != SCAN_FINDING) return;
+	if (gContinuousFinder.enabled()){
+		gContinuousFinder.pump();
+		return;
+	}
+	if (gHandle != -1) return;
+	int nymiHandle;
+	ProvisionKey provision;
+	bool strong;
+	if (!gProximity.takeNearest(nymiHandle, provision, strong)) return;
+
+	if (gMetrics.checkCall(nclStopScan())){
+		gLog.log("Stopping Scan successful");
+	}
+	else{
+		gLog.log("Stopping Scan failed");
+	}
+	gScanMode = SCAN_NONE;
+	gProximity.clearCandidates();
+
+	if (!strong) gHandle = nymiHandle;
+	beginIdentification(nymiHandle, provision, strong);
+}
+
+/*
+Function for handling the events thrown by the NCL, or replayed from the journal
+@param[in] event NclEvent that contains the event type and member variables
+@param[in] userData Data that needs to be passed to the callback functions if provided
+*/
+void handleEvent(NclEvent event, void* userData){
+	NclBool res;
+	switch (event.type){
+	case NCL_EVENT_INIT:
+		if (event.init.success){
+			gNclInitialized = true;
+			gLog.log("log: init succeeded, getting info");
+			//NclInfo info = nclInfo(); //Prints current initialization configuration
+			//std::cout << info.string;
+		}
+		break;
+	case NCL_EVENT_ERROR:
+		//Failed init and errors are handled by gRecovery below
+		break;
+	case NCL_EVENT_DISCOVERY:
+		gLog.log("log: Nymi discovered");
+		{
+			std::lock_guard<std::mutex> lock(gScanMutex);
+			res = gMetrics.checkCall(nclStopScan());	//Stops scanning to prevent discovering new Nymis
+			gScanMode = SCAN_NONE;
+		}
+		if (res){
+			gLog.log("Stopping Scan successful");
+		}
+		else{
+			gLog.log("Stopping Scan failed");
+		}
+
+		gProximity.update(event.discovery.nymiHandle, event.discovery.rssi);
+		gHandle = event.discovery.nymiHandle;
+		hintConnection(PROFILE_VALIDATE); //Agreement and provisioning are short request bursts
+		//Initiates the provisioning process with discovered Nymi
+		gScheduler.submit(gHandle, NCL_EVENT_AGREEMENT, nclAgree, "agree");
+		break;
+	case NCL_EVENT_FIND:
+		gLog.log("log: Nymi found");
+		if (gReconnect.onFind(event)) break; //a session that timed out is back, gReconnect validates it
+		//The record is ready by the time the connection and validation roundtrip is over
+		gRecords.prefetch(event.find.nymiHandle, provisionKey(event.find.provisionId));
+		//Scanning goes on until the nearest found Nymi is close enough to be at the desk
+		gProximity.update(event.find.nymiHandle, event.find.rssi);
+		//In continuous mode, repeated finds of a patient already queued or identified are dropped
+		if (!gContinuousFinder.enabled() || gContinuousFinder.admit(provisionKey(event.find.provisionId))){
+			gProximity.addCandidate(event.find.nymiHandle, provisionKey(event.find.provisionId), event.find.strong == NCL_TRUE);
+		}
+		validateNearest();
+		break;
+	case NCL_EVENT_DETECTION:
+		gProximity.update(event.detection.nymiHandle, event.detection.rssi);
+		validateNearest();
+		break;
+	case NCL_EVENT_DISCONNECTION:
+		gLog.log("log: disconnected");
+		//A validated session that timed out is kept and reconnected in the background
+		if (!gReconnect.onDisconnection(event, event.disconnection.nymiHandle == gHandle)){
+			gSessions.remove(event.disconnection.nymiHandle);
+		}
+		gProximity.forget(event.disconnection.nymiHandle);
+		gRecords.dropPrefetch(event.disconnection.nymiHandle);
+		if (event.disconnection.nymiHandle == gHandle) gHandle = -1; //Uninitialize the Nymi handle
+		break;
+	case NCL_EVENT_AGREEMENT:{
+		//Displays the LED pattern for user confirmation
+		std::string pattern;
+		for (unsigned i = 0; i<NCL_AGREEMENT_PATTERNS; ++i){
+			for (unsigned j = 0; j<NCL_LEDS; ++j)
+				pattern += event.agreement.leds[i][j] ? '1' : '0';
+			pattern += "\n";
+		}
+		gLog.log("Is this:\n{}the correct LED pattern (agree/reject)?", pattern);
+		break;
+	}
+	case NCL_EVENT_PROVISION:
+		//Store the provision information in a vector. Ideally this information
+		//is stored in persistent memory to be used later for future validations
+		gProvisions.push_back(event.provision.provision);
+		gLog.log("log: provisioned");
+		break;
+	case NCL_EVENT_VALIDATION:{
+		gLog.log("Nymi validated! Now trusted user requests can happen, such as request Symmetric Keys!");
+		ProvisionKey provision;
+		if (gSessions.onValidation(event.validation.nymiHandle) && gSessions.provisionOf(event.validation.nymiHandle, provision)){
+			gScheduler.resume(provision, event.validation.nymiHandle); //Commands parked by an NCL recovery or a reconnect
+		}
+		bool current;
+		if (gReconnect.onValidation(event.validation.nymiHandle, current)){
+			//The session carries on where it left off, the patient was identified before
+			if (current && gHandle == -1) gHandle = event.validation.nymiHandle;
+			break;
+		}
+		if (gStreamOnValidate){
+			gStreamOnValidate = false;
+			gScheduler.submit(event.validation.nymiHandle, NCL_EVENT_ECG_START, nclStartEcgStream, "ecg start");
+		}
+		gIdentifiedHandler.load()(event.validation.nymiHandle, false);
+		break;
+	}
+	case NCL_EVENT_ECG_START:
+		gLog.log("log: ECG stream started");
+		break;
+	case NCL_EVENT_ECG_STOP:
+		gLog.log("log: ECG stream stopped");
+		break;
+	case NCL_EVENT_CREATED_SK:
+		//Only the ID is kept, the key itself is secret
+		memcpy(gSkId, event.createdSk.id, NCL_SK_ID_SIZE);
+		gHaveSkId = true;
+		memset(event.createdSk.sk, 0, NCL_SK_SIZE);
+		gLog.log("log: symmetric key created");
+		break;
+	case NCL_EVENT_GOT_SK:
+		memset(event.gotSk.sk, 0, NCL_SK_SIZE);
+		gLog.log("log: got symmetric key");
+		break;
+	case NCL_EVENT_PRG:
+		gLog.log("log: got pseudorandom value");
+		break;
+	case NCL_EVENT_RSSI:
+		gProximity.update(event.rssi.nymiHandle, event.rssi.rssi);
+		gLog.log("log: RSSI {} dB", event.rssi.rssi);
+		break;
+	case NCL_EVENT_FIRMWARE_VERSION:
+		gLog.log("log: firmware version {}", std::string((const char*)event.firmwareVersion.version, NCL_FIRMWARE_VERSION_SIZE).c_str());
+		break;
+	default: break;
+	}
+
+	//Frees the Nymi's command channel if this event completes a queued command, and issues the next one
+	gScheduler.onEvent(event);
+	gSweep.onEvent(event);
+	gScanMaintenance.onEvent(event);
+	gContinuousFinder.onEvent(event);
+}
+
+/*
+Callback registered with the NCL. Counts and journals the event before handling it.
+Recovery only reacts to live events, so a replayed journal never reinitializes the NCL.
+*/
+void callback(NclEvent event, void* userData){
+	if (event.type == NCL_EVENT_ERROR){
+		//Reading the error code clears it, so it is read once here for everyone downstream
+		NclErrorCode code = nclGetErrorCode();
+		if (code != NCL_ERROR_NULL) event.error.code = code;
+	}
+	gMetrics.onEvent(event);
+	gJournal.append(event);
+	handleEvent(event, userData);
+	//Reinitializes the NCL in-process on dongle or ecodaemon failures
+	gRecovery.onEvent(event);
+}
+
+/*
+Starts finding every provisioned Nymi. Caller holds gScanMutex.
+*/
+static bool startFindingLocked(){
+	gProximity.clearCandidates();
+	//Detections carry RSSI too, so they keep the proximity estimates of found Nymis fresh
+	if (!gMetrics.checkCall(nclStartFinding(gProvisions.data(), gProvisions.size(), NCL_TRUE))) return false;
+	gScanMode = SCAN_FINDING;
+	gIdentityTiming.scanStarted();
+	return true;
+}
+
+bool startFinding(){
+	std::lock_guard<std::mutex> lock(gScanMutex);
+	return startFindingLocked();
+}
+
+/*
+Stops the running scan so gScanMaintenance can clear the scanned Nymi list
+@return false while a Nymi is being provisioned or validated
+*/
+bool pauseScan(){
+	std::lock_guard<std::mutex> lock(gScanMutex);
+	if (gHandle != -1 || gReconnect.pending() > 0) return false;
+	gPausedScan = gScanMode;
+	if (gScanMode != SCAN_NONE){
+		gMetrics.checkCall(nclStopScan());
+		gScanMode = SCAN_NONE;
+	}
+	return true;
+}
+
+/*
+Restarts the scan stopped by pauseScan, with fresh handles
+*/
+void resumeScan(){
+	gRecords.dropPrefetches(); //handles from before the list was cleared aren't reused for the same Nymis
+	std::lock_guard<std::mutex> lock(gScanMutex);
+	if (gPausedScan == SCAN_DISCOVERY){
+		if (gMetrics.checkCall(nclStartDiscovery())) gScanMode = SCAN_DISCOVERY;
+	}
+	else if (gPausedScan == SCAN_FINDING){
+		startFindingLocked();
+	}
+	gPausedScan = SCAN_NONE;
+}
+
+/*
+Called by gRecovery once the NCL is initialized again. All handles from before are invalid,
+so the scan that was running is restarted and sessions are found and validated again.
+*/
+void resumeAfterRecovery(){
+	gHandle = -1;
+	gReconnect.reset(); //Sessions being reconnected are found again below, like every other session
+	gRecords.dropPrefetches();
+	resetConnectionHint(); //The new NCL instance starts from its defaults
+	gScanMaintenance.reset(); //and with an empty scanned Nymi list
+	std::lock_guard<std::mutex> lock(gScanMutex);
+	if (gScanMode == SCAN_DISCOVERY){
+		if (!gMetrics.checkCall(nclStartDiscovery())) gLog.log("log: restarting discovery failed");
+	}
+	else if (gScanMode == SCAN_FINDING || gSessions.size() > 0){
+		if (!startFindingLocked()) gLog.log("log: restarting finding failed");
+	}
+}
+
+/*
+Looks up a provision made by this NEA, for gReconnect
+*/
+bool lookupProvision(const ProvisionKey& provision, NclProvision& found){
+	for (size_t i = 0; i < gProvisions.size(); ++i){
+		if (provisionKey(gProvisions[i].id) == provision){
+			found = gProvisions[i];
+			return true;
+		}
+	}
+	return false;
+}
+
+/*
+Restarts the scan the NEA was running once gReconnect doesn't need the scanner anymore
+*/
+void restoreScan(){
+	std::lock_guard<std::mutex> lock(gScanMutex);
+	if (gScanMode == SCAN_DISCOVERY){
+		if (!gMetrics.checkCall(nclStartDiscovery())) gLog.log("log: restarting discovery failed");
+	}
+	else if (gScanMode == SCAN_FINDING){
+		if (!startFindingLocked()) gLog.log("log: restarting finding failed");
+	}
+}
+
+/*
+Queues a command for the currently connected Nymi
+@param[in] completion event type that completes the command
+@param[in] command NCL call to make
+@param[in] name name of the command, for logs
+*/
+void queueCommand(NclEventType completion, NclCommand command, const char* name){
+	if (gHandle == -1){
+		std::cout << "NEA Not connected to a Nymi. Cannot " << name << "\n";
+		return;
+	}
+	gScheduler.submit(gHandle, completion, command, name);
+}
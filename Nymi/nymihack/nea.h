@@ -0,0 +1,112 @@
+#ifndef NEA_H
+#define NEA_H
+
+#include "ncl.h"
+#include "command_queue.h"
+#include "sessions.h"
+
+#include <atomic>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/*
+State and event handling of the NEA, shared by the interactive program and the replay benchmark
+*/
+
+enum ScanMode{ SCAN_NONE, SCAN_DISCOVERY, SCAN_FINDING };
+
+extern bool gNclInitialized;	//Global variable to maintain the state of the NCL
+extern int gHandle; //Global variable to maintain the current connected Nymi handle
+extern std::vector<NclProvision> gProvisions; //Global vector for storing the list of provisioned Nymi
+extern NclSkId gSkId; //ID of the last symmetric key created, used by "getsk"
+extern bool gHaveSkId;
+extern ScanMode gScanMode; //Scan the NEA asked for, restarted after an NCL recovery
+extern ScanMode gPausedScan; //Scan stopped while the scanned Nymi list is cleared
+extern std::mutex gScanMutex; //Held while gScanMode or gPausedScan is read or changed along with the NCL scan itself
+extern bool gStreamOnValidate; //Set by "stream": connect with the streaming profile and start ECG once validated
+extern std::string gStation; //Triage station this NEA's reader is at, whose terminals get its validations
+extern int retval;
+extern std::ofstream myfile;
+
+/*
+Called once a patient's identity is established
+@param[in] nymiHandle handle of the patient's Nymi
+@param[in] strong true if it came from a strong find, which needs no connection
+*/
+void onIdentified(int nymiHandle, bool strong);
+
+/*
+Where established identities go: onIdentified, unless a benchmark's own validations must not reach
+the terminals, the records and example.txt, e.g. the connection sweep's
+*/
+typedef void (*IdentifiedHandler)(int nymiHandle, bool strong);
+extern std::atomic<IdentifiedHandler> gIdentifiedHandler;
+
+/*
+Starts identifying a found Nymi picked at the desk
+@param[in] nymiHandle handle of the Nymi
+@param[in] provision provision it was found with
+@param[in] strong whether the find was strong
+*/
+void beginIdentification(int nymiHandle, const ProvisionKey& provision, bool strong);
+
+/*
+Validates the nearest found Nymi, if it is close enough to be at the desk and no other Nymi is being validated
+*/
+void validateNearest();
+
+/*
+Function for handling the events thrown by the NCL, or replayed from the journal
+@param[in] event NclEvent that contains the event type and member variables
+@param[in] userData Data that needs to be passed to the callback functions if provided
+*/
+void handleEvent(NclEvent event, void* userData);
+
+/*
+Callback registered with the NCL. Journals the event before handling it.
+*/
+void callback(NclEvent event, void* userData);
+
+/*
+Starts finding every provisioned Nymi
+*/
+bool startFinding();
+
+/*
+Stops the running scan so gScanMaintenance can clear the scanned Nymi list
+@return false while a Nymi is being provisioned or validated
+*/
+bool pauseScan();
+
+/*
+Restarts the scan stopped by pauseScan, with fresh handles
+*/
+void resumeScan();
+
+/*
+Called by gRecovery once the NCL is initialized again
+*/
+void resumeAfterRecovery();
+
+/*
+Looks up a provision made by this NEA, for gReconnect
+@return false if the provision isn't one of gProvisions
+*/
+bool lookupProvision(const ProvisionKey& provision, NclProvision& found);
+
+/*
+Restarts the scan the NEA was running once gReconnect doesn't need the scanner anymore
+*/
+void restoreScan();
+
+/*
+Queues a command for the currently connected Nymi
+@param[in] completion event type that completes the command
+@param[in] command NCL call to make
+@param[in] name name of the command, for logs
+*/
+void queueCommand(NclEventType completion, NclCommand command, const char* name);
+
+#endif
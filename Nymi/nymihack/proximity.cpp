@@ -0,0 +1,118 @@
+#include "proximity.h"
+#include "clock.h"
+
+#include <algorithm>
+
+ProximityTracker gProximity;
+
+static const double kMeasurementVariance = 25.0; //BLE RSSI readings scatter by about 5 dB
+static const double kDriftPerSecond = 4.0; //how fast the true RSSI can change as a wearer moves, dB^2/s
+static const unsigned kMinSamples = 3; //readings needed before a Nymi can be picked
+static const double kDefaultDeskRssi = -70.0;
+
+ProximityTracker::ProximityTracker() : mDeskRssi(kDefaultDeskRssi){}
+
+void ProximityTracker::update(int nymiHandle, int rssi){
+	long long now = monotonicMicros();
+	std::lock_guard<std::mutex> lock(mMutex);
+	std::map<int, Track>::iterator it = mTracks.find(nymiHandle);
+	if (it == mTracks.end()){
+		Track track;
+		track.rssi = rssi;
+		track.variance = kMeasurementVariance;
+		track.updatedAt = now;
+		track.samples = 1;
+		mTracks[nymiHandle] = track;
+		return;
+	}
+	Track& track = it->second;
+	//Predict: uncertainty grows with the time since the last reading
+	track.variance += kDriftPerSecond * (now - track.updatedAt) / 1e6;
+	//Correct: weigh the reading by how uncertain the estimate is
+	double gain = track.variance / (track.variance + kMeasurementVariance);
+	track.rssi += gain * (rssi - track.rssi);
+	track.variance *= 1.0 - gain;
+	track.updatedAt = now;
+	++track.samples;
+}
+
+bool ProximityTracker::estimate(int nymiHandle, double& rssi){
+	std::lock_guard<std::mutex> lock(mMutex);
+	std::map<int, Track>::iterator it = mTracks.find(nymiHandle);
+	if (it == mTracks.end()) return false;
+	rssi = it->second.rssi;
+	return true;
+}
+
+void ProximityTracker::addCandidate(int nymiHandle, const ProvisionKey& provision, bool strong){
+	std::lock_guard<std::mutex> lock(mMutex);
+	Candidate& candidate = mCandidates[nymiHandle];
+	candidate.strong = (candidate.provision == provision && candidate.strong) || strong;
+	candidate.provision = provision;
+}
+
+bool ProximityTracker::takeNearest(int& nymiHandle, ProvisionKey& provision, bool& strong){
+	std::lock_guard<std::mutex> lock(mMutex);
+	std::map<int, Candidate>::iterator nearest = mCandidates.end();
+	double nearestRssi = mDeskRssi;
+	for (std::map<int, Candidate>::iterator it = mCandidates.begin(); it != mCandidates.end(); ++it){
+		std::map<int, Track>::iterator track = mTracks.find(it->first);
+		if (track == mTracks.end() || track->second.samples < kMinSamples) continue;
+		if (track->second.rssi >= nearestRssi){
+			nearestRssi = track->second.rssi;
+			nearest = it;
+		}
+	}
+	if (nearest == mCandidates.end()) return false;
+	nymiHandle = nearest->first;
+	provision = nearest->second.provision;
+	strong = nearest->second.strong;
+	mCandidates.erase(nearest);
+	return true;
+}
+
+static bool nearerFirst(const std::pair<int, double>& a, const std::pair<int, double>& b){
+	return a.second > b.second;
+}
+
+std::vector<std::pair<int, double> > ProximityTracker::ranked(){
+	std::lock_guard<std::mutex> lock(mMutex);
+	std::vector<std::pair<int, double> > tracks;
+	for (std::map<int, Track>::iterator it = mTracks.begin(); it != mTracks.end(); ++it){
+		tracks.push_back(std::make_pair(it->first, it->second.rssi));
+	}
+	std::sort(tracks.begin(), tracks.end(), nearerFirst);
+	return tracks;
+}
+
+void ProximityTracker::setDeskRssi(double rssi){
+	std::lock_guard<std::mutex> lock(mMutex);
+	mDeskRssi = rssi;
+}
+
+double ProximityTracker::deskRssi(){
+	std::lock_guard<std::mutex> lock(mMutex);
+	return mDeskRssi;
+}
+
+void ProximityTracker::forget(int nymiHandle){
+	std::lock_guard<std::mutex> lock(mMutex);
+	mTracks.erase(nymiHandle);
+	mCandidates.erase(nymiHandle);
+}
+
+void ProximityTracker::clearCandidates(){
+	std::lock_guard<std::mutex> lock(mMutex);
+	mCandidates.clear();
+}
+
+void ProximityTracker::clear(){
+	std::lock_guard<std::mutex> lock(mMutex);
+	mTracks.clear();
+	mCandidates.clear();
+}
+
+size_t ProximityTracker::size(){
+	std::lock_guard<std::mutex> lock(mMutex);
+	return mTracks.size();
+}
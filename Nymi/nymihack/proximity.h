@@ -0,0 +1,85 @@
+#ifndef PROXIMITY_H
+#define PROXIMITY_H
+
+#include "sessions.h"
+
+#include <map>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+/*
+Tracks how close each Nymi is from the RSSI of discovery, find, detection and nclGetRssi events.
+Raw RSSI jumps by several dB between advertisements, so each handle gets a scalar Kalman filter:
+the estimate drifts (process noise grows with the time since the last reading) and each reading
+is weighed against its measurement noise. A single strong reading from someone walking past the
+door moves the estimate only part of the way, while someone standing at the desk converges quickly.
+*/
+class ProximityTracker{
+public:
+	ProximityTracker();
+
+	/*
+	Feeds an RSSI reading for a Nymi
+	@param[in] nymiHandle handle of the Nymi
+	@param[in] rssi RSSI in dB
+	*/
+	void update(int nymiHandle, int rssi);
+
+	/*
+	Smoothed RSSI of a Nymi
+	@return false if the Nymi hasn't been seen
+	*/
+	bool estimate(int nymiHandle, double& rssi);
+
+	/*
+	Marks a found Nymi as waiting for validation
+	@param[in] strong whether the find was strong, in which case the Nymi needs no validation
+	*/
+	void addCandidate(int nymiHandle, const ProvisionKey& provision, bool strong);
+
+	/*
+	Removes and returns the nearest waiting Nymi, if it's close enough to be at the desk
+	@param[out] nymiHandle handle of the nearest Nymi
+	@param[out] provision provision it was found with
+	@param[out] strong whether it was found strongly
+	@return false if no waiting Nymi has enough readings above the desk threshold
+	*/
+	bool takeNearest(int& nymiHandle, ProvisionKey& provision, bool& strong);
+
+	/*
+	Handles and smoothed RSSI of every tracked Nymi, nearest first
+	*/
+	std::vector<std::pair<int, double> > ranked();
+
+	void setDeskRssi(double rssi); //smoothed RSSI a Nymi needs before it's validated
+	double deskRssi();
+
+	void forget(int nymiHandle);
+	void clearCandidates();
+	void clear();
+	size_t size();
+
+private:
+	struct Track{
+		double rssi; //estimate in dB
+		double variance; //variance of the estimate in dB^2
+		long long updatedAt; //monotonicMicros() of the last reading
+		unsigned samples;
+	};
+
+	struct Candidate{
+		Candidate() : strong(false){}
+		ProvisionKey provision;
+		bool strong;
+	};
+
+	std::mutex mMutex;
+	std::map<int, Track> mTracks;
+	std::map<int, Candidate> mCandidates;
+	double mDeskRssi;
+};
+
+extern ProximityTracker gProximity; //Global proximity tracker
+
+#endif
@@ -0,0 +1,252 @@
+#include "reconnect.h"
+#include "clock.h"
+#include "command_queue.h"
+#include "connection_profiles.h"
+#include "logger.h"
+#include "metrics.h"
+#include "recovery.h"
+
+#include <chrono>
+
+ReconnectEngine gReconnect;
+
+static const unsigned kMaxReconnectAttempts = 6;
+static const long long kFindWindowMicros = 3000000; //a Nymi in range advertises well within this
+static const long long kValidateTimeoutMicros = 5000000;
+static const unsigned kBackoffBaseMillis = 100;
+static const unsigned kBackoffMaxMillis = 2000;
+
+ReconnectEngine::ReconnectEngine() : mRunning(false), mRescan(false), mScanning(false), mScanMutex(NULL), mRecovered(0), mAbandoned(0), mLastReconnectMicros(0){}
+
+ReconnectEngine::~ReconnectEngine(){
+	stop();
+}
+
+void ReconnectEngine::start(std::function<bool(const ProvisionKey&, NclProvision&)> lookup, std::function<void()> restoreScan, std::mutex& scanMutex){
+	std::lock_guard<std::mutex> lock(mMutex);
+	if (mRunning) return;
+	mLookup = lookup;
+	mRestoreScan = restoreScan;
+	mScanMutex = &scanMutex;
+	mRunning = true;
+	mThread = std::thread(&ReconnectEngine::run, this);
+}
+
+void ReconnectEngine::stop(){
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		if (!mRunning) return;
+		mRunning = false;
+	}
+	mWake.notify_all();
+	mThread.join();
+}
+
+bool ReconnectEngine::onDisconnection(const NclEvent& event, bool current){
+	int nymiHandle = event.disconnection.nymiHandle;
+	long long now = monotonicMicros();
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		if (!mRunning) return false;
+		for (size_t i = 0; i < mReconnects.size(); ++i){
+			if (mReconnects[i].nymiHandle == nymiHandle){ //validation of the new handle failed
+				Session before;
+				gSessions.unbind(nymiHandle, before);
+				gScheduler.park(nymiHandle, mReconnects[i].provision);
+				failAttempt(mReconnects[i], now);
+				mWake.notify_all();
+				return true;
+			}
+		}
+	}
+
+	NclDisconnectionReason reason = event.disconnection.reason;
+	if (reason != NCL_DISCONNECTION_TIMEOUT && reason != NCL_DISCONNECTION_LL_RESPONSE_TIMEOUT) return false;
+	Session session;
+	if (!gSessions.find(nymiHandle, session) || !session.validated) return false;
+	Reconnect reconnect;
+	if (!mLookup(session.provision, reconnect.ncl)) return false;
+
+	//Commands queued for the old handle wait for the new one
+	gScheduler.park(nymiHandle, session.provision);
+	gSessions.unbind(nymiHandle, session);
+
+	reconnect.provision = session.provision;
+	reconnect.nymiHandle = -1;
+	reconnect.current = current;
+	reconnect.attempt = 0;
+	reconnect.lostAt = now;
+	reconnect.deadline = now + kFindWindowMicros;
+	reconnect.waiting = false;
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mReconnects.push_back(reconnect);
+		mRescan = true;
+	}
+	mWake.notify_all();
+	gLog.log("log: Nymi {} timed out ({}), reconnecting", nymiHandle, reason == NCL_DISCONNECTION_TIMEOUT ? "timeout" : "link layer timeout");
+	return true;
+}
+
+bool ReconnectEngine::onFind(const NclEvent& event){
+	ProvisionKey provision = provisionKey(event.find.provisionId);
+	int nymiHandle = event.find.nymiHandle;
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		size_t i = 0;
+		while (i < mReconnects.size() && mReconnects[i].provision != provision) ++i;
+		if (i == mReconnects.size()) return false;
+		Reconnect& reconnect = mReconnects[i];
+		if (reconnect.nymiHandle != -1) return true; //already validating, a repeated find
+		//Taken even while backing off: the Nymi is obviously back in range
+		reconnect.nymiHandle = nymiHandle;
+		reconnect.waiting = false;
+		reconnect.deadline = monotonicMicros() + kValidateTimeoutMicros;
+		mRescan = true;
+	}
+	mWake.notify_all();
+	gSessions.onFind(nymiHandle, provision);
+	hintConnection(PROFILE_VALIDATE);
+	gScheduler.submit(nymiHandle, NCL_EVENT_VALIDATION, nclValidate, "revalidate");
+	return true;
+}
+
+bool ReconnectEngine::onValidation(int nymiHandle, bool& current){
+	long long took;
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		size_t i = 0;
+		while (i < mReconnects.size() && mReconnects[i].nymiHandle != nymiHandle) ++i;
+		if (i == mReconnects.size()) return false;
+		current = mReconnects[i].current;
+		took = monotonicMicros() - mReconnects[i].lostAt;
+		mLastReconnectMicros = took;
+		++mRecovered;
+		mReconnects.erase(mReconnects.begin() + i);
+		mRescan = true;
+	}
+	mWake.notify_all();
+	gLog.log("log: Nymi {} reconnected in {} ms", nymiHandle, took / 1000);
+	return true;
+}
+
+void ReconnectEngine::reset(){
+	std::lock_guard<std::mutex> lock(mMutex);
+	mReconnects.clear();
+	mRescan = false;
+	mScanning = false; //the reinit stopped every scan
+}
+
+/*
+Counts a failed attempt and backs off, or gives the session up. Called with mMutex held.
+*/
+void ReconnectEngine::failAttempt(Reconnect& reconnect, long long now){
+	reconnect.nymiHandle = -1;
+	++reconnect.attempt;
+	mRescan = true;
+	if (reconnect.attempt >= kMaxReconnectAttempts){
+		gLog.log("log: giving up reconnecting a Nymi after {} attempts", reconnect.attempt);
+		gSessions.removeUnbound(reconnect.provision);
+		++mAbandoned;
+		reconnect.deadline = 0; //removed by run()
+		return;
+	}
+	reconnect.waiting = true;
+	reconnect.deadline = now + backoffMillis(reconnect.attempt - 1, kBackoffBaseMillis, kBackoffMaxMillis) * 1000LL;
+}
+
+void ReconnectEngine::run(){
+	std::unique_lock<std::mutex> lock(mMutex);
+	std::vector<int> stale; //handles whose validation timed out
+	while (mRunning){
+		long long now = monotonicMicros();
+		for (size_t i = 0; i < mReconnects.size(); ++i){
+			Reconnect& reconnect = mReconnects[i];
+			if (reconnect.deadline == 0 || now < reconnect.deadline) continue;
+			if (reconnect.waiting){ //backoff over, open the next find window
+				reconnect.waiting = false;
+				reconnect.deadline = now + kFindWindowMicros;
+				mRescan = true;
+			}
+			else{ //no find in the window, or no validation in time
+				if (reconnect.nymiHandle != -1){
+					Session before;
+					gSessions.unbind(reconnect.nymiHandle, before);
+					gScheduler.park(reconnect.nymiHandle, reconnect.provision);
+					stale.push_back(reconnect.nymiHandle);
+				}
+				failAttempt(reconnect, now);
+			}
+		}
+		for (size_t i = 0; i < mReconnects.size();){
+			if (mReconnects[i].deadline == 0) mReconnects.erase(mReconnects.begin() + i);
+			else ++i;
+		}
+
+		if (!stale.empty()){
+			std::vector<int> handles;
+			handles.swap(stale);
+			lock.unlock();
+			for (size_t i = 0; i < handles.size(); ++i) gMetrics.checkCall(nclDisconnect(handles[i]));
+			lock.lock();
+		}
+
+		if (mRescan){
+			mRescan = false;
+			std::vector<NclProvision> finding;
+			for (size_t i = 0; i < mReconnects.size(); ++i){
+				if (!mReconnects[i].waiting && mReconnects[i].nymiHandle == -1) finding.push_back(mReconnects[i].ncl);
+			}
+			bool wasScanning = mScanning;
+			bool done = mReconnects.empty();
+			mScanning = !done;
+			//The NCL may deliver events while these calls run, so they're made without the lock
+			lock.unlock();
+			{
+				std::lock_guard<std::mutex> scanLock(*mScanMutex);
+				if (!finding.empty()){
+					gMetrics.checkCall(nclStopScan());
+					if (!gMetrics.checkCall(nclStartFinding(finding.data(), finding.size(), NCL_FALSE))) gLog.log("log: finding Nymis to reconnect failed");
+				}
+				else if (!done || wasScanning){
+					gMetrics.checkCall(nclStopScan()); //between find windows, or before the NEA's scan is restored
+				}
+			}
+			if (done && wasScanning && mRestoreScan) mRestoreScan(); //takes the scan mutex itself
+			lock.lock();
+			continue; //state may have changed while unlocked
+		}
+
+		long long next = 0;
+		for (size_t i = 0; i < mReconnects.size(); ++i){
+			if (next == 0 || mReconnects[i].deadline < next) next = mReconnects[i].deadline;
+		}
+		if (next == 0){
+			mWake.wait(lock);
+		}
+		else{
+			long long wait = next - monotonicMicros();
+			if (wait > 0) mWake.wait_for(lock, std::chrono::microseconds(wait));
+		}
+	}
+}
+
+size_t ReconnectEngine::pending(){
+	std::lock_guard<std::mutex> lock(mMutex);
+	return mReconnects.size();
+}
+
+unsigned ReconnectEngine::recovered(){
+	std::lock_guard<std::mutex> lock(mMutex);
+	return mRecovered;
+}
+
+unsigned ReconnectEngine::abandoned(){
+	std::lock_guard<std::mutex> lock(mMutex);
+	return mAbandoned;
+}
+
+long long ReconnectEngine::lastReconnectMicros(){
+	std::lock_guard<std::mutex> lock(mMutex);
+	return mLastReconnectMicros;
+}
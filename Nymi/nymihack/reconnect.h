@@ -0,0 +1,99 @@
+#ifndef RECONNECT_H
+#define RECONNECT_H
+
+#include "ncl.h"
+#include "sessions.h"
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+Brings back validated sessions whose Nymi dropped with NCL_DISCONNECTION_TIMEOUT or
+NCL_DISCONNECTION_LL_RESPONSE_TIMEOUT, without an operator retyping "validate".
+The session is kept but unbound, its queued commands are parked, and the scan is switched to finding
+only the provisions being reconnected. The first find is validated right away and the validation
+resumes the parked commands. A window without a find, or a failed validation, is retried after a
+jittered backoff; after kMaxReconnectAttempts the session is given up. Other sessions keep their
+connections; once nothing is left to reconnect, the scan the NEA was running is restored.
+*/
+class ReconnectEngine{
+public:
+	ReconnectEngine();
+	~ReconnectEngine();
+
+	/*
+	Starts the reconnect thread
+	@param[in] lookup finds the NclProvision (id and key) of a provision, false if it isn't known
+	@param[in] restoreScan restarts the NEA's own scan once no reconnect needs the scanner
+	@param[in] scanMutex held around the thread's scan calls, the one the NEA changes its scan under
+	*/
+	void start(std::function<bool(const ProvisionKey&, NclProvision&)> lookup, std::function<void()> restoreScan, std::mutex& scanMutex);
+	void stop();
+
+	/*
+	Starts reconnecting if a validated session's Nymi timed out, or retries if a reconnecting Nymi dropped again
+	@param[in] event NCL_EVENT_DISCONNECTION
+	@param[in] current true if the handle was the NEA's current Nymi
+	@return true if the session is kept for a reconnect
+	*/
+	bool onDisconnection(const NclEvent& event, bool current);
+
+	/*
+	Takes a find of a provision being reconnected and validates it
+	@return true if the find was taken, so it must not go through the normal finding path
+	*/
+	bool onFind(const NclEvent& event);
+
+	/*
+	Completes a reconnect
+	@param[out] current true if the Nymi was the NEA's current Nymi when it dropped
+	@return true if the validation finished a reconnect
+	*/
+	bool onValidation(int nymiHandle, bool& current);
+
+	/*
+	Forgets every reconnect without touching the scan, e.g. after an NCL reinit invalidated all handles
+	*/
+	void reset();
+
+	size_t pending();
+	unsigned recovered();
+	unsigned abandoned();
+	long long lastReconnectMicros(); //from the drop to the validation of the last reconnect
+
+private:
+	struct Reconnect{
+		ProvisionKey provision;
+		NclProvision ncl;
+		int nymiHandle; //new handle while validating, -1 before it is found
+		bool current;
+		unsigned attempt; //attempts that failed so far
+		long long lostAt; //monotonicMicros() of the drop
+		long long deadline; //end of the find window, of the validation, or of the backoff
+		bool waiting; //backing off before the next find window
+	};
+
+	void run();
+	void failAttempt(Reconnect& reconnect, long long now);
+
+	std::mutex mMutex;
+	std::condition_variable mWake;
+	std::thread mThread;
+	bool mRunning;
+	bool mRescan; //set of provisions to find changed
+	bool mScanning; //the scanner is ours
+	std::vector<Reconnect> mReconnects;
+	std::function<bool(const ProvisionKey&, NclProvision&)> mLookup;
+	std::function<void()> mRestoreScan;
+	std::mutex* mScanMutex; //the NEA's, see start()
+	unsigned mRecovered;
+	unsigned mAbandoned;
+	long long mLastReconnectMicros;
+};
+
+extern ReconnectEngine gReconnect; //Global reconnect engine
+
+#endif
@@ -0,0 +1,277 @@
+#include "record_log.h"
+#include "gzip.h"
+#include "logger.h"
+
+#include <fstream>
+#include <iterator>
+#include <vector>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+RecordLog gRecordLog;
+
+static const size_t kEntryHeaderBytes = 8; //payload length and CRC32
+
+static const char* gFieldNames[FIELD_COUNT] = {
+	"ohip", "name", "sex", "born", "expiry", "address", "phone",
+	"contactName", "contactPhone", "contactRelationship", "donor", "allergies"
+};
+
+const char* recordFieldName(RecordField field){
+	return field < FIELD_COUNT ? gFieldNames[field] : "unknown";
+}
+
+bool parseRecordField(const std::string& name, RecordField& field){
+	for (int i = 0; i < FIELD_COUNT; ++i){
+		if (name == gFieldNames[i]){
+			field = (RecordField)i;
+			return true;
+		}
+	}
+	return false;
+}
+
+static void putInt(std::string& out, unsigned long long value, unsigned bytes){
+	for (unsigned i = 0; i < bytes; ++i) out += (char)((value >> (8 * i)) & 0xff);
+}
+
+static unsigned long long getInt(const char* in, unsigned bytes){
+	unsigned long long value = 0;
+	for (unsigned i = 0; i < bytes; ++i) value |= (unsigned long long)(unsigned char)in[i] << (8 * i);
+	return value;
+}
+
+/*
+Appends an entry: payload length, CRC32 of the payload, then the payload
+(sequence, time, field, health number, value), all little endian
+*/
+static void encode(std::string& out, unsigned long long sequence, const FieldUpdate& update){
+	std::string payload;
+	payload.reserve(27 + update.ohip.size() + update.value.size());
+	putInt(payload, sequence, 8);
+	putInt(payload, (unsigned long long)update.time, 8);
+	putInt(payload, (unsigned)update.field, 1);
+	putInt(payload, update.ohip.size(), 2);
+	payload += update.ohip;
+	putInt(payload, update.value.size(), 4);
+	payload += update.value;
+	putInt(out, payload.size(), 4);
+	putInt(out, crc32(payload.data(), payload.size()), 4);
+	out += payload;
+}
+
+/*
+Decodes the entry at offset
+@return the entry's size, 0 if it is torn or corrupt
+*/
+static size_t decode(const std::vector<char>& data, size_t offset, FieldUpdate& update){
+	if (data.size() - offset < kEntryHeaderBytes) return 0;
+	size_t length = (size_t)getInt(&data[offset], 4);
+	unsigned crc = (unsigned)getInt(&data[offset + 4], 4);
+	if (length < 23 || data.size() - offset - kEntryHeaderBytes < length) return 0;
+	const char* payload = &data[offset + kEntryHeaderBytes];
+	if (crc32(payload, length) != crc) return 0;
+	update.time = (long long)getInt(payload + 8, 8);
+	unsigned field = (unsigned)getInt(payload + 16, 1);
+	size_t ohipLength = (size_t)getInt(payload + 17, 2);
+	if (field >= FIELD_COUNT || 19 + ohipLength + 4 > length) return 0;
+	update.field = (RecordField)field;
+	update.ohip.assign(payload + 19, ohipLength);
+	size_t valueLength = (size_t)getInt(payload + 19 + ohipLength, 4);
+	if (23 + ohipLength + valueLength != length) return 0;
+	update.value.assign(payload + 23 + ohipLength, valueLength);
+	return kEntryHeaderBytes + length;
+}
+
+RecordLog::RecordLog() : mRunning(false), mFailed(false), mLastSequence(0), mDurableSequence(0), mSyncs(0), mFile(-1), mGoodBytes(0){}
+
+RecordLog::~RecordLog(){
+	close();
+}
+
+bool RecordLog::open(const std::string& path, std::function<void(const FieldUpdate&)> replay){
+	if (mRunning) return false;
+	std::vector<char> data;
+	{
+		std::ifstream in(path.c_str(), std::ios::binary);
+		if (in) data.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+	}
+	size_t good = 0;
+	unsigned long long replayed = 0;
+	FieldUpdate update;
+	while (size_t size = decode(data, good, update)){
+		replay(update);
+		good += size;
+		++replayed;
+	}
+	if (good < data.size()){
+		//Only a torn tail is cut; acknowledged edits after the bad bytes must not be thrown away with it
+		for (size_t offset = good + 1; offset < data.size(); ++offset){
+			FieldUpdate later;
+			if (decode(data, offset, later)){
+				gLog.log("log: record log is corrupt at byte {} but has good edits at byte {}, left as is", (unsigned long long)good, (unsigned long long)offset);
+				return false;
+			}
+		}
+		gLog.log("log: record log has {} bytes of torn or corrupt edits at its end, dropped", (unsigned long long)(data.size() - good));
+	}
+	if (replayed > 0) gLog.log("log: {} record edits replayed", replayed);
+
+	//The file is cut after the last good entry, so new entries don't follow garbage
+#if defined(_WIN32)
+	HANDLE file = CreateFileA(path.c_str(), GENERIC_WRITE, FILE_SHARE_READ, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE) return false;
+	LARGE_INTEGER end;
+	end.QuadPart = (LONGLONG)good;
+	if (!SetFilePointerEx(file, end, NULL, FILE_BEGIN) || !SetEndOfFile(file)){
+		CloseHandle(file);
+		return false;
+	}
+	mFile = (long long)(size_t)file;
+#else
+	int fd = ::open(path.c_str(), O_WRONLY | O_CREAT, 0600);
+	if (fd < 0) return false;
+	if (ftruncate(fd, (off_t)good) != 0 || lseek(fd, (off_t)good, SEEK_SET) < 0){
+		::close(fd);
+		return false;
+	}
+	mFile = fd;
+#endif
+	mLastSequence = mDurableSequence = replayed;
+	mGoodBytes = good;
+	mFailed = false;
+	mRunning = true;
+	mCommitter = std::thread(&RecordLog::run, this);
+	return true;
+}
+
+void RecordLog::close(){
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		if (!mRunning) return;
+		mRunning = false;
+	}
+	mWake.notify_all();
+	mCommitter.join(); //commits what is pending before it returns
+	mDurable.notify_all();
+#if defined(_WIN32)
+	CloseHandle((HANDLE)(size_t)mFile);
+#else
+	::close((int)mFile);
+#endif
+	mFile = -1;
+}
+
+unsigned long long RecordLog::append(const FieldUpdate& update){
+	std::string entry;
+	encode(entry, 0, update); //encoded outside the lock, the sequence is patched in below
+	std::lock_guard<std::mutex> lock(mMutex);
+	if (!mRunning || mFailed) return 0;
+	unsigned long long sequence = ++mLastSequence;
+	for (unsigned i = 0; i < 8; ++i) entry[kEntryHeaderBytes + i] = (char)((sequence >> (8 * i)) & 0xff);
+	unsigned crc = crc32(entry.data() + kEntryHeaderBytes, entry.size() - kEntryHeaderBytes);
+	for (unsigned i = 0; i < 4; ++i) entry[4 + i] = (char)((crc >> (8 * i)) & 0xff);
+	mPending += entry;
+	mWake.notify_one();
+	return sequence;
+}
+
+bool RecordLog::waitDurable(unsigned long long sequence){
+	std::unique_lock<std::mutex> lock(mMutex);
+	while (mDurableSequence < sequence && !mFailed && mRunning) mDurable.wait(lock);
+	return mDurableSequence >= sequence;
+}
+
+unsigned long long RecordLog::durable(){
+	std::lock_guard<std::mutex> lock(mMutex);
+	return mDurableSequence;
+}
+
+/*
+Writes a batch and waits for the disk. Called by the committer only, without the lock.
+*/
+bool RecordLog::writeBatch(const std::string& batch){
+#if defined(_WIN32)
+	HANDLE file = (HANDLE)(size_t)mFile;
+	size_t written = 0;
+	while (written < batch.size()){
+		DWORD wrote;
+		if (!WriteFile(file, batch.data() + written, (DWORD)(batch.size() - written), &wrote, NULL)) return false;
+		written += wrote;
+	}
+	return FlushFileBuffers(file) != 0;
+#else
+	int fd = (int)mFile;
+	size_t written = 0;
+	while (written < batch.size()){
+		ssize_t wrote = write(fd, batch.data() + written, batch.size() - written);
+		if (wrote < 0) return false;
+		written += (size_t)wrote;
+	}
+	return fdatasync(fd) == 0;
+#endif
+}
+
+/*
+Cuts what a failed batch may have left after the last durable entry, so the log still opens.
+Called by the committer only, without the lock.
+*/
+bool RecordLog::truncateBatch(){
+#if defined(_WIN32)
+	HANDLE file = (HANDLE)(size_t)mFile;
+	LARGE_INTEGER end;
+	end.QuadPart = (LONGLONG)mGoodBytes;
+	return SetFilePointerEx(file, end, NULL, FILE_BEGIN) && SetEndOfFile(file) && FlushFileBuffers(file);
+#else
+	int fd = (int)mFile;
+	return ftruncate(fd, (off_t)mGoodBytes) == 0 && lseek(fd, (off_t)mGoodBytes, SEEK_SET) >= 0 && fdatasync(fd) == 0;
+#endif
+}
+
+void RecordLog::run(){
+	std::unique_lock<std::mutex> lock(mMutex);
+	while (true){
+		while (mRunning && mPending.empty()) mWake.wait(lock);
+		if (mPending.empty()) return; //closed with nothing left
+		//Everything queued while the previous sync ran goes out in this one
+		std::string batch;
+		batch.swap(mPending);
+		unsigned long long last = mLastSequence;
+		lock.unlock();
+		bool written = writeBatch(batch);
+		lock.lock();
+		if (written){
+			mDurableSequence = last;
+			mGoodBytes += batch.size();
+			++mSyncs;
+		}
+		else{
+			//Nothing more is written after a partial batch: edits appended meanwhile are failed with it,
+			//and append() refuses new ones, so the log keeps what was acknowledged and opens next time
+			mFailed = true;
+			mPending.clear();
+			lock.unlock();
+			bool truncated = truncateBatch();
+			lock.lock();
+			gLog.log(truncated ? "log: record log couldn't be written, edits are no longer acknowledged" :
+				"log: record log couldn't be written or cut back to its last good edit, edits are no longer acknowledged");
+		}
+		mDurable.notify_all();
+	}
+}
+
+unsigned long long RecordLog::appended(){
+	std::lock_guard<std::mutex> lock(mMutex);
+	return mLastSequence;
+}
+
+unsigned long long RecordLog::syncs(){
+	std::lock_guard<std::mutex> lock(mMutex);
+	return mSyncs;
+}
@@ -0,0 +1,121 @@
+#ifndef RECORD_LOG_H
+#define RECORD_LOG_H
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+
+/*
+Fields of a patient record that infoPage.php can update one at a time
+*/
+enum RecordField{
+	FIELD_OHIP,
+	FIELD_NAME,
+	FIELD_SEX,
+	FIELD_BORN,
+	FIELD_EXPIRY,
+	FIELD_ADDRESS,
+	FIELD_PHONE,
+	FIELD_CONTACT_NAME,
+	FIELD_CONTACT_PHONE,
+	FIELD_CONTACT_RELATIONSHIP,
+	FIELD_DONOR,
+	FIELD_ALLERGIES, //comma separated
+	FIELD_COUNT
+};
+
+/*
+Name of a field in JSON and URLs, e.g. "contactPhone"
+*/
+const char* recordFieldName(RecordField field);
+
+/*
+@return false if the name isn't one of recordFieldName's
+*/
+bool parseRecordField(const std::string& name, RecordField& field);
+
+static const size_t kMaxUpdateValueBytes = 64 * 1024; //longest value an edit may carry; fields are capped at 32767 bytes, allergy lists a few times that
+
+/*
+One edit of one field of one record
+*/
+struct FieldUpdate{
+	std::string ohip; //health number of the record before the edit
+	RecordField field;
+	std::string value;
+	long long time; //milliseconds since 1970-01-01 UTC
+};
+
+/*
+Write-ahead log of record edits, replayed over the records file at startup.
+append() only copies the edit into the pending batch and returns its sequence number. A committer
+thread writes the whole batch and makes it durable with a single FlushFileBuffers/fdatasync, so
+edits arriving from many stations while one sync is running share the next one. Callers wait for
+their sequence number with waitDurable() before acknowledging the edit.
+Each entry carries its length and a CRC32; replay stops at the first torn or corrupt entry and the
+log is truncated there, unless a good entry follows it: then the damage isn't a torn tail and the
+log is left alone for inspection.
+After a failed write the log is cut back to its last durable entry and takes no more edits.
+*/
+class RecordLog{
+public:
+	RecordLog();
+	~RecordLog();
+
+	/*
+	Replays the log and opens it for appending
+	@param[in] path log file, created if missing
+	@param[in] replay called with every edit in the log, in order
+	@return false if the file couldn't be opened, or is corrupt before its end
+	*/
+	bool open(const std::string& path, std::function<void(const FieldUpdate&)> replay);
+
+	/*
+	Commits what is pending and closes the log
+	*/
+	void close();
+
+	/*
+	Queues an edit for the next group commit
+	@return its sequence number, 0 if the log isn't open or a write failed
+	*/
+	unsigned long long append(const FieldUpdate& update);
+
+	/*
+	Blocks until the edit with this sequence number is on disk
+	@return false if the log couldn't be written, or was closed first
+	*/
+	bool waitDurable(unsigned long long sequence);
+
+	/*
+	Sequence number of the last edit on disk; every edit up to it is durable
+	*/
+	unsigned long long durable();
+
+	unsigned long long appended();
+	unsigned long long syncs(); //group commits so far; appended() / syncs() edits share a sync on average
+
+private:
+	void run();
+	bool writeBatch(const std::string& batch);
+	bool truncateBatch();
+
+	std::mutex mMutex;
+	std::condition_variable mWake; //wakes the committer
+	std::condition_variable mDurable; //wakes waitDurable
+	std::thread mCommitter;
+	bool mRunning;
+	bool mFailed;
+	std::string mPending; //encoded entries not written yet
+	unsigned long long mLastSequence;
+	unsigned long long mDurableSequence;
+	unsigned long long mSyncs;
+	long long mFile; //HANDLE or file descriptor, -1 when closed
+	unsigned long long mGoodBytes; //end of the last durable entry in the file
+};
+
+extern RecordLog gRecordLog; //Global write-ahead log of record edits
+
+#endif
@@ -0,0 +1,1312 @@
+#include "records.h"
+#include "clock.h"
+#include "edit_distance.h"
+#include "validation_status.h"
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+
+RecordStore gRecords;
+
+static const char kRecordsPrefix[] = "/records/";
+static const size_t kDefaultAllergicLimit = 100;
+static const size_t kDefaultSearchResults = 10;
+
+std::string normalizeOhip(const std::string& ohip){
+	std::string normalized;
+	normalized.reserve(ohip.size());
+	for (size_t i = 0; i < ohip.size(); ++i){
+		unsigned char c = (unsigned char)ohip[i];
+		if (isalnum(c)) normalized += (char)toupper(c);
+	}
+	return normalized;
+}
+
+static const unsigned short kNoDate = 0xffff;
+static const unsigned kColdFields = 5; //name, address, phone, contact name, contact phone
+static const size_t kInitialIndexSlots = 1024; //power of two
+
+/*
+Packs a normalized health number, 10 digits and a version code of up to 2 letters, into 8 bytes:
+the digits times 1024, plus 5 bits per letter (A is 1, 0 for none)
+@return false if it isn't a valid health number
+*/
+static bool packOhip(const std::string& normalized, unsigned long long& packed){
+	if (normalized.size() < 10 || normalized.size() > 12) return false;
+	unsigned long long digits = 0;
+	for (size_t i = 0; i < 10; ++i){
+		if (normalized[i] < '0' || normalized[i] > '9') return false;
+		digits = digits * 10 + (normalized[i] - '0');
+	}
+	unsigned version = 0;
+	for (size_t i = 10; i < 12; ++i){
+		unsigned letter = 0;
+		if (i < normalized.size()){
+			if (normalized[i] < 'A' || normalized[i] > 'Z') return false;
+			letter = normalized[i] - 'A' + 1;
+		}
+		version = (version << 5) | letter;
+	}
+	packed = (digits << 10) | version;
+	return true;
+}
+
+std::string normalizeAllergen(const std::string& allergen){
+	std::string normalized;
+	normalized.reserve(allergen.size());
+	bool space = false;
+	for (size_t i = 0; i < allergen.size(); ++i){
+		unsigned char c = (unsigned char)allergen[i];
+		if (isspace(c)){
+			space = !normalized.empty();
+			continue;
+		}
+		if (space) normalized += ' ';
+		space = false;
+		normalized += (char)tolower(c);
+	}
+	return normalized;
+}
+
+/*
+Appends a packed health number as printed on the card, e.g. 5584-486-674-YM
+*/
+static void appendOhip(std::string& out, unsigned long long packed){
+	char digits[10];
+	unsigned long long number = packed >> 10;
+	for (int i = 9; i >= 0; --i){
+		digits[i] = (char)('0' + number % 10);
+		number /= 10;
+	}
+	out.append(digits, 4);
+	out += '-';
+	out.append(digits + 4, 3);
+	out += '-';
+	out.append(digits + 7, 3);
+	unsigned first = (unsigned)(packed >> 5) & 31, second = (unsigned)packed & 31;
+	if (first != 0){
+		out += '-';
+		out += (char)('A' + first - 1);
+		if (second != 0) out += (char)('A' + second - 1);
+	}
+}
+
+/*
+Days from 1970-01-01 of a civil date, valid for any Gregorian date
+*/
+static long daysFromCivil(long year, unsigned month, unsigned day){
+	year -= month <= 2;
+	long era = (year >= 0 ? year : year - 399) / 400;
+	unsigned yearOfEra = (unsigned)(year - era * 400);
+	unsigned dayOfYear = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+	unsigned dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+	return era * 146097 + (long)dayOfEra - 719468;
+}
+
+static void civilFromDays(long days, long& year, unsigned& month, unsigned& day){
+	days += 719468;
+	long era = (days >= 0 ? days : days - 146096) / 146097;
+	unsigned dayOfEra = (unsigned)(days - era * 146097);
+	unsigned yearOfEra = (dayOfEra - dayOfEra / 1460 + dayOfEra / 36524 - dayOfEra / 146096) / 365;
+	unsigned dayOfYear = dayOfEra - (365 * yearOfEra + yearOfEra / 4 - yearOfEra / 100);
+	unsigned mp = (5 * dayOfYear + 2) / 153;
+	day = dayOfYear - (153 * mp + 2) / 5 + 1;
+	month = mp < 10 ? mp + 3 : mp - 9;
+	year = (long)yearOfEra + era * 400 + (month <= 2);
+}
+
+static const long kDateEpoch = -25567; //daysFromCivil(1900, 1, 1)
+
+/*
+Packs a YYYY-MM-DD date as days since 1900-01-01, an empty date as kNoDate
+@return false if it isn't a date the column can hold
+*/
+static bool packDate(const std::string& text, unsigned short& packed){
+	if (text.empty()){
+		packed = kNoDate;
+		return true;
+	}
+	if (text.size() != 10 || text[4] != '-' || text[7] != '-') return false;
+	for (size_t i = 0; i < text.size(); ++i){
+		if (i != 4 && i != 7 && (text[i] < '0' || text[i] > '9')) return false;
+	}
+	long year = atol(text.substr(0, 4).c_str());
+	unsigned month = (unsigned)atoi(text.substr(5, 2).c_str());
+	unsigned day = (unsigned)atoi(text.substr(8, 2).c_str());
+	if (month < 1 || month > 12 || day < 1 || day > 31) return false;
+	long days = daysFromCivil(year, month, day) - kDateEpoch;
+	long year2;
+	unsigned month2, day2;
+	civilFromDays(days + kDateEpoch, year2, month2, day2);
+	if (month2 != month || day2 != day) return false; //e.g. 2015-02-30
+	if (days < 0 || days >= kNoDate) return false;
+	packed = (unsigned short)days;
+	return true;
+}
+
+static void appendDate(std::string& out, unsigned short packed){
+	if (packed == kNoDate) return;
+	long year;
+	unsigned month, day;
+	civilFromDays(packed + kDateEpoch, year, month, day);
+	char text[10] = { (char)('0' + year / 1000), (char)('0' + year / 100 % 10), (char)('0' + year / 10 % 10), (char)('0' + year % 10), '-',
+		(char)('0' + month / 10), (char)('0' + month % 10), '-', (char)('0' + day / 10), (char)('0' + day % 10) };
+	out.append(text, sizeof(text));
+}
+
+/*
+Appends a JSON string literal
+*/
+static void appendJsonString(std::string& out, const char* text, size_t length){
+	static const char digits[] = "0123456789abcdef";
+	out += '"';
+	for (size_t i = 0; i < length; ++i){
+		unsigned char c = (unsigned char)text[i];
+		switch (c){
+		case '"': out += "\\\""; break;
+		case '\\': out += "\\\\"; break;
+		case '\n': out += "\\n"; break;
+		case '\r': out += "\\r"; break;
+		case '\t': out += "\\t"; break;
+		default:
+			if (c < 0x20){
+				out += "\\u00";
+				out += digits[c >> 4];
+				out += digits[c & 0xf];
+			}
+			else{
+				out += (char)c;
+			}
+		}
+	}
+	out += '"';
+}
+
+std::string quotedValue(const std::string& value){
+	std::string quoted;
+	appendJsonString(quoted, value.data(), value.size());
+	return quoted;
+}
+
+static void appendJsonName(std::string& out, const char* name){
+	out += '"';
+	out += name;
+	out += "\":";
+}
+
+/*
+Reads the next length-prefixed string of a row's unique strings. Lengths under 128 take one byte,
+longer ones two with the top bit of the first set.
+*/
+static const char* nextCold(const char*& cold, size_t& length){
+	unsigned char first = (unsigned char)cold[0];
+	const char* text;
+	if (first < 0x80){
+		length = first;
+		text = cold + 1;
+	}
+	else{
+		length = ((first & 0x7f) << 8) | (unsigned char)cold[1];
+		text = cold + 2;
+	}
+	cold = text + length;
+	return text;
+}
+
+/*
+Parses a provision id written in hex
+@return false if it isn't NCL_PROVISION_ID_SIZE bytes of hex
+*/
+static bool parseProvisionHex(const std::string& hex, ProvisionKey& provision){
+	if (hex.size() != NCL_PROVISION_ID_SIZE * 2) return false;
+	provision.assign(NCL_PROVISION_ID_SIZE, '\0');
+	for (size_t i = 0; i < hex.size(); ++i){
+		int c = tolower((unsigned char)hex[i]);
+		int nibble;
+		if (c >= '0' && c <= '9') nibble = c - '0';
+		else if (c >= 'a' && c <= 'f') nibble = c - 'a' + 10;
+		else return false;
+		provision[i / 2] = (char)(((unsigned char)provision[i / 2] << 4) | nibble);
+	}
+	return true;
+}
+
+static std::vector<std::string> split(const std::string& text, char separator){
+	std::vector<std::string> parts;
+	std::istringstream in(text);
+	std::string part;
+	while (std::getline(in, part, separator)) parts.push_back(part);
+	if (!text.empty() && text[text.size() - 1] == separator) parts.push_back(std::string());
+	return parts;
+}
+
+static long long nowMillis(){
+	return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+/*
+Spreads a packed health number over the index
+*/
+static size_t hashOhip(unsigned long long ohip){
+	ohip ^= ohip >> 33;
+	ohip *= 0xff51afd7ed558ccdULL;
+	ohip ^= ohip >> 33;
+	return (size_t)ohip;
+}
+
+RecordStore::RecordStore() : mColdGarbage(0), mAllergyGarbage(0), mHaveCurrent(false), mGeneration(0), mCurrentGeneration(0), mCurrentChanges(0), mPrefetchOrder(0),
+	mPrefetchesPublished(0), mPrefetchesMissed(0), mPrefetchesDropped(0){
+	mIndex.assign(kInitialIndexSlots, 0);
+}
+
+bool RecordStore::load(const std::string& path){
+	std::ifstream in(path.c_str());
+	if (!in) return false;
+	std::string line;
+	while (std::getline(in, line)){
+		if (!line.empty() && line[line.size() - 1] == '\r') line.resize(line.size() - 1);
+		if (line.empty() || line[0] == '#') continue;
+		std::vector<std::string> fields = split(line, '\t');
+		if (fields.size() < 12) continue;
+		PatientRecord record;
+		record.ohip = fields[0];
+		record.name = fields[1];
+		record.sex = fields[2];
+		record.born = fields[3];
+		record.expiry = fields[4];
+		record.address = fields[5];
+		record.phone = fields[6];
+		record.contactName = fields[7];
+		record.contactPhone = fields[8];
+		record.contactRelationship = fields[9];
+		record.donor = fields[10];
+		std::vector<std::string> allergies = split(fields[11], ',');
+		for (size_t i = 0; i < allergies.size(); ++i){
+			if (!allergies[i].empty()) record.allergies.push_back(allergies[i]);
+		}
+		if (!put(record)) continue;
+		ProvisionKey provision;
+		if (fields.size() > 12 && parseProvisionHex(fields[12], provision)) link(provision, record.ohip);
+	}
+	shrink();
+	return true;
+}
+
+void RecordStore::seed(){
+	PatientRecord record;
+	record.ohip = "5584-486-674-YM";
+	record.name = "Anita Jean Walker";
+	record.sex = "F";
+	record.born = "1981-12-15";
+	record.expiry = "2017-12-15";
+	record.address = "123 Some Street";
+	record.phone = "905-888-1234";
+	record.contactName = "John Doe";
+	record.contactPhone = "416-888-1234";
+	record.contactRelationship = "Father";
+	record.donor = "9Z";
+	record.allergies.push_back("Penicillin");
+	record.allergies.push_back("Grass");
+	put(record);
+}
+
+/*
+Finds the row of a packed health number. Called with mMutex held.
+*/
+bool RecordStore::findRow(unsigned long long ohip, unsigned& row) const{
+	size_t mask = mIndex.size() - 1;
+	for (size_t slot = hashOhip(ohip) & mask; mIndex[slot] != 0; slot = (slot + 1) & mask){
+		if (mOhip[mIndex[slot] - 1] == ohip){
+			row = mIndex[slot] - 1;
+			return true;
+		}
+	}
+	return false;
+}
+
+/*
+Adds a row to the index, growing it to stay at most half full. Called with mMutex held.
+*/
+void RecordStore::indexRow(unsigned row){
+	if ((mOhip.size()) * 2 > mIndex.size()){
+		std::vector<unsigned> index(mIndex.size() * 2, 0);
+		size_t mask = index.size() - 1;
+		for (unsigned i = 0; i < mOhip.size(); ++i){
+			if (i == row) continue;
+			size_t slot = hashOhip(mOhip[i]) & mask;
+			while (index[slot] != 0) slot = (slot + 1) & mask;
+			index[slot] = i + 1;
+		}
+		mIndex.swap(index);
+	}
+	size_t mask = mIndex.size() - 1;
+	size_t slot = hashOhip(mOhip[row]) & mask;
+	while (mIndex[slot] != 0) slot = (slot + 1) & mask;
+	mIndex[slot] = row + 1;
+}
+
+/*
+Takes a row out of the index, moving later entries of its probe run back over the hole so that
+lookups don't stop at it. Called with mMutex held.
+*/
+void RecordStore::unindexRow(unsigned row){
+	size_t mask = mIndex.size() - 1;
+	size_t slot = hashOhip(mOhip[row]) & mask;
+	while (mIndex[slot] != row + 1) slot = (slot + 1) & mask;
+	for (size_t next = (slot + 1) & mask; mIndex[next] != 0; next = (next + 1) & mask){
+		size_t home = hashOhip(mOhip[mIndex[next] - 1]) & mask;
+		if (((next - home) & mask) >= ((next - slot) & mask)){
+			mIndex[slot] = mIndex[next];
+			slot = next;
+		}
+	}
+	mIndex[slot] = 0;
+}
+
+/*
+Appends a record's unique strings to mColdArena. Called with mMutex held.
+*/
+void RecordStore::appendCold(const PatientRecord& record){
+	const std::string* fields[kColdFields] = { &record.name, &record.address, &record.phone, &record.contactName, &record.contactPhone };
+	for (unsigned i = 0; i < kColdFields; ++i){
+		size_t length = fields[i]->size();
+		if (length >= 0x80) mColdArena.push_back((char)(0x80 | (length >> 8)));
+		mColdArena.push_back((char)(length & 0xff));
+		mColdArena.insert(mColdArena.end(), fields[i]->begin(), fields[i]->end());
+	}
+}
+
+/*
+Rewrites the arenas without the strings of replaced records. Called with mMutex held.
+*/
+void RecordStore::compact(){
+	std::vector<char> cold;
+	std::vector<unsigned> allergies;
+	cold.reserve(mColdArena.size() - mColdGarbage);
+	allergies.reserve(mAllergyIds.size() - mAllergyGarbage);
+	for (size_t row = 0; row < mOhip.size(); ++row){
+		const char* begin = mColdArena.data() + mCold[row];
+		const char* end = begin;
+		size_t length;
+		for (unsigned i = 0; i < kColdFields; ++i) nextCold(end, length);
+		mCold[row] = (unsigned)cold.size();
+		cold.insert(cold.end(), begin, end);
+		unsigned start = mAllergyStart[row];
+		mAllergyStart[row] = (unsigned)allergies.size();
+		allergies.insert(allergies.end(), mAllergyIds.begin() + start, mAllergyIds.begin() + start + mAllergyCount[row]);
+	}
+	mColdArena.swap(cold);
+	mAllergyIds.swap(allergies);
+	mColdGarbage = 0;
+	mAllergyGarbage = 0;
+}
+
+/*
+Adds a row to, or removes it from, the bitmaps of its allergens. Called with mMutex held.
+*/
+void RecordStore::indexAllergies(unsigned row, bool add){
+	for (unsigned i = 0; i < mAllergyCount[row]; ++i){
+		std::string allergen = normalizeAllergen(mDictionary.str(mAllergyIds[mAllergyStart[row] + i]));
+		if (allergen.empty()) continue;
+		unsigned id;
+		if (add){
+			id = mAllergens.intern(allergen);
+			if (id >= mAllergenRows.size()) mAllergenRows.resize(id + 1);
+			mAllergenRows[id].add(row);
+		}
+		else if (mAllergens.find(allergen, id)){
+			mAllergenRows[id].remove(row);
+		}
+	}
+}
+
+/*
+Checks a record and packs its key and dates
+@return false if put() would reject it
+*/
+static bool packRecord(const PatientRecord& record, unsigned long long& ohip, unsigned short& born, unsigned short& expiry){
+	if (!packOhip(normalizeOhip(record.ohip), ohip) || !packDate(record.born, born) || !packDate(record.expiry, expiry)) return false;
+	return record.name.size() <= kMaxRecordFieldBytes && record.address.size() <= kMaxRecordFieldBytes && record.phone.size() <= kMaxRecordFieldBytes &&
+		record.contactName.size() <= kMaxRecordFieldBytes && record.contactPhone.size() <= kMaxRecordFieldBytes &&
+		record.allergies.size() <= kMaxAllergies;
+}
+
+/*
+Writes a record into a row, new or replaced. Called with mMutex held.
+*/
+void RecordStore::writeRow(unsigned row, bool replacing, const PatientRecord& record, unsigned short born, unsigned short expiry){
+	++mGeneration;
+	if (replacing){
+		indexAllergies(row, false);
+		//Replaced in place; the old strings stay in the arenas until they make up half of either
+		const char* cold = mColdArena.data() + mCold[row];
+		const char* begin = cold;
+		size_t length;
+		const char* name = nextCold(cold, length);
+		mNames.remove(row, std::string(name, length));
+		for (unsigned i = 1; i < kColdFields; ++i) nextCold(cold, length);
+		mColdGarbage += cold - begin;
+		mAllergyGarbage += mAllergyCount[row];
+	}
+	mBorn[row] = born;
+	mExpiry[row] = expiry;
+	mSex[row] = mDictionary.intern(record.sex);
+	mDonor[row] = mDictionary.intern(record.donor);
+	mRelationship[row] = mDictionary.intern(record.contactRelationship);
+	mCold[row] = (unsigned)mColdArena.size();
+	appendCold(record);
+	mAllergyStart[row] = (unsigned)mAllergyIds.size();
+	mAllergyCount[row] = (unsigned char)record.allergies.size();
+	for (size_t i = 0; i < record.allergies.size(); ++i) mAllergyIds.push_back(mDictionary.intern(record.allergies[i]));
+	indexAllergies(row, true);
+	mNames.add(row, record.name);
+	if (mColdGarbage * 2 > mColdArena.size() || mAllergyGarbage * 2 > mAllergyIds.size()) compact();
+}
+
+bool RecordStore::put(const PatientRecord& record){
+	unsigned long long ohip;
+	unsigned short born, expiry;
+	if (!packRecord(record, ohip, born, expiry)) return false;
+
+	std::lock_guard<std::mutex> lock(mMutex);
+	unsigned row;
+	bool replacing = findRow(ohip, row);
+	if (!replacing){
+		row = (unsigned)mOhip.size();
+		mOhip.push_back(ohip);
+		mBorn.push_back(0);
+		mExpiry.push_back(0);
+		mSex.push_back(0);
+		mDonor.push_back(0);
+		mRelationship.push_back(0);
+		mCold.push_back(0);
+		mAllergyStart.push_back(0);
+		mAllergyCount.push_back(0);
+		indexRow(row);
+	}
+	else{
+		PatientRecord before;
+		readRow(row, before);
+		addVersions(row, before, record, nowMillis());
+	}
+	writeRow(row, replacing, record, born, expiry);
+	return true;
+}
+
+/*
+Reads a row back into a record. Called with mMutex held.
+*/
+void RecordStore::readRow(unsigned row, PatientRecord& record) const{
+	const char* cold = mColdArena.data() + mCold[row];
+	const char* text;
+	size_t length;
+	record.ohip.clear();
+	appendOhip(record.ohip, mOhip[row]);
+	text = nextCold(cold, length);
+	record.name.assign(text, length);
+	record.sex = mDictionary.str(mSex[row]);
+	record.born.clear();
+	appendDate(record.born, mBorn[row]);
+	record.expiry.clear();
+	appendDate(record.expiry, mExpiry[row]);
+	text = nextCold(cold, length);
+	record.address.assign(text, length);
+	text = nextCold(cold, length);
+	record.phone.assign(text, length);
+	text = nextCold(cold, length);
+	record.contactName.assign(text, length);
+	text = nextCold(cold, length);
+	record.contactPhone.assign(text, length);
+	record.contactRelationship = mDictionary.str(mRelationship[row]);
+	record.donor = mDictionary.str(mDonor[row]);
+	record.allergies.clear();
+	for (unsigned i = 0; i < mAllergyCount[row]; ++i) record.allergies.push_back(mDictionary.str(mAllergyIds[mAllergyStart[row] + i]));
+}
+
+/*
+Sets a field of a record to an edited value; allergies are comma separated
+*/
+static void setField(PatientRecord& record, RecordField field, const std::string& value){
+	switch (field){
+	case FIELD_OHIP: record.ohip = value; break;
+	case FIELD_NAME: record.name = value; break;
+	case FIELD_SEX: record.sex = value; break;
+	case FIELD_BORN: record.born = value; break;
+	case FIELD_EXPIRY: record.expiry = value; break;
+	case FIELD_ADDRESS: record.address = value; break;
+	case FIELD_PHONE: record.phone = value; break;
+	case FIELD_CONTACT_NAME: record.contactName = value; break;
+	case FIELD_CONTACT_PHONE: record.contactPhone = value; break;
+	case FIELD_CONTACT_RELATIONSHIP: record.contactRelationship = value; break;
+	case FIELD_DONOR: record.donor = value; break;
+	case FIELD_ALLERGIES:{
+		record.allergies.clear();
+		std::vector<std::string> allergies = split(value, ',');
+		for (size_t i = 0; i < allergies.size(); ++i){
+			size_t begin = allergies[i].find_first_not_of(" \t");
+			if (begin == std::string::npos) continue;
+			size_t end = allergies[i].find_last_not_of(" \t");
+			record.allergies.push_back(allergies[i].substr(begin, end - begin + 1));
+		}
+		break;
+	}
+	default: break;
+	}
+}
+
+/*
+A field's value as an edit sets it
+*/
+static std::string getField(const PatientRecord& record, RecordField field){
+	switch (field){
+	case FIELD_OHIP: return record.ohip;
+	case FIELD_NAME: return record.name;
+	case FIELD_SEX: return record.sex;
+	case FIELD_BORN: return record.born;
+	case FIELD_EXPIRY: return record.expiry;
+	case FIELD_ADDRESS: return record.address;
+	case FIELD_PHONE: return record.phone;
+	case FIELD_CONTACT_NAME: return record.contactName;
+	case FIELD_CONTACT_PHONE: return record.contactPhone;
+	case FIELD_CONTACT_RELATIONSHIP: return record.contactRelationship;
+	case FIELD_DONOR: return record.donor;
+	case FIELD_ALLERGIES:{
+		std::string allergies;
+		for (size_t i = 0; i < record.allergies.size(); ++i){
+			if (i > 0) allergies += ',';
+			allergies += record.allergies[i];
+		}
+		return allergies;
+	}
+	default: return std::string();
+	}
+}
+
+/*
+Pushes the fields a write changes onto the row's version chain, with the values they had before.
+A version is never older than the one before it, even if the clock was set back, since jsonAt stops
+walking the chain at the first version old enough. Called with mMutex held.
+*/
+void RecordStore::addVersions(unsigned row, const PatientRecord& before, const PatientRecord& after, long long time){
+	for (int field = 0; field < FIELD_COUNT; ++field){
+		std::string old = getField(before, (RecordField)field);
+		if (old == getField(after, (RecordField)field)) continue;
+		Version version;
+		unsigned& newest = mNewestVersion[row];
+		version.time = newest != 0 ? std::max(time, mVersions[newest - 1].time) : time;
+		version.older = newest;
+		version.offset = (unsigned)mVersionArena.size();
+		version.length = (unsigned)old.size();
+		version.field = (unsigned char)field;
+		mVersionArena.insert(mVersionArena.end(), old.begin(), old.end());
+		mVersions.push_back(version);
+		newest = (unsigned)mVersions.size();
+	}
+}
+
+/*
+Checks an edit against the current records and applies it unless checkOnly. Called with mMutex held.
+*/
+UpdateResult RecordStore::applyLocked(const FieldUpdate& edit, bool checkOnly){
+	unsigned long long ohip;
+	if (!packOhip(normalizeOhip(edit.ohip), ohip)) return UPDATE_NOT_FOUND;
+	if (edit.field >= FIELD_COUNT) return UPDATE_INVALID;
+	unsigned row;
+	if (!findRow(ohip, row)) return UPDATE_NOT_FOUND;
+	PatientRecord before;
+	readRow(row, before);
+	PatientRecord record = before;
+	setField(record, edit.field, edit.value);
+	unsigned long long newOhip;
+	unsigned short born, expiry;
+	if (!packRecord(record, newOhip, born, expiry)) return UPDATE_INVALID;
+	unsigned other;
+	if (newOhip != ohip && findRow(newOhip, other)) return UPDATE_CONFLICT;
+	if (checkOnly) return UPDATE_APPLIED;
+	if (newOhip != ohip){
+		unindexRow(row);
+		mOhip[row] = newOhip;
+		indexRow(row);
+	}
+	addVersions(row, before, record, edit.time);
+	writeRow(row, true, record, born, expiry);
+	return UPDATE_APPLIED;
+}
+
+/*
+Applies the logged edits up to the durable sequence number, in log order, keeping their outcomes
+for the writers waiting on them. Called with mMutex held.
+*/
+void RecordStore::applyDurableLocked(unsigned long long durable){
+	while (!mUnapplied.empty() && mUnapplied.begin()->first <= durable){
+		mUpdateResults[mUnapplied.begin()->first] = applyLocked(mUnapplied.begin()->second, false);
+		mUnapplied.erase(mUnapplied.begin());
+	}
+}
+
+UpdateResult RecordStore::update(const FieldUpdate& edit, bool durable){
+	if (!durable){
+		std::lock_guard<std::mutex> lock(mMutex);
+		return applyLocked(edit, false);
+	}
+	unsigned long long sequence;
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		UpdateResult checked = applyLocked(edit, true);
+		if (checked != UPDATE_APPLIED) return checked;
+		//Appended under the lock, so the log holds edits in the order they are applied and replays to the same records
+		sequence = gRecordLog.append(edit);
+		if (sequence == 0) return UPDATE_NOT_DURABLE;
+		mUnapplied[sequence] = edit;
+	}
+	//Other requests keep being served meanwhile, and see the edit only once it is on disk
+	bool written = gRecordLog.waitDurable(sequence);
+	std::lock_guard<std::mutex> lock(mMutex);
+	applyDurableLocked(gRecordLog.durable());
+	if (!written){
+		mUnapplied.erase(sequence); //never replayed either, so it never happened
+		return UPDATE_NOT_DURABLE;
+	}
+	std::map<unsigned long long, UpdateResult>::iterator applied = mUpdateResults.find(sequence);
+	UpdateResult result = applied->second;
+	mUpdateResults.erase(applied);
+	return result;
+}
+
+void RecordStore::shrink(){
+	std::lock_guard<std::mutex> lock(mMutex);
+	mOhip.shrink_to_fit();
+	mBorn.shrink_to_fit();
+	mExpiry.shrink_to_fit();
+	mSex.shrink_to_fit();
+	mDonor.shrink_to_fit();
+	mRelationship.shrink_to_fit();
+	mCold.shrink_to_fit();
+	mAllergyStart.shrink_to_fit();
+	mAllergyCount.shrink_to_fit();
+	mColdArena.shrink_to_fit();
+	mAllergyIds.shrink_to_fit();
+}
+
+bool RecordStore::link(const ProvisionKey& provision, const std::string& ohip){
+	unsigned long long packed;
+	if (!packOhip(normalizeOhip(ohip), packed)) return false;
+	std::lock_guard<std::mutex> lock(mMutex);
+	unsigned row;
+	if (!findRow(packed, row)) return false;
+	mRowByProvision[provision] = row;
+	++mGeneration;
+	return true;
+}
+
+/*
+Renders a row as JSON. Called with mMutex held.
+*/
+void RecordStore::renderJson(unsigned row, std::string& out) const{
+	const char* cold = mColdArena.data() + mCold[row];
+	const char* text;
+	size_t length;
+	out.clear();
+	out.reserve(384);
+	out += "{\"ohip\":\"";
+	appendOhip(out, mOhip[row]);
+	out += "\",";
+	appendJsonName(out, "name");
+	text = nextCold(cold, length);
+	appendJsonString(out, text, length);
+	out += ',';
+	appendJsonName(out, "sex");
+	appendJsonString(out, mDictionary.text(mSex[row]), mDictionary.length(mSex[row]));
+	out += ",\"born\":\"";
+	appendDate(out, mBorn[row]);
+	out += "\",\"expiry\":\"";
+	appendDate(out, mExpiry[row]);
+	out += "\",";
+	appendJsonName(out, "address");
+	text = nextCold(cold, length);
+	appendJsonString(out, text, length);
+	out += ',';
+	appendJsonName(out, "phone");
+	text = nextCold(cold, length);
+	appendJsonString(out, text, length);
+	out += ",\"emergencyContact\":{";
+	appendJsonName(out, "name");
+	text = nextCold(cold, length);
+	appendJsonString(out, text, length);
+	out += ',';
+	appendJsonName(out, "phone");
+	text = nextCold(cold, length);
+	appendJsonString(out, text, length);
+	out += ',';
+	appendJsonName(out, "relationship");
+	appendJsonString(out, mDictionary.text(mRelationship[row]), mDictionary.length(mRelationship[row]));
+	out += "},";
+	appendJsonName(out, "donor");
+	appendJsonString(out, mDictionary.text(mDonor[row]), mDictionary.length(mDonor[row]));
+	out += ",\"allergies\":[";
+	for (unsigned i = 0; i < mAllergyCount[row]; ++i){
+		unsigned id = mAllergyIds[mAllergyStart[row] + i];
+		if (i > 0) out += ',';
+		appendJsonString(out, mDictionary.text(id), mDictionary.length(id));
+	}
+	out += "]}";
+}
+
+/*
+Renders a record that isn't in the columns, e.g. an older version, as renderJson would
+*/
+static void renderRecord(const PatientRecord& record, std::string& out){
+	out.clear();
+	out += "{";
+	appendJsonName(out, "ohip");
+	appendJsonString(out, record.ohip.data(), record.ohip.size());
+	out += ',';
+	appendJsonName(out, "name");
+	appendJsonString(out, record.name.data(), record.name.size());
+	out += ',';
+	appendJsonName(out, "sex");
+	appendJsonString(out, record.sex.data(), record.sex.size());
+	out += ',';
+	appendJsonName(out, "born");
+	appendJsonString(out, record.born.data(), record.born.size());
+	out += ',';
+	appendJsonName(out, "expiry");
+	appendJsonString(out, record.expiry.data(), record.expiry.size());
+	out += ',';
+	appendJsonName(out, "address");
+	appendJsonString(out, record.address.data(), record.address.size());
+	out += ',';
+	appendJsonName(out, "phone");
+	appendJsonString(out, record.phone.data(), record.phone.size());
+	out += ",\"emergencyContact\":{";
+	appendJsonName(out, "name");
+	appendJsonString(out, record.contactName.data(), record.contactName.size());
+	out += ',';
+	appendJsonName(out, "phone");
+	appendJsonString(out, record.contactPhone.data(), record.contactPhone.size());
+	out += ',';
+	appendJsonName(out, "relationship");
+	appendJsonString(out, record.contactRelationship.data(), record.contactRelationship.size());
+	out += "},";
+	appendJsonName(out, "donor");
+	appendJsonString(out, record.donor.data(), record.donor.size());
+	out += ",\"allergies\":[";
+	for (size_t i = 0; i < record.allergies.size(); ++i){
+		if (i > 0) out += ',';
+		appendJsonString(out, record.allergies[i].data(), record.allergies[i].size());
+	}
+	out += "]}";
+}
+
+bool RecordStore::jsonByOhip(const std::string& ohip, std::string& json){
+	unsigned long long packed;
+	if (!packOhip(normalizeOhip(ohip), packed)) return false;
+	std::lock_guard<std::mutex> lock(mMutex);
+	unsigned row;
+	if (!findRow(packed, row)) return false;
+	renderJson(row, json);
+	return true;
+}
+
+bool RecordStore::jsonByProvision(const ProvisionKey& provision, std::string& json){
+	std::lock_guard<std::mutex> lock(mMutex);
+	std::unordered_map<ProvisionKey, unsigned>::iterator it = mRowByProvision.find(provision);
+	if (it == mRowByProvision.end()) return false;
+	renderJson(it->second, json);
+	return true;
+}
+
+bool RecordStore::ohipByProvision(const ProvisionKey& provision, std::string& ohip){
+	std::lock_guard<std::mutex> lock(mMutex);
+	std::unordered_map<ProvisionKey, unsigned>::iterator it = mRowByProvision.find(provision);
+	if (it == mRowByProvision.end()) return false;
+	ohip.clear();
+	appendOhip(ohip, mOhip[it->second]);
+	return true;
+}
+
+bool RecordStore::currentJson(std::string& json){
+	std::lock_guard<std::mutex> lock(mMutex);
+	if (!mHaveCurrent) return false;
+	if (mCurrentJson.empty() || mCurrentGeneration != mGeneration){
+		std::unordered_map<ProvisionKey, unsigned>::iterator it = mRowByProvision.find(mCurrent);
+		if (it == mRowByProvision.end()) return false;
+		renderJson(it->second, mCurrentJson);
+		mCurrentGeneration = mGeneration;
+	}
+	json = mCurrentJson;
+	return true;
+}
+
+bool RecordStore::jsonAt(const std::string& ohip, long long time, std::string& json){
+	unsigned long long packed;
+	if (!packOhip(normalizeOhip(ohip), packed)) return false;
+	std::lock_guard<std::mutex> lock(mMutex);
+	unsigned row;
+	if (!findRow(packed, row)) return false;
+	std::unordered_map<unsigned, unsigned>::const_iterator newest = mNewestVersion.find(row);
+	if (newest == mNewestVersion.end() || mVersions[newest->second - 1].time <= time){
+		renderJson(row, json); //unchanged since then, the common case
+		return true;
+	}
+	//Undo the edits made after time, newest first
+	PatientRecord record;
+	readRow(row, record);
+	for (unsigned i = newest->second; i != 0 && mVersions[i - 1].time > time; i = mVersions[i - 1].older){
+		const Version& version = mVersions[i - 1];
+		setField(record, (RecordField)version.field, std::string(mVersionArena.data() + version.offset, version.length));
+	}
+	renderRecord(record, json);
+	return true;
+}
+
+bool RecordStore::history(const std::string& ohip, std::vector<RecordChange>& changes){
+	unsigned long long packed;
+	if (!packOhip(normalizeOhip(ohip), packed)) return false;
+	std::lock_guard<std::mutex> lock(mMutex);
+	unsigned row;
+	if (!findRow(packed, row)) return false;
+	changes.clear();
+	std::unordered_map<unsigned, unsigned>::const_iterator newest = mNewestVersion.find(row);
+	if (newest == mNewestVersion.end()) return true;
+	//Walking back from the current version, a change's after is the value its field has at that point
+	PatientRecord record;
+	readRow(row, record);
+	for (unsigned i = newest->second; i != 0; i = mVersions[i - 1].older){
+		const Version& version = mVersions[i - 1];
+		RecordChange change;
+		change.time = version.time;
+		change.field = (RecordField)version.field;
+		change.after = getField(record, change.field);
+		change.before.assign(mVersionArena.data() + version.offset, version.length);
+		setField(record, change.field, change.before);
+		changes.push_back(change);
+	}
+	return true;
+}
+
+/*
+Health number and name of a row. Called with mMutex held.
+*/
+void RecordStore::summarize(unsigned row, std::pair<std::string, std::string>& patient) const{
+	patient.first.clear();
+	appendOhip(patient.first, mOhip[row]);
+	const char* cold = mColdArena.data() + mCold[row];
+	size_t length;
+	const char* name = nextCold(cold, length);
+	patient.second.assign(name, length);
+}
+
+void RecordStore::identified(const ProvisionKey& provision){
+	long long now = monotonicMicros();
+	std::lock_guard<std::mutex> lock(mMutex);
+	mIdentifiedAt[provision] = now;
+}
+
+unsigned long long RecordStore::findAllergic(const std::string& allergen, bool presentOnly, size_t limit, std::vector<std::pair<std::string, std::string> >& patients){
+	patients.clear();
+	long long now = monotonicMicros();
+	std::lock_guard<std::mutex> lock(mMutex);
+	unsigned id;
+	if (!mAllergens.find(normalizeAllergen(allergen), id)) return 0;
+	const RoaringBitmap* rows = &mAllergenRows[id];
+	RoaringBitmap present, matches;
+	if (presentOnly){
+		//Present for as long as a validation counts on /status, whatever became of the BLE session
+		for (std::unordered_map<ProvisionKey, long long>::iterator i = mIdentifiedAt.begin(); i != mIdentifiedAt.end();){
+			if (now - i->second > kValidationTtlMillis * 1000){
+				i = mIdentifiedAt.erase(i);
+				continue;
+			}
+			std::unordered_map<ProvisionKey, unsigned>::iterator it = mRowByProvision.find(i->first);
+			if (it != mRowByProvision.end()) present.add(it->second);
+			++i;
+		}
+		RoaringBitmap::intersect(present, *rows, matches);
+		rows = &matches;
+	}
+	std::vector<unsigned> first = rows->values(limit);
+	patients.resize(first.size());
+	for (size_t i = 0; i < first.size(); ++i) summarize(first[i], patients[i]);
+	return rows->cardinality();
+}
+
+void RecordStore::searchNames(const std::string& query, const std::string& sex, int bornFrom, int bornTo, size_t k, std::vector<NameMatch>& matches){
+	matches.clear();
+	std::string lowered;
+	std::vector<std::string> words;
+	{
+		std::istringstream in(query);
+		std::string word;
+		while (in >> word){
+			for (size_t i = 0; i < word.size(); ++i) word[i] = (char)tolower((unsigned char)word[i]);
+			if (!lowered.empty()) lowered += ' ';
+			lowered += word;
+			words.push_back(word);
+		}
+	}
+	if (lowered.empty() || k == 0) return;
+	//Typos allowed grow with the query: 1 up to 4 letters, 2 up to 8, 3 past that
+	unsigned bound = lowered.size() <= 4 ? 1 : lowered.size() <= 8 ? 2 : 3;
+	std::vector<unsigned> grams;
+	TrigramIndex::trigrams(lowered, grams);
+	//A string within distance d of the query still shares all but 3d of its trigrams. For short
+	//queries that would be none at all, so a third of them is asked for at least: a single typo in
+	//a short name misses that only when it's a swap of the first two letters.
+	unsigned total = (unsigned)grams.size();
+	unsigned minShared = std::max(total > 3 * bound ? total - 3 * bound : 1, (total + 2) / 3);
+
+	std::lock_guard<std::mutex> lock(mMutex);
+	unsigned sexId = 0;
+	if (!sex.empty() && !mDictionary.find(sex, sexId)) return;
+	long fromDays = bornFrom > 0 ? daysFromCivil(bornFrom, 1, 1) - kDateEpoch : 0;
+	long toDays = bornTo > 0 ? daysFromCivil(bornTo + 1, 1, 1) - kDateEpoch : kNoDate;
+
+	std::vector<std::pair<unsigned, unsigned> > rows;
+	mNames.match(lowered, minShared, rows);
+
+	//Filters first, then the remaining names and, for a one word query, their words go to the re-ranker.
+	//The query may be a single name, e.g. only the first name is known, or the whole name.
+	//Strings whose length is off by more than the bound can't be close enough and are skipped.
+	std::vector<unsigned> kept;
+	std::vector<const char*> candidates;
+	std::vector<size_t> lengths;
+	std::vector<size_t> firstCandidate;
+	for (size_t i = 0; i < rows.size(); ++i){
+		unsigned row = rows[i].first;
+		if (!sex.empty() && mSex[row] != sexId) continue;
+		if ((bornFrom > 0 || bornTo > 0) && (mBorn[row] == kNoDate || mBorn[row] < fromDays || mBorn[row] >= toDays)) continue;
+		const char* cold = mColdArena.data() + mCold[row];
+		size_t length;
+		const char* name = nextCold(cold, length);
+		size_t first = candidates.size();
+		if (length + bound >= lowered.size() && length <= lowered.size() + bound){
+			candidates.push_back(name);
+			lengths.push_back(length);
+		}
+		if (words.size() == 1){
+			size_t start = 0;
+			for (size_t j = 0; j <= length; ++j){
+				if (j < length && name[j] != ' ') continue;
+				size_t word = j - start;
+				if (word != length && word + bound >= lowered.size() && word <= lowered.size() + bound){
+					candidates.push_back(name + start);
+					lengths.push_back(word);
+				}
+				start = j + 1;
+			}
+		}
+		if (candidates.size() == first) continue;
+		kept.push_back((unsigned)i);
+		firstCandidate.push_back(first);
+	}
+	firstCandidate.push_back(candidates.size());
+	std::vector<unsigned> distances(candidates.size());
+	boundedEditDistances(lowered.data(), lowered.size(), candidates.data(), lengths.data(), candidates.size(), bound, distances.data());
+
+	//Closest first, then most trigrams shared, then by row; packed so ranking sorts plain integers
+	std::vector<unsigned long long> ranked;
+	for (size_t i = 0; i < kept.size(); ++i){
+		unsigned long long distance = *std::min_element(distances.begin() + firstCandidate[i], distances.begin() + firstCandidate[i + 1]);
+		if (distance > bound) continue;
+		unsigned long long shared = std::min(rows[kept[i]].second, 255u); //a name sharing more ranks with those sharing 255
+		ranked.push_back((distance << 40) | ((255 - shared) << 32) | rows[kept[i]].first);
+	}
+	size_t top = std::min(k, ranked.size());
+	std::partial_sort(ranked.begin(), ranked.begin() + top, ranked.end());
+	matches.resize(top);
+	for (size_t i = 0; i < top; ++i){
+		unsigned row = (unsigned)ranked[i];
+		std::pair<std::string, std::string> patient;
+		summarize(row, patient);
+		matches[i].ohip.swap(patient.first);
+		matches[i].name.swap(patient.second);
+		matches[i].sex = mDictionary.str(mSex[row]);
+		appendDate(matches[i].born, mBorn[row]);
+		matches[i].distance = (unsigned)(ranked[i] >> 40);
+	}
+}
+
+void RecordStore::setCurrent(const ProvisionKey& provision){
+	std::lock_guard<std::mutex> lock(mMutex);
+	mCurrent = provision;
+	mHaveCurrent = true;
+	mCurrentJson.clear();
+	++mCurrentChanges;
+}
+
+void RecordStore::prefetch(int nymiHandle, const ProvisionKey& provision){
+	std::lock_guard<std::mutex> lock(mMutex);
+	std::map<int, Prefetch>::iterator found = mPrefetches.find(nymiHandle);
+	if (found != mPrefetches.end() && found->second.provision == provision && found->second.generation == mGeneration) return; //found again
+	std::unordered_map<ProvisionKey, unsigned>::iterator it = mRowByProvision.find(provision);
+	if (it == mRowByProvision.end()) return; //no record to show, publish() will find none either
+	if (found == mPrefetches.end() && mPrefetches.size() >= kMaxPrefetches){
+		std::map<int, Prefetch>::iterator oldest = mPrefetches.begin();
+		for (std::map<int, Prefetch>::iterator i = mPrefetches.begin(); i != mPrefetches.end(); ++i){
+			if (i->second.order < oldest->second.order) oldest = i;
+		}
+		mPrefetches.erase(oldest);
+		++mPrefetchesDropped;
+	}
+	Prefetch& entry = mPrefetches[nymiHandle];
+	entry.provision = provision;
+	renderJson(it->second, entry.json);
+	entry.generation = mGeneration;
+	entry.order = ++mPrefetchOrder;
+}
+
+void RecordStore::publish(int nymiHandle, const ProvisionKey& provision){
+	std::lock_guard<std::mutex> lock(mMutex);
+	mCurrent = provision;
+	mHaveCurrent = true;
+	mCurrentJson.clear();
+	++mCurrentChanges;
+	std::map<int, Prefetch>::iterator found = mPrefetches.find(nymiHandle);
+	if (found == mPrefetches.end()){
+		++mPrefetchesMissed;
+		return;
+	}
+	if (found->second.provision == provision && found->second.generation == mGeneration){
+		mCurrentJson.swap(found->second.json);
+		mCurrentGeneration = mGeneration;
+		++mPrefetchesPublished;
+	}
+	else{
+		++mPrefetchesMissed; //edited or relinked while the Nymi was validating
+	}
+	mPrefetches.erase(found);
+}
+
+void RecordStore::dropPrefetch(int nymiHandle){
+	std::lock_guard<std::mutex> lock(mMutex);
+	mPrefetchesDropped += mPrefetches.erase(nymiHandle);
+}
+
+void RecordStore::dropPrefetches(){
+	std::lock_guard<std::mutex> lock(mMutex);
+	mPrefetchesDropped += mPrefetches.size();
+	mPrefetches.clear();
+}
+
+unsigned long long RecordStore::prefetchesPublished(){
+	std::lock_guard<std::mutex> lock(mMutex);
+	return mPrefetchesPublished;
+}
+
+unsigned long long RecordStore::prefetchesMissed(){
+	std::lock_guard<std::mutex> lock(mMutex);
+	return mPrefetchesMissed;
+}
+
+unsigned long long RecordStore::prefetchesDropped(){
+	std::lock_guard<std::mutex> lock(mMutex);
+	return mPrefetchesDropped;
+}
+
+/*
+Key of a lookup for mFlights: the request, and the version of the store it reads, so a lookup
+arriving after an edit or a validation never shares a rendering started before it
+*/
+std::string RecordStore::flightKey(const HttpRequest& request){
+	std::lock_guard<std::mutex> lock(mMutex);
+	return request.path + "?" + request.query + "@" + std::to_string(mGeneration) + "." + std::to_string(mCurrentChanges);
+}
+
+/*
+GET of one record: current, ohip/<health number>[?at=] or provision/<id>
+*/
+void RecordStore::serveRecord(const std::string& route, const HttpRequest& request, HttpResponse& response){
+	bool found;
+	if (route == "current"){
+		found = currentJson(response.body);
+	}
+	else if (route.compare(0, 5, "ohip/") == 0){
+		std::string at = request.param("at");
+		std::string ohip = urlDecode(route.substr(5));
+		found = at.empty() ? jsonByOhip(ohip, response.body) : jsonAt(ohip, strtoll(at.c_str(), NULL, 10), response.body);
+	}
+	else{
+		ProvisionKey provision;
+		if (!parseProvisionHex(route.substr(10), provision)){
+			response.status = 400;
+			return;
+		}
+		found = jsonByProvision(provision, response.body);
+	}
+	if (!found){
+		response.status = 404;
+		return;
+	}
+	response.contentType = "application/json";
+	response.headers["Cache-Control"] = "no-store"; //medical data
+}
+
+unsigned long long RecordStore::lookupsComputed(){
+	return mFlights.computed();
+}
+
+unsigned long long RecordStore::lookupsShared(){
+	return mFlights.shared();
+}
+
+void RecordStore::serve(const HttpRequest& request, HttpResponse& response){
+	if (request.path.compare(0, sizeof(kRecordsPrefix) - 1, kRecordsPrefix) != 0){
+		response.status = 404;
+		return;
+	}
+	std::string route = request.path.substr(sizeof(kRecordsPrefix) - 1);
+	if (request.method == "POST"){
+		//e.g. POST /records/ohip/5584486674YM/address with the new address as the body
+		size_t slash = route.rfind('/');
+		FieldUpdate edit;
+		if (route.compare(0, 5, "ohip/") != 0 || slash < 5 || !parseRecordField(route.substr(slash + 1), edit.field)){
+			response.status = 404;
+			return;
+		}
+		if (request.body.size() > kMaxUpdateValueBytes){
+			response.status = 400;
+			response.headers["Cache-Control"] = "no-store";
+			return;
+		}
+		edit.ohip = urlDecode(route.substr(5, slash - 5));
+		edit.value = request.body;
+		edit.time = nowMillis();
+		switch (update(edit, true)){
+		case UPDATE_APPLIED: response.status = 204; break;
+		case UPDATE_INVALID: response.status = 400; break;
+		case UPDATE_CONFLICT: response.status = 409; break;
+		case UPDATE_NOT_DURABLE: response.status = 503; break;
+		default: response.status = 404; break;
+		}
+		response.headers["Cache-Control"] = "no-store";
+		return;
+	}
+	if (request.method != "GET"){
+		response.status = 405;
+		return;
+	}
+	bool historyRoute = route.size() > 13 && route.compare(route.size() - 8, 8, "/history") == 0;
+	if (route == "current" || route.compare(0, 10, "provision/") == 0 || (route.compare(0, 5, "ohip/") == 0 && !historyRoute)){
+		mFlights.run(flightKey(request), [&](HttpResponse& shared){ serveRecord(route, request, shared); }, response);
+		return;
+	}
+	bool found;
+	if (route.compare(0, 5, "ohip/") == 0 && historyRoute){
+		std::vector<RecordChange> changes;
+		found = history(urlDecode(route.substr(5, route.size() - 13)), changes);
+		std::string& out = response.body;
+		out = "{\"changes\":[";
+		for (size_t i = 0; i < changes.size(); ++i){
+			if (i > 0) out += ',';
+			out += "{\"time\":";
+			out += std::to_string(changes[i].time);
+			out += ",\"field\":\"";
+			out += recordFieldName(changes[i].field);
+			out += "\",";
+			appendJsonName(out, "before");
+			appendJsonString(out, changes[i].before.data(), changes[i].before.size());
+			out += ',';
+			appendJsonName(out, "after");
+			appendJsonString(out, changes[i].after.data(), changes[i].after.size());
+			out += '}';
+		}
+		out += "]}";
+	}
+	else if (route == "search"){
+		//e.g. /records/search?name=anita&sex=F&born=1981 or born=1975-1985, k for how many
+		std::string born = request.param("born");
+		int bornFrom = 0, bornTo = 0;
+		if (!born.empty()){
+			bornFrom = atoi(born.c_str());
+			size_t dash = born.find('-');
+			bornTo = dash == std::string::npos ? bornFrom : atoi(born.c_str() + dash + 1);
+		}
+		std::string k = request.param("k");
+		std::vector<NameMatch> matches;
+		searchNames(request.param("name"), request.param("sex"), bornFrom, bornTo, k.empty() ? kDefaultSearchResults : (size_t)strtoul(k.c_str(), NULL, 10), matches);
+		std::string& out = response.body;
+		out = "{\"patients\":[";
+		for (size_t i = 0; i < matches.size(); ++i){
+			if (i > 0) out += ',';
+			out += "{\"ohip\":\"";
+			out += matches[i].ohip;
+			out += "\",";
+			appendJsonName(out, "name");
+			appendJsonString(out, matches[i].name.data(), matches[i].name.size());
+			out += ',';
+			appendJsonName(out, "sex");
+			appendJsonString(out, matches[i].sex.data(), matches[i].sex.size());
+			out += ",\"born\":\"";
+			out += matches[i].born;
+			out += "\",\"distance\":";
+			out += std::to_string(matches[i].distance);
+			out += '}';
+		}
+		out += "]}";
+		found = true;
+	}
+	else if (route.compare(0, 9, "allergic/") == 0){
+		std::string allergen = urlDecode(route.substr(9));
+		bool all = request.param("all") == "1";
+		std::string limitText = request.param("limit");
+		size_t limit = limitText.empty() ? kDefaultAllergicLimit : (size_t)strtoul(limitText.c_str(), NULL, 10);
+		std::vector<std::pair<std::string, std::string> > patients;
+		unsigned long long count = findAllergic(allergen, !all, limit, patients);
+		std::string& out = response.body;
+		out = "{";
+		appendJsonName(out, "allergen");
+		std::string normalized = normalizeAllergen(allergen);
+		appendJsonString(out, normalized.data(), normalized.size());
+		out += all ? ",\"present\":false,\"count\":" : ",\"present\":true,\"count\":";
+		out += std::to_string(count);
+		out += ",\"patients\":[";
+		for (size_t i = 0; i < patients.size(); ++i){
+			if (i > 0) out += ',';
+			out += "{\"ohip\":\"";
+			out += patients[i].first;
+			out += "\",";
+			appendJsonName(out, "name");
+			appendJsonString(out, patients[i].second.data(), patients[i].second.size());
+			out += '}';
+		}
+		out += "]}";
+		found = true;
+	}
+	else{
+		found = false;
+	}
+	if (!found){
+		response.status = 404;
+		return;
+	}
+	response.contentType = "application/json";
+	response.headers["Cache-Control"] = "no-store"; //medical data
+}
+
+size_t RecordStore::size(){
+	std::lock_guard<std::mutex> lock(mMutex);
+	return mOhip.size();
+}
+
+/*
+Bytes of the allergen index. Called with mMutex held.
+*/
+size_t RecordStore::allergenIndexBytes() const{
+	size_t bytes = mAllergens.memoryBytes() + mAllergenRows.capacity() * sizeof(RoaringBitmap) + mNames.memoryBytes();
+	for (size_t i = 0; i < mAllergenRows.size(); ++i) bytes += mAllergenRows[i].memoryBytes();
+	return bytes;
+}
+
+size_t RecordStore::memoryBytes(){
+	std::lock_guard<std::mutex> lock(mMutex);
+	return mOhip.capacity() * sizeof(unsigned long long) + (mBorn.capacity() + mExpiry.capacity()) * sizeof(unsigned short) +
+		(mSex.capacity() + mDonor.capacity() + mRelationship.capacity() + mCold.capacity() + mAllergyStart.capacity()) * sizeof(unsigned) +
+		mAllergyCount.capacity() + mColdArena.capacity() + mAllergyIds.capacity() * sizeof(unsigned) +
+		mDictionary.memoryBytes() + mIndex.capacity() * sizeof(unsigned) + allergenIndexBytes() +
+		mVersions.capacity() * sizeof(Version) + mVersionArena.capacity() + mNewestVersion.size() * (2 * sizeof(unsigned) + 2 * sizeof(void*));
+}
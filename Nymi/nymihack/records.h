@@ -0,0 +1,339 @@
+#ifndef RECORDS_H
+#define RECORDS_H
+
+#include "http_server.h"
+#include "interner.h"
+#include "record_log.h"
+#include "roaring.h"
+#include "singleflight.h"
+#include "trigram_index.h"
+#include "sessions.h"
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/*
+A patient's medical record, the fields infoPage.php shows
+*/
+struct PatientRecord{
+	std::string ohip; //health number as printed, e.g. 5584-486-674-YM
+	std::string name;
+	std::string sex;
+	std::string born; //YYYY-MM-DD
+	std::string expiry; //YYYY-MM-DD, of the health card
+	std::string address;
+	std::string phone;
+	std::string contactName; //emergency contact
+	std::string contactPhone;
+	std::string contactRelationship;
+	std::string donor; //donor code, e.g. 9Z
+	std::vector<std::string> allergies;
+};
+
+static const size_t kMaxRecordFieldBytes = 32767;
+static const size_t kMaxAllergies = 255;
+static const size_t kMaxPrefetches = 16; //Nymis found at once whose records are rendered ahead of validation
+
+/*
+Health number without the dashes and spaces it's printed with, upper case
+*/
+std::string normalizeOhip(const std::string& ohip);
+
+/*
+A patient found by searchNames
+*/
+struct NameMatch{
+	std::string ohip;
+	std::string name;
+	std::string sex;
+	std::string born;
+	unsigned distance; //edits from the query to the name or one of its words
+};
+
+/*
+Allergen as indexed: lower case, with surrounding whitespace dropped and inner runs of it collapsed
+*/
+std::string normalizeAllergen(const std::string& allergen);
+
+/*
+One change in a record's history
+*/
+struct RecordChange{
+	long long time; //milliseconds since 1970-01-01 UTC
+	RecordField field;
+	std::string before; //allergies comma separated
+	std::string after;
+};
+
+/*
+A field value as a quoted JSON string, escaped as the record service sends it, for printing
+values that came from a request, e.g. a change's before and after, without their control characters
+*/
+std::string quotedValue(const std::string& value);
+
+/*
+Outcome of RecordStore::update
+*/
+enum UpdateResult{
+	UPDATE_APPLIED,
+	UPDATE_INVALID, //the value doesn't fit the field
+	UPDATE_CONFLICT, //the new health number belongs to another record
+	UPDATE_NOT_FOUND,
+	UPDATE_NOT_DURABLE //gRecordLog couldn't write the edit, so it wasn't applied
+};
+
+/*
+Patient records keyed by health number and by the provision of the patient's Nymi, served as JSON
+by serve():
+	GET /records/current              record of the patient identified last
+	GET /records/ohip/<health number>[?at=<ms since 1970>]   the record now, or as it was then
+	GET /records/ohip/<health number>/history    the record's changes, newest first
+	GET /records/provision/<provision id in hex>
+	GET /records/allergic/<allergen>[?all=1][&limit=N]   patients with a validated session who are
+	                                                      allergic, or every patient with all=1
+	GET /records/search?name=<name>[&sex=F][&born=1981 or 1975-1985][&k=10]   fuzzy name search
+	POST /records/ohip/<health number>/<field>   sets one field (see recordFieldName) to the request
+	                                             body, answering 204 once the edit is in gRecordLog and applied
+Records are packed to fit a province's worth in memory. Hot fixed-width fields are columns indexed
+by row: the health number packed in 8 bytes, dates as 2 byte day numbers, and the repeated strings
+(sex, donor code, relationship, allergens) as ids in a StringInterner. The strings unique to a
+patient (name, address, phones, contact name) sit length-prefixed in one arena. A row costs about
+40 bytes plus its unique strings, where a rendered JSON string in a hash map cost several hundred.
+JSON is rendered from the columns on every lookup, which takes microseconds.
+An inverted index maps each normalized allergen to the rows of its patients as a RoaringBitmap, so
+"who here is allergic to penicillin" is one intersection with the rows of the validated sessions.
+Names are in a TrigramIndex for patients known only by a (misspelled) name.
+Records are versioned copy-on-write with reverse deltas: the columns always hold the current
+version, so reading it costs nothing extra, and each edit pushes only the values it overwrote onto
+the row's version chain. An older version is the current one rolled back through the chain, and
+history costs the bytes that changed rather than a copy of the record per edit.
+Terminals asking for the same record at the same time share one lookup and rendering (see
+Singleflight), so polling the current record costs the same however many terminals poll it.
+*/
+class RecordStore{
+public:
+	RecordStore();
+
+	/*
+	Loads records from a tab separated file, one patient per line: health number, name, sex, born,
+	expiry, address, phone, contact name, contact phone, relationship, donor, allergies separated by
+	commas, and optionally the hex provision id of the patient's Nymi. Lines starting with # are skipped.
+	@return false if the file couldn't be read
+	*/
+	bool load(const std::string& path);
+
+	/*
+	Stores the patient infoPage.php was written for, so the page works without a records file
+	*/
+	void seed();
+
+	/*
+	Adds or replaces a record
+	@return false if the health number isn't 10 digits and an optional version code, a date isn't
+	YYYY-MM-DD between 1900 and 2078, or a field is longer than kMaxRecordFieldBytes
+	*/
+	bool put(const PatientRecord& record);
+
+	/*
+	Sets one field of a record
+	@param[in] durable if true, the edit is checked, appended to gRecordLog and applied only once it is
+	on disk, in log order, so replaying the log gives the same records. Blocks until then without
+	holding up readers. If false it is applied right away, e.g. when the log is replayed.
+	*/
+	UpdateResult update(const FieldUpdate& edit, bool durable);
+
+	/*
+	Gives back the spare capacity the columns grew by, e.g. after a bulk load
+	*/
+	void shrink();
+
+	/*
+	Links the provision of a patient's Nymi to their record
+	@return false if no record has the health number
+	*/
+	bool link(const ProvisionKey& provision, const std::string& ohip);
+
+	/*
+	Renders a record's JSON
+	@return false if there is no such record
+	*/
+	bool jsonByOhip(const std::string& ohip, std::string& json);
+	bool jsonByProvision(const ProvisionKey& provision, std::string& json);
+	bool currentJson(std::string& json);
+
+	/*
+	Finds the health number of the record a provision is linked to
+	@return false if it isn't linked to one
+	*/
+	bool ohipByProvision(const ProvisionKey& provision, std::string& ohip);
+
+	/*
+	Renders a record as it was at a point in time
+	@param[in] ohip current health number of the record
+	@param[in] time milliseconds since 1970-01-01 UTC; changes made after it are rolled back
+	@return false if there is no such record
+	*/
+	bool jsonAt(const std::string& ohip, long long time, std::string& json);
+
+	/*
+	Lists the changes made to a record since it was loaded, newest first
+	@return false if there is no such record
+	*/
+	bool history(const std::string& ohip, std::vector<RecordChange>& changes);
+
+	/*
+	Marks a patient present, for findAllergic. Called when their Nymi is identified, however it left
+	afterwards: continuous finding disconnects every Nymi right away, strong finds never connect.
+	*/
+	void identified(const ProvisionKey& provision);
+
+	/*
+	Finds the patients allergic to an allergen
+	@param[in] presentOnly only patients identified at the desk within kValidationTtlMillis, see identified()
+	@param[in] limit at most this many patients are returned
+	@param[out] patients health number and name of the first patients, by row
+	@return how many patients match, even past the limit
+	*/
+	unsigned long long findAllergic(const std::string& allergen, bool presentOnly, size_t limit, std::vector<std::pair<std::string, std::string> >& patients);
+
+	/*
+	Finds patients by name, for a patient without card or Nymi who can only give a name.
+	Rows sharing enough trigrams with the query are filtered, then re-ranked by bounded edit
+	distance to the whole name and, for a one word query, to each word of the name.
+	@param[in] query name or part of it, any case
+	@param[in] sex only patients of this sex, if not empty
+	@param[in] bornFrom, bornTo only patients born in these years, inclusive, if not 0
+	@param[in] k at most this many patients, closest first
+	*/
+	void searchNames(const std::string& query, const std::string& sex, int bornFrom, int bornTo, size_t k, std::vector<NameMatch>& matches);
+
+	/*
+	Remembers the patient identified last, whose record /records/current returns
+	*/
+	void setCurrent(const ProvisionKey& provision);
+
+	/*
+	Renders the record of a found Nymi while its connection and validation are still under way,
+	into an entry of its own that /records/current doesn't see. At most kMaxPrefetches are kept,
+	the oldest is dropped first.
+	@param[in] nymiHandle handle the Nymi was found with
+	@param[in] provision provision it was found with
+	*/
+	void prefetch(int nymiHandle, const ProvisionKey& provision);
+
+	/*
+	Makes a validated patient the current one, like setCurrent. The record rendered by prefetch()
+	becomes what /records/current returns, unless the record changed since; then, or if nothing was
+	prefetched for the handle, it is rendered on the next request.
+	*/
+	void publish(int nymiHandle, const ProvisionKey& provision);
+
+	/*
+	Drops what was prefetched for a Nymi that disconnected or failed to validate
+	*/
+	void dropPrefetch(int nymiHandle);
+
+	/*
+	Drops everything prefetched, when the NCL's handles become invalid
+	*/
+	void dropPrefetches();
+
+	unsigned long long prefetchesPublished(); //validations whose record was ready
+	unsigned long long prefetchesMissed(); //validations whose record had to be rendered after all
+	unsigned long long prefetchesDropped(); //prefetches never published
+	unsigned long long lookupsComputed(); //record lookups rendered
+	unsigned long long lookupsShared(); //record lookups answered with another one's rendering
+
+	/*
+	HTTP handler for the endpoints above
+	*/
+	void serve(const HttpRequest& request, HttpResponse& response);
+
+	size_t size();
+	size_t memoryBytes(); //of the columns, arenas, dictionary and index
+
+private:
+	bool findRow(unsigned long long ohip, unsigned& row) const;
+	void serveRecord(const std::string& route, const HttpRequest& request, HttpResponse& response);
+	std::string flightKey(const HttpRequest& request);
+	void indexRow(unsigned row);
+	void unindexRow(unsigned row);
+	void readRow(unsigned row, PatientRecord& record) const;
+	void writeRow(unsigned row, bool replacing, const PatientRecord& record, unsigned short born, unsigned short expiry);
+	void addVersions(unsigned row, const PatientRecord& before, const PatientRecord& after, long long time);
+	UpdateResult applyLocked(const FieldUpdate& edit, bool checkOnly);
+	void applyDurableLocked(unsigned long long durable);
+	void renderJson(unsigned row, std::string& out) const;
+	void appendCold(const PatientRecord& record);
+	void compact();
+	void indexAllergies(unsigned row, bool add);
+	size_t allergenIndexBytes() const;
+	void summarize(unsigned row, std::pair<std::string, std::string>& patient) const;
+
+	std::mutex mMutex;
+
+	//One entry per row
+	std::vector<unsigned long long> mOhip; //see packOhip in records.cpp
+	std::vector<unsigned short> mBorn; //days since 1900-01-01, kNoDate if unknown
+	std::vector<unsigned short> mExpiry;
+	std::vector<unsigned> mSex; //ids in mDictionary
+	std::vector<unsigned> mDonor;
+	std::vector<unsigned> mRelationship;
+	std::vector<unsigned> mCold; //offset of the row's unique strings in mColdArena
+	std::vector<unsigned> mAllergyStart; //first of the row's allergen ids in mAllergyIds
+	std::vector<unsigned char> mAllergyCount;
+
+	std::vector<char> mColdArena;
+	std::vector<unsigned> mAllergyIds;
+	size_t mColdGarbage; //bytes of mColdArena left behind by replaced records
+	size_t mAllergyGarbage; //ids of mAllergyIds left behind by replaced records
+	StringInterner mDictionary;
+	StringInterner mAllergens; //normalized allergens
+	std::vector<RoaringBitmap> mAllergenRows; //rows of the patients allergic to each of mAllergens
+	TrigramIndex mNames;
+
+	//Reverse delta: the value a field had before an edit
+	struct Version{
+		long long time; //of the edit
+		unsigned older; //index + 1 of the row's previous version in mVersions, 0 for none
+		unsigned offset; //of the value in mVersionArena
+		unsigned length;
+		unsigned char field; //a RecordField
+	};
+	std::vector<Version> mVersions;
+	std::vector<char> mVersionArena;
+	std::unordered_map<unsigned, unsigned> mNewestVersion; //row to index + 1 in mVersions, for rows edited since loading
+	std::map<unsigned long long, FieldUpdate> mUnapplied; //logged edits waiting for the disk, by sequence number
+	std::map<unsigned long long, UpdateResult> mUpdateResults; //of applied edits whose writers haven't picked them up yet
+
+	std::vector<unsigned> mIndex; //open addressing table of row + 1 by health number, 0 for empty
+	std::unordered_map<ProvisionKey, unsigned> mRowByProvision;
+	std::unordered_map<ProvisionKey, long long> mIdentifiedAt; //monotonicMicros of each patient's last identification
+	ProvisionKey mCurrent;
+	bool mHaveCurrent;
+	unsigned long long mGeneration; //bumped by every write, so rendered JSON can tell it's stale
+	std::string mCurrentJson; //rendered record of mCurrent, empty until rendered
+	unsigned long long mCurrentGeneration;
+	unsigned long long mCurrentChanges; //bumped whenever mCurrent is set
+	Singleflight mFlights; //of lookups of one record
+
+	//Record of a found Nymi, rendered ahead of its validation
+	struct Prefetch{
+		ProvisionKey provision;
+		std::string json;
+		unsigned long long generation;
+		unsigned long long order; //of the prefetch, the smallest is dropped first
+	};
+	std::map<int, Prefetch> mPrefetches; //by Nymi handle
+	unsigned long long mPrefetchOrder;
+	unsigned long long mPrefetchesPublished;
+	unsigned long long mPrefetchesMissed;
+	unsigned long long mPrefetchesDropped;
+};
+
+extern RecordStore gRecords; //Global record store
+
+#endif
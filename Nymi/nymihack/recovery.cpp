@@ -0,0 +1,196 @@
+#include "recovery.h"
+#include "clock.h"
+#include "command_queue.h"
+#include "nclevents.h"
+#include "sessions.h"
+#include "logger.h"
+
+#include <chrono>
+
+RecoveryEngine gRecovery;
+
+static const unsigned kInitTimeoutMillis = 3000; //how long to wait for NCL_EVENT_INIT after nclInit
+
+RecoveryEngine::RecoveryEngine() :
+	mCallback(NULL), mUserData(NULL), mName(NULL), mMode(NCL_MODE_DEFAULT), mErrorStream(NULL),
+	mRunning(false), mReinitRequested(false), mRecovering(false), mInitDone(false), mInitSucceeded(false),
+	mBusyRetries(0), mBusyRetryRequested(false), mErrorAt(0), mLastRecoveryMicros(0), mRecoveries(0){}
+
+RecoveryEngine::~RecoveryEngine(){
+	stop();
+}
+
+NclBool RecoveryEngine::init(NclCallback callback, void* userData, const char* name, NclMode mode, FILE* errorStream){
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mCallback = callback;
+		mUserData = userData;
+		mName = name;
+		mMode = mode;
+		mErrorStream = errorStream;
+		mInitDone = false;
+		if (!mRunning){
+			mRunning = true;
+			mWorker = std::thread(&RecoveryEngine::run, this);
+		}
+	}
+	return nclInit(callback, userData, name, mode, errorStream);
+}
+
+void RecoveryEngine::stop(){
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		if (!mRunning) return;
+		mRunning = false;
+	}
+	mWake.notify_all();
+	mWorker.join();
+}
+
+void RecoveryEngine::setRecoveredHandler(std::function<void()> handler){
+	std::lock_guard<std::mutex> lock(mMutex);
+	mRecoveredHandler = handler;
+}
+
+void RecoveryEngine::onEvent(const NclEvent& event){
+	if (event.type == NCL_EVENT_INIT){
+		std::lock_guard<std::mutex> lock(mMutex);
+		mInitDone = true;
+		mInitSucceeded = event.init.success == NCL_TRUE;
+		if (!mInitSucceeded && !mRecovering){
+			gLog.log("log: init failed, reinitializing");
+			mRecovering = true;
+			mErrorAt = monotonicMicros();
+			mReinitRequested = true;
+		}
+		mWake.notify_all();
+		return;
+	}
+	if (event.type != NCL_EVENT_ERROR){
+		if (nclEventHandle(event) != -1){
+			std::lock_guard<std::mutex> lock(mMutex);
+			mBusyRetries = 0; //a Nymi talked to us, so whatever was busy moved on
+		}
+		return;
+	}
+
+	NclErrorCode code = event.error.code; //callback() already merged in nclGetErrorCode()
+	std::lock_guard<std::mutex> lock(mMutex);
+	switch (code){
+	case NCL_ERROR_BUSY:
+		requestBusyRetryLocked();
+		break;
+	case NCL_ERROR_SERIAL_FAILED:
+	case NCL_ERROR_ECODAEMON_MISSING:
+	case NCL_ERROR_NCL_FAILED:
+		if (mRecovering) return; //a reinit is already underway
+		gLog.log("log: {}, reinitializing NCL", nclErrorName(code));
+		mRecovering = true;
+		mErrorAt = monotonicMicros();
+		mReinitRequested = true;
+		break;
+	default:
+		gLog.log("log: error {}", nclErrorName(code));
+		return;
+	}
+	mWake.notify_all();
+}
+
+void RecoveryEngine::retryBusy(){
+	std::lock_guard<std::mutex> lock(mMutex);
+	requestBusyRetryLocked();
+	mWake.notify_all();
+}
+
+void RecoveryEngine::requestBusyRetryLocked(){
+	++mBusyRetries;
+	mBusyRetryRequested = true;
+}
+
+unsigned backoffMillis(unsigned attempt, unsigned baseMillis, unsigned maxMillis){
+	unsigned delay = baseMillis;
+	for (unsigned i = 0; i < attempt && delay < maxMillis; ++i) delay *= 2;
+	if (delay > maxMillis) delay = maxMillis;
+	unsigned long long seed = (unsigned long long)monotonicNanos();
+	seed ^= seed >> 33;
+	seed *= 0xff51afd7ed558ccdULL;
+	seed ^= seed >> 33;
+	return delay + (unsigned)(seed % (delay / 4 + 1));
+}
+
+void RecoveryEngine::run(){
+	std::unique_lock<std::mutex> lock(mMutex);
+	while (mRunning){
+		if (mReinitRequested){
+			mReinitRequested = false;
+			lock.unlock();
+			reinit();
+			lock.lock();
+			continue;
+		}
+		if (mBusyRetryRequested){
+			mBusyRetryRequested = false;
+			unsigned delay = backoffMillis(mBusyRetries, 20, 1000);
+			mWake.wait_for(lock, std::chrono::milliseconds(delay), [this]{ return !mRunning || mReinitRequested; });
+			if (!mRunning || mReinitRequested) continue;
+			lock.unlock();
+			gScheduler.retryStalled();
+			lock.lock();
+			continue;
+		}
+		mWake.wait(lock);
+	}
+}
+
+void RecoveryEngine::reinit(){
+	//Handles die with the NCL. Sessions stay keyed by provision and their queued commands are
+	//parked until the same Nymi is found and validated again.
+	gScheduler.parkAll(gSessions.unbindAll());
+
+	if (!nclFinish()){
+		gLog.log("log: nclFinish failed during recovery, trying nclInit anyway");
+	}
+
+	for (unsigned attempt = 0;; ++attempt){
+		std::unique_lock<std::mutex> lock(mMutex);
+		if (!mRunning) return;
+		mInitDone = false;
+		lock.unlock();
+		bool started = nclInit(mCallback, mUserData, mName, mMode, mErrorStream) == NCL_TRUE;
+		lock.lock();
+		if (started){
+			mWake.wait_for(lock, std::chrono::milliseconds(kInitTimeoutMillis), [this]{ return mInitDone || !mRunning; });
+			if (!mRunning) return;
+			if (mInitDone && mInitSucceeded){
+				mRecovering = false;
+				mLastRecoveryMicros = monotonicMicros() - mErrorAt;
+				++mRecoveries;
+				std::function<void()> handler = mRecoveredHandler;
+				gLog.log("log: NCL recovered in {} ms (attempt {})", mLastRecoveryMicros / 1000, attempt + 1);
+				lock.unlock();
+				if (handler) handler();
+				return;
+			}
+			lock.unlock();
+			nclFinish(); //nclInit may only be called again after nclFinish
+			lock.lock();
+		}
+		unsigned delay = backoffMillis(attempt, 50, 2000);
+		mWake.wait_for(lock, std::chrono::milliseconds(delay), [this]{ return !mRunning; });
+	}
+}
+
+bool RecoveryEngine::recovering(){
+	std::lock_guard<std::mutex> lock(mMutex);
+	return mRecovering;
+}
+
+long long RecoveryEngine::lastRecoveryMicros(){
+	std::lock_guard<std::mutex> lock(mMutex);
+	return mLastRecoveryMicros;
+}
+
+unsigned RecoveryEngine::recoveries(){
+	std::lock_guard<std::mutex> lock(mMutex);
+	return mRecoveries;
+}
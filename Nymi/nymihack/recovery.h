@@ -0,0 +1,90 @@
+#ifndef RECOVERY_H
+#define RECOVERY_H
+
+#include "ncl.h"
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+/*
+Keeps the NCL running through dongle and ecodaemon failures without restarting the process.
+NCL_EVENT_ERROR is classified with nclGetErrorCode():
+- NCL_ERROR_BUSY backs off and then retries the stalled command channels
+- NCL_ERROR_SERIAL_FAILED, NCL_ERROR_ECODAEMON_MISSING and NCL_ERROR_NCL_FAILED run nclFinish/nclInit
+  on a worker thread (nclFinish can't be called from inside a callback), retrying with backoff
+- anything else is logged, since it concerns a single request
+Sessions, provisions and queued commands live outside the NCL, so they survive a reinit.
+*/
+class RecoveryEngine{
+public:
+	RecoveryEngine();
+	~RecoveryEngine();
+
+	/*
+	Initializes the NCL and remembers the parameters for later reinits. Same parameters as nclInit.
+	*/
+	NclBool init(NclCallback callback, void* userData, const char* name, NclMode mode, FILE* errorStream);
+
+	/*
+	Stops the worker thread. Call before nclFinish at shutdown.
+	*/
+	void stop();
+
+	/*
+	Feeds NCL_EVENT_INIT and NCL_EVENT_ERROR from the callback
+	*/
+	void onEvent(const NclEvent& event);
+
+	/*
+	Retries the stalled command channels after a backoff that grows with each NCL_ERROR_BUSY in a row
+	*/
+	void retryBusy();
+
+	/*
+	Sets the function called after a reinit finished, used to restart scans and rebind sessions
+	*/
+	void setRecoveredHandler(std::function<void()> handler);
+
+	bool recovering();
+	long long lastRecoveryMicros(); //time from the error to the successful NCL_EVENT_INIT of the last recovery
+	unsigned recoveries();
+
+private:
+	void run();
+	void reinit();
+	void requestBusyRetryLocked(); //caller holds mMutex
+
+	NclCallback mCallback;
+	void* mUserData;
+	const char* mName;
+	NclMode mMode;
+	FILE* mErrorStream;
+
+	std::mutex mMutex;
+	std::condition_variable mWake;
+	std::thread mWorker;
+	std::function<void()> mRecoveredHandler;
+	bool mRunning;
+	bool mReinitRequested;
+	bool mRecovering;
+	bool mInitDone; //NCL_EVENT_INIT for the current nclInit arrived
+	bool mInitSucceeded;
+	unsigned mBusyRetries; //consecutive NCL_ERROR_BUSY errors, drives the backoff
+	bool mBusyRetryRequested;
+	long long mErrorAt; //monotonicMicros() of the error that started the current recovery
+	long long mLastRecoveryMicros;
+	unsigned mRecoveries;
+};
+
+extern RecoveryEngine gRecovery; //Global recovery engine
+
+/*
+Exponential backoff with up to 25% jitter, so many stations don't retry in lockstep
+@param[in] attempt number of attempts that failed before, 0 for the first retry
+@return delay in milliseconds
+*/
+unsigned backoffMillis(unsigned attempt, unsigned baseMillis, unsigned maxMillis);
+
+#endif
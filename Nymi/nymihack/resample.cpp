@@ -0,0 +1,123 @@
+#include "resample.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__SSE2__)
+#include <emmintrin.h>
+#define RESAMPLE_SSE2
+#endif
+
+/*
+Filter taps of every output pixel along one axis, normalized to sum to 1
+*/
+struct Taps{
+	std::vector<unsigned> start; //first source pixel of each output pixel
+	std::vector<unsigned> count;
+	std::vector<float> weights; //stride entries per output pixel
+	unsigned stride;
+};
+
+static void computeTaps(unsigned inSize, unsigned outSize, Taps& taps){
+	double scale = (double)inSize / outSize;
+	double support = std::max(scale, 1.0); //radius of the triangle, in source pixels
+	taps.stride = (unsigned)std::ceil(support) * 2 + 1;
+	taps.start.resize(outSize);
+	taps.count.resize(outSize);
+	taps.weights.assign((size_t)outSize * taps.stride, 0.0f);
+	for (unsigned i = 0; i < outSize; ++i){
+		double center = (i + 0.5) * scale - 0.5;
+		int first = std::max(0, (int)std::floor(center - support) + 1);
+		int last = std::min((int)inSize - 1, (int)std::floor(center + support));
+		if (last < first) last = first = std::min(std::max(0, (int)(center + 0.5)), (int)inSize - 1);
+		float* weights = &taps.weights[(size_t)i * taps.stride];
+		double total = 0;
+		unsigned count = 0;
+		for (int j = first; j <= last && count < taps.stride; ++j, ++count){
+			double weight = std::max(0.0, 1.0 - std::fabs(j - center) / support);
+			weights[count] = (float)weight;
+			total += weight;
+		}
+		if (total <= 0){
+			weights[0] = 1.0f;
+			count = 1;
+			total = 1;
+		}
+		for (unsigned j = 0; j < count; ++j) weights[j] = (float)(weights[j] / total);
+		taps.start[i] = (unsigned)first;
+		taps.count[i] = count;
+	}
+}
+
+void resizeImage(const Image& source, unsigned width, unsigned height, Image& out){
+	Taps horizontal, vertical;
+	computeTaps(source.width, width, horizontal);
+	computeTaps(source.height, height, vertical);
+
+	//Rows filtered horizontally, 4 floats a pixel
+	std::vector<float> rows((size_t)width * 4 * source.height);
+	std::vector<float> line((size_t)source.width * 4);
+	for (unsigned y = 0; y < source.height; ++y){
+		const unsigned char* in = &source.pixels[(size_t)y * source.width * 4];
+		for (size_t i = 0; i < line.size(); ++i) line[i] = in[i];
+		float* row = &rows[(size_t)y * width * 4];
+		for (unsigned x = 0; x < width; ++x){
+			const float* weights = &horizontal.weights[(size_t)x * horizontal.stride];
+			const float* pixel = &line[(size_t)horizontal.start[x] * 4];
+#if defined(RESAMPLE_SSE2)
+			__m128 sum = _mm_setzero_ps();
+			for (unsigned k = 0; k < horizontal.count[x]; ++k){
+				sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(pixel + k * 4), _mm_set1_ps(weights[k])));
+			}
+			_mm_storeu_ps(row + x * 4, sum);
+#else
+			float sum[4] = { 0, 0, 0, 0 };
+			for (unsigned k = 0; k < horizontal.count[x]; ++k){
+				for (unsigned c = 0; c < 4; ++c) sum[c] += pixel[k * 4 + c] * weights[k];
+			}
+			std::copy(sum, sum + 4, row + x * 4);
+#endif
+		}
+	}
+
+	//Columns, a whole output row at a time
+	out.width = width;
+	out.height = height;
+	out.pixels.resize((size_t)width * height * 4);
+	std::vector<float> sums((size_t)width * 4);
+	size_t floats = sums.size();
+	for (unsigned y = 0; y < height; ++y){
+		const float* weights = &vertical.weights[(size_t)y * vertical.stride];
+		std::fill(sums.begin(), sums.end(), 0.0f);
+		for (unsigned k = 0; k < vertical.count[y]; ++k){
+			const float* row = &rows[(size_t)(vertical.start[y] + k) * floats];
+#if defined(RESAMPLE_SSE2)
+			__m128 weight = _mm_set1_ps(weights[k]);
+			for (size_t i = 0; i < floats; i += 4){
+				_mm_storeu_ps(&sums[i], _mm_add_ps(_mm_loadu_ps(&sums[i]), _mm_mul_ps(_mm_loadu_ps(row + i), weight)));
+			}
+#else
+			for (size_t i = 0; i < floats; ++i) sums[i] += row[i] * weights[k];
+#endif
+		}
+		unsigned char* pixel = &out.pixels[(size_t)y * width * 4];
+#if defined(RESAMPLE_SSE2)
+		for (size_t i = 0; i < floats; i += 4){
+			//Rounded to integers, then saturated to 0..255 by the two packs
+			__m128i value = _mm_cvtps_epi32(_mm_loadu_ps(&sums[i]));
+			value = _mm_packs_epi32(value, value);
+			value = _mm_packus_epi16(value, value);
+			int packed = _mm_cvtsi128_si32(value);
+			pixel[i] = (unsigned char)packed;
+			pixel[i + 1] = (unsigned char)(packed >> 8);
+			pixel[i + 2] = (unsigned char)(packed >> 16);
+			pixel[i + 3] = (unsigned char)(packed >> 24);
+		}
+#else
+		for (size_t i = 0; i < floats; ++i){
+			float value = sums[i] + 0.5f;
+			pixel[i] = (unsigned char)(value < 0 ? 0 : value > 255 ? 255 : value);
+		}
+#endif
+	}
+}
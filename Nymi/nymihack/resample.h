@@ -0,0 +1,16 @@
+#ifndef RESAMPLE_H
+#define RESAMPLE_H
+
+#include "image.h"
+
+/*
+Resizes an image with a triangle filter widened by the scale factor, so a downscale averages
+every source pixel under an output pixel instead of skipping most of them like nearest neighbour
+or plain bilinear would. Rows are filtered first into a float buffer, then columns.
+With SSE2 a pixel's four channels are filtered at once in one register, and the column pass runs
+four floats at a time across the row; without SSE2 the same sums are done a channel at a time.
+@param[in] width, height size of the result, at least 1
+*/
+void resizeImage(const Image& source, unsigned width, unsigned height, Image& out);
+
+#endif
@@ -0,0 +1,192 @@
+#include "roaring.h"
+
+#include <algorithm>
+#include <iterator>
+
+static const size_t kBitmapWords = 65536 / 64;
+
+/*
+Index of the container for a key, or of where it would be inserted
+*/
+size_t RoaringBitmap::find(unsigned short key) const{
+	size_t low = 0, high = mContainers.size();
+	while (low < high){
+		size_t middle = (low + high) / 2;
+		if (mContainers[middle].key < key) low = middle + 1;
+		else high = middle;
+	}
+	return low;
+}
+
+void RoaringBitmap::toBitmap(Container& container){
+	container.bits.assign(kBitmapWords, 0);
+	for (size_t i = 0; i < container.array.size(); ++i){
+		unsigned short low = container.array[i];
+		container.bits[low >> 6] |= 1ULL << (low & 63);
+	}
+	std::vector<unsigned short>().swap(container.array);
+}
+
+void RoaringBitmap::toArray(Container& container){
+	container.array.clear();
+	container.array.reserve(container.cardinality);
+	for (size_t word = 0; word < kBitmapWords; ++word){
+		for (unsigned long long bits = container.bits[word]; bits != 0; bits &= bits - 1){
+			container.array.push_back((unsigned short)(word * 64 + lowestBit(bits)));
+		}
+	}
+	std::vector<unsigned long long>().swap(container.bits);
+}
+
+void RoaringBitmap::add(unsigned value){
+	unsigned short key = (unsigned short)(value >> 16), low = (unsigned short)value;
+	size_t i = find(key);
+	if (i == mContainers.size() || mContainers[i].key != key){
+		Container container;
+		container.key = key;
+		container.cardinality = 0;
+		mContainers.insert(mContainers.begin() + i, container);
+	}
+	Container& container = mContainers[i];
+	if (!container.bits.empty()){
+		unsigned long long& word = container.bits[low >> 6];
+		unsigned long long bit = 1ULL << (low & 63);
+		if (!(word & bit)){
+			word |= bit;
+			++container.cardinality;
+		}
+		return;
+	}
+	std::vector<unsigned short>::iterator at = std::lower_bound(container.array.begin(), container.array.end(), low);
+	if (at != container.array.end() && *at == low) return;
+	container.array.insert(at, low);
+	if (++container.cardinality > kRoaringArrayMax) toBitmap(container);
+}
+
+void RoaringBitmap::remove(unsigned value){
+	unsigned short key = (unsigned short)(value >> 16), low = (unsigned short)value;
+	size_t i = find(key);
+	if (i == mContainers.size() || mContainers[i].key != key) return;
+	Container& container = mContainers[i];
+	if (!container.bits.empty()){
+		unsigned long long& word = container.bits[low >> 6];
+		unsigned long long bit = 1ULL << (low & 63);
+		if (!(word & bit)) return;
+		word &= ~bit;
+		if (--container.cardinality <= kRoaringArrayMax) toArray(container);
+	}
+	else{
+		std::vector<unsigned short>::iterator at = std::lower_bound(container.array.begin(), container.array.end(), low);
+		if (at == container.array.end() || *at != low) return;
+		container.array.erase(at);
+		--container.cardinality;
+	}
+	if (container.cardinality == 0) mContainers.erase(mContainers.begin() + i);
+}
+
+bool RoaringBitmap::contains(unsigned value) const{
+	unsigned short key = (unsigned short)(value >> 16), low = (unsigned short)value;
+	size_t i = find(key);
+	if (i == mContainers.size() || mContainers[i].key != key) return false;
+	const Container& container = mContainers[i];
+	if (!container.bits.empty()) return (container.bits[low >> 6] >> (low & 63)) & 1;
+	return std::binary_search(container.array.begin(), container.array.end(), low);
+}
+
+unsigned long long RoaringBitmap::cardinality() const{
+	unsigned long long total = 0;
+	for (size_t i = 0; i < mContainers.size(); ++i) total += mContainers[i].cardinality;
+	return total;
+}
+
+std::vector<unsigned> RoaringBitmap::values(size_t limit) const{
+	std::vector<unsigned> out;
+	for (size_t i = 0; i < mContainers.size() && out.size() < limit; ++i){
+		const Container& container = mContainers[i];
+		unsigned high = (unsigned)container.key << 16;
+		if (container.bits.empty()){
+			for (size_t j = 0; j < container.array.size() && out.size() < limit; ++j) out.push_back(high | container.array[j]);
+			continue;
+		}
+		for (size_t word = 0; word < kBitmapWords && out.size() < limit; ++word){
+			for (unsigned long long bits = container.bits[word]; bits != 0 && out.size() < limit; bits &= bits - 1){
+				out.push_back(high | (unsigned)(word * 64 + lowestBit(bits)));
+			}
+		}
+	}
+	return out;
+}
+
+/*
+Intersects two containers with the same key
+*/
+void RoaringBitmap::intersect(const Container& a, const Container& b, Container& out){
+	out.key = a.key;
+	out.array.clear();
+	out.bits.clear();
+	if (!a.bits.empty() && !b.bits.empty()){
+		out.bits.resize(kBitmapWords);
+		unsigned cardinality = 0;
+		for (size_t word = 0; word < kBitmapWords; ++word){
+			out.bits[word] = a.bits[word] & b.bits[word];
+			cardinality += popcount64(out.bits[word]);
+		}
+		out.cardinality = cardinality;
+		if (cardinality <= kRoaringArrayMax) toArray(out);
+		return;
+	}
+	if (!a.bits.empty() || !b.bits.empty()){
+		//Probes the bitmap with each value of the array
+		const Container& array = a.bits.empty() ? a : b;
+		const Container& bitmap = a.bits.empty() ? b : a;
+		for (size_t i = 0; i < array.array.size(); ++i){
+			unsigned short low = array.array[i];
+			if ((bitmap.bits[low >> 6] >> (low & 63)) & 1) out.array.push_back(low);
+		}
+		out.cardinality = (unsigned)out.array.size();
+		return;
+	}
+	const std::vector<unsigned short>& small = a.array.size() <= b.array.size() ? a.array : b.array;
+	const std::vector<unsigned short>& large = a.array.size() <= b.array.size() ? b.array : a.array;
+	if (small.size() * 32 < large.size()){
+		//Very different sizes: binary search the large array from where the last value was found
+		std::vector<unsigned short>::const_iterator from = large.begin();
+		for (size_t i = 0; i < small.size() && from != large.end(); ++i){
+			from = std::lower_bound(from, large.end(), small[i]);
+			if (from != large.end() && *from == small[i]) out.array.push_back(small[i]);
+		}
+	}
+	else{
+		std::set_intersection(small.begin(), small.end(), large.begin(), large.end(), std::back_inserter(out.array));
+	}
+	out.cardinality = (unsigned)out.array.size();
+}
+
+void RoaringBitmap::intersect(const RoaringBitmap& a, const RoaringBitmap& b, RoaringBitmap& out){
+	out.mContainers.clear();
+	size_t i = 0, j = 0;
+	while (i < a.mContainers.size() && j < b.mContainers.size()){
+		unsigned short keyA = a.mContainers[i].key, keyB = b.mContainers[j].key;
+		if (keyA < keyB){
+			++i;
+		}
+		else if (keyB < keyA){
+			++j;
+		}
+		else{
+			Container container;
+			intersect(a.mContainers[i], b.mContainers[j], container);
+			if (container.cardinality > 0) out.mContainers.push_back(container);
+			++i;
+			++j;
+		}
+	}
+}
+
+size_t RoaringBitmap::memoryBytes() const{
+	size_t bytes = mContainers.capacity() * sizeof(Container);
+	for (size_t i = 0; i < mContainers.size(); ++i){
+		bytes += mContainers[i].array.capacity() * sizeof(unsigned short) + mContainers[i].bits.capacity() * sizeof(unsigned long long);
+	}
+	return bytes;
+}
@@ -0,0 +1,91 @@
+#ifndef ROARING_H
+#define ROARING_H
+
+#include <cstddef>
+#include <vector>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+//Two 32 bit halves, the 64 bit intrinsics don't exist on Win32
+inline unsigned popcount64(unsigned long long word){ return __popcnt((unsigned)word) + __popcnt((unsigned)(word >> 32)); }
+inline unsigned lowestBit(unsigned long long word){
+	unsigned long index;
+	if (_BitScanForward(&index, (unsigned long)word)) return index;
+	_BitScanForward(&index, (unsigned long)(word >> 32));
+	return index + 32;
+}
+#else
+inline unsigned popcount64(unsigned long long word){ return (unsigned)__builtin_popcountll(word); }
+inline unsigned lowestBit(unsigned long long word){ return (unsigned)__builtin_ctzll(word); }
+#endif
+
+static const unsigned kRoaringArrayMax = 4096; //past this a container is smaller as a bitmap
+
+/*
+Compressed set of 32 bit integers (record rows), after the Roaring bitmap format.
+Values are split by their high 16 bits into containers. A container holding up to
+kRoaringArrayMax values is a sorted array of their low 16 bits; a fuller one is a 65536 bit bitmap.
+Sparse sets cost 2 bytes a value, dense ones an eighth of a byte, and intersecting picks a merge,
+probes or word-wise AND depending on the two containers.
+Not synchronized: the owner locks around it.
+*/
+class RoaringBitmap{
+public:
+	void add(unsigned value);
+	void remove(unsigned value);
+	bool contains(unsigned value) const;
+
+	bool empty() const{ return mContainers.empty(); }
+	unsigned long long cardinality() const;
+
+	/*
+	Values in ascending order
+	@param[in] limit stops after this many values
+	*/
+	std::vector<unsigned> values(size_t limit = (size_t)-1) const;
+
+	/*
+	Calls visit(value) for every value in ascending order, without allocating
+	*/
+	template <typename Visitor>
+	void forEach(Visitor visit) const{
+		for (size_t i = 0; i < mContainers.size(); ++i){
+			const Container& container = mContainers[i];
+			unsigned high = (unsigned)container.key << 16;
+			if (container.bits.empty()){
+				for (size_t j = 0; j < container.array.size(); ++j) visit(high | container.array[j]);
+				continue;
+			}
+			for (size_t word = 0; word < container.bits.size(); ++word){
+				for (unsigned long long bits = container.bits[word]; bits != 0; bits &= bits - 1){
+					visit(high | (unsigned)(word * 64 + lowestBit(bits)));
+				}
+			}
+		}
+	}
+
+	/*
+	Intersection of two bitmaps
+	@param[out] out replaced by the values in both a and b; may not be a or b
+	*/
+	static void intersect(const RoaringBitmap& a, const RoaringBitmap& b, RoaringBitmap& out);
+
+	size_t memoryBytes() const;
+
+private:
+	struct Container{
+		unsigned short key; //high 16 bits of the values
+		unsigned cardinality;
+		std::vector<unsigned short> array; //sorted low 16 bits while cardinality <= kRoaringArrayMax
+		std::vector<unsigned long long> bits; //1024 words otherwise
+	};
+
+	size_t find(unsigned short key) const;
+	static void toBitmap(Container& container);
+	static void toArray(Container& container);
+	static void intersect(const Container& a, const Container& b, Container& out);
+
+	std::vector<Container> mContainers; //sorted by key
+};
+
+#endif
@@ -0,0 +1,130 @@
+#include "scan_maintenance.h"
+#include "clock.h"
+#include "command_queue.h"
+#include "proximity.h"
+#include "recovery.h"
+#include "sessions.h"
+#include "logger.h"
+
+#include <chrono>
+
+ScanMaintenance gScanMaintenance;
+
+static const size_t kMaxSeenHandles = 256; //clear once this many handles piled up
+static const long long kMaxListAgeMicros = 10LL * 60 * 1000000; //or once the list is this old
+static const unsigned kCheckIntervalMillis = 30000;
+static const unsigned kMaxConnected = 32; //size of the buffer given to nclGetConnected
+
+ScanMaintenance::ScanMaintenance() : mRunning(false), mLastClearAt(monotonicMicros()), mClears(0){}
+
+ScanMaintenance::~ScanMaintenance(){
+	stop();
+}
+
+void ScanMaintenance::start(std::function<bool()> stopScan, std::function<void()> restartScan){
+	std::lock_guard<std::mutex> lock(mMutex);
+	if (mRunning) return;
+	mStopScan = stopScan;
+	mRestartScan = restartScan;
+	mRunning = true;
+	mThread = std::thread(&ScanMaintenance::run, this);
+}
+
+void ScanMaintenance::stop(){
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		if (!mRunning) return;
+		mRunning = false;
+	}
+	mWake.notify_all();
+	mThread.join();
+}
+
+void ScanMaintenance::onEvent(const NclEvent& event){
+	int nymiHandle;
+	switch (event.type){
+	case NCL_EVENT_DISCOVERY: nymiHandle = event.discovery.nymiHandle; break;
+	case NCL_EVENT_FIND: nymiHandle = event.find.nymiHandle; break;
+	case NCL_EVENT_DETECTION: nymiHandle = event.detection.nymiHandle; break;
+	default: return;
+	}
+	std::lock_guard<std::mutex> lock(mMutex);
+	if (mSeen.insert(nymiHandle).second && mSeen.size() == kMaxSeenHandles){
+		mWake.notify_all();
+	}
+}
+
+/*
+True if no Nymi is connected and no command is queued, so no handle is in use
+*/
+bool ScanMaintenance::idle(){
+	if (gScheduler.totalDepth() > 0) return false;
+	int handles[kMaxConnected];
+	unsigned connected = kMaxConnected;
+	if (!nclGetConnected(handles, &connected)) return false;
+	return connected == 0;
+}
+
+bool ScanMaintenance::clearNow(){
+	std::lock_guard<std::mutex> clearLock(mClearMutex);
+	if (gRecovery.recovering() || !idle()) return false;
+	//Stopping the scan first means no find can start a new connection while the list is cleared
+	if (mStopScan && !mStopScan()) return false;
+	if (!idle()){
+		if (mRestartScan) mRestartScan();
+		return false;
+	}
+
+	size_t seen;
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		seen = mSeen.size();
+	}
+	bool cleared = nclClearScannedNymis() == NCL_TRUE;
+	if (cleared){
+		//Every handle is invalid now: sessions fall back to their provision, and RSSI tracks go
+		gScheduler.parkAll(gSessions.unbindAll());
+		gProximity.clear();
+		std::lock_guard<std::mutex> lock(mMutex);
+		mSeen.clear();
+		mLastClearAt = monotonicMicros();
+		++mClears;
+	}
+	if (mRestartScan) mRestartScan();
+	if (cleared){
+		gLog.log("log: cleared {} scanned Nymis", seen);
+	}
+	else{
+		gLog.log("log: clearing scanned Nymis failed");
+	}
+	return cleared;
+}
+
+void ScanMaintenance::run(){
+	std::unique_lock<std::mutex> lock(mMutex);
+	while (mRunning){
+		mWake.wait_for(lock, std::chrono::milliseconds(kCheckIntervalMillis));
+		if (!mRunning) break;
+		bool due = mSeen.size() >= kMaxSeenHandles || (!mSeen.empty() && monotonicMicros() - mLastClearAt >= kMaxListAgeMicros);
+		if (!due) continue;
+		lock.unlock();
+		clearNow(); //if a Nymi is connected, the next check tries again
+		lock.lock();
+	}
+}
+
+void ScanMaintenance::reset(){
+	std::lock_guard<std::mutex> lock(mMutex);
+	mSeen.clear();
+	mLastClearAt = monotonicMicros();
+}
+
+size_t ScanMaintenance::seenHandles(){
+	std::lock_guard<std::mutex> lock(mMutex);
+	return mSeen.size();
+}
+
+unsigned ScanMaintenance::clears(){
+	std::lock_guard<std::mutex> lock(mMutex);
+	return mClears;
+}
@@ -0,0 +1,69 @@
+#ifndef SCAN_MAINTENANCE_H
+#define SCAN_MAINTENANCE_H
+
+#include "ncl.h"
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <set>
+#include <thread>
+
+/*
+Keeps the NCL's internal list of scanned Nymis from growing without bound.
+Nymis rotate their MAC address when not connected, so every rotation shows up as a new handle and
+the NCL keeps all of them. Handles seen since the last clear are counted; once there are enough of
+them, or enough time has passed, and nclGetConnected reports no connection, the scan is paused, the
+list is cleared with nclClearScannedNymis and every handle held by the session layer is invalidated.
+*/
+class ScanMaintenance{
+public:
+	ScanMaintenance();
+	~ScanMaintenance();
+
+	/*
+	Starts the maintenance thread
+	@param[in] stopScan stops the running scan, returns false if a scan can't be interrupted right now
+	@param[in] restartScan restarts the scan stopped by stopScan, if there was one
+	*/
+	void start(std::function<bool()> stopScan, std::function<void()> restartScan);
+	void stop();
+
+	/*
+	Feeds events from the NCL callback to count scanned handles
+	*/
+	void onEvent(const NclEvent& event);
+
+	/*
+	Clears the scanned list right away if no Nymi is connected
+	@return false if it wasn't safe to clear
+	*/
+	bool clearNow();
+
+	/*
+	Forgets the handles counted so far, e.g. after an NCL reinit started a fresh list
+	*/
+	void reset();
+
+	size_t seenHandles();
+	unsigned clears();
+
+private:
+	void run();
+	bool idle();
+
+	std::mutex mMutex;
+	std::mutex mClearMutex; //serializes clearNow() between the thread and the main loop
+	std::condition_variable mWake;
+	std::thread mThread;
+	std::function<bool()> mStopScan;
+	std::function<void()> mRestartScan;
+	bool mRunning;
+	std::set<int> mSeen; //handles scanned since the last clear
+	long long mLastClearAt;
+	unsigned mClears;
+};
+
+extern ScanMaintenance gScanMaintenance; //Global scanned-Nymi list maintenance
+
+#endif
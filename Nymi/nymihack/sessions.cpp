@@ -0,0 +1,129 @@
+#include "sessions.h"
+#include "clock.h"
+
+SessionTable gSessions;
+
+ProvisionKey provisionKey(const NclProvisionId id){
+	return ProvisionKey((const char*)id, NCL_PROVISION_ID_SIZE);
+}
+
+std::string provisionHex(const ProvisionKey& key){
+	static const char digits[] = "0123456789abcdef";
+	std::string hex;
+	hex.reserve(key.size() * 2);
+	for (size_t i = 0; i < key.size(); ++i){
+		unsigned char byte = (unsigned char)key[i];
+		hex += digits[byte >> 4];
+		hex += digits[byte & 0xf];
+	}
+	return hex;
+}
+
+void SessionTable::onFind(int nymiHandle, const ProvisionKey& key){
+	std::lock_guard<std::mutex> lock(mMutex);
+	std::map<ProvisionKey, Session>::iterator it = mSessions.find(key);
+	if (it == mSessions.end()){
+		Session session;
+		session.provision = key;
+		session.nymiHandle = nymiHandle;
+		session.validated = false;
+		session.foundAt = monotonicMicros();
+		session.validatedAt = 0;
+		mSessions[key] = session;
+		return;
+	}
+	if (it->second.nymiHandle != nymiHandle){
+		//A new handle means a new connection, which has to be validated again
+		it->second.nymiHandle = nymiHandle;
+		it->second.validated = false;
+		it->second.foundAt = monotonicMicros();
+	}
+}
+
+bool SessionTable::onValidation(int nymiHandle){
+	std::lock_guard<std::mutex> lock(mMutex);
+	for (std::map<ProvisionKey, Session>::iterator it = mSessions.begin(); it != mSessions.end(); ++it){
+		if (it->second.nymiHandle == nymiHandle){
+			it->second.validated = true;
+			it->second.validatedAt = monotonicMicros();
+			return true;
+		}
+	}
+	return false;
+}
+
+void SessionTable::remove(int nymiHandle){
+	std::lock_guard<std::mutex> lock(mMutex);
+	for (std::map<ProvisionKey, Session>::iterator it = mSessions.begin(); it != mSessions.end(); ++it){
+		if (it->second.nymiHandle == nymiHandle){
+			mSessions.erase(it);
+			return;
+		}
+	}
+}
+
+void SessionTable::removeUnbound(const ProvisionKey& provision){
+	std::lock_guard<std::mutex> lock(mMutex);
+	std::map<ProvisionKey, Session>::iterator it = mSessions.find(provision);
+	if (it != mSessions.end() && it->second.nymiHandle == -1) mSessions.erase(it);
+}
+
+bool SessionTable::unbind(int nymiHandle, Session& before){
+	std::lock_guard<std::mutex> lock(mMutex);
+	for (std::map<ProvisionKey, Session>::iterator it = mSessions.begin(); it != mSessions.end(); ++it){
+		if (it->second.nymiHandle == nymiHandle){
+			before = it->second;
+			it->second.nymiHandle = -1;
+			it->second.validated = false;
+			return true;
+		}
+	}
+	return false;
+}
+
+bool SessionTable::provisionOf(int nymiHandle, ProvisionKey& provision){
+	std::lock_guard<std::mutex> lock(mMutex);
+	for (std::map<ProvisionKey, Session>::iterator it = mSessions.begin(); it != mSessions.end(); ++it){
+		if (it->second.nymiHandle == nymiHandle){
+			provision = it->first;
+			return true;
+		}
+	}
+	return false;
+}
+
+bool SessionTable::find(int nymiHandle, Session& session){
+	std::lock_guard<std::mutex> lock(mMutex);
+	for (std::map<ProvisionKey, Session>::iterator it = mSessions.begin(); it != mSessions.end(); ++it){
+		if (it->second.nymiHandle == nymiHandle){
+			session = it->second;
+			return true;
+		}
+	}
+	return false;
+}
+
+std::vector<Session> SessionTable::unbindAll(){
+	std::lock_guard<std::mutex> lock(mMutex);
+	std::vector<Session> before;
+	for (std::map<ProvisionKey, Session>::iterator it = mSessions.begin(); it != mSessions.end(); ++it){
+		before.push_back(it->second);
+		it->second.nymiHandle = -1;
+		it->second.validated = false;
+	}
+	return before;
+}
+
+std::vector<Session> SessionTable::snapshot(){
+	std::lock_guard<std::mutex> lock(mMutex);
+	std::vector<Session> sessions;
+	for (std::map<ProvisionKey, Session>::iterator it = mSessions.begin(); it != mSessions.end(); ++it){
+		sessions.push_back(it->second);
+	}
+	return sessions;
+}
+
+size_t SessionTable::size(){
+	std::lock_guard<std::mutex> lock(mMutex);
+	return mSessions.size();
+}
@@ -0,0 +1,97 @@
+#ifndef SESSIONS_H
+#define SESSIONS_H
+
+#include "ncl.h"
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/*
+Provision IDs as map keys: the NCL_PROVISION_ID_SIZE raw bytes of an NclProvisionId
+*/
+typedef std::string ProvisionKey;
+
+ProvisionKey provisionKey(const NclProvisionId id);
+
+/*
+Lower case hex form of a provision key, for logs and URLs
+*/
+std::string provisionHex(const ProvisionKey& key);
+
+/*
+A patient's Nymi that was found with one of our provisions.
+Sessions are keyed by provision rather than by handle, since handles don't survive an NCL reinit
+or a clear of the scanned Nymi list, while the provision does.
+*/
+struct Session{
+	ProvisionKey provision;
+	int nymiHandle; //-1 while the session isn't bound to a handle, e.g. after an NCL reinit
+	bool validated;
+	long long foundAt; //monotonicMicros() of the find
+	long long validatedAt; //monotonicMicros() of the validation, 0 if not validated
+};
+
+/*
+Table of active sessions, shared by the callback and the main loop
+*/
+class SessionTable{
+public:
+	/*
+	Creates the session for a provision, or rebinds it to a new handle
+	*/
+	void onFind(int nymiHandle, const ProvisionKey& provision);
+
+	/*
+	Marks the session bound to a handle as validated
+	@return false if no session is bound to the handle
+	*/
+	bool onValidation(int nymiHandle);
+
+	/*
+	Ends the session bound to a handle
+	*/
+	void remove(int nymiHandle);
+
+	/*
+	Ends a provision's session if it isn't bound to a handle
+	*/
+	void removeUnbound(const ProvisionKey& provision);
+
+	/*
+	Detaches the session bound to a handle from it, keeping the session, e.g. while reconnecting
+	@param[out] before the session as it was before unbinding
+	@return false if no session is bound to the handle
+	*/
+	bool unbind(int nymiHandle, Session& before);
+
+	/*
+	Looks up the provision of the session bound to a handle
+	@return false if no session is bound to the handle
+	*/
+	bool provisionOf(int nymiHandle, ProvisionKey& provision);
+
+	/*
+	Copies the session bound to a handle
+	@return false if no session is bound to the handle
+	*/
+	bool find(int nymiHandle, Session& session);
+
+	/*
+	Detaches every session from its handle. Used when all handles become invalid.
+	@return the sessions as they were before unbinding
+	*/
+	std::vector<Session> unbindAll();
+
+	std::vector<Session> snapshot();
+	size_t size();
+
+private:
+	std::mutex mMutex;
+	std::map<ProvisionKey, Session> mSessions;
+};
+
+extern SessionTable gSessions; //Global session table
+
+#endif
@@ -0,0 +1,47 @@
+#include "singleflight.h"
+
+Singleflight::Singleflight() : mComputed(0), mShared(0){}
+
+bool Singleflight::run(const std::string& key, const std::function<void(HttpResponse&)>& compute, HttpResponse& response){
+	std::shared_ptr<Flight> flight;
+	{
+		std::unique_lock<std::mutex> lock(mMutex);
+		std::map<std::string, std::shared_ptr<Flight> >::iterator found = mFlights.find(key);
+		if (found != mFlights.end()){
+			flight = found->second; //kept alive by us after the computing request erases it
+			while (!flight->done) mLanded.wait(lock);
+			response = flight->response;
+			++mShared;
+			return true;
+		}
+		flight = std::make_shared<Flight>();
+		mFlights[key] = flight;
+	}
+
+	compute(response);
+	if (!response.body.empty() && !response.sharedBody){
+		std::shared_ptr<std::string> body = std::make_shared<std::string>();
+		body->swap(response.body);
+		response.sharedBody = body;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		flight->response = response;
+		flight->done = true;
+		mFlights.erase(key);
+		++mComputed;
+	}
+	mLanded.notify_all();
+	return false;
+}
+
+unsigned long long Singleflight::computed(){
+	std::lock_guard<std::mutex> lock(mMutex);
+	return mComputed;
+}
+
+unsigned long long Singleflight::shared(){
+	std::lock_guard<std::mutex> lock(mMutex);
+	return mShared;
+}
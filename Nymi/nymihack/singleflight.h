@@ -0,0 +1,51 @@
+#ifndef SINGLEFLIGHT_H
+#define SINGLEFLIGHT_H
+
+#include "http_server.h"
+
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+/*
+Coalesces identical requests served at the same time: the first one for a key computes its
+response, and those arriving with the same key while it does wait for it and are sent the same
+response instead of computing their own. The body is shared, not copied, between them.
+Nothing is kept once the computation finishes, so a request never gets a response computed before
+it arrived unless that computation was still running; put the version of the data read in the key
+when even that must not happen (e.g. a read following a write).
+*/
+class Singleflight{
+public:
+	Singleflight();
+
+	/*
+	Answers a request with compute, or with the response of an identical one being computed
+	@param[in] key identifies the request and what it reads
+	@param[in] compute fills in a response, on this thread, if no request with the key is in flight
+	@param[out] response
+	@return true if the response was shared from another request's computation
+	*/
+	bool run(const std::string& key, const std::function<void(HttpResponse&)>& compute, HttpResponse& response);
+
+	unsigned long long computed(); //responses computed
+	unsigned long long shared(); //responses taken from another request's computation
+
+private:
+	struct Flight{
+		Flight() : done(false){}
+		bool done;
+		HttpResponse response; //once done, with its body in sharedBody
+	};
+
+	std::mutex mMutex;
+	std::condition_variable mLanded;
+	std::map<std::string, std::shared_ptr<Flight> > mFlights; //being computed, by key
+	unsigned long long mComputed;
+	unsigned long long mShared;
+};
+
+#endif
@@ -0,0 +1,316 @@
+#include "static_files.h"
+#include "clock.h"
+#include "gzip.h"
+
+#include <cctype>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+#include <iterator>
+#include <sstream>
+#include <vector>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <sys/stat.h>
+#endif
+
+StaticFiles gStaticFiles;
+
+struct ContentType{
+	const char* extension;
+	const char* type;
+	bool compressible;
+};
+
+//Files of other types (.php, .less, .tiff, ...) aren't served
+static const ContentType kContentTypes[] = {
+	{ ".css", "text/css", true },
+	{ ".js", "application/javascript", true },
+	{ ".html", "text/html; charset=utf-8", true },
+	{ ".json", "application/json", true },
+	{ ".txt", "text/plain", true },
+	{ ".svg", "image/svg+xml", true },
+	{ ".ttf", "font/ttf", true },
+	{ ".otf", "font/otf", true },
+	{ ".eot", "application/vnd.ms-fontobject", true },
+	{ ".woff", "font/woff", false },
+	{ ".woff2", "font/woff2", false },
+	{ ".gif", "image/gif", false },
+	{ ".jpg", "image/jpeg", false },
+	{ ".jpeg", "image/jpeg", false },
+	{ ".png", "image/png", false },
+	{ ".ico", "image/x-icon", false }
+};
+
+static const ContentType* contentTypeOf(const std::string& name){
+	size_t dot = name.rfind('.');
+	if (dot == std::string::npos) return NULL;
+	std::string extension = name.substr(dot);
+	for (size_t i = 0; i < extension.size(); ++i) extension[i] = (char)tolower((unsigned char)extension[i]);
+	for (size_t i = 0; i < sizeof(kContentTypes) / sizeof(kContentTypes[0]); ++i){
+		if (extension == kContentTypes[i].extension) return &kContentTypes[i];
+	}
+	return NULL;
+}
+
+/*
+Lists the files under a directory, recursively
+@param[in] relative subdirectory of root being listed, "" or ending in a slash
+@param[out] files paths relative to root, with forward slashes
+*/
+static void listFiles(const std::string& root, const std::string& relative, std::vector<std::string>& files){
+#if defined(_WIN32)
+	WIN32_FIND_DATAA found;
+	HANDLE search = FindFirstFileA((root + relative + "*").c_str(), &found);
+	if (search == INVALID_HANDLE_VALUE) return;
+	do{
+		std::string name = found.cFileName;
+		if (name.empty() || name[0] == '.') continue;
+		if (found.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) listFiles(root, relative + name + "/", files);
+		else files.push_back(relative + name);
+	} while (FindNextFileA(search, &found));
+	FindClose(search);
+#else
+	DIR* directory = opendir((root + relative).c_str());
+	if (directory == NULL) return;
+	while (dirent* entry = readdir(directory)){
+		std::string name = entry->d_name;
+		if (name.empty() || name[0] == '.') continue;
+		struct stat info;
+		if (stat((root + relative + name).c_str(), &info) != 0) continue;
+		if (S_ISDIR(info.st_mode)) listFiles(root, relative + name + "/", files);
+		else if (S_ISREG(info.st_mode)) files.push_back(relative + name);
+	}
+	closedir(directory);
+#endif
+}
+
+/*
+RFC 7231 date, e.g. Sun, 06 Nov 1994 08:49:37 GMT
+*/
+static std::string httpDate(long long seconds){
+	static const char* kDays[] = { "Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat" };
+	static const char* kMonths[] = { "Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec" };
+	time_t time = (time_t)seconds;
+	tm utc;
+#if defined(_WIN32)
+	if (gmtime_s(&utc, &time) != 0) return std::string();
+#else
+	if (gmtime_r(&time, &utc) == NULL) return std::string();
+#endif
+	std::ostringstream date;
+	date << kDays[utc.tm_wday] << ", " << std::setfill('0') << std::setw(2) << utc.tm_mday << " " << kMonths[utc.tm_mon] << " "
+		<< utc.tm_year + 1900 << " " << std::setw(2) << utc.tm_hour << ":" << std::setw(2) << utc.tm_min << ":"
+		<< std::setw(2) << utc.tm_sec << " GMT";
+	return date.str();
+}
+
+/*
+Whether an Accept-Encoding header allows gzip, i.e. names it without q=0
+*/
+static bool acceptsGzip(const std::string& acceptEncoding){
+	size_t found = acceptEncoding.find("gzip");
+	if (found == std::string::npos) return false;
+	size_t end = acceptEncoding.find(',', found);
+	std::string options = acceptEncoding.substr(found + 4, end == std::string::npos ? std::string::npos : end - found - 4);
+	size_t quality = options.find("q=");
+	return quality == std::string::npos || strtod(options.c_str() + quality + 2, NULL) > 0;
+}
+
+StaticFiles::StaticFiles() : mOpenFiles(0), mUses(0), mSentFiles(0), mSentGzipped(0), mNotModified(0){}
+
+size_t StaticFiles::load(const std::string& root){
+	std::vector<std::string> files;
+	listFiles(root, "", files);
+	for (size_t i = 0; i < files.size(); ++i){
+		const ContentType* type = contentTypeOf(files[i]);
+		if (type == NULL) continue;
+		Asset asset;
+		asset.path = root + files[i];
+		asset.contentType = type->type;
+		asset.compressible = type->compressible;
+		asset.size = 0;
+		asset.modified = -1;
+		asset.checked = monotonicMicros();
+		asset.used = 0;
+		Version version;
+		version.size = asset.size;
+		version.modified = asset.modified;
+		if (!readVersion(asset.path, asset.compressible, version)) continue;
+		install(asset, version);
+		std::lock_guard<std::mutex> lock(mMutex);
+		std::map<std::string, Asset>::iterator old = mAssets.find("/" + files[i]);
+		if (old != mAssets.end() && old->second.file) --mOpenFiles;
+		mAssets["/" + files[i]] = asset;
+	}
+	std::lock_guard<std::mutex> lock(mMutex);
+	return mAssets.size();
+}
+
+/*
+Reads a file's size and time again and, if they changed, gzips it again. Takes no lock, so a
+changed file is compressed while other requests are served.
+@param[in,out] version the one known, replaced by the file's current one
+@return false if the file is gone
+*/
+bool StaticFiles::readVersion(const std::string& path, bool compressible, Version& version){
+	unsigned long long size;
+	long long modified;
+	if (!OpenFile::stat(path, size, modified)) return false;
+	if (size == version.size && modified == version.modified) return true;
+	version.size = size;
+	version.modified = modified;
+	version.gzip.reset();
+	if (compressible){
+		std::ifstream in(path.c_str(), std::ios::binary);
+		std::string content((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+		std::shared_ptr<std::string> gzip = std::make_shared<std::string>();
+		gzipCompress(content.data(), content.size(), *gzip);
+		if (gzip->size() < content.size() * kMaxGzipRatio) version.gzip = gzip;
+	}
+	return true;
+}
+
+/*
+Switches an asset to a version of its file read by readVersion: its validators, gzipped copy and open file
+*/
+void StaticFiles::install(Asset& asset, const Version& version){
+	if (version.size == asset.size && version.modified == asset.modified) return;
+	asset.size = version.size;
+	asset.modified = version.modified;
+	std::ostringstream etag;
+	etag << "\"" << std::hex << asset.size << "-" << asset.modified << "\"";
+	asset.etag = etag.str();
+	asset.lastModified = httpDate(asset.modified);
+	if (asset.file){
+		asset.file.reset(); //responses still sending it keep it open
+		--mOpenFiles;
+	}
+	asset.gzip = version.gzip;
+}
+
+/*
+The asset's open file, opening it if needed and closing the least recently sent one if too many are open
+*/
+std::shared_ptr<OpenFile> StaticFiles::openFile(Asset& asset){
+	asset.used = ++mUses;
+	if (asset.file) return asset.file;
+	if (mOpenFiles >= kMaxOpenFiles){
+		Asset* oldest = NULL;
+		for (std::map<std::string, Asset>::iterator i = mAssets.begin(); i != mAssets.end(); ++i){
+			if (i->second.file && (oldest == NULL || i->second.used < oldest->used)) oldest = &i->second;
+		}
+		if (oldest != NULL){
+			oldest->file.reset();
+			--mOpenFiles;
+		}
+	}
+	asset.file = OpenFile::open(asset.path);
+	if (asset.file) ++mOpenFiles;
+	return asset.file;
+}
+
+void StaticFiles::serve(const HttpRequest& request, HttpResponse& response){
+	if (request.method != "GET" && request.method != "HEAD"){
+		response.status = 405;
+		return;
+	}
+	std::string path = urlDecode(request.path);
+	if (!path.empty() && path[path.size() - 1] == '/') path += "index.html";
+	bool gzip = acceptsGzip(request.header("accept-encoding"));
+	std::string ifNoneMatch = request.header("if-none-match");
+	std::string ifModifiedSince = request.header("if-modified-since");
+	bool versioned = !request.param("v").empty();
+
+	//Held while sending is set up, never while sending or compressing
+	std::unique_lock<std::mutex> lock(mMutex);
+	std::map<std::string, Asset>::iterator found = mAssets.find(path);
+	if (found == mAssets.end()){
+		response.status = 404;
+		return;
+	}
+	Asset& asset = found->second; //assets are never removed, so it outlives the unlock below
+	long long now = monotonicMicros();
+	if (now - asset.checked > kRecheckMicros){
+		//Other requests are served the version known until the new one is swapped in
+		asset.checked = now;
+		std::string diskPath = asset.path;
+		bool compressible = asset.compressible;
+		Version version;
+		version.size = asset.size;
+		version.modified = asset.modified;
+		lock.unlock();
+		bool exists = readVersion(diskPath, compressible, version);
+		lock.lock();
+		if (!exists){
+			response.status = 404;
+			return;
+		}
+		if (asset.path == diskPath) install(asset, version); //unless load() replaced it meanwhile
+	}
+
+	bool gzipped = gzip && asset.gzip;
+	std::string etag = asset.etag;
+	if (gzipped) etag.insert(etag.size() - 1, "-gz"); //another representation, so another strong validator
+	response.contentType = asset.contentType;
+	response.headers["ETag"] = etag;
+	response.headers["Last-Modified"] = asset.lastModified;
+	response.headers["Cache-Control"] = versioned ? "public, max-age=31536000, immutable" : "no-cache";
+	if (asset.gzip) response.headers["Vary"] = "Accept-Encoding";
+	bool fresh = ifNoneMatch.empty() ? !ifModifiedSince.empty() && ifModifiedSince == asset.lastModified : matchesEtag(ifNoneMatch, etag);
+	if (fresh){
+		response.status = 304;
+		++mNotModified;
+		return;
+	}
+	if (gzipped){
+		response.headers["Content-Encoding"] = "gzip";
+		response.sharedBody = asset.gzip;
+		++mSentGzipped;
+		return;
+	}
+	response.file = openFile(asset);
+	if (!response.file){
+		response.status = 404;
+		return;
+	}
+	++mSentFiles;
+}
+
+size_t StaticFiles::size(){
+	std::lock_guard<std::mutex> lock(mMutex);
+	return mAssets.size();
+}
+
+size_t StaticFiles::openFiles(){
+	std::lock_guard<std::mutex> lock(mMutex);
+	return mOpenFiles;
+}
+
+size_t StaticFiles::memoryBytes(){
+	std::lock_guard<std::mutex> lock(mMutex);
+	size_t bytes = 0;
+	for (std::map<std::string, Asset>::iterator i = mAssets.begin(); i != mAssets.end(); ++i){
+		if (i->second.gzip) bytes += i->second.gzip->size();
+	}
+	return bytes;
+}
+
+unsigned long long StaticFiles::sentFiles(){
+	std::lock_guard<std::mutex> lock(mMutex);
+	return mSentFiles;
+}
+
+unsigned long long StaticFiles::sentGzipped(){
+	std::lock_guard<std::mutex> lock(mMutex);
+	return mSentGzipped;
+}
+
+unsigned long long StaticFiles::notModified(){
+	std::lock_guard<std::mutex> lock(mMutex);
+	return mNotModified;
+}
@@ -0,0 +1,91 @@
+#ifndef STATIC_FILES_H
+#define STATIC_FILES_H
+
+#include "http_server.h"
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+static const size_t kMaxOpenFiles = 64; //held open for sending, the least recently sent is closed first
+static const long long kRecheckMicros = 2000000; //how long a file's size and time are trusted before a request checks them again
+static const double kMaxGzipRatio = 0.9; //a gzipped copy is only kept if smaller than this fraction of the file
+
+/*
+The site's static files (bootstrap, jquery, font-awesome, the glyphicons fonts, images), served by
+serve() at their path under the site's root, e.g. GET /css/bootstrap.min.css.
+Every file of a known type is found when loaded, and the text ones are gzipped then, so a browser
+asking for gzip is sent the cached copy. Only a file changed since is compressed while serving, by
+the request noticing the change and without the lock, so other requests aren't held up. Other files are
+sent from a cache of open files with sendfile (TransmitFile on Windows), never passing through
+user space. ETag and Last-Modified come from each file's size and time, so revalidations with
+If-None-Match or If-Modified-Since are answered 304. A URL with a v parameter (see asset() in
+Web/assets.php) names one version of a file and may be kept for good; without one, browsers
+revalidate every use.
+Brotli variants would be smaller still, but there's no encoder here and writing one isn't worth
+it for a few text files, so gzip is the only encoding.
+*/
+class StaticFiles{
+public:
+	StaticFiles();
+
+	/*
+	Finds the files under a directory and gzips the text ones. Called before serving starts.
+	@param[in] root the site's directory, ending in a slash
+	@return files found
+	*/
+	size_t load(const std::string& root);
+
+	/*
+	HTTP handler for GET and HEAD of the files found
+	*/
+	void serve(const HttpRequest& request, HttpResponse& response);
+
+	size_t size(); //files found
+	size_t openFiles();
+	size_t memoryBytes(); //of the gzipped copies
+	unsigned long long sentFiles(); //responses sent from an open file
+	unsigned long long sentGzipped(); //responses sent from a gzipped copy
+	unsigned long long notModified(); //304 responses
+
+private:
+	struct Asset{
+		std::string path; //on disk
+		const char* contentType;
+		bool compressible;
+		unsigned long long size;
+		long long modified; //seconds since 1970
+		long long checked; //monotonicMicros when size and modified were last read
+		std::string etag; //quoted, as sent
+		std::string lastModified; //HTTP date
+		std::shared_ptr<const std::string> gzip; //NULL if not worth it
+		std::shared_ptr<OpenFile> file; //NULL until sent, or once closed for another
+		unsigned long long used; //mUses when last sent from file
+	};
+
+	/*
+	A file's size and time, and its gzipped copy then
+	*/
+	struct Version{
+		unsigned long long size;
+		long long modified;
+		std::shared_ptr<const std::string> gzip;
+	};
+
+	static bool readVersion(const std::string& path, bool compressible, Version& version); //without mMutex
+	void install(Asset& asset, const Version& version); //caller holds mMutex
+	std::shared_ptr<OpenFile> openFile(Asset& asset);
+
+	std::mutex mMutex;
+	std::map<std::string, Asset> mAssets; //by URL path
+	size_t mOpenFiles;
+	unsigned long long mUses;
+	unsigned long long mSentFiles;
+	unsigned long long mSentGzipped;
+	unsigned long long mNotModified;
+};
+
+extern StaticFiles gStaticFiles; //Global static file server
+
+#endif
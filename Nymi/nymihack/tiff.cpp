@@ -0,0 +1,270 @@
+#include "tiff.h"
+
+#include <cstring>
+#include <string>
+
+static const unsigned kMaxDimension = 16384;
+static const unsigned kLzwClear = 256;
+static const unsigned kLzwEnd = 257;
+static const unsigned kLzwMaxCodes = 4096;
+
+enum TiffTag{
+	TAG_WIDTH = 256,
+	TAG_HEIGHT = 257,
+	TAG_BITS_PER_SAMPLE = 258,
+	TAG_COMPRESSION = 259,
+	TAG_PHOTOMETRIC = 262,
+	TAG_STRIP_OFFSETS = 273,
+	TAG_SAMPLES_PER_PIXEL = 277,
+	TAG_ROWS_PER_STRIP = 278,
+	TAG_STRIP_BYTE_COUNTS = 279,
+	TAG_PLANAR_CONFIGURATION = 284,
+	TAG_PREDICTOR = 317,
+	TAG_EXTRA_SAMPLES = 338
+};
+
+/*
+Reads the file in its own byte order, refusing to read past its end
+*/
+class TiffReader{
+public:
+	TiffReader(const unsigned char* data, size_t size) : mData(data), mSize(size), mBigEndian(false){}
+
+	bool header(size_t& ifd){
+		if (mSize < 8) return false;
+		if (mData[0] == 'M' && mData[1] == 'M') mBigEndian = true;
+		else if (mData[0] != 'I' || mData[1] != 'I') return false;
+		unsigned magic;
+		unsigned long long offset;
+		if (!read(2, 2, magic) || magic != 42 || !read(4, 4, offset)) return false;
+		ifd = (size_t)offset;
+		return true;
+	}
+
+	bool read(size_t at, unsigned bytes, unsigned long long& value) const{
+		if (at > mSize || mSize - at < bytes) return false;
+		value = 0;
+		for (unsigned i = 0; i < bytes; ++i){
+			unsigned char byte = mData[at + (mBigEndian ? i : bytes - 1 - i)];
+			value = (value << 8) | byte;
+		}
+		return true;
+	}
+
+	bool read(size_t at, unsigned bytes, unsigned& value) const{
+		unsigned long long wide;
+		if (!read(at, bytes, wide)) return false;
+		value = (unsigned)wide;
+		return true;
+	}
+
+	/*
+	Reads value index of a directory entry, stored in the entry if it fits in 4 bytes
+	*/
+	bool value(size_t entry, unsigned index, unsigned& out) const{
+		unsigned type, count;
+		if (!read(entry + 2, 2, type) || !read(entry + 4, 4, count) || index >= count) return false;
+		unsigned bytes = type == 3 ? 2 : type == 4 ? 4 : type == 1 ? 1 : 0; //SHORT, LONG, BYTE
+		if (bytes == 0) return false;
+		size_t at = entry + 8;
+		if ((unsigned long long)count * bytes > 4){
+			unsigned offset;
+			if (!read(entry + 8, 4, offset)) return false;
+			at = offset;
+		}
+		return read(at + (size_t)index * bytes, bytes, out);
+	}
+
+	unsigned count(size_t entry) const{
+		unsigned count = 0;
+		read(entry + 4, 4, count);
+		return count;
+	}
+
+private:
+	const unsigned char* mData;
+	size_t mSize;
+	bool mBigEndian;
+};
+
+/*
+Decodes a strip compressed with TIFF's LZW: MSB first codes of 9 to 12 bits, widened one code
+early, with 256 clearing the table and 257 ending the strip
+@param[out] out filled up to size bytes
+@return false if the codes are corrupt
+*/
+static bool decodeLzw(const unsigned char* in, size_t inSize, unsigned char* out, size_t size){
+	unsigned short prefix[kLzwMaxCodes];
+	unsigned char suffix[kLzwMaxCodes];
+	unsigned char first[kLzwMaxCodes];
+	unsigned short length[kLzwMaxCodes];
+	for (unsigned i = 0; i < 256; ++i){
+		prefix[i] = 0;
+		suffix[i] = first[i] = (unsigned char)i;
+		length[i] = 1;
+	}
+	size_t written = 0;
+	unsigned long long bitBuffer = 0;
+	unsigned bitCount = 0;
+	size_t position = 0;
+	unsigned width = 9;
+	unsigned next = 258;
+	int previous = -1;
+	while (written < size){
+		while (bitCount < width){
+			if (position >= inSize) return true; //a short strip leaves the rest of the image blank
+			bitBuffer = (bitBuffer << 8) | in[position++];
+			bitCount += 8;
+		}
+		unsigned code = (unsigned)(bitBuffer >> (bitCount - width)) & ((1u << width) - 1);
+		bitCount -= width;
+		if (code == kLzwEnd) return true;
+		if (code == kLzwClear){
+			width = 9;
+			next = 258;
+			previous = -1;
+			continue;
+		}
+		if (previous < 0){
+			if (code > 255) return false;
+			out[written++] = (unsigned char)code;
+			previous = (int)code;
+			continue;
+		}
+		unsigned emitted;
+		if (code < next){
+			emitted = code;
+		}
+		else if (code == next && next < kLzwMaxCodes){
+			//The code being defined: the previous string plus its own first byte
+			prefix[next] = (unsigned short)previous;
+			suffix[next] = first[previous];
+			first[next] = first[previous];
+			length[next] = (unsigned short)(length[previous] + 1);
+			emitted = next;
+		}
+		else{
+			return false;
+		}
+		//Strings are written back to front by walking their prefixes
+		size_t stringLength = length[emitted];
+		size_t fits = stringLength < size - written ? stringLength : size - written;
+		unsigned walk = emitted;
+		for (size_t i = stringLength; i > fits; --i) walk = prefix[walk];
+		for (size_t i = fits; i > 0; --i){
+			out[written + i - 1] = suffix[walk];
+			walk = prefix[walk];
+		}
+		written += fits;
+		if (code < next && next < kLzwMaxCodes){
+			prefix[next] = (unsigned short)previous;
+			suffix[next] = first[code];
+			first[next] = first[previous];
+			length[next] = (unsigned short)(length[previous] + 1);
+		}
+		if (next < kLzwMaxCodes) ++next;
+		if (next + 1 >= (1u << width) && width < 12) ++width;
+		previous = (int)code;
+	}
+	return true;
+}
+
+bool decodeTiff(const unsigned char* data, size_t size, Image& image){
+	TiffReader reader(data, size);
+	size_t ifd;
+	unsigned entries;
+	if (!reader.header(ifd) || !reader.read(ifd, 2, entries)) return false;
+
+	unsigned width = 0, height = 0, compression = 1, photometric = 2, samples = 1, rowsPerStrip = 0xffffffff;
+	unsigned planar = 1, predictor = 1, extra = 0;
+	size_t offsetsEntry = 0, countsEntry = 0;
+	bool eightBit = true;
+	for (unsigned i = 0; i < entries; ++i){
+		size_t entry = ifd + 2 + (size_t)i * 12;
+		unsigned tag;
+		if (!reader.read(entry, 2, tag)) return false;
+		switch (tag){
+		case TAG_WIDTH: reader.value(entry, 0, width); break;
+		case TAG_HEIGHT: reader.value(entry, 0, height); break;
+		case TAG_BITS_PER_SAMPLE:
+			for (unsigned j = 0; j < reader.count(entry); ++j){
+				unsigned bits = 0;
+				if (!reader.value(entry, j, bits) || bits != 8) eightBit = false;
+			}
+			break;
+		case TAG_COMPRESSION: reader.value(entry, 0, compression); break;
+		case TAG_PHOTOMETRIC: reader.value(entry, 0, photometric); break;
+		case TAG_STRIP_OFFSETS: offsetsEntry = entry; break;
+		case TAG_SAMPLES_PER_PIXEL: reader.value(entry, 0, samples); break;
+		case TAG_ROWS_PER_STRIP: reader.value(entry, 0, rowsPerStrip); break;
+		case TAG_STRIP_BYTE_COUNTS: countsEntry = entry; break;
+		case TAG_PLANAR_CONFIGURATION: reader.value(entry, 0, planar); break;
+		case TAG_PREDICTOR: reader.value(entry, 0, predictor); break;
+		case TAG_EXTRA_SAMPLES: reader.value(entry, 0, extra); break;
+		default: break;
+		}
+	}
+	if (width == 0 || height == 0 || width > kMaxDimension || height > kMaxDimension || !eightBit || planar != 1) return false;
+	if (compression != 1 && compression != 5) return false; //none or LZW
+	if (predictor != 1 && predictor != 2) return false;
+	bool gray = photometric == 1 && samples >= 1;
+	if (!gray && !(photometric == 2 && samples >= 3)) return false;
+	if (offsetsEntry == 0 || countsEntry == 0 || reader.count(offsetsEntry) != reader.count(countsEntry)) return false;
+	if (rowsPerStrip == 0 || rowsPerStrip > height) rowsPerStrip = height;
+
+	//Strips are decoded into one buffer of interleaved samples
+	size_t rowBytes = (size_t)width * samples;
+	std::vector<unsigned char> raw(rowBytes * height, 0);
+	unsigned strips = reader.count(offsetsEntry);
+	for (unsigned strip = 0; strip < strips; ++strip){
+		size_t firstRow = (size_t)strip * rowsPerStrip;
+		if (firstRow >= height) break;
+		size_t rows = height - firstRow < rowsPerStrip ? height - firstRow : rowsPerStrip;
+		unsigned offset, bytes;
+		if (!reader.value(offsetsEntry, strip, offset) || !reader.value(countsEntry, strip, bytes)) return false;
+		if (offset > size || size - offset < bytes) return false;
+		unsigned char* out = &raw[firstRow * rowBytes];
+		size_t outSize = rows * rowBytes;
+		if (compression == 5){
+			if (!decodeLzw(data + offset, bytes, out, outSize)) return false;
+		}
+		else{
+			memcpy(out, data + offset, bytes < outSize ? bytes : outSize);
+		}
+	}
+	if (predictor == 2){
+		for (size_t row = 0; row < height; ++row){
+			unsigned char* line = &raw[row * rowBytes];
+			for (size_t i = samples; i < rowBytes; ++i) line[i] = (unsigned char)(line[i] + line[i - samples]);
+		}
+	}
+
+	image.width = width;
+	image.height = height;
+	image.pixels.resize((size_t)width * height * 4);
+	unsigned char* pixel = image.pixels.data();
+	const unsigned char* sample = raw.data();
+	for (size_t i = 0; i < (size_t)width * height; ++i, pixel += 4, sample += samples){
+		unsigned r = sample[0], g = gray ? sample[0] : sample[1], b = gray ? sample[0] : sample[2];
+		unsigned alphaIndex = gray ? 1 : 3;
+		if (samples > alphaIndex && (extra == 1 || extra == 2)){
+			unsigned a = sample[alphaIndex];
+			if (extra == 1){
+				//Associated alpha: the colour is already multiplied by it, white shows through the rest
+				r = r + 255 - a > 255 ? 255 : r + 255 - a;
+				g = g + 255 - a > 255 ? 255 : g + 255 - a;
+				b = b + 255 - a > 255 ? 255 : b + 255 - a;
+			}
+			else{
+				r = (r * a + 255 * (255 - a) + 127) / 255;
+				g = (g * a + 255 * (255 - a) + 127) / 255;
+				b = (b * a + 255 * (255 - a) + 127) / 255;
+			}
+		}
+		pixel[0] = (unsigned char)r;
+		pixel[1] = (unsigned char)g;
+		pixel[2] = (unsigned char)b;
+		pixel[3] = 255;
+	}
+	return true;
+}
@@ -0,0 +1,16 @@
+#ifndef TIFF_H
+#define TIFF_H
+
+#include "image.h"
+
+#include <cstddef>
+
+/*
+Decodes the first image of a baseline TIFF file, as the scans of the health cards are saved:
+either byte order, 8 bit gray, RGB or RGBA samples interleaved in strips, uncompressed or LZW,
+with or without horizontal differencing. Alpha is flattened onto white, so the image is opaque.
+@return false if the file is malformed or uses anything else
+*/
+bool decodeTiff(const unsigned char* data, size_t size, Image& image);
+
+#endif
@@ -0,0 +1,91 @@
+#include "trigram_index.h"
+
+#include <algorithm>
+#include <cctype>
+
+void TrigramIndex::trigrams(const std::string& text, std::vector<unsigned>& out){
+	out.clear();
+	std::string padded;
+	padded.reserve(text.size() + 3);
+	for (size_t i = 0; i <= text.size(); ++i){
+		unsigned char c = i < text.size() ? (unsigned char)text[i] : ' ';
+		if (isspace(c)){
+			if (padded.empty()) continue;
+			padded += ' ';
+			for (size_t j = 0; j + 3 <= padded.size(); ++j){
+				out.push_back(((unsigned char)padded[j] << 16) | ((unsigned char)padded[j + 1] << 8) | (unsigned char)padded[j + 2]);
+			}
+			padded.clear();
+			continue;
+		}
+		if (padded.empty()) padded = "  ";
+		padded += (char)tolower(c);
+	}
+	std::sort(out.begin(), out.end());
+	out.erase(std::unique(out.begin(), out.end()), out.end());
+}
+
+void TrigramIndex::add(unsigned row, const std::string& text){
+	std::vector<unsigned> grams;
+	trigrams(text, grams);
+	for (size_t i = 0; i < grams.size(); ++i) mPostings[grams[i]].add(row);
+}
+
+void TrigramIndex::remove(unsigned row, const std::string& text){
+	std::vector<unsigned> grams;
+	trigrams(text, grams);
+	for (size_t i = 0; i < grams.size(); ++i){
+		std::unordered_map<unsigned, RoaringBitmap>::iterator it = mPostings.find(grams[i]);
+		if (it == mPostings.end()) continue;
+		it->second.remove(row);
+		if (it->second.empty()) mPostings.erase(it);
+	}
+}
+
+void TrigramIndex::match(const std::string& text, unsigned minShared, std::vector<std::pair<unsigned, unsigned> >& rows){
+	rows.clear();
+	std::vector<unsigned> grams;
+	trigrams(text, grams);
+	if (grams.size() > 255){
+		//Counts are bytes. A row sharing minShared of all the trigrams shares all but as many of the first 255.
+		unsigned dropped = (unsigned)grams.size() - 255;
+		minShared = minShared > dropped ? minShared - dropped : 1;
+		grams.resize(255);
+	}
+	std::vector<std::pair<unsigned long long, const RoaringBitmap*> > postings;
+	for (size_t i = 0; i < grams.size(); ++i){
+		std::unordered_map<unsigned, RoaringBitmap>::const_iterator it = mPostings.find(grams[i]);
+		if (it != mPostings.end()) postings.push_back(std::make_pair(it->second.cardinality(), &it->second));
+	}
+	if (minShared == 0) minShared = 1;
+	if (postings.size() < minShared) return;
+	//A row sharing minShared of the n trigrams is in at least one of any n - minShared + 1 of them,
+	//so only the rarest ones are scanned; the common ones are probed for those rows only
+	std::sort(postings.begin(), postings.end());
+	size_t scanned = postings.size() - minShared + 1;
+	for (size_t i = 0; i < scanned; ++i){
+		postings[i].second->forEach([this](unsigned row){
+			if (row >= mCounts.size()) mCounts.resize(row + 1, 0);
+			if (mCounts[row]++ == 0) mTouched.push_back(row);
+		});
+	}
+	for (size_t i = 0; i < mTouched.size(); ++i){
+		unsigned row = mTouched[i];
+		unsigned shared = mCounts[row];
+		mCounts[row] = 0;
+		for (size_t j = scanned; j < postings.size(); ++j){
+			if (shared + (postings.size() - j) < minShared) break; //can't make it anymore
+			if (postings[j].second->contains(row)) ++shared;
+		}
+		if (shared >= minShared) rows.push_back(std::make_pair(row, shared));
+	}
+	mTouched.clear();
+}
+
+size_t TrigramIndex::memoryBytes() const{
+	size_t bytes = mCounts.capacity() + mTouched.capacity() * sizeof(unsigned);
+	for (std::unordered_map<unsigned, RoaringBitmap>::const_iterator it = mPostings.begin(); it != mPostings.end(); ++it){
+		bytes += sizeof(*it) + sizeof(void*) + it->second.memoryBytes();
+	}
+	return bytes;
+}
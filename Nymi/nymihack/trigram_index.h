@@ -0,0 +1,42 @@
+#ifndef TRIGRAM_INDEX_H
+#define TRIGRAM_INDEX_H
+
+#include "roaring.h"
+
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/*
+Inverted index from the trigrams of a text (patient names) to the rows holding it.
+Texts are lower cased and each word is padded with two spaces in front and one behind, so
+"Anita" gives "  a", " an", "ani", "nit", "ita", "ta ". Postings are RoaringBitmaps.
+Not synchronized: the owner locks around it.
+*/
+class TrigramIndex{
+public:
+	void add(unsigned row, const std::string& text);
+	void remove(unsigned row, const std::string& text);
+
+	/*
+	Finds the rows sharing trigrams with a text
+	@param[in] minShared rows sharing fewer distinct trigrams are left out
+	@param[out] rows row and number of shared trigrams; only the first 255 trigrams of a longer text are counted
+	*/
+	void match(const std::string& text, unsigned minShared, std::vector<std::pair<unsigned, unsigned> >& rows);
+
+	/*
+	Distinct trigrams of a text, sorted, each as its 3 bytes in an integer
+	*/
+	static void trigrams(const std::string& text, std::vector<unsigned>& out);
+
+	size_t memoryBytes() const;
+
+private:
+	std::unordered_map<unsigned, RoaringBitmap> mPostings;
+	std::vector<unsigned char> mCounts; //shared trigrams by row while matching, all 0 between calls
+	std::vector<unsigned> mTouched; //rows whose count isn't 0
+};
+
+#endif
@@ -0,0 +1,207 @@
+#include "validation_bus.h"
+#include "clock.h"
+#include "validation_status.h"
+
+#include <cctype>
+#include <chrono>
+#include <cstdlib>
+
+ValidationBus gValidations;
+
+static const char kStationsPrefix[] = "/stations/";
+static const char kSubscribersPrefix[] = "/subscribers/";
+
+bool validStation(const std::string& station){
+	if (station.empty() || station.size() > kMaxStationBytes) return false;
+	for (size_t i = 0; i < station.size(); ++i){
+		unsigned char c = (unsigned char)station[i];
+		if (!isalnum(c) && c != '-' && c != '_') return false;
+	}
+	return true;
+}
+
+ValidationBus::ValidationBus() : mNextId(1), mSequence(0), mDelivered(0), mDropped(0), mTestPublishing(false){}
+
+void ValidationBus::publish(const std::string& station, const std::string& ohip, const ProvisionKey& provision){
+	long long time = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+	std::lock_guard<std::mutex> lock(mMutex);
+	//Station ids and health numbers are validated, and the provision is hex, so nothing needs escaping
+	std::shared_ptr<std::string> json = std::make_shared<std::string>();
+	*json = "{\"sequence\":" + std::to_string(++mSequence) + ",\"station\":\"" + station + "\",\"time\":" + std::to_string(time) +
+		",\"ohip\":\"" + ohip + "\",\"provision\":\"" + provisionHex(provision) + "\"}";
+	std::shared_ptr<const std::string> validation = json;
+	typedef std::multimap<std::string, unsigned long long>::iterator StationIterator;
+	std::pair<StationIterator, StationIterator> range = mStations.equal_range(station);
+	for (StationIterator i = range.first; i != range.second; ++i){
+		std::deque<std::shared_ptr<const std::string> >& queue = mSubscribers[i->second].queue;
+		if (queue.size() >= kMaxQueuedValidations){
+			queue.pop_front();
+			++mDropped;
+		}
+		queue.push_back(validation);
+	}
+}
+
+void ValidationBus::remove(std::map<unsigned long long, Subscriber>::iterator subscriber){
+	typedef std::multimap<std::string, unsigned long long>::iterator StationIterator;
+	std::pair<StationIterator, StationIterator> range = mStations.equal_range(subscriber->second.station);
+	for (StationIterator i = range.first; i != range.second; ++i){
+		if (i->second == subscriber->first){
+			mStations.erase(i);
+			break;
+		}
+	}
+	mSubscribers.erase(subscriber);
+}
+
+/*
+Drops the subscribers that stopped polling, e.g. closed browsers
+*/
+void ValidationBus::expire(long long now){
+	for (std::map<unsigned long long, Subscriber>::iterator i = mSubscribers.begin(); i != mSubscribers.end();){
+		if (now - i->second.polled > kSubscriberIdleMicros) remove(i++);
+		else ++i;
+	}
+}
+
+unsigned long long ValidationBus::subscribe(const std::string& station){
+	long long now = monotonicMicros();
+	std::lock_guard<std::mutex> lock(mMutex);
+	if (mSubscribers.size() >= kMaxSubscribers) expire(now);
+	if (mSubscribers.size() >= kMaxSubscribers) return 0;
+	unsigned long long id = mNextId++;
+	Subscriber& subscriber = mSubscribers[id];
+	subscriber.station = station;
+	subscriber.polled = now;
+	mStations.insert(std::make_pair(station, id));
+	return id;
+}
+
+void ValidationBus::unsubscribe(unsigned long long subscriber){
+	std::lock_guard<std::mutex> lock(mMutex);
+	std::map<unsigned long long, Subscriber>::iterator found = mSubscribers.find(subscriber);
+	if (found != mSubscribers.end()) remove(found);
+}
+
+/*
+Whether a test validation's health number is safe to put in its JSON unescaped
+*/
+static bool validTestOhip(const std::string& ohip){
+	if (ohip.empty() || ohip.size() > kMaxStationBytes) return false;
+	for (size_t i = 0; i < ohip.size(); ++i){
+		unsigned char c = (unsigned char)ohip[i];
+		if (!isalnum(c) && c != '-') return false;
+	}
+	return true;
+}
+
+bool ValidationBus::next(unsigned long long subscriber, std::shared_ptr<const std::string>& validation){
+	long long now = monotonicMicros();
+	std::lock_guard<std::mutex> lock(mMutex);
+	std::map<unsigned long long, Subscriber>::iterator found = mSubscribers.find(subscriber);
+	if (found == mSubscribers.end() || now - found->second.polled > kSubscriberIdleMicros) return false;
+	found->second.polled = now;
+	validation.reset();
+	if (found->second.queue.empty()) return true;
+	validation = found->second.queue.front();
+	found->second.queue.pop_front();
+	++mDelivered;
+	return true;
+}
+
+void ValidationBus::serve(const HttpRequest& request, HttpResponse& response){
+	response.headers["Cache-Control"] = "no-store";
+	if (request.path.compare(0, sizeof(kStationsPrefix) - 1, kStationsPrefix) == 0){
+		//e.g. POST /stations/triage-2/subscribers
+		std::string route = request.path.substr(sizeof(kStationsPrefix) - 1);
+		size_t slash = route.find('/');
+		bool validation = slash != std::string::npos && route.substr(slash) == "/validations" && testPublishing();
+		if (slash == std::string::npos || (route.substr(slash) != "/subscribers" && !validation) || !validStation(route.substr(0, slash))){
+			response.status = 404;
+			return;
+		}
+		if (request.method != "POST"){
+			response.status = 405;
+			return;
+		}
+		if (validation){
+			//e.g. POST /stations/triage-2/validations with 5584-486-674-YM, from nymiload
+			if (!validTestOhip(request.body)){
+				response.status = 400;
+				return;
+			}
+			publish(route.substr(0, slash), request.body, ProvisionKey());
+			gValidationStatus.identified(route.substr(0, slash));
+			response.status = 204;
+			return;
+		}
+		unsigned long long id = subscribe(route.substr(0, slash));
+		if (id == 0){
+			response.status = 503;
+			return;
+		}
+		response.body = std::to_string(id);
+		return;
+	}
+	if (request.path.compare(0, sizeof(kSubscribersPrefix) - 1, kSubscribersPrefix) != 0){
+		response.status = 404;
+		return;
+	}
+	std::string route = request.path.substr(sizeof(kSubscribersPrefix) - 1);
+	unsigned long long id = strtoull(route.c_str(), NULL, 10);
+	size_t slash = route.find('/');
+	if (request.method == "DELETE" && slash == std::string::npos){
+		unsubscribe(id);
+		response.status = 204;
+		return;
+	}
+	if (slash == std::string::npos || route.substr(slash) != "/next"){
+		response.status = 404;
+		return;
+	}
+	if (request.method != "POST"){
+		response.status = 405;
+		return;
+	}
+	std::shared_ptr<const std::string> validation;
+	if (!next(id, validation)){
+		response.status = 404;
+		return;
+	}
+	if (!validation){
+		response.status = 204;
+		return;
+	}
+	response.contentType = "application/json";
+	response.sharedBody = validation;
+}
+
+void ValidationBus::setTestPublishing(bool enabled){
+	std::lock_guard<std::mutex> lock(mMutex);
+	mTestPublishing = enabled;
+}
+
+bool ValidationBus::testPublishing(){
+	std::lock_guard<std::mutex> lock(mMutex);
+	return mTestPublishing;
+}
+
+size_t ValidationBus::subscribers(){
+	std::lock_guard<std::mutex> lock(mMutex);
+	return mSubscribers.size();
+}
+
+unsigned long long ValidationBus::published(){
+	std::lock_guard<std::mutex> lock(mMutex);
+	return mSequence;
+}
+
+unsigned long long ValidationBus::delivered(){
+	std::lock_guard<std::mutex> lock(mMutex);
+	return mDelivered;
+}
+
+unsigned long long ValidationBus::dropped(){
+	std::lock_guard<std::mutex> lock(mMutex);
+	return mDropped;
+}
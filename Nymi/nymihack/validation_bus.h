@@ -0,0 +1,101 @@
+#ifndef VALIDATION_BUS_H
+#define VALIDATION_BUS_H
+
+#include "http_server.h"
+#include "sessions.h"
+
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+static const size_t kMaxQueuedValidations = 8; //per subscriber, the oldest is dropped to make room
+static const size_t kMaxSubscribers = 1024; //a few terminals for every triage station
+static const long long kSubscriberIdleMicros = 120000000; //a subscriber not polled for this long is dropped
+static const size_t kMaxStationBytes = 32;
+
+/*
+Validations routed to the triage stations they happened at. Each station's browsers (loading.php)
+subscribe by station id and get only the patients validated by that station's reader, each
+subscriber in its own queue, so every one of them sees every validation once. Served on the
+record service:
+	POST /stations/<station>/subscribers   subscribes, answering the subscriber id
+	POST /subscribers/<id>/next            takes the subscriber's oldest validation, 204 if none,
+	                                       404 if the subscriber expired
+	DELETE /subscribers/<id>
+	POST /stations/<station>/validations   test only, off unless setTestPublishing: publishes a validation
+	                                       of the health number in the body as if the station's reader
+	                                       had validated it, so nymiload can drive the whole path
+A validation is rendered to JSON once when published and its subscribers' queues hold the same
+immutable copy, so fanning out to any number of terminals copies a pointer each. Queues are
+bounded: a subscriber that stops polling loses its oldest validations, then itself once idle for
+kSubscriberIdleMicros.
+*/
+class ValidationBus{
+public:
+	ValidationBus();
+
+	/*
+	Sends a validation to the subscribers of a station
+	@param[in] ohip health number of the patient's record, empty if the Nymi isn't linked to one
+	*/
+	void publish(const std::string& station, const std::string& ohip, const ProvisionKey& provision);
+
+	/*
+	@return the new subscriber's id, 0 if there are kMaxSubscribers already
+	*/
+	unsigned long long subscribe(const std::string& station);
+	void unsubscribe(unsigned long long subscriber);
+
+	/*
+	Takes a subscriber's oldest validation
+	@param[out] validation its JSON, NULL if none is queued
+	@return false if there is no such subscriber
+	*/
+	bool next(unsigned long long subscriber, std::shared_ptr<const std::string>& validation);
+
+	/*
+	HTTP handler for the endpoints above
+	*/
+	void serve(const HttpRequest& request, HttpResponse& response);
+
+	/*
+	Allows POST /stations/<station>/validations, for load tests; off by default
+	*/
+	void setTestPublishing(bool enabled);
+	bool testPublishing();
+
+	size_t subscribers();
+	unsigned long long published(); //validations published
+	unsigned long long delivered(); //validations taken by subscribers
+	unsigned long long dropped(); //validations dropped from full queues
+
+private:
+	struct Subscriber{
+		std::string station;
+		std::deque<std::shared_ptr<const std::string> > queue;
+		long long polled; //monotonicMicros of the last poll
+	};
+
+	void remove(std::map<unsigned long long, Subscriber>::iterator subscriber);
+	void expire(long long now);
+
+	std::mutex mMutex;
+	std::map<unsigned long long, Subscriber> mSubscribers; //by id
+	std::multimap<std::string, unsigned long long> mStations; //subscriber ids by station
+	unsigned long long mNextId;
+	unsigned long long mSequence; //of the last validation published
+	unsigned long long mDelivered;
+	unsigned long long mDropped;
+	bool mTestPublishing;
+};
+
+/*
+Whether a station id is 1 to kMaxStationBytes letters, digits, - or _
+*/
+bool validStation(const std::string& station);
+
+extern ValidationBus gValidations; //Global validation routing
+
+#endif
@@ -0,0 +1,73 @@
+#include "validation_status.h"
+#include "clock.h"
+#include "validation_bus.h"
+
+#include <chrono>
+
+ValidationStatus gValidationStatus;
+
+ValidationStatus::ValidationStatus() : mNotModified(0){}
+
+void ValidationStatus::identified(const std::string& station){
+	long long time = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+	long long now = monotonicMicros();
+	std::lock_guard<std::mutex> lock(mMutex);
+	State* states[] = { &mAll, &mStations[station] };
+	for (int i = 0; i < 2; ++i){
+		++states[i]->generation;
+		states[i]->time = time;
+		states[i]->validatedMicros = now;
+	}
+}
+
+void ValidationStatus::serve(const HttpRequest& request, HttpResponse& response){
+	if (request.method != "GET"){
+		response.status = 405;
+		return;
+	}
+	std::string station = request.param("station");
+	if (!station.empty() && !validStation(station)){
+		response.status = 400;
+		return;
+	}
+	State state;
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		if (station.empty()){
+			state = mAll;
+		}
+		else{
+			std::map<std::string, State>::iterator found = mStations.find(station);
+			if (found != mStations.end()) state = found->second;
+		}
+	}
+	bool validated = state.generation > 0 && monotonicMicros() - state.validatedMicros < kValidationTtlMillis * 1000;
+	std::string etag = "\"" + std::to_string(state.generation) + (validated ? "" : "x") + "\"";
+	response.headers["ETag"] = etag;
+	response.headers["Cache-Control"] = "no-cache"; //kept, but revalidated on every poll
+	if (matchesEtag(request.header("if-none-match"), etag)){
+		response.status = 304;
+		std::lock_guard<std::mutex> lock(mMutex);
+		++mNotModified;
+		return;
+	}
+	//Keyed by what the body depends on, so a poll after a validation never shares an answer from before it
+	mFlights.run("status/" + station + "@" + etag, [&](HttpResponse& shared){
+		shared.contentType = "application/json";
+		shared.body = "{\"generation\":" + std::to_string(state.generation) + ",\"validated\":" + (validated ? "true" : "false") +
+			",\"time\":" + std::to_string(state.time) + ",\"expires\":" + std::to_string(state.generation > 0 ? state.time + kValidationTtlMillis : 0) + "}";
+	}, response);
+}
+
+unsigned long long ValidationStatus::pollsComputed(){
+	return mFlights.computed();
+}
+
+unsigned long long ValidationStatus::pollsShared(){
+	return mFlights.shared();
+}
+
+unsigned long long ValidationStatus::pollsNotModified(){
+	std::lock_guard<std::mutex> lock(mMutex);
+	return mNotModified;
+}
@@ -0,0 +1,59 @@
+#ifndef VALIDATION_STATUS_H
+#define VALIDATION_STATUS_H
+
+#include "http_server.h"
+#include "singleflight.h"
+
+#include <map>
+#include <mutex>
+#include <string>
+
+static const long long kValidationTtlMillis = 120000; //a validation older than this no longer counts as a patient at the desk
+
+/*
+Whether a patient was just validated, polled by loading.php on the record service:
+	GET /status[?station=<id>]   {"generation":7,"validated":true,"time":<ms since 1970>,"expires":<ms>}
+	                             for the station, or for any station without one
+The generation counts validations, so a poller can tell a new one from the one it saw. A
+validation stops counting kValidationTtlMillis after it happened. The ETag names the generation
+and whether it expired, which is all the body depends on, so a poll with If-None-Match of the
+last ETag is answered 304 without rendering anything until the next validation or expiry.
+Terminals poll at the same moments, so identical polls in flight share one answer (see Singleflight).
+*/
+class ValidationStatus{
+public:
+	ValidationStatus();
+
+	/*
+	Called once a patient's identity is established
+	@param[in] station where, see gStation
+	*/
+	void identified(const std::string& station);
+
+	/*
+	HTTP handler for the endpoint above
+	*/
+	void serve(const HttpRequest& request, HttpResponse& response);
+
+	unsigned long long pollsComputed(); //status polls answered with a body
+	unsigned long long pollsShared(); //polls answered with another one's body
+	unsigned long long pollsNotModified(); //polls answered 304
+
+private:
+	struct State{
+		State() : generation(0), time(0), validatedMicros(0){}
+		unsigned long long generation; //validations so far
+		long long time; //of the last one, ms since 1970
+		long long validatedMicros; //of the last one, monotonicMicros
+	};
+
+	std::mutex mMutex;
+	State mAll; //of every station
+	std::map<std::string, State> mStations;
+	unsigned long long mNotModified;
+	Singleflight mFlights;
+};
+
+extern ValidationStatus gValidationStatus; //Global validation status
+
+#endif
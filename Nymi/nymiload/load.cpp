@@ -0,0 +1,768 @@
+/*
+Load generator for the triage terminals' path through nymihack. Simulates N terminals, each a browser
+showing loading.php until a patient is validated at its station, then infoPage.php for as long as the
+nurse reads it, then loading.php again. Each makes the requests those pages make of the record service
+(status, next, subscribe, record) and of the web server (card images, assets the first time), in order,
+over two keep-alive connections, one to each. loading.php refreshes every --refresh ms; pages are read
+for exponentially distributed times around --reading seconds, drawn from a per-terminal seed, so runs
+repeat. The pages themselves are PHP served elsewhere and aren't requested.
+Each station also gets a simulated reader, validating one of --ohips every --arrival seconds on
+average through nymihack's test endpoint (enter "loadtest" at its prompt first). So the status polls
+see new generations, loading.php takes each validation with next and goes on to infoPage.php with it,
+as at a real desk. Besides the table, each run reports validations published, taken and status changes.
+
+A request's latency is measured from when it was due, not from when it was sent, so a server falling
+behind shows in the percentiles instead of slowing the terminals down. For each number of terminals in
+--terminals in turn, after --warmup seconds, reports requests/sec and latency percentiles per request
+over --duration seconds, then the capacity curve of all of them. Rows are appended to nymiload.csv
+(label, terminals, request, count, errors, not modified, per sec, p50, p90, p99, max ms) so each
+--label's curve can be compared across releases.
+
+Usage: nymiload [--terminals 10,50,100,200,400] [--warmup s] [--duration s] [--host address]
+                [--records-port 9109] [--web-port 9110] [--per-station N] [--ohips a,b,...]
+                [--arrival s] [--reading s] [--refresh ms] [--threads N] [--label name]
+*/
+#include "clock.h"
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <set>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(_WIN32)
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#pragma comment(lib, "ws2_32.lib")
+#pragma comment(lib, "winmm.lib")
+typedef SOCKET Socket;
+typedef int SocketLength;
+typedef WSAPOLLFD PollEntry;
+static const Socket kNoSocket = INVALID_SOCKET;
+static void closeSocket(Socket s){ closesocket(s); }
+static int pollSockets(PollEntry* entries, size_t count, int timeoutMillis){ return WSAPoll(entries, (ULONG)count, timeoutMillis); }
+static void setNonBlocking(Socket s){
+	u_long nonBlocking = 1;
+	ioctlsocket(s, FIONBIO, &nonBlocking);
+}
+static bool wouldBlock(){ return WSAGetLastError() == WSAEWOULDBLOCK; }
+#else
+#include <arpa/inet.h>
+#include <cerrno>
+#include <csignal>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+typedef int Socket;
+typedef socklen_t SocketLength;
+typedef pollfd PollEntry;
+static const Socket kNoSocket = -1;
+static void closeSocket(Socket s){ close(s); }
+static int pollSockets(PollEntry* entries, size_t count, int timeoutMillis){ return poll(entries, (nfds_t)count, timeoutMillis); }
+static void setNonBlocking(Socket s){ fcntl(s, F_SETFL, fcntl(s, F_GETFL, 0) | O_NONBLOCK); }
+static bool wouldBlock(){ return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINPROGRESS || errno == EINTR; }
+#endif
+
+static const long long kSubscriptionPollMicros = 60000000; //loading.php takes the next validation at least this often
+static const long long kRequestTimeoutMicros = 10000000; //a request not answered by then is an error
+static const long long kMaxLoopMicros = 100000;
+static const long long kTimerSlackMicros = 2000; //poll timeouts are whole milliseconds, so pages start up to this late by design
+
+enum RequestKind{
+	REQUEST_STATUS, //GET /status?station=, loading.php on every refresh
+	REQUEST_NEXT, //POST /subscribers/<id>/next, loading.php when the status changed or once a minute
+	REQUEST_SUBSCRIBE, //POST /stations/<station>/subscribers, loading.php the first time
+	REQUEST_RECORD, //GET /records/ohip/<ohip>, infoPage.php
+	REQUEST_IMAGE, //GET /images/healthCard*, infoPage.php's card images, revalidated
+	REQUEST_ASSET, //GET of a versioned script, style sheet or image, the first time a page needs it
+	REQUEST_VALIDATE, //POST /stations/<station>/validations, a station's simulated reader
+	REQUEST_UNSUBSCRIBE, //DELETE /subscribers/<id>, cleaning up after a run, not measured
+	REQUEST_KINDS
+};
+
+static const char* const kRequestNames[REQUEST_KINDS] = { "status", "next", "subscribe", "record", "image", "asset", "validate", "unsubscribe" };
+
+enum Server{
+	SERVER_RECORDS,
+	SERVER_WEB,
+	SERVERS
+};
+
+enum Page{
+	PAGE_LOADING,
+	PAGE_INFO,
+	PAGE_DONE //the run is over for the terminal
+};
+
+//What each page has the browser fetch, see asset() in the pages
+static const char* const kLoadingAssets[] = { "css/bootstrap.min.css", "css/grayscale.css", "font-awesome/css/font-awesome.min.css",
+	"blurcity.jpg", "loading.gif", "js/jquery.js", "js/bootstrap.min.js", "js/jquery.easing.min.js", "js/grayscale.js" };
+static const char* const kInfoAssets[] = { "css/bootstrap.min.css", "js/jquery.js", "js/bootstrap.min.js", "Ontario%20Logo.jpg" };
+static const char* const kCardImages[] = { "healthCardFront", "healthCardBack" };
+static const int kPhpSteps = 3; //steps of a page before its assets
+static const char kAcceptEncoding[] = "Accept-Encoding: gzip, deflate\r\n"; //as a browser asks
+
+struct Options{
+	Options() : perStation(2), arrivalSeconds(90), readingSeconds(30), refreshMicros(1000000),
+		warmupMicros(5000000), durationMicros(30000000), threads(0){
+		ports[SERVER_RECORDS] = 9109;
+		ports[SERVER_WEB] = 9110;
+	}
+	std::string host;
+	unsigned short ports[SERVERS];
+	unsigned perStation; //terminals per triage station
+	std::vector<std::string> ohips; //of the patients arriving
+	double arrivalSeconds; //mean time between validations at a station
+	double readingSeconds; //mean time infoPage.php is read
+	long long refreshMicros;
+	long long warmupMicros;
+	long long durationMicros;
+	unsigned threads;
+};
+
+static Options gOptions;
+static sockaddr_in gAddress;
+
+/*
+xorshift64*, one per terminal so its think times are the same every run
+*/
+class Random{
+public:
+	explicit Random(unsigned long long seed = 1) : mState(seed * 0x9E3779B97F4A7C15ULL | 1){}
+
+	double uniform(){
+		mState ^= mState >> 12;
+		mState ^= mState << 25;
+		mState ^= mState >> 27;
+		return ((mState * 2685821657736338717ULL) >> 11) * (1.0 / 9007199254740992.0);
+	}
+
+	long long exponentialMicros(double meanSeconds){
+		return (long long)(-log(1.0 - uniform()) * meanSeconds * 1e6);
+	}
+
+private:
+	unsigned long long mState;
+};
+
+struct Connection{
+	Connection() : socket(kNoSocket), connected(false), answered(false){}
+	Socket socket;
+	bool connected; //connect() finished
+	bool answered; //a response came on it, so it closing before the next one is the server's idle timeout
+};
+
+struct Terminal{
+	Terminal() : reader(false), polledMicros(0), page(PAGE_LOADING), step(0), nextPageMicros(0), statusChanged(true),
+		nextStatus(0), busy(false), kind(REQUEST_STATUS), server(SERVER_RECORDS), sent(0), dueMicros(0), retried(false){}
+	std::string station;
+	bool reader; //the station's Nymi reader, validating patients instead of showing pages
+	Random random;
+	Connection connections[SERVERS];
+
+	//The PHP session
+	std::string subscriber;
+	std::string statusEtag;
+	long long polledMicros;
+
+	//The browser's cache
+	std::set<std::string> assets; //fetched, versioned so never asked again
+	std::map<std::string, std::string> imageEtags; //by path
+
+	//Where the terminal is
+	Page page;
+	int step; //of the page
+	long long nextPageMicros; //when the next page loads, or the reader validates, once the terminal is idle
+	std::string ohip; //of the validation taken by next, shown by infoPage.php
+	bool statusChanged; //the last status poll wasn't answered 304
+	std::string newEtag; //of the last status poll
+	int nextStatus; //of this page's next, 0 if not asked
+
+	//The request in flight
+	bool busy;
+	RequestKind kind;
+	Server server;
+	std::string target;
+	std::string out;
+	size_t sent;
+	std::string in;
+	long long dueMicros;
+	bool retried; //sent again on a new connection, after the kept one turned out closed
+};
+
+struct Samples{
+	Samples() : connections(0), published(0), taken(0), statusChanges(0){
+		for (int k = 0; k < REQUEST_KINDS; ++k) errors[k] = notModified[k] = 0;
+	}
+	std::vector<long long> latencies[REQUEST_KINDS]; //micros, of the answered requests due while measuring
+	unsigned long long errors[REQUEST_KINDS]; //failed, timed out or answered with an unexpected status
+	unsigned long long notModified[REQUEST_KINDS];
+	unsigned long long connections; //opened
+	unsigned long long published; //validations the readers made
+	unsigned long long taken; //validations next handed to a terminal
+	unsigned long long statusChanges; //status polls answered with a new status rather than 304
+};
+
+static std::string urlEncode(const std::string& text){
+	static const char kHex[] = "0123456789ABCDEF";
+	std::string encoded;
+	for (size_t i = 0; i < text.size(); ++i){
+		unsigned char c = (unsigned char)text[i];
+		if (isalnum(c) || c == '-' || c == '_' || c == '.' || c == '~'){
+			encoded += (char)c;
+		}
+		else{
+			encoded += '%';
+			encoded += kHex[c >> 4];
+			encoded += kHex[c & 15];
+		}
+	}
+	return encoded;
+}
+
+/*
+Returns a response header's value, or an empty string if there isn't one
+@param[in] name lowercase header name
+*/
+static std::string headerValue(const std::string& head, const char* name){
+	size_t nameLength = strlen(name);
+	size_t line = head.find("\r\n");
+	while (line != std::string::npos){
+		line += 2;
+		size_t end = head.find("\r\n", line);
+		if (end == std::string::npos) end = head.size();
+		size_t colon = head.find(':', line);
+		if (colon < end && colon - line == nameLength){
+			size_t i = 0;
+			while (i < nameLength && tolower((unsigned char)head[line + i]) == name[i]) ++i;
+			if (i == nameLength){
+				size_t begin = head.find_first_not_of(" \t", colon + 1);
+				return begin < end ? head.substr(begin, end - begin) : std::string();
+			}
+		}
+		line = end < head.size() ? end : std::string::npos;
+	}
+	return std::string();
+}
+
+static void closeConnection(Connection& connection){
+	if (connection.socket != kNoSocket) closeSocket(connection.socket);
+	connection = Connection();
+}
+
+/*
+Starts connecting, finished once the socket is writable
+*/
+static bool openConnection(Connection& connection, Server server, Samples& samples){
+	Socket s = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	if (s == kNoSocket) return false;
+	setNonBlocking(s);
+	int noDelay = 1; //requests are written whole
+	setsockopt(s, IPPROTO_TCP, TCP_NODELAY, (const char*)&noDelay, sizeof(noDelay));
+	sockaddr_in address = gAddress;
+	address.sin_port = htons(gOptions.ports[server]);
+	if (connect(s, (sockaddr*)&address, sizeof(address)) != 0 && !wouldBlock()){
+		closeSocket(s);
+		return false;
+	}
+	connection.socket = s;
+	++samples.connections;
+	return true;
+}
+
+static void issue(Terminal& t, RequestKind kind, Server server, const char* method, const std::string& target, const std::string& headers, long long due,
+	const std::string& body = std::string()){
+	std::ostringstream out;
+	out << method << " " << target << " HTTP/1.1\r\nHost: " << gOptions.host << ":" << gOptions.ports[server] << "\r\n" << headers;
+	if (strcmp(method, "POST") == 0) out << "Content-Length: " << body.size() << "\r\n";
+	out << "\r\n" << body;
+	t.kind = kind;
+	t.server = server;
+	t.target = target;
+	t.out = out.str();
+	t.sent = 0;
+	t.in.clear();
+	t.dueMicros = due;
+	t.retried = false;
+	t.busy = true;
+}
+
+/*
+Sends the terminal's next request of its page, or ends the page and schedules the next one
+@param[in] now when the request is due
+*/
+static void advance(Terminal& t, long long now){
+	if (t.reader){
+		if (t.step++ == 0){
+			const std::string& ohip = gOptions.ohips[(size_t)(t.random.uniform() * gOptions.ohips.size())];
+			issue(t, REQUEST_VALIDATE, SERVER_RECORDS, "POST", "/stations/" + t.station + "/validations", std::string(), now, ohip);
+			return;
+		}
+		t.step = 0;
+		t.nextPageMicros = now + t.random.exponentialMicros(gOptions.arrivalSeconds);
+		return;
+	}
+	while (true){
+		int step = t.step++;
+		if (t.page == PAGE_LOADING){
+			if (step == 0){
+				t.nextStatus = 0;
+				issue(t, REQUEST_STATUS, SERVER_RECORDS, "GET", "/status?station=" + t.station,
+					t.statusEtag.empty() ? std::string() : "If-None-Match: " + t.statusEtag + "\r\n", now);
+				return;
+			}
+			if (step == 1){
+				if (t.subscriber.empty() || (!t.statusChanged && now - t.polledMicros < kSubscriptionPollMicros)) continue;
+				t.polledMicros = now;
+				issue(t, REQUEST_NEXT, SERVER_RECORDS, "POST", "/subscribers/" + t.subscriber + "/next", std::string(), now);
+				return;
+			}
+			if (step == 2){
+				if (!t.subscriber.empty() && t.nextStatus != 404) continue;
+				issue(t, REQUEST_SUBSCRIBE, SERVER_RECORDS, "POST", "/stations/" + t.station + "/subscribers", std::string(), now);
+				return;
+			}
+			if (step == kPhpSteps && !t.ohip.empty()){
+				//Redirected to the record of the patient next handed over
+				t.page = PAGE_INFO;
+				t.step = 0;
+				continue;
+			}
+			size_t asset = step - kPhpSteps;
+			if (asset < sizeof(kLoadingAssets) / sizeof(kLoadingAssets[0])){
+				std::string target = std::string("/") + kLoadingAssets[asset] + "?v=1";
+				if (t.assets.count(target)) continue;
+				issue(t, REQUEST_ASSET, SERVER_WEB, "GET", target, std::string(kAcceptEncoding), now);
+				return;
+			}
+			t.step = 0;
+			t.nextPageMicros = now + gOptions.refreshMicros;
+			return;
+		}
+
+		if (step == 0){
+			issue(t, REQUEST_RECORD, SERVER_RECORDS, "GET", "/records/ohip/" + urlEncode(t.ohip), std::string(), now);
+			return;
+		}
+		if (step == 1 || step == 2){
+			std::string target = std::string("/images/") + kCardImages[step - 1] + "?w=400&h=250";
+			std::map<std::string, std::string>::iterator cached = t.imageEtags.find(target);
+			issue(t, REQUEST_IMAGE, SERVER_WEB, "GET", target,
+				std::string(kAcceptEncoding) + (cached == t.imageEtags.end() ? std::string() : "If-None-Match: " + cached->second + "\r\n"), now);
+			return;
+		}
+		size_t asset = step - kPhpSteps;
+		if (asset < sizeof(kInfoAssets) / sizeof(kInfoAssets[0])){
+			std::string target = std::string("/") + kInfoAssets[asset] + "?v=1";
+			if (t.assets.count(target)) continue;
+			issue(t, REQUEST_ASSET, SERVER_WEB, "GET", target, std::string(kAcceptEncoding), now);
+			return;
+		}
+		//Read, then back to loading.php until the next patient
+		t.ohip.clear();
+		t.page = PAGE_LOADING;
+		t.step = 0;
+		t.nextPageMicros = now + t.random.exponentialMicros(gOptions.readingSeconds);
+		return;
+	}
+}
+
+/*
+Whether a response's status is one the page expects
+*/
+static bool expected(RequestKind kind, int status){
+	switch (kind){
+	case REQUEST_STATUS:
+	case REQUEST_IMAGE:
+	case REQUEST_ASSET: return status == 200 || status == 304;
+	case REQUEST_NEXT: return status == 200 || status == 204 || status == 404;
+	case REQUEST_VALIDATE:
+	case REQUEST_UNSUBSCRIBE: return status == 204;
+	default: return status == 200;
+	}
+}
+
+/*
+Takes the terminal's response, or its failure, as the page would, and goes on to the next request
+@param[in] status 0 if the request failed
+*/
+static void complete(Terminal& t, long long now, int status, const std::string& head, const std::string& body,
+	long long measureFrom, long long measureUntil, Samples& samples){
+	t.busy = false;
+	if (t.dueMicros >= measureFrom && t.dueMicros < measureUntil && t.kind != REQUEST_UNSUBSCRIBE){
+		if (expected(t.kind, status)) samples.latencies[t.kind].push_back(now - t.dueMicros);
+		else ++samples.errors[t.kind];
+		if (status == 304) ++samples.notModified[t.kind];
+		if (t.kind == REQUEST_VALIDATE && status == 204) ++samples.published;
+		if (t.kind == REQUEST_NEXT && status == 200) ++samples.taken;
+		if (t.kind == REQUEST_STATUS && status == 200) ++samples.statusChanges;
+	}
+
+	switch (t.kind){
+	case REQUEST_STATUS:
+		t.statusChanged = status != 304;
+		t.newEtag = headerValue(head, "etag");
+		break;
+	case REQUEST_NEXT:
+		t.nextStatus = status;
+		if (status == 204) t.statusEtag = t.newEtag; //nothing queued, so nothing new until the status changes
+		if (status == 200){
+			//A validation at the station, by its simulated reader or a Nymi at the real one
+			size_t ohip = body.find("\"ohip\":\"");
+			if (ohip != std::string::npos){
+				ohip += 8;
+				t.ohip = body.substr(ohip, body.find('"', ohip) - ohip);
+			}
+			if (t.ohip.empty()) t.ohip = gOptions.ohips[0]; //a Nymi not linked to a record
+		}
+		break;
+	case REQUEST_SUBSCRIBE:
+		if (status == 200){
+			t.subscriber = body;
+			t.polledMicros = now;
+			t.statusEtag = t.newEtag;
+		}
+		break;
+	case REQUEST_IMAGE:
+		if (status == 200) t.imageEtags[t.target] = headerValue(head, "etag");
+		break;
+	case REQUEST_ASSET:
+		t.assets.insert(t.target); //even if missing, as the page would look the same without it
+		break;
+	default:
+		break;
+	}
+	if (now < measureUntil) advance(t, now);
+}
+
+/*
+Whether the terminal's response is whole
+@param[in] closed the server closed the connection, which ends a response without a length
+*/
+static bool responseComplete(const Terminal& t, bool closed, size_t& headEnd, int& status){
+	headEnd = t.in.find("\r\n\r\n");
+	if (headEnd == std::string::npos) return false;
+	status = t.in.size() > 12 ? atoi(t.in.c_str() + 9) : 0;
+	if (status == 204 || status == 304 || status < 200) return true;
+	std::string length = headerValue(t.in.substr(0, headEnd), "content-length");
+	if (length.empty()) return closed;
+	return t.in.size() >= headEnd + 4 + strtoull(length.c_str(), NULL, 10);
+}
+
+/*
+Sends the request again on a new connection if the kept one was closed by the server while idle,
+as browsers do, else fails it
+*/
+static void retryOrFail(Terminal& t, long long now, long long measureFrom, long long measureUntil, Samples& samples){
+	Connection& connection = t.connections[t.server];
+	bool retry = connection.answered && !t.retried && t.in.empty();
+	closeConnection(connection);
+	if (retry){
+		t.retried = true;
+		t.sent = 0;
+		return;
+	}
+	complete(t, now, 0, std::string(), std::string(), measureFrom, measureUntil, samples);
+}
+
+/*
+Runs a share of the terminals until the end of the measurement, then unsubscribes them
+*/
+static void drive(std::vector<Terminal*>* share, long long measureFrom, long long measureUntil, Samples* samples){
+	std::vector<Terminal*>& terminals = *share;
+	std::vector<PollEntry> entries;
+	std::vector<Terminal*> polled;
+	char chunk[16 * 1024];
+	while (true){
+		long long now = monotonicMicros();
+		long long wakeAt = now + kMaxLoopMicros;
+		size_t done = 0;
+		entries.clear();
+		polled.clear();
+		for (size_t i = 0; i < terminals.size(); ++i){
+			Terminal& t = *terminals[i];
+			if (t.busy && now - t.dueMicros > kRequestTimeoutMicros){
+				closeConnection(t.connections[t.server]);
+				complete(t, now, 0, std::string(), std::string(), measureFrom, measureUntil, *samples);
+			}
+			if (!t.busy){
+				if (now >= measureUntil){
+					if (t.subscriber.empty()){
+						t.page = PAGE_DONE;
+						++done;
+						continue;
+					}
+					issue(t, REQUEST_UNSUBSCRIBE, SERVER_RECORDS, "DELETE", "/subscribers/" + t.subscriber, std::string(), now);
+					t.subscriber.clear();
+				}
+				else if (now >= t.nextPageMicros){
+					//Late past the timer's slack only if this loop fell behind, which counts against the latency
+					advance(t, std::min(now, t.nextPageMicros + kTimerSlackMicros));
+					if (!t.busy) continue;
+				}
+				else{
+					wakeAt = std::min(wakeAt, t.nextPageMicros);
+					continue;
+				}
+			}
+			Connection& connection = t.connections[t.server];
+			if (connection.socket == kNoSocket && !openConnection(connection, t.server, *samples)){
+				complete(t, now, 0, std::string(), std::string(), measureFrom, measureUntil, *samples);
+				continue;
+			}
+			PollEntry entry;
+			entry.fd = connection.socket;
+			entry.events = !connection.connected || t.sent < t.out.size() ? POLLOUT : POLLIN;
+			entry.revents = 0;
+			entries.push_back(entry);
+			polled.push_back(&t);
+			wakeAt = std::min(wakeAt, t.dueMicros + kRequestTimeoutMicros);
+		}
+		if (done == terminals.size()) break;
+
+		int timeoutMillis = (int)std::max(0LL, (wakeAt - now + 999) / 1000);
+		if (entries.empty()){
+			std::this_thread::sleep_for(std::chrono::milliseconds(timeoutMillis));
+			continue;
+		}
+		if (pollSockets(&entries[0], entries.size(), timeoutMillis) <= 0) continue;
+		now = monotonicMicros();
+		for (size_t i = 0; i < entries.size(); ++i){
+			if (entries[i].revents == 0) continue;
+			Terminal& t = *polled[i];
+			Connection& connection = t.connections[t.server];
+			if (!connection.connected){
+				int error = 0;
+				SocketLength length = sizeof(error);
+				getsockopt(connection.socket, SOL_SOCKET, SO_ERROR, (char*)&error, &length);
+				if (error != 0){
+					closeConnection(connection);
+					complete(t, now, 0, std::string(), std::string(), measureFrom, measureUntil, *samples);
+					continue;
+				}
+				connection.connected = true;
+			}
+			if (t.sent < t.out.size()){
+				int sent = send(connection.socket, t.out.data() + t.sent, (int)(t.out.size() - t.sent), 0);
+				if (sent < 0 && wouldBlock()) continue;
+				if (sent <= 0){
+					retryOrFail(t, now, measureFrom, measureUntil, *samples);
+					continue;
+				}
+				t.sent += sent;
+				continue;
+			}
+			int received = recv(connection.socket, chunk, sizeof(chunk), 0);
+			if (received < 0 && wouldBlock()) continue;
+			if (received > 0) t.in.append(chunk, received);
+			size_t headEnd;
+			int status;
+			if (!responseComplete(t, received <= 0, headEnd, status)){
+				if (received <= 0) retryOrFail(t, now, measureFrom, measureUntil, *samples);
+				continue;
+			}
+			std::string head = t.in.substr(0, headEnd);
+			connection.answered = true;
+			if (received <= 0 || headerValue(head, "connection") == "close") closeConnection(connection);
+			complete(t, now, status, head, t.in.substr(headEnd + 4), measureFrom, measureUntil, *samples);
+		}
+	}
+	for (size_t i = 0; i < terminals.size(); ++i){
+		for (int s = 0; s < SERVERS; ++s) closeConnection(terminals[i]->connections[s]);
+	}
+}
+
+static long long percentile(const std::vector<long long>& sorted, double fraction){
+	if (sorted.empty()) return 0;
+	size_t index = (size_t)(fraction * (sorted.size() - 1) + 0.5);
+	return sorted[index];
+}
+
+static void split(const std::string& list, std::vector<std::string>& items){
+	items.clear();
+	std::istringstream in(list);
+	std::string item;
+	while (std::getline(in, item, ',')){
+		if (!item.empty()) items.push_back(item);
+	}
+}
+
+struct CurvePoint{
+	unsigned terminals;
+	double perSecond;
+	unsigned long long errors;
+	double p50, p99; //ms, of all requests
+};
+
+/*
+Runs one step of the curve: the terminals, and a reader for each station, from start until the measurement ends
+*/
+static CurvePoint run(unsigned count, const std::string& label, std::ofstream& csv){
+	unsigned perStation = std::max(gOptions.perStation, 1u);
+	unsigned stations = (count + perStation - 1) / perStation;
+	std::vector<Terminal> terminals(count + stations);
+	long long start = monotonicMicros();
+	for (unsigned i = 0; i < count + stations; ++i){
+		Terminal& t = terminals[i];
+		t.reader = i >= count;
+		std::ostringstream station;
+		station << "load-" << (t.reader ? i - count : i / perStation);
+		t.station = station.str();
+		t.random = Random(i + 1);
+		if (t.reader) t.nextPageMicros = start + t.random.exponentialMicros(gOptions.arrivalSeconds);
+		else t.nextPageMicros = start + (long long)(t.random.uniform() * gOptions.refreshMicros); //terminals weren't all turned on at once
+	}
+	long long measureFrom = start + gOptions.warmupMicros;
+	long long measureUntil = measureFrom + gOptions.durationMicros;
+
+	unsigned threads = std::max(1u, std::min(gOptions.threads, count));
+	std::vector<std::vector<Terminal*> > shares(threads);
+	for (unsigned i = 0; i < count + stations; ++i) shares[i % threads].push_back(&terminals[i]);
+	std::vector<Samples> samples(threads);
+	std::vector<std::thread> drivers;
+	for (unsigned i = 0; i < threads; ++i) drivers.push_back(std::thread(drive, &shares[i], measureFrom, measureUntil, &samples[i]));
+	for (unsigned i = 0; i < threads; ++i) drivers[i].join();
+
+	Samples all;
+	std::vector<long long> every;
+	for (unsigned i = 0; i < threads; ++i){
+		for (int k = 0; k < REQUEST_KINDS; ++k){
+			all.latencies[k].insert(all.latencies[k].end(), samples[i].latencies[k].begin(), samples[i].latencies[k].end());
+			all.errors[k] += samples[i].errors[k];
+			all.notModified[k] += samples[i].notModified[k];
+		}
+		all.connections += samples[i].connections;
+		all.published += samples[i].published;
+		all.taken += samples[i].taken;
+		all.statusChanges += samples[i].statusChanges;
+	}
+	double seconds = gOptions.durationMicros / 1e6;
+	unsigned long long errors = 0, notModified = 0;
+	for (int k = 0; k < REQUEST_KINDS; ++k){
+		every.insert(every.end(), all.latencies[k].begin(), all.latencies[k].end());
+		errors += all.errors[k];
+		notModified += all.notModified[k];
+	}
+	std::sort(every.begin(), every.end());
+
+	CurvePoint point;
+	point.terminals = count;
+	point.perSecond = every.size() / seconds;
+	point.errors = errors;
+	point.p50 = percentile(every, 0.50) / 1e3;
+	point.p99 = percentile(every, 0.99) / 1e3;
+
+	std::cout << count << " terminals: " << std::fixed << std::setprecision(0) << point.perSecond << " requests/sec, "
+		<< errors << " errors, " << all.connections << " connections opened\n";
+	std::cout << "Validations: " << all.published << " published at " << stations << " stations, " << all.taken << " taken by terminals, "
+		<< all.statusChanges << " status changes seen\n";
+	if (all.published == 0 && all.errors[REQUEST_VALIDATE] > 0) std::cout << "Validations were refused, enter \"loadtest\" at nymihack's prompt first\n";
+	std::cout << std::left << std::setw(14) << "request" << std::right << std::setw(10) << "count" << std::setw(8) << "errors"
+		<< std::setw(8) << "304s" << std::setw(10) << "per sec" << std::setw(10) << "p50 ms" << std::setw(10) << "p90 ms"
+		<< std::setw(10) << "p99 ms" << std::setw(10) << "max ms" << "\n";
+	csv << std::fixed << std::setprecision(3);
+	for (int k = 0; k <= REQUEST_KINDS; ++k){
+		bool total = k == REQUEST_KINDS;
+		std::vector<long long>& sorted = total ? every : all.latencies[k];
+		unsigned long long kindErrors = total ? errors : all.errors[k];
+		unsigned long long kindNotModified = total ? notModified : all.notModified[k];
+		if (!total) std::sort(sorted.begin(), sorted.end());
+		if (sorted.empty() && kindErrors == 0) continue;
+		const char* name = total ? "ALL" : kRequestNames[k];
+		double perSecond = sorted.size() / seconds;
+		double p50 = percentile(sorted, 0.50) / 1e3, p90 = percentile(sorted, 0.90) / 1e3, p99 = percentile(sorted, 0.99) / 1e3;
+		double max = sorted.empty() ? 0 : sorted.back() / 1e3;
+		std::cout << std::left << std::setw(14) << name << std::right << std::setw(10) << sorted.size() << std::setw(8) << kindErrors
+			<< std::setw(8) << kindNotModified << std::setprecision(1) << std::setw(10) << perSecond << std::setprecision(2)
+			<< std::setw(10) << p50 << std::setw(10) << p90 << std::setw(10) << p99 << std::setw(10) << max << "\n";
+		csv << label << "," << count << "," << name << "," << sorted.size() << "," << kindErrors << "," << kindNotModified << ","
+			<< perSecond << "," << p50 << "," << p90 << "," << p99 << "," << max << "\n";
+	}
+	std::cout << "\n";
+	return point;
+}
+
+/*
+Main program function
+*/
+int main(int argc, char** argv){
+	std::string label = "unlabeled", ohips = "5584-486-674-YM";
+	std::vector<std::string> counts;
+	split("10,50,100,200,400", counts);
+	gOptions.host = "127.0.0.1";
+	gOptions.threads = std::min(4u, std::max(1u, std::thread::hardware_concurrency()));
+	for (int i = 1; i < argc; ++i){
+		std::string arg = argv[i];
+		if (arg == "--terminals" && i + 1 < argc) split(argv[++i], counts);
+		else if (arg == "--warmup" && i + 1 < argc) gOptions.warmupMicros = (long long)(atof(argv[++i]) * 1e6);
+		else if (arg == "--duration" && i + 1 < argc) gOptions.durationMicros = (long long)(atof(argv[++i]) * 1e6);
+		else if (arg == "--host" && i + 1 < argc) gOptions.host = argv[++i];
+		else if (arg == "--records-port" && i + 1 < argc) gOptions.ports[SERVER_RECORDS] = (unsigned short)atoi(argv[++i]);
+		else if (arg == "--web-port" && i + 1 < argc) gOptions.ports[SERVER_WEB] = (unsigned short)atoi(argv[++i]);
+		else if (arg == "--per-station" && i + 1 < argc) gOptions.perStation = (unsigned)atoi(argv[++i]);
+		else if (arg == "--ohips" && i + 1 < argc) ohips = argv[++i];
+		else if (arg == "--arrival" && i + 1 < argc) gOptions.arrivalSeconds = atof(argv[++i]);
+		else if (arg == "--reading" && i + 1 < argc) gOptions.readingSeconds = atof(argv[++i]);
+		else if (arg == "--refresh" && i + 1 < argc) gOptions.refreshMicros = (long long)(atof(argv[++i]) * 1e3);
+		else if (arg == "--threads" && i + 1 < argc) gOptions.threads = (unsigned)atoi(argv[++i]);
+		else if (arg == "--label" && i + 1 < argc) label = argv[++i];
+		else{
+			std::cout << "Unknown option " << arg << "\n";
+			return 1;
+		}
+	}
+	split(ohips, gOptions.ohips);
+	if (gOptions.ohips.empty() || counts.empty() || gOptions.durationMicros <= 0){
+		std::cout << "Nothing to run\n";
+		return 1;
+	}
+
+#if defined(_WIN32)
+	WSADATA data;
+	if (WSAStartup(MAKEWORD(2, 2), &data) != 0) return 1;
+	timeBeginPeriod(1); //else poll timeouts round up to the 15.6 ms tick, which would count as latency
+#else
+	signal(SIGPIPE, SIG_IGN); //a kept connection closed by the server is retried, not fatal
+#endif
+	memset(&gAddress, 0, sizeof(gAddress));
+	gAddress.sin_family = AF_INET;
+	if (inet_pton(AF_INET, gOptions.host.c_str(), &gAddress.sin_addr) != 1){
+		std::cout << "Not an IPv4 address: " << gOptions.host << "\n";
+		return 1;
+	}
+
+	std::cout << "Terminals refreshing every " << gOptions.refreshMicros / 1000 << " ms, a patient every " << gOptions.arrivalSeconds
+		<< " s, read for " << gOptions.readingSeconds << " s, " << gOptions.perStation << " per station\n\n";
+	std::ofstream csv("nymiload.csv", std::ios::app);
+	std::vector<CurvePoint> curve;
+	for (size_t i = 0; i < counts.size(); ++i){
+		unsigned count = (unsigned)strtoul(counts[i].c_str(), NULL, 10);
+		if (count > 0) curve.push_back(run(count, label, csv));
+	}
+
+	std::cout << "Capacity curve (" << label << ")\n";
+	std::cout << std::right << std::setw(10) << "terminals" << std::setw(14) << "requests/sec" << std::setw(10) << "errors"
+		<< std::setw(10) << "p50 ms" << std::setw(10) << "p99 ms" << "\n";
+	for (size_t i = 0; i < curve.size(); ++i){
+		std::cout << std::setw(10) << curve[i].terminals << std::setprecision(1) << std::setw(14) << curve[i].perSecond
+			<< std::setw(10) << curve[i].errors << std::setprecision(2) << std::setw(10) << curve[i].p50 << std::setw(10) << curve[i].p99 << "\n";
+	}
+#if defined(_WIN32)
+	timeEndPeriod(1);
+	WSACleanup();
+#endif
+	return 0;
+}
@@ -0,0 +1,39 @@
+<?php
+//Static files come from nymihack's web server. The file's time in the URL names that version of it,
+//so browsers keep it without asking again until the file changes.
+//While nymihack isn't serving, the pages link them relative to this site instead, which has them too.
+define("ASSETS_PROBE_SECONDS", 5); //how long a probe of nymihack's web server is trusted
+
+//Whether nymihack's web server is up. The probe is shared through APCu, or the session if there's
+//no APCu, so pages polled every second don't each open a connection to find out.
+function assetsServed() {
+    $apcu = function_exists("apcu_fetch");
+    if ($apcu) {
+        $probe = apcu_fetch("nymihackServed", $found);
+        if ($found) return $probe;
+    } else if (session_status() == PHP_SESSION_ACTIVE && isset($_SESSION["assetsProbedAt"])
+        && time() - $_SESSION["assetsProbedAt"] < ASSETS_PROBE_SECONDS) {
+        return $_SESSION["assetsServed"];
+    }
+    //nymihack's web server runs on this machine
+    $socket = @fsockopen("127.0.0.1", 9110, $errno, $errstr, 0.2);
+    $served = $socket !== false;
+    if ($served) fclose($socket);
+    if ($apcu) {
+        apcu_store("nymihackServed", $served, ASSETS_PROBE_SECONDS);
+    } else if (session_status() == PHP_SESSION_ACTIVE) {
+        $_SESSION["assetsServed"] = $served;
+        $_SESSION["assetsProbedAt"] = time();
+    }
+    return $served;
+}
+
+function asset($path) {
+    static $served = null;
+    if ($served === null) $served = assetsServed();
+    $url = str_replace("%2F", "/", rawurlencode($path));
+    if ($served) $url = "http://" . htmlspecialchars($_SERVER["SERVER_NAME"]) . ":9110/" . $url;
+    $modified = @filemtime(__DIR__ . "/" . $path);
+    return $modified ? $url . "?v=" . $modified : $url;
+}
+?>
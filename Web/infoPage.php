@@ -1,3 +1,79 @@
+<?php
+include "assets.php";
+//Fields each update button sends to nymihack's record service
+$updates = array(
+    "nameUpdate" => array("name"),
+    "sexUpdate" => array("sex"),
+    "bornUpdate" => array("born"),
+    "expUpdate" => array("expiry"),
+    "addressUpdate" => array("address"),
+    "phoneUpdate" => array("phone"),
+    "ohipUpdate" => array("ohip"),
+    "contactUpdate" => array("contactName", "contactPhone", "contactRelationship"),
+    "donorUpdate" => array("donor"),
+    "allergyUpdate" => array("allergies")
+);
+//What the record service's answers to an update mean to whoever made it
+$updateErrors = array(
+    0 => "The record service couldn't be reached, nothing was saved.",
+    400 => "That value isn't valid for this field, it wasn't saved.",
+    404 => "This record no longer exists.",
+    409 => "Another record already has that health number, it wasn't changed.",
+    503 => "The edit couldn't be written to disk, it wasn't saved."
+);
+//Saves one field of a record; the service answers once the edit is on disk
+//Returns the HTTP status, 204 once saved, 0 if the service couldn't be reached
+function updateField($ohip, $field, $value) {
+    $context = stream_context_create(array("http" => array(
+        "method" => "POST",
+        "header" => "Content-Type: text/plain; charset=utf-8\r\n",
+        "content" => $value,
+        "ignore_errors" => true)));
+    $http_response_header = array();
+    @file_get_contents("http://127.0.0.1:9109/records/ohip/" . rawurlencode($ohip) . "/" . $field, false, $context);
+    if (count($http_response_header) == 0 || !preg_match('#^HTTP/\S+ (\d+)#', $http_response_header[0], $status)) return 0;
+    return (int)$status[1];
+}
+if ($_SERVER["REQUEST_METHOD"] == "POST" && isset($_POST["record"])) {
+    $ohip = $_POST["record"]; //the record the form was filled from, even if another patient was identified since
+    $failed = null;
+    foreach ($updates as $button => $fields) {
+        if (!isset($_POST[$button])) continue;
+        foreach ($fields as $name) {
+            if (!isset($_POST[$name])) continue;
+            $value = is_array($_POST[$name]) ? implode(",", $_POST[$name]) : $_POST[$name];
+            $status = updateField($ohip, $name, $value);
+            if ($status != 204) {
+                if ($failed === null) $failed = $status;
+                continue;
+            }
+            if ($name == "ohip") $ohip = $value; //only once the record really has its new number
+        }
+    }
+    //A reload shows the record instead of posting again
+    $location = "infoPage.php?ohip=" . rawurlencode($ohip);
+    if ($failed !== null) $location .= "&error=" . $failed;
+    header("Location: " . $location);
+    exit;
+}
+$updateError = null;
+if (isset($_GET["error"])) {
+    $updateError = isset($updateErrors[(int)$_GET["error"]]) ? $updateErrors[(int)$_GET["error"]] : "The record service answered " . (int)$_GET["error"] . ", the edit wasn't saved.";
+}
+//Record of the patient validated at this terminal's station (see loading.php), else of the one
+//identified last, served by nymihack's record service
+$route = isset($_GET["ohip"]) && $_GET["ohip"] != "" ? "ohip/" . rawurlencode($_GET["ohip"]) : "current";
+$record = json_decode(@file_get_contents("http://127.0.0.1:9109/records/" . $route), true);
+if (!is_array($record)) $record = array();
+$contact = isset($record["emergencyContact"]) ? $record["emergencyContact"] : array();
+$allergies = isset($record["allergies"]) ? $record["allergies"] : array();
+function field($values, $name) {
+    return isset($values[$name]) ? htmlspecialchars($values[$name]) : "";
+}
+$recordInput = '<input type="hidden" name="record" value="' . field($record, "ohip") . '" />';
+//Card images come from nymihack's web server, scaled to the size they're shown at
+$images = "http://" . htmlspecialchars($_SERVER["SERVER_NAME"]) . ":9110/images";
+?>
 <!DOCTYPE html>
 <html lang="en">
 <head>
@@ -5,9 +81,9 @@
   <meta charset="utf-8">
   <meta name="viewport" content="width=device-width, initial-scale=1">
     <!-- Bootstrap Core CSS -->
-    <link href="css/bootstrap.min.css" rel="stylesheet">
-  <script src="https://ajax.googleapis.com/ajax/libs/jquery/1.11.1/jquery.min.js"></script>
-  <script src="http://maxcdn.bootstrapcdn.com/bootstrap/3.2.0/js/bootstrap.min.js"></script>
+    <link href="<?php echo asset("css/bootstrap.min.css"); ?>" rel="stylesheet">
+  <script src="<?php echo asset("js/jquery.js"); ?>"></script>
+  <script src="<?php echo asset("js/bootstrap.min.js"); ?>"></script>
   <style>
   .titlesDiv {
 	  float:left;
@@ -32,12 +108,15 @@
   <h4>All medical information listed below.</h4>
 </div>
 <div class="ontarioDiv">
-  <img src="Ontario Logo.jpg" align="right" height="50" width="142" />
+  <img src="<?php echo asset("Ontario Logo.jpg"); ?>" align="right" height="50" width="142" />
 </div>
 
 <br /><br /><br /><br /><br /><br />
-  <div class="imageDiv"><img src="healthCardFront.jpg" height="250" width="400"/><br />
-	  <img src="healthCardBack.jpg" height="250" width="400" />
+<?php if ($updateError !== null) { ?>
+  <div class="alert alert-danger"><?php echo htmlspecialchars($updateError); ?></div>
+<?php } ?>
+  <div class="imageDiv"><img src="<?php echo $images; ?>/healthCardFront?w=400&amp;h=250" onerror="this.onerror=null;this.src='healthCardFront.jpg'" height="250" width="400"/><br />
+	  <img src="<?php echo $images; ?>/healthCardBack?w=400&amp;h=250" onerror="this.onerror=null;this.src='healthCardBack.jpg'" height="250" width="400" />
   </div>
 
 
@@ -46,84 +125,86 @@
     <tbody>
       <tr class="success">
         <td>Name:</td>
-        <td><?php echo $_POST["name"]; ?><form>
-        <?php $name="Shaan Sharma"; ?>
-        <input type="text"
-        class = "form-control" value="Anita Jean Walker" />
-        <input type ="button" class="btn" value="update" method="POST" name="nameUpdate" /></td>
+        <td><form method="POST"><?php echo $recordInput; ?>
+        <input type="text" name="name"
+        class = "form-control" value="<?php echo field($record, "name"); ?>" />
+        <input type ="submit" class="btn" value="update" name="nameUpdate" /></td>
         </form>
       </tr>
       <tr class="success">
         <td>Sex:</td>
-        <td><form>
-        <input type="text"
-        class = "form-control" value="F" />
-        <input type ="button" class="btn" value="update" method="POST" name="sexUpdate" /></td>
+        <td><form method="POST"><?php echo $recordInput; ?>
+        <input type="text" name="sex"
+        class = "form-control" value="<?php echo field($record, "sex"); ?>" />
+        <input type ="submit" class="btn" value="update" name="sexUpdate" /></td>
         </form>
       </tr>
       <tr class="success">
         <td>Born:</td>
-        <td><form>
-        <input type="text"
-        class = "form-control" value="1981-12-15" />
-        <input type ="button" class="btn" value="update" method="POST" name="bornUpdate" /></td>
+        <td><form method="POST"><?php echo $recordInput; ?>
+        <input type="text" name="born"
+        class = "form-control" value="<?php echo field($record, "born"); ?>" />
+        <input type ="submit" class="btn" value="update" name="bornUpdate" /></td>
         </form>
       </tr>
       <tr class="success">
         <td>Expiry Date:</td>
-        <td><form>
-        <input type="text"
-        class = "form-control" value="2017-12-15" />
-        <input type ="button" class="btn" value="update" method="POST" name="expUpdate" /></td>
+        <td><form method="POST"><?php echo $recordInput; ?>
+        <input type="text" name="expiry"
+        class = "form-control" value="<?php echo field($record, "expiry"); ?>" />
+        <input type ="submit" class="btn" value="update" name="expUpdate" /></td>
         </form>
       </tr>
       <tr class="info">
         <td>Address:</td>       
-        <td><?php echo $_POST["address"]; ?>
-         <input type="text" class="form-control" value="123 Some Street" />
-        <input type="button" class="btn" value="update" method="POST" name="addressUpdate" />
+        <td><form method="POST"><?php echo $recordInput; ?>
+         <input type="text" name="address" class="form-control" value="<?php echo field($record, "address"); ?>" />
+        <input type="submit" class="btn" value="update" name="addressUpdate" />
         </td>
         </form>
       </tr>
       <tr class="info">
       <td>Phone Number:</td>
-      <td><?php echo$_POST["phonenumber"]; ?>
-      <input type="text" class = "form-control" value="905-888-1234" />
-      <input type="button" class="btn" value="update" method="POST" name = "phoneUpdate" />
+      <td><form method="POST"><?php echo $recordInput; ?>
+      <input type="text" name="phone" class = "form-control" value="<?php echo field($record, "phone"); ?>" />
+      <input type="submit" class="btn" value="update" name = "phoneUpdate" />
       </td>
+      </form>
       </tr>
       <tr class="success">
         <td>OHIP:</td>
-        <td><form>
-        <input type="text"
-        class = "form-control" value="5584-486-674-YM" />
-        <input type ="button" class="btn" value="update" method="POST" name="ohipUpdate" /></td>
+        <td><form method="POST"><?php echo $recordInput; ?>
+        <input type="text" name="ohip"
+        class = "form-control" value="<?php echo field($record, "ohip"); ?>" />
+        <input type ="submit" class="btn" value="update" name="ohipUpdate" /></td>
         </form>
       </tr>
       <tr class="danger">
         <td>Emergency Contact:</td>
-        <td><form>
-        Name:<input type="text" class = "form-control" value="John Doe" />
-        Phone Number:<input type="text" class = "form-control" value="416-888-1234" />
-        Relationship:<input type="text" class = "form-control" value="Father" />
-        <input type ="button" class="btn" value="update" method="POST" name="donorUpdate" /></td>
+        <td><form method="POST"><?php echo $recordInput; ?>
+        Name:<input type="text" name="contactName" class = "form-control" value="<?php echo field($contact, "name"); ?>" />
+        Phone Number:<input type="text" name="contactPhone" class = "form-control" value="<?php echo field($contact, "phone"); ?>" />
+        Relationship:<input type="text" name="contactRelationship" class = "form-control" value="<?php echo field($contact, "relationship"); ?>" />
+        <input type ="submit" class="btn" value="update" name="contactUpdate" /></td>
         </form>
       </tr>
       <tr class="danger">
         <td>Donor:</td>
-        <td><form>
-        <input type="text"
-        class = "form-control" value="9Z" />
-        <input type ="button" class="btn" value="update" method="POST" name="donorUpdate" /></td>
+        <td><form method="POST"><?php echo $recordInput; ?>
+        <input type="text" name="donor"
+        class = "form-control" value="<?php echo field($record, "donor"); ?>" />
+        <input type ="submit" class="btn" value="update" name="donorUpdate" /></td>
         </form>
       </tr>
       <tr class="danger">
         <td>Allergies</td>
-        <td><form>
+        <td><form method="POST"><?php echo $recordInput; ?>
         <ul>
-        <li><?php echo $_POST["allergies"]; ?>
-        <input type="text" class="form-control" value="Penicillin" /></li>
-        <li><input type="text" class="form-control" value="Grass" /></li>
+        <li>
+        <input type="text" name="allergies[]" class="form-control" value="<?php echo isset($allergies[0]) ? htmlspecialchars($allergies[0]) : ""; ?>" /></li>
+        <?php for ($i = 1; $i < count($allergies); $i++) { ?>
+        <li><input type="text" name="allergies[]" class="form-control" value="<?php echo htmlspecialchars($allergies[$i]); ?>" /></li>
+        <?php } ?>
         <span id="responce"></span>
 <script>
 var countBox =1;
@@ -131,12 +212,12 @@ var boxName = 0;
 function addInput()
 {
      var boxName="textBox"+countBox; 
-document.getElementById('responce').innerHTML+='<input type="text" class="form-control" id="'+boxName+'"  />';
+document.getElementById('responce').innerHTML+='<input type="text" name="allergies[]" class="form-control" id="'+boxName+'"  />';
      countBox += 1;
 }
 </script>
 	<input type="button" class="btn" value="add" method="POST" name = "addAl" onclick="addInput()" />
-        <input type="button" class="btn" value="update" method="POST" name = "allergyUpdate" />
+        <input type="submit" class="btn" value="update" name = "allergyUpdate" />
         </ul>
         </td>
         </form>